@@ -15,6 +15,7 @@
 #include "AArch64Subtarget.h"
 #include "MCTargetDesc/AArch64AddressingModes.h"
 #include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringRef.h"
@@ -37,11 +38,13 @@
 #include "llvm/Support/DebugCounter.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <utility>
 
 using namespace llvm;
 
@@ -54,6 +57,8 @@ STATISTIC(NumUnscaledPairCreated,
           "Number of load/store from unscaled generated");
 STATISTIC(NumZeroStoresPromoted, "Number of narrow zero stores promoted");
 STATISTIC(NumLoadsFromStoresPromoted, "Number of loads from stores promoted");
+STATISTIC(NumFarPairCreated,
+          "Number of load/store pairs formed beyond the scan limit");
 
 DEBUG_COUNTER(RegRenamingCounter, DEBUG_TYPE "-reg-renaming",
               "Controls which pairs are considered for renaming");
@@ -67,6 +72,11 @@ static cl::opt<unsigned> LdStLimit("aarch64-load-store-scan-limit",
 static cl::opt<unsigned> UpdateLimit("aarch64-update-scan-limit", cl::init(100),
                                      cl::Hidden);
 
+// Pair loads and stores on the same base register anywhere in a block, by
+// bucketing them on base register and offset, before the windowed search.
+static cl::opt<bool> EnableBucketPairing("aarch64-load-store-bucket-pairing",
+                                         cl::init(false), cl::Hidden);
+
 // Enable register renaming to find additional store pairing opportunities.
 static cl::opt<bool> EnableRenaming("aarch64-load-store-renaming",
                                     cl::init(true), cl::Hidden);
@@ -185,6 +195,10 @@ struct AArch64LoadStoreOpt : public MachineFunctionPass {
   // Find and pair ldr/str instructions.
   bool tryToPairLdStInst(MachineBasicBlock::iterator &MBBI);
 
+  // Find and pair ldr/str instructions on the same base register anywhere in
+  // the block.
+  bool pairLdStInstsByBase(MachineBasicBlock &MBB);
+
   // Find and promote load instructions which read directly from store.
   bool tryToPromoteLoadFromStore(MachineBasicBlock::iterator &MBBI);
 
@@ -1999,6 +2013,228 @@ bool AArch64LoadStoreOpt::tryToPairLdStInst(MachineBasicBlock::iterator &MBBI) {
   return false;
 }
 
+using RegUnitPositions = DenseMap<unsigned, SmallVector<unsigned, 4>>;
+
+// Returns true if any register unit of Reg has a recorded position strictly
+// between Lo and Hi.
+static bool hasPositionBetween(const RegUnitPositions &Positions, Register Reg,
+                               unsigned Lo, unsigned Hi,
+                               const TargetRegisterInfo *TRI) {
+  for (MCRegUnitIterator Unit(Reg.asMCReg(), TRI); Unit.isValid(); ++Unit) {
+    auto It = Positions.find(*Unit);
+    if (It == Positions.end())
+      continue;
+    auto Pos = std::upper_bound(It->second.begin(), It->second.end(), Lo);
+    if (Pos != It->second.end() && *Pos < Hi)
+      return true;
+  }
+  return false;
+}
+
+// Returns true if MI may alias any of the memory accesses strictly between
+// positions Lo and Hi. Gives up after LdStLimit queries.
+static bool
+mayAliasBetween(MachineInstr &MI,
+                ArrayRef<std::pair<unsigned, MachineInstr *>> Accesses,
+                unsigned Lo, unsigned Hi, AliasAnalysis *AA) {
+  auto It = std::upper_bound(
+      Accesses.begin(), Accesses.end(), Lo,
+      [](unsigned P, const std::pair<unsigned, MachineInstr *> &Access) {
+        return P < Access.first;
+      });
+  unsigned NumQueries = 0;
+  for (; It != Accesses.end() && It->first < Hi; ++It) {
+    if (++NumQueries > LdStLimit ||
+        MI.mayAlias(AA, *It->second, /*UseTBAA*/ false))
+      return true;
+  }
+  return false;
+}
+
+// Pair loads and stores without a window: number the instructions of the
+// block once, recording where each register unit is defined and used, where
+// memory is accessed and where calls are, and bucket the candidates by base
+// register value, pair opcode and byte offset. The partner of a candidate is
+// then a lookup at offset +/- size, and the checks findMatchingInsn does by
+// scanning become binary searches over the recorded positions.
+//
+// Only the later instruction is moved up, so once a pair is formed the
+// recorded positions of the moved instruction are stale, but all later
+// queries start after the pair, where the staleness is conservative.
+bool AArch64LoadStoreOpt::pairLdStInstsByBase(MachineBasicBlock &MBB) {
+  if (MBB.size() <= LdStLimit)
+    return false;
+
+  struct Candidate {
+    MachineInstr *MI;
+    unsigned Pos;
+    // Base register, its value and the pair opcode.
+    uint64_t Bucket;
+    // Offset in bytes.
+    int Offset;
+  };
+  SmallVector<Candidate, 32> Candidates;
+  DenseMap<std::pair<uint64_t, int>, SmallVector<unsigned, 2>> ByAddress;
+  RegUnitPositions DefPositions, UsePositions;
+  SmallVector<std::pair<unsigned, MachineInstr *>, 32> MemAccesses, Stores;
+  // CallsBefore[P] is the number of calls before position P.
+  SmallVector<unsigned, 64> CallsBefore;
+
+  unsigned Pos = 0, NumCalls = 0;
+  for (MachineInstr &MI : MBB) {
+    if (MI.isDebugInstr())
+      continue;
+    CallsBefore.push_back(NumCalls);
+
+    if (TII->isPairableLdStInst(MI) && TII->isCandidateToMergeOrPair(MI) &&
+        getLdStBaseOp(MI).isReg()) {
+      int Size = TII->getMemScale(MI);
+      int Offset = getLdStOffsetOp(MI).getImm();
+      if (!TII->isUnscaledLdSt(MI))
+        Offset *= Size;
+      // The value of the base register is identified by its last def.
+      Register BaseReg = getLdStBaseOp(MI).getReg();
+      unsigned BaseDef = 0;
+      for (MCRegUnitIterator Unit(BaseReg.asMCReg(), TRI); Unit.isValid();
+           ++Unit) {
+        auto It = DefPositions.find(*Unit);
+        if (It != DefPositions.end())
+          BaseDef = std::max(BaseDef, It->second.back() + 1);
+      }
+      unsigned PairOpc =
+          getMatchingPairOpcode(getMatchingNonSExtOpcode(MI.getOpcode()));
+      assert(BaseReg < (1u << 16) && PairOpc < (1u << 16) &&
+             "Register or opcode does not fit the bucket key");
+      uint64_t Bucket =
+          (uint64_t(BaseDef) << 32) | (BaseReg << 16) | PairOpc;
+      // An offset that is not a multiple of the size can never be paired.
+      if (Offset % Size == 0) {
+        ByAddress[{Bucket, Offset}].push_back(Candidates.size());
+        Candidates.push_back({&MI, Pos, Bucket, Offset});
+      }
+    }
+
+    for (const MachineOperand &MO : MI.operands()) {
+      if (MO.isRegMask()) {
+        // Treat a register mask clobber like a call.
+        ++NumCalls;
+        continue;
+      }
+      if (!MO.isReg() || !MO.getReg())
+        continue;
+      for (MCRegUnitIterator Unit(MO.getReg().asMCReg(), TRI); Unit.isValid();
+           ++Unit) {
+        if (MO.isDef()) {
+          auto &Defs = DefPositions[*Unit];
+          if (Defs.empty() || Defs.back() != Pos)
+            Defs.push_back(Pos);
+        }
+        if (MO.readsReg()) {
+          auto &Uses = UsePositions[*Unit];
+          if (Uses.empty() || Uses.back() != Pos)
+            Uses.push_back(Pos);
+        }
+      }
+    }
+    if (MI.isCall())
+      ++NumCalls;
+    if (MI.mayLoadOrStore()) {
+      MemAccesses.push_back({Pos, &MI});
+      if (MI.mayStore())
+        Stores.push_back({Pos, &MI});
+    }
+    ++Pos;
+  }
+  CallsBefore.push_back(NumCalls);
+
+  auto ReplaceAccess = [](MutableArrayRef<std::pair<unsigned, MachineInstr *>>
+                              Accesses,
+                          unsigned AccessPos, MachineInstr *NewMI) {
+    auto It = llvm::lower_bound(
+        Accesses, AccessPos,
+        [](const std::pair<unsigned, MachineInstr *> &Access, unsigned P) {
+          return Access.first < P;
+        });
+    if (It != Accesses.end() && It->first == AccessPos)
+      It->second = NewMI;
+  };
+
+  bool Modified = false;
+  for (Candidate &First : Candidates) {
+    if (!First.MI)
+      continue;
+    MachineInstr &FirstMI = *First.MI;
+    bool MayLoad = FirstMI.mayLoad();
+    int Size = TII->getMemScale(FirstMI);
+    Register Reg = getLdStRegOp(FirstMI).getReg();
+
+    // Find the earliest legal partner at either adjacent offset.
+    Candidate *Second = nullptr;
+    LdStPairFlags Flags;
+    for (int Offset : {First.Offset - Size, First.Offset + Size}) {
+      auto It = ByAddress.find({First.Bucket, Offset});
+      if (It == ByAddress.end())
+        continue;
+      for (unsigned Idx : It->second) {
+        Candidate &C = Candidates[Idx];
+        if (!C.MI || C.Pos <= First.Pos)
+          continue;
+        if (Second && C.Pos > Second->Pos)
+          break;
+        MachineInstr &MI = *C.MI;
+        LdStPairFlags CFlags;
+        if (!areCandidatesToMergeOrPair(FirstMI, MI, CFlags, TII))
+          continue;
+        // Pairwise instructions have a 7-bit signed, scaled offset.
+        int MinOffset = std::min(First.Offset, C.Offset) / Size;
+        if (MinOffset < -64 || MinOffset > 63)
+          continue;
+        // A load pair may not write the same register twice.
+        Register MIReg = getLdStRegOp(MI).getReg();
+        if (MayLoad && TRI->isSuperOrSubRegisterEq(Reg, MIReg))
+          continue;
+        // MI is moved up to FirstMI: nothing in between may be a call, write
+        // its register, read its register if it is a load, or alias it.
+        if (CallsBefore[C.Pos] != CallsBefore[First.Pos + 1] ||
+            hasPositionBetween(DefPositions, MIReg, First.Pos, C.Pos, TRI) ||
+            (MI.mayLoad() &&
+             hasPositionBetween(UsePositions, MIReg, First.Pos, C.Pos, TRI)) ||
+            mayAliasBetween(MI, MI.mayStore() ? MemAccesses : Stores,
+                            First.Pos, C.Pos, AA))
+          continue;
+        Second = &C;
+        Flags = CFlags;
+        break;
+      }
+    }
+    if (!Second)
+      continue;
+
+    ++NumPairCreated;
+    if (TII->isUnscaledLdSt(FirstMI))
+      ++NumUnscaledPairCreated;
+    if (Second->Pos - First.Pos > LdStLimit)
+      ++NumFarPairCreated;
+
+    MachineBasicBlock::iterator FirstIt = FirstMI.getIterator();
+    MachineInstr *Prev =
+        FirstIt == MBB.begin() ? nullptr : &*std::prev(FirstIt);
+    Flags.setMergeForward(false);
+    mergePairedInsns(FirstIt, Second->MI->getIterator(), Flags);
+    MachineInstr *PairMI =
+        Prev ? &*std::next(Prev->getIterator()) : &MBB.front();
+
+    // Keep the memory summary pointing at live instructions.
+    for (unsigned P : {First.Pos, Second->Pos}) {
+      ReplaceAccess(MemAccesses, P, PairMI);
+      ReplaceAccess(Stores, P, PairMI);
+    }
+    First.MI = Second->MI = nullptr;
+    Modified = true;
+  }
+  return Modified;
+}
+
 bool AArch64LoadStoreOpt::tryToMergeLdStUpdate
     (MachineBasicBlock::iterator &MBBI) {
   MachineInstr &MI = *MBBI;
@@ -2100,6 +2336,10 @@ bool AArch64LoadStoreOpt::optimizeBlock(MachineBasicBlock &MBB,
   //        ldr x1, [x2, #8]
   //        ; becomes
   //        ldp x0, x1, [x2]
+  //    If enabled, first pair instructions on the same base register however
+  //    far apart they are, then search the window for the rest.
+  if (EnableBucketPairing)
+    Modified |= pairLdStInstsByBase(MBB);
 
   if (MBB.getParent()->getRegInfo().tracksLiveness()) {
     DefinedInBB.clear();
@@ -17,6 +17,7 @@
 #include "AArch64Subtarget.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Target/TargetMachine.h"
+#include <mutex>
 
 namespace llvm {
 
@@ -26,6 +27,7 @@ class AArch64TargetMachine : public LLVMTargetMachine {
 protected:
   std::unique_ptr<TargetLoweringObjectFile> TLOF;
   mutable StringMap<std::unique_ptr<AArch64Subtarget>> SubtargetMap;
+  mutable std::mutex SubtargetMapMutex;
 
 public:
   AArch64TargetMachine(const Target &T, const Triple &TT, StringRef CPU,
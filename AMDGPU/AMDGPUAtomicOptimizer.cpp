@@ -10,6 +10,11 @@
 /// This pass optimizes atomic operations by using a single lane of a wavefront
 /// to perform the atomic operation, thus reducing contention on that memory
 /// location.
+///
+/// Divergent values are combined either with a DPP scan, or by iterating over
+/// the active lanes with readlane. Optionally, atomics with a divergent address
+/// are handled by looping over the distinct addresses in the wavefront and
+/// optimizing the atomic for the group of lanes sharing each one.
 //
 //===----------------------------------------------------------------------===//
 
@@ -21,6 +26,7 @@
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/IR/IntrinsicsAMDGPU.h"
 #include "llvm/InitializePasses.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
@@ -31,11 +37,33 @@ using namespace llvm::AMDGPU;
 
 namespace {
 
+enum class ScanStrategy { DPP, Iterative };
+
+} // namespace
+
+static cl::opt<ScanStrategy> AtomicScanStrategy(
+    "amdgpu-atomic-optimizer-strategy",
+    cl::desc("Select how divergent atomic values are combined"),
+    cl::values(clEnumValN(ScanStrategy::DPP, "DPP",
+                          "Use a DPP scan where the subtarget supports it"),
+               clEnumValN(ScanStrategy::Iterative, "Iterative",
+                          "Loop over the active lanes with readlane")),
+    cl::init(ScanStrategy::DPP), cl::Hidden);
+
+static cl::opt<bool> GroupLanesByAddress(
+    "amdgpu-atomic-optimizer-group-by-address",
+    cl::desc("Optimize atomics with a divergent address by looping over the "
+             "distinct addresses in the wavefront"),
+    cl::init(false), cl::Hidden);
+
+namespace {
+
 struct ReplacementInfo {
   Instruction *I;
   AtomicRMWInst::BinOp Op;
   unsigned ValIdx;
   bool ValDivergent;
+  bool PtrDivergent;
 };
 
 class AMDGPUAtomicOptimizer : public FunctionPass,
@@ -51,6 +79,11 @@ private:
   Value *buildScan(IRBuilder<> &B, AtomicRMWInst::BinOp Op, Value *V,
                    Value *const Identity) const;
   Value *buildShiftRight(IRBuilder<> &B, Value *V, Value *const Identity) const;
+  std::pair<Value *, Value *>
+  buildScanIteratively(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
+                       Value *const Identity, Value *V, Value *const Ballot,
+                       Instruction &I, bool NeedResult) const;
+  void groupLanesByAddress(AtomicRMWInst &I) const;
   void optimizeAtomic(Instruction &I, AtomicRMWInst::BinOp Op, unsigned ValIdx,
                       bool ValDivergent) const;
 
@@ -97,6 +130,8 @@ bool AMDGPUAtomicOptimizer::runOnFunction(Function &F) {
   const bool Changed = !ToReplace.empty();
 
   for (ReplacementInfo &Info : ToReplace) {
+    if (Info.PtrDivergent)
+      groupLanesByAddress(*cast<AtomicRMWInst>(Info.I));
     optimizeAtomic(*Info.I, Info.Op, Info.ValIdx, Info.ValDivergent);
   }
 
@@ -105,6 +140,13 @@ bool AMDGPUAtomicOptimizer::runOnFunction(Function &F) {
   return Changed;
 }
 
+// Return true if values of type Ty can be moved between lanes, which is done
+// with 32-bit cross-lane operations on one or two halves of the value.
+static bool canMoveAcrossLanes(const DataLayout &DL, Type *Ty) {
+  const uint64_t BitWidth = DL.getTypeSizeInBits(Ty);
+  return BitWidth == 32 || BitWidth == 64;
+}
+
 void AMDGPUAtomicOptimizer::visitAtomicRMWInst(AtomicRMWInst &I) {
   // Early exit for unhandled address space atomic instructions.
   switch (I.getPointerAddressSpace()) {
@@ -129,6 +171,8 @@ void AMDGPUAtomicOptimizer::visitAtomicRMWInst(AtomicRMWInst &I) {
   case AtomicRMWInst::Min:
   case AtomicRMWInst::UMax:
   case AtomicRMWInst::UMin:
+  case AtomicRMWInst::FAdd:
+  case AtomicRMWInst::FSub:
     break;
   }
 
@@ -136,26 +180,30 @@ void AMDGPUAtomicOptimizer::visitAtomicRMWInst(AtomicRMWInst &I) {
   const unsigned ValIdx = 1;
 
   // If the pointer operand is divergent, then each lane is doing an atomic
-  // operation on a different address, and we cannot optimize that.
-  if (DA->isDivergentUse(&I.getOperandUse(PtrIdx))) {
+  // operation on a different address. We can only optimize that by grouping
+  // the lanes by address first, which is not done in pixel shaders since the
+  // helper lanes would take part in the grouping.
+  const bool PtrDivergent = DA->isDivergentUse(&I.getOperandUse(PtrIdx));
+  if (PtrDivergent && (!GroupLanesByAddress || IsPixelShader)) {
     return;
   }
 
   const bool ValDivergent = DA->isDivergentUse(&I.getOperandUse(ValIdx));
 
   // If the value operand is divergent, each lane is contributing a different
-  // value to the atomic calculation. We can only optimize divergent values if
-  // we have DPP available on our subtarget, and the atomic operation is 32
+  // value to the atomic calculation. We can only combine such values, and
+  // broadcast floating-point results, if the atomic operation is 32 or 64
   // bits.
-  if (ValDivergent &&
-      (!ST->hasDPP() || DL->getTypeSizeInBits(I.getType()) != 32)) {
+  if ((ValDivergent || PtrDivergent || I.getType()->isFPOrFPVectorTy()) &&
+      !canMoveAcrossLanes(*DL, I.getType())) {
     return;
   }
 
   // If we get here, we can optimize the atomic using a single wavefront-wide
-  // atomic operation to do the calculation for the entire wavefront, so
-  // remember the instruction so we can come back to it.
-  const ReplacementInfo Info = {&I, Op, ValIdx, ValDivergent};
+  // atomic operation to do the calculation for the entire wavefront (or for
+  // each group of lanes sharing an address), so remember the instruction so
+  // we can come back to it.
+  const ReplacementInfo Info = {&I, Op, ValIdx, ValDivergent, PtrDivergent};
 
   ToReplace.push_back(Info);
 }
@@ -211,18 +259,27 @@ void AMDGPUAtomicOptimizer::visitIntrinsicInst(IntrinsicInst &I) {
   case Intrinsic::amdgcn_raw_buffer_atomic_umax:
     Op = AtomicRMWInst::UMax;
     break;
+  case Intrinsic::amdgcn_struct_buffer_atomic_fadd:
+  case Intrinsic::amdgcn_raw_buffer_atomic_fadd:
+    Op = AtomicRMWInst::FAdd;
+    break;
   }
 
+  // The buffer fadd intrinsics also accept packed <2 x half>, which can't be
+  // reduced across lanes as a single value.
+  if (I.getType()->isVectorTy())
+    return;
+
   const unsigned ValIdx = 0;
 
   const bool ValDivergent = DA->isDivergentUse(&I.getOperandUse(ValIdx));
 
   // If the value operand is divergent, each lane is contributing a different
-  // value to the atomic calculation. We can only optimize divergent values if
-  // we have DPP available on our subtarget, and the atomic operation is 32
+  // value to the atomic calculation. We can only combine such values, and
+  // broadcast floating-point results, if the atomic operation is 32 or 64
   // bits.
-  if (ValDivergent &&
-      (!ST->hasDPP() || DL->getTypeSizeInBits(I.getType()) != 32)) {
+  if ((ValDivergent || I.getType()->isFPOrFPVectorTy()) &&
+      !canMoveAcrossLanes(*DL, I.getType())) {
     return;
   }
 
@@ -237,7 +294,7 @@ void AMDGPUAtomicOptimizer::visitIntrinsicInst(IntrinsicInst &I) {
   // If we get here, we can optimize the atomic using a single wavefront-wide
   // atomic operation to do the calculation for the entire wavefront, so
   // remember the instruction so we can come back to it.
-  const ReplacementInfo Info = {&I, Op, ValIdx, ValDivergent};
+  const ReplacementInfo Info = {&I, Op, ValIdx, ValDivergent, false};
 
   ToReplace.push_back(Info);
 }
@@ -261,6 +318,10 @@ static Value *buildNonAtomicBinOp(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
     return B.CreateBinOp(Instruction::Or, LHS, RHS);
   case AtomicRMWInst::Xor:
     return B.CreateBinOp(Instruction::Xor, LHS, RHS);
+  case AtomicRMWInst::FAdd:
+    return B.CreateFAdd(LHS, RHS);
+  case AtomicRMWInst::FSub:
+    return B.CreateFSub(LHS, RHS);
 
   case AtomicRMWInst::Max:
     Pred = CmpInst::ICMP_SGT;
@@ -279,60 +340,117 @@ static Value *buildNonAtomicBinOp(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
   return B.CreateSelect(Cond, LHS, RHS);
 }
 
+// Use the builder to apply BuildOp, which creates a cross-lane operation on
+// i32 values, to Vals. These are 32 or 64-bit values of the same type, which
+// are handled one half at a time if they are 64 bits wide.
+static Value *buildLaneOp(IRBuilder<> &B, ArrayRef<Value *> Vals,
+                          function_ref<Value *(ArrayRef<Value *>)> BuildOp) {
+  Type *const Ty = Vals[0]->getType();
+  SmallVector<Value *, 2> Ops;
+
+  if (Ty->getPrimitiveSizeInBits() == 32) {
+    for (Value *V : Vals)
+      Ops.push_back(B.CreateBitCast(V, B.getInt32Ty()));
+    return B.CreateBitCast(BuildOp(Ops), Ty);
+  }
+
+  assert(Ty->getPrimitiveSizeInBits() == 64 && "Unhandled atomic bit width");
+  auto *const VecTy = FixedVectorType::get(B.getInt32Ty(), 2);
+  Value *Result = UndefValue::get(VecTy);
+  for (unsigned Half = 0; Half < 2; Half++) {
+    Ops.clear();
+    for (Value *V : Vals)
+      Ops.push_back(B.CreateExtractElement(B.CreateBitCast(V, VecTy),
+                                           B.getInt32(Half)));
+    Result = B.CreateInsertElement(Result, BuildOp(Ops), B.getInt32(Half));
+  }
+  return B.CreateBitCast(Result, Ty);
+}
+
+static Value *buildReadLane(IRBuilder<> &B, Value *V, Value *Lane) {
+  return buildLaneOp(B, V, [&](ArrayRef<Value *> Ops) {
+    return B.CreateIntrinsic(Intrinsic::amdgcn_readlane, {}, {Ops[0], Lane});
+  });
+}
+
+static Value *buildReadFirstLane(IRBuilder<> &B, Value *V) {
+  return buildLaneOp(B, V, [&](ArrayRef<Value *> Ops) {
+    return B.CreateIntrinsic(Intrinsic::amdgcn_readfirstlane, {}, Ops[0]);
+  });
+}
+
+static Value *buildWriteLane(IRBuilder<> &B, Value *V, Value *Lane,
+                             Value *Old) {
+  return buildLaneOp(B, {V, Old}, [&](ArrayRef<Value *> Ops) {
+    return B.CreateIntrinsic(Intrinsic::amdgcn_writelane, {},
+                             {Ops[0], Lane, Ops[1]});
+  });
+}
+
+static Value *buildPermLaneX16(IRBuilder<> &B, Value *V) {
+  return buildLaneOp(B, V, [&](ArrayRef<Value *> Ops) {
+    return B.CreateIntrinsic(Intrinsic::amdgcn_permlanex16, {},
+                             {Ops[0], Ops[0], B.getInt32(-1), B.getInt32(-1),
+                              B.getFalse(), B.getFalse()});
+  });
+}
+
+// The DPP intrinsics only take integers, so floating-point values are moved
+// as integers of the same size.
+static Value *buildUpdateDPP(IRBuilder<> &B, Value *Old, Value *V,
+                             unsigned DPPCtrl, unsigned RowMask,
+                             unsigned BankMask) {
+  Type *const Ty = V->getType();
+  Type *const IntTy = B.getIntNTy(Ty->getPrimitiveSizeInBits());
+  Value *const DPP = B.CreateIntrinsic(
+      Intrinsic::amdgcn_update_dpp, IntTy,
+      {B.CreateBitCast(Old, IntTy), B.CreateBitCast(V, IntTy),
+       B.getInt32(DPPCtrl), B.getInt32(RowMask), B.getInt32(BankMask),
+       B.getFalse()});
+  return B.CreateBitCast(DPP, Ty);
+}
+
+static Value *buildSetInactive(IRBuilder<> &B, Value *V, Value *Inactive) {
+  Type *const Ty = V->getType();
+  Type *const IntTy = B.getIntNTy(Ty->getPrimitiveSizeInBits());
+  Value *const Result =
+      B.CreateIntrinsic(Intrinsic::amdgcn_set_inactive, IntTy,
+                        {B.CreateBitCast(V, IntTy),
+                         B.CreateBitCast(Inactive, IntTy)});
+  return B.CreateBitCast(Result, Ty);
+}
+
 // Use the builder to create an inclusive scan of V across the wavefront, with
 // all lanes active.
 Value *AMDGPUAtomicOptimizer::buildScan(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
                                         Value *V, Value *const Identity) const {
-  Type *const Ty = V->getType();
-  Module *M = B.GetInsertBlock()->getModule();
-  Function *UpdateDPP =
-      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_update_dpp, Ty);
-  Function *PermLaneX16 =
-      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_permlanex16, {});
-  Function *ReadLane =
-      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_readlane, {});
-
   for (unsigned Idx = 0; Idx < 4; Idx++) {
     V = buildNonAtomicBinOp(
         B, Op, V,
-        B.CreateCall(UpdateDPP,
-                     {Identity, V, B.getInt32(DPP::ROW_SHR0 | 1 << Idx),
-                      B.getInt32(0xf), B.getInt32(0xf), B.getFalse()}));
+        buildUpdateDPP(B, Identity, V, DPP::ROW_SHR0 | 1 << Idx, 0xf, 0xf));
   }
   if (ST->hasDPPBroadcasts()) {
     // GFX9 has DPP row broadcast operations.
     V = buildNonAtomicBinOp(
-        B, Op, V,
-        B.CreateCall(UpdateDPP,
-                     {Identity, V, B.getInt32(DPP::BCAST15), B.getInt32(0xa),
-                      B.getInt32(0xf), B.getFalse()}));
+        B, Op, V, buildUpdateDPP(B, Identity, V, DPP::BCAST15, 0xa, 0xf));
     V = buildNonAtomicBinOp(
-        B, Op, V,
-        B.CreateCall(UpdateDPP,
-                     {Identity, V, B.getInt32(DPP::BCAST31), B.getInt32(0xc),
-                      B.getInt32(0xf), B.getFalse()}));
+        B, Op, V, buildUpdateDPP(B, Identity, V, DPP::BCAST31, 0xc, 0xf));
   } else {
     // On GFX10 all DPP operations are confined to a single row. To get cross-
     // row operations we have to use permlane or readlane.
 
     // Combine lane 15 into lanes 16..31 (and, for wave 64, lane 47 into lanes
     // 48..63).
-    Value *const PermX =
-        B.CreateCall(PermLaneX16, {V, V, B.getInt32(-1), B.getInt32(-1),
-                                   B.getFalse(), B.getFalse()});
+    Value *const PermX = buildPermLaneX16(B, V);
     V = buildNonAtomicBinOp(
         B, Op, V,
-        B.CreateCall(UpdateDPP,
-                     {Identity, PermX, B.getInt32(DPP::QUAD_PERM_ID),
-                      B.getInt32(0xa), B.getInt32(0xf), B.getFalse()}));
+        buildUpdateDPP(B, Identity, PermX, DPP::QUAD_PERM_ID, 0xa, 0xf));
     if (!ST->isWave32()) {
       // Combine lane 31 into lanes 32..63.
-      Value *const Lane31 = B.CreateCall(ReadLane, {V, B.getInt32(31)});
+      Value *const Lane31 = buildReadLane(B, V, B.getInt32(31));
       V = buildNonAtomicBinOp(
           B, Op, V,
-          B.CreateCall(UpdateDPP,
-                       {Identity, Lane31, B.getInt32(DPP::QUAD_PERM_ID),
-                        B.getInt32(0xc), B.getInt32(0xf), B.getFalse()}));
+          buildUpdateDPP(B, Identity, Lane31, DPP::QUAD_PERM_ID, 0xc, 0xf));
     }
   }
   return V;
@@ -342,50 +460,180 @@ Value *AMDGPUAtomicOptimizer::buildScan(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
 // lanes active, to turn an inclusive scan into an exclusive scan.
 Value *AMDGPUAtomicOptimizer::buildShiftRight(IRBuilder<> &B, Value *V,
                                               Value *const Identity) const {
-  Type *const Ty = V->getType();
-  Module *M = B.GetInsertBlock()->getModule();
-  Function *UpdateDPP =
-      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_update_dpp, Ty);
-  Function *ReadLane =
-      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_readlane, {});
-  Function *WriteLane =
-      Intrinsic::getDeclaration(M, Intrinsic::amdgcn_writelane, {});
-
   if (ST->hasDPPWavefrontShifts()) {
     // GFX9 has DPP wavefront shift operations.
-    V = B.CreateCall(UpdateDPP,
-                     {Identity, V, B.getInt32(DPP::WAVE_SHR1), B.getInt32(0xf),
-                      B.getInt32(0xf), B.getFalse()});
+    V = buildUpdateDPP(B, Identity, V, DPP::WAVE_SHR1, 0xf, 0xf);
   } else {
     // On GFX10 all DPP operations are confined to a single row. To get cross-
     // row operations we have to use permlane or readlane.
     Value *Old = V;
-    V = B.CreateCall(UpdateDPP,
-                     {Identity, V, B.getInt32(DPP::ROW_SHR0 + 1),
-                      B.getInt32(0xf), B.getInt32(0xf), B.getFalse()});
+    V = buildUpdateDPP(B, Identity, V, DPP::ROW_SHR0 + 1, 0xf, 0xf);
 
     // Copy the old lane 15 to the new lane 16.
-    V = B.CreateCall(WriteLane, {B.CreateCall(ReadLane, {Old, B.getInt32(15)}),
-                                 B.getInt32(16), V});
+    V = buildWriteLane(B, buildReadLane(B, Old, B.getInt32(15)),
+                       B.getInt32(16), V);
 
     if (!ST->isWave32()) {
       // Copy the old lane 31 to the new lane 32.
-      V = B.CreateCall(
-          WriteLane,
-          {B.CreateCall(ReadLane, {Old, B.getInt32(31)}), B.getInt32(32), V});
+      V = buildWriteLane(B, buildReadLane(B, Old, B.getInt32(31)),
+                         B.getInt32(32), V);
 
       // Copy the old lane 47 to the new lane 48.
-      V = B.CreateCall(
-          WriteLane,
-          {B.CreateCall(ReadLane, {Old, B.getInt32(47)}), B.getInt32(48), V});
+      V = buildWriteLane(B, buildReadLane(B, Old, B.getInt32(47)),
+                         B.getInt32(48), V);
     }
   }
 
   return V;
 }
 
-static APInt getIdentityValueForAtomicOp(AtomicRMWInst::BinOp Op,
-                                         unsigned BitWidth) {
+// Use the builder to create a loop over the active lanes in Ballot, which
+// reads the value of V in each of them and combines it into an accumulator.
+// This works for any 32 or 64-bit type, and without DPP. Returns the combined
+// value of all active lanes, and, if NeedResult is set, the exclusive scan of
+// V in each active lane.
+std::pair<Value *, Value *> AMDGPUAtomicOptimizer::buildScanIteratively(
+    IRBuilder<> &B, AtomicRMWInst::BinOp Op, Value *const Identity, Value *V,
+    Value *const Ballot, Instruction &I, bool NeedResult) const {
+  Type *const Ty = V->getType();
+  Type *const WaveTy = Ballot->getType();
+
+  // Split I's basic block so that the loop can go between the two halves:
+  // entry --> compute_loop --> compute_end
+  //                ^   |
+  //                \---/
+  BasicBlock *const EntryBB = I.getParent();
+  BasicBlock *const ComputeEnd =
+      SplitBlock(EntryBB, &I, DT, nullptr, nullptr, "ComputeEnd");
+  BasicBlock *const ComputeLoop = SplitBlock(
+      EntryBB, EntryBB->getTerminator(), DT, nullptr, nullptr, "ComputeLoop");
+
+  B.SetInsertPoint(ComputeLoop->getTerminator());
+  PHINode *const Accumulator = B.CreatePHI(Ty, 2, "Accumulator");
+  Accumulator->addIncoming(Identity, EntryBB);
+  PHINode *OldValuePhi = nullptr;
+  if (NeedResult) {
+    OldValuePhi = B.CreatePHI(Ty, 2, "OldValuePhi");
+    OldValuePhi->addIncoming(UndefValue::get(Ty), EntryBB);
+  }
+  PHINode *const ActiveBits = B.CreatePHI(WaveTy, 2, "ActiveBits");
+  ActiveBits->addIncoming(Ballot, EntryBB);
+
+  // Pick the lowest active lane that has not been handled yet.
+  Value *const FF1 =
+      B.CreateIntrinsic(Intrinsic::cttz, WaveTy, {ActiveBits, B.getTrue()});
+  Value *const LaneIdx = B.CreateTrunc(FF1, B.getInt32Ty());
+  Value *const LaneValue = buildReadLane(B, V, LaneIdx);
+
+  // The accumulator holds the combined value of all lanes below this one,
+  // which is this lane's slice of the atomic result.
+  Value *OldValue = nullptr;
+  if (NeedResult) {
+    OldValue = buildWriteLane(B, Accumulator, LaneIdx, OldValuePhi);
+    OldValuePhi->addIncoming(OldValue, ComputeLoop);
+  }
+
+  Value *const NewAccumulator =
+      buildNonAtomicBinOp(B, Op, Accumulator, LaneValue);
+  Accumulator->addIncoming(NewAccumulator, ComputeLoop);
+
+  // Clear the bit of the lane just handled, and leave the loop once all of
+  // them are done.
+  Value *const Mask = B.CreateShl(ConstantInt::get(WaveTy, 1), FF1);
+  Value *const NewActiveBits = B.CreateAnd(ActiveBits, B.CreateNot(Mask));
+  ActiveBits->addIncoming(NewActiveBits, ComputeLoop);
+  Value *const IsEnd =
+      B.CreateICmpEQ(NewActiveBits, ConstantInt::get(WaveTy, 0));
+  ReplaceInstWithInst(ComputeLoop->getTerminator(),
+                      BranchInst::Create(ComputeEnd, ComputeLoop, IsEnd));
+
+  B.SetInsertPoint(&I);
+  return {NewAccumulator, OldValue};
+}
+
+// Wrap I in a loop that handles one of the distinct addresses in the
+// wavefront per iteration. The lanes using that address execute a copy of I
+// whose address is uniform, so that it can be optimized like any other
+// uniform atomic:
+// entry --> loop_header --> group ---> loop_latch --> loop_end
+//               ^    \-------------------/  |
+//               \--------------------------/
+void AMDGPUAtomicOptimizer::groupLanesByAddress(AtomicRMWInst &I) const {
+  const unsigned PtrIdx = AtomicRMWInst::getPointerOperandIndex();
+  Type *const Ty = I.getType();
+  Type *const WaveTy = IntegerType::get(I.getContext(),
+                                        ST->getWavefrontSize());
+  Value *const Ptr = I.getOperand(PtrIdx);
+  Type *const IntPtrTy = DL->getIntPtrType(Ptr->getType());
+  const bool NeedResult = !I.use_empty();
+
+  IRBuilder<> B(&I);
+  Value *const Ballot =
+      B.CreateIntrinsic(Intrinsic::amdgcn_ballot, WaveTy, B.getTrue());
+
+  BasicBlock *const EntryBB = I.getParent();
+  BasicBlock *const HeaderBB =
+      SplitBlock(EntryBB, &I, DT, nullptr, nullptr, "AddressLoop");
+
+  B.SetInsertPoint(&I);
+  PHINode *const Remaining = B.CreatePHI(WaveTy, 2, "Remaining");
+  Remaining->addIncoming(Ballot, EntryBB);
+  PHINode *Carried = nullptr;
+  if (NeedResult) {
+    Carried = B.CreatePHI(Ty, 2);
+    Carried->addIncoming(UndefValue::get(Ty), EntryBB);
+  }
+
+  // The lowest remaining lane picks the address handled in this iteration.
+  Value *const Leader = B.CreateTrunc(
+      B.CreateIntrinsic(Intrinsic::cttz, WaveTy, {Remaining, B.getTrue()}),
+      B.getInt32Ty());
+  Value *const PtrInt = B.CreatePtrToInt(Ptr, IntPtrTy);
+  Value *const LeaderPtrInt = buildReadLane(B, PtrInt, Leader);
+  Value *const InGroup = B.CreateICmpEQ(PtrInt, LeaderPtrInt);
+  Value *const Group =
+      B.CreateIntrinsic(Intrinsic::amdgcn_ballot, WaveTy, InGroup);
+
+  Instruction *const GroupTerminator =
+      SplitBlockAndInsertIfThen(InGroup, &I, false, nullptr, DT, nullptr);
+  BasicBlock *const GroupBB = GroupTerminator->getParent();
+  BasicBlock *const LatchBB = I.getParent();
+
+  // Move I into the group block, and use the address read from the leader,
+  // which is equal to the lane's own address there but known to be uniform.
+  I.moveBefore(GroupTerminator);
+  B.SetInsertPoint(&I);
+  I.setOperand(PtrIdx, B.CreateIntToPtr(LeaderPtrInt, Ptr->getType()));
+
+  B.SetInsertPoint(LatchBB->getFirstNonPHI());
+  PHINode *Result = nullptr;
+  if (NeedResult) {
+    Result = B.CreatePHI(Ty, 2);
+    Result->addIncoming(Carried, HeaderBB);
+    Result->addIncoming(UndefValue::get(Ty), GroupBB);
+    Carried->addIncoming(Result, LatchBB);
+  }
+  Value *const NewRemaining = B.CreateAnd(Remaining, B.CreateNot(Group));
+  Remaining->addIncoming(NewRemaining, LatchBB);
+  Instruction *const IsEnd = cast<Instruction>(
+      B.CreateICmpEQ(NewRemaining, ConstantInt::get(WaveTy, 0)));
+
+  BasicBlock *const ExitBB = SplitBlock(LatchBB, IsEnd->getNextNode(), DT,
+                                        nullptr, nullptr, "AddressLoopEnd");
+  // The back edge leaves the dominator tree unchanged, since the header
+  // dominates the latch.
+  ReplaceInstWithInst(LatchBB->getTerminator(),
+                      BranchInst::Create(ExitBB, HeaderBB, IsEnd));
+
+  if (NeedResult) {
+    I.replaceAllUsesWith(Result);
+    Result->setIncomingValueForBlock(GroupBB, &I);
+  }
+}
+
+static Constant *getIdentityValueForAtomicOp(Type *const Ty,
+                                             AtomicRMWInst::BinOp Op) {
+  const unsigned BitWidth = Ty->getPrimitiveSizeInBits();
   switch (Op) {
   default:
     llvm_unreachable("Unhandled atomic op");
@@ -394,14 +642,18 @@ static APInt getIdentityValueForAtomicOp(AtomicRMWInst::BinOp Op,
   case AtomicRMWInst::Or:
   case AtomicRMWInst::Xor:
   case AtomicRMWInst::UMax:
-    return APInt::getMinValue(BitWidth);
+    return ConstantInt::get(Ty, APInt::getMinValue(BitWidth));
   case AtomicRMWInst::And:
   case AtomicRMWInst::UMin:
-    return APInt::getMaxValue(BitWidth);
+    return ConstantInt::get(Ty, APInt::getMaxValue(BitWidth));
   case AtomicRMWInst::Max:
-    return APInt::getSignedMinValue(BitWidth);
+    return ConstantInt::get(Ty, APInt::getSignedMinValue(BitWidth));
   case AtomicRMWInst::Min:
-    return APInt::getSignedMaxValue(BitWidth);
+    return ConstantInt::get(Ty, APInt::getSignedMaxValue(BitWidth));
+  case AtomicRMWInst::FAdd:
+  case AtomicRMWInst::FSub:
+    // -0.0 rather than 0.0, so that a sum of -0.0 values stays negative.
+    return ConstantFP::get(Ty, -0.0);
   }
 }
 
@@ -410,6 +662,14 @@ static Value *buildMul(IRBuilder<> &B, Value *LHS, Value *RHS) {
   return (CI && CI->isOne()) ? RHS : B.CreateMul(LHS, RHS);
 }
 
+// Convert the lane count Count to Ty, the type of the atomic operation.
+static Value *buildLaneCount(IRBuilder<> &B, Value *Count, Type *const Ty) {
+  assert(!Ty->isVectorTy() && "Vector atomics are not optimized");
+  if (Ty->isFloatingPointTy())
+    return B.CreateUIToFP(Count, Ty);
+  return B.CreateIntCast(Count, Ty, false);
+}
+
 void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
                                            AtomicRMWInst::BinOp Op,
                                            unsigned ValIdx,
@@ -443,8 +703,8 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
   }
 
   Type *const Ty = I.getType();
-  const unsigned TyBitWidth = DL->getTypeSizeInBits(Ty);
   auto *const VecTy = FixedVectorType::get(B.getInt32Ty(), 2);
+  const bool NeedResult = !I.use_empty();
 
   // This is the value in the atomic operation we need to combine in order to
   // reduce the number of atomic operations.
@@ -473,22 +733,27 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
     Mbcnt =
         B.CreateIntrinsic(Intrinsic::amdgcn_mbcnt_hi, {}, {ExtractHi, Mbcnt});
   }
-  Mbcnt = B.CreateIntCast(Mbcnt, Ty, false);
 
-  Value *const Identity = B.getInt(getIdentityValueForAtomicOp(Op, TyBitWidth));
+  Value *const Identity = getIdentityValueForAtomicOp(Ty, Op);
 
   Value *ExclScan = nullptr;
   Value *NewV = nullptr;
 
-  // If we have a divergent value in each lane, we need to combine the value
-  // using DPP.
-  if (ValDivergent) {
+  // Divergent values are combined with DPP where we have it, and otherwise by
+  // visiting the active lanes one at a time.
+  const bool UseDPP =
+      AtomicScanStrategy == ScanStrategy::DPP && ST->hasDPP();
+  AtomicRMWInst::BinOp ScanOp = Op;
+  if (Op == AtomicRMWInst::Sub)
+    ScanOp = AtomicRMWInst::Add;
+  else if (Op == AtomicRMWInst::FSub)
+    ScanOp = AtomicRMWInst::FAdd;
+
+  if (ValDivergent && UseDPP) {
     // First we need to set all inactive invocations to the identity value, so
     // that they can correctly contribute to the final result.
-    NewV = B.CreateIntrinsic(Intrinsic::amdgcn_set_inactive, Ty, {V, Identity});
+    NewV = buildSetInactive(B, V, Identity);
 
-    const AtomicRMWInst::BinOp ScanOp =
-        Op == AtomicRMWInst::Sub ? AtomicRMWInst::Add : Op;
     NewV = buildScan(B, ScanOp, NewV, Identity);
     ExclScan = buildShiftRight(B, NewV, Identity);
 
@@ -496,28 +761,15 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
     // each active lane in the wavefront. This will be our new value which we
     // will provide to the atomic operation.
     Value *const LastLaneIdx = B.getInt32(ST->getWavefrontSize() - 1);
-    if (TyBitWidth == 64) {
-      Value *const ExtractLo = B.CreateTrunc(NewV, B.getInt32Ty());
-      Value *const ExtractHi =
-          B.CreateTrunc(B.CreateLShr(NewV, 32), B.getInt32Ty());
-      CallInst *const ReadLaneLo = B.CreateIntrinsic(
-          Intrinsic::amdgcn_readlane, {}, {ExtractLo, LastLaneIdx});
-      CallInst *const ReadLaneHi = B.CreateIntrinsic(
-          Intrinsic::amdgcn_readlane, {}, {ExtractHi, LastLaneIdx});
-      Value *const PartialInsert = B.CreateInsertElement(
-          UndefValue::get(VecTy), ReadLaneLo, B.getInt32(0));
-      Value *const Insert =
-          B.CreateInsertElement(PartialInsert, ReadLaneHi, B.getInt32(1));
-      NewV = B.CreateBitCast(Insert, Ty);
-    } else if (TyBitWidth == 32) {
-      NewV = B.CreateIntrinsic(Intrinsic::amdgcn_readlane, {},
-                               {NewV, LastLaneIdx});
-    } else {
-      llvm_unreachable("Unhandled atomic bit width");
-    }
+    NewV = buildReadLane(B, NewV, LastLaneIdx);
 
     // Finally mark the readlanes in the WWM section.
     NewV = B.CreateIntrinsic(Intrinsic::amdgcn_wwm, Ty, NewV);
+  } else if (ValDivergent) {
+    // The loop leaves B inserting before I, which is now in the block after
+    // the loop.
+    std::tie(NewV, ExclScan) =
+        buildScanIteratively(B, ScanOp, Identity, V, Ballot, I, NeedResult);
   } else {
     switch (Op) {
     default:
@@ -533,6 +785,14 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
       break;
     }
 
+    case AtomicRMWInst::FAdd:
+    case AtomicRMWInst::FSub: {
+      Value *const Ctpop = buildLaneCount(
+          B, B.CreateUnaryIntrinsic(Intrinsic::ctpop, Ballot), Ty);
+      NewV = B.CreateFMul(V, Ctpop);
+      break;
+    }
+
     case AtomicRMWInst::And:
     case AtomicRMWInst::Or:
     case AtomicRMWInst::Max:
@@ -557,7 +817,7 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
   // We only want a single lane to enter our new control flow, and we do this
   // by checking if there are any active lanes below us. Only one lane will
   // have 0 active lanes below us, so that will be the only one to progress.
-  Value *const Cond = B.CreateICmpEQ(Mbcnt, B.getIntN(TyBitWidth, 0));
+  Value *const Cond = B.CreateICmpEQ(Mbcnt, B.getInt32(0));
 
   // Store I's original basic block before we split the block.
   BasicBlock *const EntryBB = I.getParent();
@@ -583,7 +843,6 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
   // original instruction.
   B.SetInsertPoint(&I);
 
-  const bool NeedResult = !I.use_empty();
   if (NeedResult) {
     // Create a PHI node to get our new atomic result into the exit block.
     PHINode *const PHI = B.CreatePHI(Ty, 2);
@@ -593,42 +852,28 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
     // We need to broadcast the value who was the lowest active lane (the first
     // lane) to all other lanes in the wavefront. We use an intrinsic for this,
     // but have to handle 64-bit broadcasts with two calls to this intrinsic.
-    Value *BroadcastI = nullptr;
-
-    if (TyBitWidth == 64) {
-      Value *const ExtractLo = B.CreateTrunc(PHI, B.getInt32Ty());
-      Value *const ExtractHi =
-          B.CreateTrunc(B.CreateLShr(PHI, 32), B.getInt32Ty());
-      CallInst *const ReadFirstLaneLo =
-          B.CreateIntrinsic(Intrinsic::amdgcn_readfirstlane, {}, ExtractLo);
-      CallInst *const ReadFirstLaneHi =
-          B.CreateIntrinsic(Intrinsic::amdgcn_readfirstlane, {}, ExtractHi);
-      Value *const PartialInsert = B.CreateInsertElement(
-          UndefValue::get(VecTy), ReadFirstLaneLo, B.getInt32(0));
-      Value *const Insert =
-          B.CreateInsertElement(PartialInsert, ReadFirstLaneHi, B.getInt32(1));
-      BroadcastI = B.CreateBitCast(Insert, Ty);
-    } else if (TyBitWidth == 32) {
-
-      BroadcastI = B.CreateIntrinsic(Intrinsic::amdgcn_readfirstlane, {}, PHI);
-    } else {
-      llvm_unreachable("Unhandled atomic bit width");
-    }
+    Value *const BroadcastI = buildReadFirstLane(B, PHI);
 
     // Now that we have the result of our single atomic operation, we need to
     // get our individual lane's slice into the result. We use the lane offset
     // we previously calculated combined with the atomic result value we got
     // from the first lane, to get our lane's index into the atomic result.
     Value *LaneOffset = nullptr;
-    if (ValDivergent) {
+    if (ValDivergent && UseDPP) {
       LaneOffset = B.CreateIntrinsic(Intrinsic::amdgcn_wwm, Ty, ExclScan);
+    } else if (ValDivergent) {
+      LaneOffset = ExclScan;
     } else {
       switch (Op) {
       default:
         llvm_unreachable("Unhandled atomic op");
       case AtomicRMWInst::Add:
       case AtomicRMWInst::Sub:
-        LaneOffset = buildMul(B, V, Mbcnt);
+        LaneOffset = buildMul(B, V, buildLaneCount(B, Mbcnt, Ty));
+        break;
+      case AtomicRMWInst::FAdd:
+      case AtomicRMWInst::FSub:
+        LaneOffset = B.CreateFMul(V, buildLaneCount(B, Mbcnt, Ty));
         break;
       case AtomicRMWInst::And:
       case AtomicRMWInst::Or:
@@ -639,7 +884,8 @@ void AMDGPUAtomicOptimizer::optimizeAtomic(Instruction &I,
         LaneOffset = B.CreateSelect(Cond, Identity, V);
         break;
       case AtomicRMWInst::Xor:
-        LaneOffset = buildMul(B, V, B.CreateAnd(Mbcnt, 1));
+        LaneOffset =
+            buildMul(B, V, B.CreateAnd(buildLaneCount(B, Mbcnt, Ty), 1));
         break;
       }
     }
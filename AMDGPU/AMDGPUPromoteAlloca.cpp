@@ -9,17 +9,26 @@
 // This pass eliminates allocas by either converting them into vectors or
 // by migrating them to local address space.
 //
+// With -amdgpu-promote-alloca-cost-model, promotion is decided by weighing the
+// scratch accesses it removes against the occupancy lost by the extra VGPRs
+// or LDS, and array allocas that cannot be promoted as a whole may be split
+// into a part small enough for registers and a remainder.
+//
 //===----------------------------------------------------------------------===//
 
 #include "AMDGPU.h"
 #include "GCNSubtarget.h"
 #include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicsAMDGPU.h"
 #include "llvm/IR/IntrinsicsR600.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/KnownBits.h"
 #include "llvm/Target/TargetMachine.h"
 
 #define DEBUG_TYPE "amdgpu-promote-alloca"
@@ -43,6 +52,29 @@ static cl::opt<unsigned> PromoteAllocaToVectorLimit(
   cl::desc("Maximum byte size to consider promote alloca to vector"),
   cl::init(0));
 
+static cl::opt<bool> PromoteAllocaCostModel(
+  "amdgpu-promote-alloca-cost-model",
+  cl::desc("Decide alloca promotion by weighing scratch traffic against "
+           "occupancy, and split array allocas that do not fit as a whole"),
+  cl::init(false));
+
+static cl::opt<unsigned> ScratchAccessCost(
+  "amdgpu-promote-alloca-scratch-cost",
+  cl::desc("Cost of a scratch access relative to other instructions, used by "
+           "the promote alloca cost model"),
+  cl::init(16));
+
+static cl::opt<unsigned> AssumedVGPRs(
+  "amdgpu-promote-alloca-assumed-vgprs",
+  cl::desc("Number of VGPRs assumed to be used besides promoted allocas, used "
+           "by the promote alloca cost model to estimate occupancy"),
+  cl::init(32));
+
+// Each loop level is assumed to multiply the execution count of a block by
+// this much, up to MaxLoopDepthWeighted levels.
+static const unsigned LoopDepthWeight = 8;
+static const unsigned MaxLoopDepthWeighted = 5;
+
 // FIXME: This can create globals so should be a module pass.
 class AMDGPUPromoteAlloca : public FunctionPass {
 public:
@@ -76,6 +108,15 @@ private:
   bool IsAMDGCN = false;
   bool IsAMDHSA = false;
 
+  // State of the cost model, which is only set up if it is enabled.
+  bool UseCostModel = false;
+  DominatorTree DT;
+  LoopInfo LI;
+  uint64_t FunctionWeight = 0;
+  unsigned PromotedVGPRs = 0;
+
+  OptimizationRemarkEmitter *ORE = nullptr;
+
   std::pair<Value *, Value *> getLocalSizeYZ(IRBuilder<> &Builder);
   Value *getWorkitemID(IRBuilder<> &Builder, unsigned N);
 
@@ -96,8 +137,28 @@ private:
   /// Check whether we have enough local memory for promotion.
   bool hasSufficientLocalMem(const Function &F);
 
+  /// Estimated execution count of \p BB relative to the function entry.
+  uint64_t getBlockWeight(const BasicBlock *BB) const;
+
+  /// Sum of the block weights of all memory accesses through \p Ptr.
+  uint64_t getAccessWeight(Value *Ptr) const;
+
+  /// Return true if removing the scratch accesses of weight \p AccessWeight
+  /// is worth the occupancy lost by using \p ExtraVGPRs more VGPRs and a
+  /// total of \p LDSSize bytes of LDS.
+  bool isPromotionProfitable(const Function &F, uint64_t AccessWeight,
+                             unsigned ExtraVGPRs, uint32_t LDSSize) const;
+
+  /// Split the array alloca \p I at an element boundary that no access
+  /// crosses, if one part can then profitably be promoted to a vector. On
+  /// success, \p I is erased and \p Hot is set to that part.
+  bool splitAlloca(AllocaInst &I, AllocaInst *&Hot, AllocaInst *&Cold);
+
   bool handleAlloca(AllocaInst &I, bool SufficientLDS);
 
+  /// Promote \p I, or split it and promote its parts with the cost model.
+  bool promoteOrSplitAlloca(AllocaInst &I, bool SufficientLDS);
+
 public:
   AMDGPUPromoteAllocaImpl(TargetMachine &TM) : TM(TM) {}
   bool run(Function &F);
@@ -175,6 +236,20 @@ bool AMDGPUPromoteAllocaImpl::run(Function &F) {
     MaxVGPRs = 128;
   }
 
+  // The cost model needs GCN occupancy information.
+  UseCostModel = PromoteAllocaCostModel && IsAMDGCN;
+  if (UseCostModel) {
+    DT.recalculate(F);
+    LI.analyze(DT);
+    FunctionWeight = 0;
+    for (const BasicBlock &BB : F)
+      FunctionWeight += BB.size() * getBlockWeight(&BB);
+    PromotedVGPRs = 0;
+  }
+
+  OptimizationRemarkEmitter FunctionORE(&F);
+  ORE = &FunctionORE;
+
   bool SufficientLDS = hasSufficientLocalMem(F);
   bool Changed = false;
   BasicBlock &EntryBB = *F.begin();
@@ -186,10 +261,11 @@ bool AMDGPUPromoteAllocaImpl::run(Function &F) {
   }
 
   for (AllocaInst *AI : Allocas) {
-    if (handleAlloca(*AI, SufficientLDS))
+    if (promoteOrSplitAlloca(*AI, SufficientLDS))
       Changed = true;
   }
 
+  ORE = nullptr;
   return Changed;
 }
 
@@ -399,8 +475,19 @@ static bool canVectorizeInst(Instruction *Inst, User *User,
   }
 }
 
+// Return true if an alloca of SizeInBits is small enough to be promoted to a
+// vector. Up to 1/4 of the available register budget is used, unless the cost
+// model has already decided that the registers are well spent.
+static bool fitsVectorBudget(uint64_t SizeInBits, unsigned MaxVGPRs,
+                             bool UseAllVGPRs) {
+  unsigned Limit = PromoteAllocaToVectorLimit ? PromoteAllocaToVectorLimit * 8
+                                              : (MaxVGPRs * 32);
+  return SizeInBits * (UseAllVGPRs ? 1 : 4) <= Limit;
+}
+
 static bool tryPromoteAllocaToVector(AllocaInst *Alloca, const DataLayout &DL,
-                                     unsigned MaxVGPRs) {
+                                     unsigned MaxVGPRs,
+                                     bool UseAllVGPRs = false) {
 
   if (DisablePromoteAllocaToVector) {
     LLVM_DEBUG(dbgs() << "  Promotion alloca to vector is disabled\n");
@@ -415,11 +502,8 @@ static bool tryPromoteAllocaToVector(AllocaInst *Alloca, const DataLayout &DL,
       VectorTy = arrayTypeToVecType(ArrayTy);
   }
 
-  // Use up to 1/4 of available register budget for vectorization.
-  unsigned Limit = PromoteAllocaToVectorLimit ? PromoteAllocaToVectorLimit * 8
-                                              : (MaxVGPRs * 32);
-
-  if (DL.getTypeSizeInBits(AllocaTy) * 4 > Limit) {
+  if (!fitsVectorBudget(DL.getTypeSizeInBits(AllocaTy), MaxVGPRs,
+                        UseAllVGPRs)) {
     LLVM_DEBUG(dbgs() << "  Alloca too big for vectorization with "
                       << MaxVGPRs << " registers available\n");
     return false;
@@ -820,7 +904,8 @@ bool AMDGPUPromoteAllocaImpl::hasSufficientLocalMem(const Function &F) {
   if (CurrentLocalMemUsage > MaxSizeWithWaveCount)
     return false;
 
-  LocalMemLimit = MaxSizeWithWaveCount;
+  // The cost model decides by itself how much occupancy is worth giving up.
+  LocalMemLimit = UseCostModel ? ST.getLocalMemorySize() : MaxSizeWithWaveCount;
 
   LLVM_DEBUG(dbgs() << F.getName() << " uses " << CurrentLocalMemUsage
                     << " bytes of LDS\n"
@@ -832,6 +917,245 @@ bool AMDGPUPromoteAllocaImpl::hasSufficientLocalMem(const Function &F) {
   return true;
 }
 
+uint64_t AMDGPUPromoteAllocaImpl::getBlockWeight(const BasicBlock *BB) const {
+  uint64_t Weight = 1;
+  for (unsigned Depth = std::min(LI.getLoopDepth(BB), MaxLoopDepthWeighted);
+       Depth; --Depth)
+    Weight *= LoopDepthWeight;
+  return Weight;
+}
+
+uint64_t AMDGPUPromoteAllocaImpl::getAccessWeight(Value *Ptr) const {
+  uint64_t Weight = 0;
+  SmallVector<Value *, 8> WorkList = {Ptr};
+  SmallPtrSet<Instruction *, 16> Visited;
+
+  while (!WorkList.empty()) {
+    Value *V = WorkList.pop_back_val();
+    for (User *U : V->users()) {
+      Instruction *UseInst = dyn_cast<Instruction>(U);
+      if (!UseInst || !Visited.insert(UseInst).second)
+        continue;
+
+      if (isa<LoadInst>(UseInst) || isa<StoreInst>(UseInst) ||
+          isa<AtomicRMWInst>(UseInst) || isa<AtomicCmpXchgInst>(UseInst) ||
+          isa<MemIntrinsic>(UseInst))
+        Weight += getBlockWeight(UseInst->getParent());
+      else if (UseInst->getType()->isPointerTy())
+        WorkList.push_back(UseInst);
+    }
+  }
+  return Weight;
+}
+
+bool AMDGPUPromoteAllocaImpl::isPromotionProfitable(const Function &F,
+                                                    uint64_t AccessWeight,
+                                                    unsigned ExtraVGPRs,
+                                                    uint32_t LDSSize) const {
+  const GCNSubtarget &ST = TM.getSubtarget<GCNSubtarget>(F);
+  const unsigned VGPRs = AssumedVGPRs + PromotedVGPRs;
+  const unsigned OccBefore =
+      ST.computeOccupancy(F, CurrentLocalMemUsage, 0, VGPRs);
+  const unsigned OccAfter =
+      ST.computeOccupancy(F, LDSSize, 0, VGPRs + ExtraVGPRs);
+  if (OccAfter == 0)
+    return false;
+
+  // Losing occupancy is assumed to slow down the whole function by the same
+  // fraction, since there are fewer waves to hide its latencies.
+  const uint64_t Benefit = AccessWeight * ScratchAccessCost;
+  const uint64_t Cost =
+      OccAfter < OccBefore ? FunctionWeight * (OccBefore - OccAfter) / OccBefore
+                           : 0;
+
+  LLVM_DEBUG(dbgs() << "  Occupancy " << OccBefore << " -> " << OccAfter
+                    << ", benefit " << Benefit << ", cost " << Cost << '\n');
+  return Benefit > Cost;
+}
+
+bool AMDGPUPromoteAllocaImpl::splitAlloca(AllocaInst &I, AllocaInst *&Hot,
+                                          AllocaInst *&Cold) {
+  ArrayType *ArrayTy = dyn_cast<ArrayType>(I.getAllocatedType());
+  if (DisablePromoteAllocaToVector || !I.isStaticAlloca() ||
+      I.isArrayAllocation() || !ArrayTy ||
+      !VectorType::isValidElementType(ArrayTy->getElementType()))
+    return false;
+
+  // The part promoted to a vector must have between 2 and 16 elements, as
+  // required by tryPromoteAllocaToVector.
+  const uint64_t NumElts = ArrayTy->getNumElements();
+  const uint64_t MinVectorElts = 2;
+  const uint64_t MaxVectorElts = 16;
+  if (NumElts <= MinVectorElts)
+    return false;
+
+  // Every use must be an element address that is only loaded from or stored
+  // to as a whole element, so that it can be rebased onto one of the parts
+  // and the hot part is certain to become a vector. Each access covers the
+  // range of elements its index may take.
+  Type *EltTy = ArrayTy->getElementType();
+  struct ElementAccess {
+    GetElementPtrInst *GEP;
+    uint64_t First;
+    uint64_t Last;
+    uint64_t Weight;
+  };
+  SmallVector<ElementAccess, 16> Accesses;
+  for (User *U : I.users()) {
+    GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(U);
+    if (!GEP || !GEP->isInBounds() || !GEPToVectorIndex(GEP))
+      return false;
+
+    uint64_t Weight = 0;
+    for (User *GEPUser : GEP->users()) {
+      LoadInst *Load = dyn_cast<LoadInst>(GEPUser);
+      StoreInst *Store = dyn_cast<StoreInst>(GEPUser);
+      if (!(Load && Load->isSimple() && Load->getType() == EltTy) &&
+          !(Store && Store->isSimple() && Store->getPointerOperand() == GEP &&
+            Store->getValueOperand()->getType() == EltTy))
+        return false;
+      Weight += getBlockWeight(cast<Instruction>(GEPUser)->getParent());
+    }
+
+    // The access is inbounds, so the index is below NumElts whatever its
+    // known bits say.
+    KnownBits Known = computeKnownBits(GEP->getOperand(2), *DL);
+    uint64_t First =
+        std::min(Known.getMinValue().getLimitedValue(), NumElts - 1);
+    uint64_t Last =
+        std::min(Known.getMaxValue().getLimitedValue(), NumElts - 1);
+    Accesses.push_back({GEP, First, Last, Weight});
+  }
+
+  // Find the split point that leaves the most weighted accesses in a part
+  // that can be promoted to a vector.
+  uint64_t BestWeight = 0;
+  uint64_t BestSplit = 0;
+  bool BestHotIsLow = false;
+  for (uint64_t Split = 1; Split < NumElts; ++Split) {
+    const uint64_t LowElts = Split;
+    const uint64_t HighElts = NumElts - Split;
+    const bool LowFits = LowElts >= MinVectorElts && LowElts <= MaxVectorElts;
+    const bool HighFits =
+        HighElts >= MinVectorElts && HighElts <= MaxVectorElts;
+    if (!LowFits && !HighFits)
+      continue;
+
+    uint64_t LowWeight = 0;
+    uint64_t HighWeight = 0;
+    bool Crossed = false;
+    for (const ElementAccess &A : Accesses) {
+      if (A.First < Split && A.Last >= Split) {
+        Crossed = true;
+        break;
+      }
+      (A.Last < Split ? LowWeight : HighWeight) += A.Weight;
+    }
+    if (Crossed)
+      continue;
+
+    if (LowFits && LowWeight > BestWeight) {
+      BestWeight = LowWeight;
+      BestSplit = Split;
+      BestHotIsLow = true;
+    }
+    if (HighFits && HighWeight > BestWeight) {
+      BestWeight = HighWeight;
+      BestSplit = Split;
+      BestHotIsLow = false;
+    }
+  }
+
+  if (BestWeight == 0)
+    return false;
+
+  // A split on its own only makes the code worse, so make sure that the hot
+  // part will actually be promoted before rewriting anything.
+  const uint64_t HotElts = BestHotIsLow ? BestSplit : NumElts - BestSplit;
+  const uint64_t HotBits =
+      DL->getTypeSizeInBits(ArrayType::get(EltTy, HotElts));
+  if (!fitsVectorBudget(HotBits, MaxVGPRs, /*UseAllVGPRs=*/true) ||
+      !isPromotionProfitable(*I.getFunction(), BestWeight,
+                             divideCeil(HotBits, 32), CurrentLocalMemUsage)) {
+    LLVM_DEBUG(dbgs() << "  Promoting a part of the alloca not profitable\n");
+    return false;
+  }
+
+  LLVM_DEBUG(dbgs() << "  Splitting alloca at element " << BestSplit << '\n');
+
+  ORE->emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "SplitAlloca", &I)
+           << "split alloca of " << ore::NV("NumElements", NumElts)
+           << " elements at element " << ore::NV("SplitElement", BestSplit);
+  });
+
+  ArrayType *LowTy = ArrayType::get(EltTy, BestSplit);
+  ArrayType *HighTy = ArrayType::get(EltTy, NumElts - BestSplit);
+  const unsigned AddrSpace = I.getType()->getAddressSpace();
+
+  IRBuilder<> Builder(&I);
+  AllocaInst *Low =
+      Builder.CreateAlloca(LowTy, AddrSpace, nullptr, I.getName() + ".lo");
+  Low->setAlignment(I.getAlign());
+  AllocaInst *High =
+      Builder.CreateAlloca(HighTy, AddrSpace, nullptr, I.getName() + ".hi");
+  High->setAlignment(commonAlignment(
+      I.getAlign(), BestSplit * DL->getTypeAllocSize(EltTy)));
+
+  for (const ElementAccess &A : Accesses) {
+    GetElementPtrInst *GEP = A.GEP;
+    Builder.SetInsertPoint(GEP);
+    Value *Index = GEP->getOperand(2);
+    Value *NewGEP;
+    if (A.Last < BestSplit) {
+      NewGEP =
+          Builder.CreateInBoundsGEP(LowTy, Low, {GEP->getOperand(1), Index});
+    } else {
+      Index = Builder.CreateSub(Index,
+                                ConstantInt::get(Index->getType(), BestSplit));
+      NewGEP =
+          Builder.CreateInBoundsGEP(HighTy, High, {GEP->getOperand(1), Index});
+    }
+    NewGEP->takeName(GEP);
+    GEP->replaceAllUsesWith(NewGEP);
+    GEP->eraseFromParent();
+  }
+  I.eraseFromParent();
+
+  Hot = BestHotIsLow ? Low : High;
+  Cold = BestHotIsLow ? High : Low;
+  return true;
+}
+
+bool AMDGPUPromoteAllocaImpl::promoteOrSplitAlloca(AllocaInst &I,
+                                                   bool SufficientLDS) {
+  auto EmitScratchRemark = [&](AllocaInst &AI) {
+    const uint64_t Size =
+        DL->getTypeAllocSize(AI.getAllocatedType()).getFixedSize();
+    ORE->emit([&]() {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "AllocaInScratch", &AI)
+             << "alloca of " << ore::NV("Size", Size)
+             << " bytes left in scratch memory";
+    });
+  };
+
+  if (handleAlloca(I, SufficientLDS))
+    return true;
+
+  AllocaInst *Hot, *Cold;
+  if (!UseCostModel || !splitAlloca(I, Hot, Cold)) {
+    EmitScratchRemark(I);
+    return false;
+  }
+
+  // Promote the hot part first, so that it gets the registers and LDS.
+  for (AllocaInst *Part : {Hot, Cold}) {
+    if (!handleAlloca(*Part, SufficientLDS))
+      EmitScratchRemark(*Part);
+  }
+  return true;
+}
+
 // FIXME: Should try to pick the most likely to be profitable allocas first.
 bool AMDGPUPromoteAllocaImpl::handleAlloca(AllocaInst &I, bool SufficientLDS) {
   // Array allocations are probably not worth handling, since an allocation of
@@ -847,13 +1171,35 @@ bool AMDGPUPromoteAllocaImpl::handleAlloca(AllocaInst &I, bool SufficientLDS) {
 
   LLVM_DEBUG(dbgs() << "Trying to promote " << I << '\n');
 
-  if (tryPromoteAllocaToVector(&I, DL, MaxVGPRs))
-    return true; // Promoted to vector.
+  const Function &ContainingFunction = *I.getParent()->getParent();
+  const uint64_t AccessWeight = UseCostModel ? getAccessWeight(&I) : 0;
+
+  bool PromotedToVector;
+  if (UseCostModel) {
+    const unsigned VGPRs = divideCeil(DL.getTypeSizeInBits(AllocaTy), 32);
+    PromotedToVector =
+        isPromotionProfitable(ContainingFunction, AccessWeight, VGPRs,
+                              CurrentLocalMemUsage) &&
+        tryPromoteAllocaToVector(&I, DL, MaxVGPRs, /*UseAllVGPRs=*/true);
+    if (PromotedToVector)
+      PromotedVGPRs += VGPRs;
+  } else {
+    PromotedToVector = tryPromoteAllocaToVector(&I, DL, MaxVGPRs);
+  }
+
+  if (PromotedToVector) {
+    ORE->emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "PromotedToVector", &I)
+             << "promoted alloca of "
+             << ore::NV("Size", DL.getTypeAllocSize(AllocaTy).getFixedSize())
+             << " bytes to a vector";
+    });
+    return true;
+  }
 
   if (DisablePromoteAllocaToLDS)
     return false;
 
-  const Function &ContainingFunction = *I.getParent()->getParent();
   CallingConv::ID CC = ContainingFunction.getCallingConv();
 
   // Don't promote the alloca to LDS for shader calling conventions as the work
@@ -896,6 +1242,12 @@ bool AMDGPUPromoteAllocaImpl::handleAlloca(AllocaInst &I, bool SufficientLDS) {
     return false;
   }
 
+  if (UseCostModel &&
+      !isPromotionProfitable(ContainingFunction, AccessWeight, 0, NewSize)) {
+    LLVM_DEBUG(dbgs() << "  Promotion to local memory not profitable\n");
+    return false;
+  }
+
   CurrentLocalMemUsage = NewSize;
 
   std::vector<Value*> WorkList;
@@ -907,6 +1259,14 @@ bool AMDGPUPromoteAllocaImpl::handleAlloca(AllocaInst &I, bool SufficientLDS) {
 
   LLVM_DEBUG(dbgs() << "Promoting alloca to local memory\n");
 
+  ORE->emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "PromotedToLDS", &I)
+           << "promoted alloca of "
+           << ore::NV("Size", DL.getTypeAllocSize(AllocaTy).getFixedSize())
+           << " bytes to " << ore::NV("LDSSize", AllocSize)
+           << " bytes of local memory";
+  });
+
   Function *F = I.getParent()->getParent();
 
   Type *GVTy = ArrayType::get(I.getAllocatedType(), WorkGroupSize);
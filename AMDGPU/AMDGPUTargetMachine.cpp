@@ -630,6 +630,7 @@ const R600Subtarget *R600TargetMachine::getSubtargetImpl(
   SmallString<128> SubtargetKey(GPU);
   SubtargetKey.append(FS);
 
+  std::lock_guard<std::mutex> Lock(SubtargetMapMutex);
   auto &I = SubtargetMap[SubtargetKey];
   if (!I) {
     // This needs to be done before we create a new subtarget since any
@@ -699,6 +700,7 @@ const GCNSubtarget *GCNTargetMachine::getSubtargetImpl(const Function &F) const
   SmallString<128> SubtargetKey(GPU);
   SubtargetKey.append(FS);
 
+  std::lock_guard<std::mutex> Lock(SubtargetMapMutex);
   auto &I = SubtargetMap[SubtargetKey];
   if (!I) {
     // This needs to be done before we create a new subtarget since any
@@ -17,6 +17,7 @@
 #include "GCNSubtarget.h"
 #include "R600Subtarget.h"
 #include "llvm/Target/TargetMachine.h"
+#include <mutex>
 
 namespace llvm {
 
@@ -70,6 +71,7 @@ public:
 class R600TargetMachine final : public AMDGPUTargetMachine {
 private:
   mutable StringMap<std::unique_ptr<R600Subtarget>> SubtargetMap;
+  mutable std::mutex SubtargetMapMutex;
 
 public:
   R600TargetMachine(const Target &T, const Triple &TT, StringRef CPU,
@@ -95,6 +97,7 @@ public:
 class GCNTargetMachine final : public AMDGPUTargetMachine {
 private:
   mutable StringMap<std::unique_ptr<GCNSubtarget>> SubtargetMap;
+  mutable std::mutex SubtargetMapMutex;
 
 public:
   GCNTargetMachine(const Target &T, const Triple &TT, StringRef CPU,
@@ -14,11 +14,25 @@
 #include "GCNIterativeScheduler.h"
 #include "GCNSchedStrategy.h"
 #include "SIMachineFunctionInfo.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/ThreadPool.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "machine-scheduler"
 
+static cl::opt<unsigned> IterativeSchedBudget(
+    "amdgpu-iterative-sched-budget", cl::Hidden,
+    cl::desc("Maximum number of instructions the iterative scheduler "
+             "schedules tentatively per function, 0 for no limit"),
+    cl::init(0));
+
+static cl::opt<unsigned> IterativeSchedThreads(
+    "amdgpu-iterative-sched-threads", cl::Hidden,
+    cl::desc("Number of threads used to compute the candidate schedules of "
+             "independent regions"),
+    cl::init(1));
+
 namespace llvm {
 
 std::vector<const SUnit *> makeMinRegSchedule(ArrayRef<const SUnit *> TopRoots,
@@ -307,6 +321,8 @@ void GCNIterativeScheduler::schedule() { // overriden
 void GCNIterativeScheduler::finalizeSchedule() { // overriden
   if (Regions.empty())
     return;
+  BudgetLeft = IterativeSchedBudget ? IterativeSchedBudget.getValue()
+                                    : std::numeric_limits<unsigned>::max();
   switch (Strategy) {
   case SCHEDULE_MINREGONLY: scheduleMinReg(); break;
   case SCHEDULE_MINREGFORCED: scheduleMinReg(true); break;
@@ -337,11 +353,84 @@ GCNIterativeScheduler::detachSchedule(ScheduleRef Schedule) const {
   return Res;
 }
 
-void GCNIterativeScheduler::setBestSchedule(Region &R,
-                                            ScheduleRef Schedule,
-                                            const GCNRegPressure &MaxRP) {
-  R.BestSchedule.reset(
-    new TentativeSchedule{ detachSchedule(Schedule), MaxRP });
+// Charge the instructions of R to the compile-time budget. Returns false if
+// the budget is exhausted.
+bool GCNIterativeScheduler::takeBudget(const Region &R) {
+  if (R.NumRegionInstrs > BudgetLeft) {
+    BudgetLeft = 0;
+    return false;
+  }
+  BudgetLeft -= R.NumRegionInstrs;
+  return true;
+}
+
+// Compute the candidate schedules of Kinds that R doesn't have yet from DAG,
+// which has been built for R by this scheduler. Only the DAG and LIS are
+// read, so this can run concurrently for different regions.
+void GCNIterativeScheduler::computeCandidates(Region &R, const BuildDAG &DAG,
+                                              unsigned Kinds) {
+  if ((Kinds & CANDIDATE_MINREG) && !R.MinRegSchedule) {
+    const auto Schedule = makeMinRegSchedule(DAG.getTopRoots(), *this);
+    const auto MaxRP = getSchedulePressure(R, Schedule);
+    R.MinRegSchedule.reset(
+      new TentativeSchedule{ detachSchedule(Schedule), MaxRP });
+  }
+  if ((Kinds & CANDIDATE_ILP) && !R.ILPSchedule) {
+    const auto Schedule = makeGCNILPScheduler(DAG.getBottomRoots(), *this);
+    const auto MaxRP = getSchedulePressure(R, Schedule);
+    R.ILPSchedule.reset(
+      new TentativeSchedule{ detachSchedule(Schedule), MaxRP });
+  }
+}
+
+// Compute the candidate schedules of Kinds for Rgns, building the DAG of each
+// region once for all of them. Regions that don't fit into the compile-time
+// budget get no candidates. With more than one thread, the candidates of
+// independent regions are computed concurrently: the DAGs are built on this
+// thread, as alias analysis isn't thread-safe, into one helper scheduler per
+// thread. Candidates are only committed later by the caller, in region order,
+// so the result doesn't depend on the number of threads.
+void GCNIterativeScheduler::computeCandidateSchedules(ArrayRef<Region *> Rgns,
+                                                      unsigned Kinds) {
+  SmallVector<Region *, 16> Todo;
+  for (auto R : Rgns) {
+    if (((Kinds & CANDIDATE_MINREG) && !R->MinRegSchedule) ||
+        ((Kinds & CANDIDATE_ILP) && !R->ILPSchedule)) {
+      if (!takeBudget(*R))
+        break;
+      Todo.push_back(R);
+    }
+  }
+
+  const unsigned NumThreads =
+      std::min<unsigned>(IterativeSchedThreads, Todo.size());
+  if (NumThreads <= 1) {
+    for (auto R : Todo) {
+      BuildDAG DAG(*R, *this);
+      computeCandidates(*R, DAG, Kinds);
+    }
+    return;
+  }
+
+  std::vector<std::unique_ptr<GCNIterativeScheduler>> Workers;
+  for (unsigned I = 0; I < NumThreads; ++I)
+    Workers.push_back(
+        std::make_unique<GCNIterativeScheduler>(Context, Strategy));
+
+  ThreadPool Pool(hardware_concurrency(NumThreads));
+  for (size_t Begin = 0, E = Todo.size(); Begin < E; Begin += NumThreads) {
+    const size_t End = std::min<size_t>(E, Begin + NumThreads);
+    SmallVector<std::unique_ptr<BuildDAG>, 8> DAGs;
+    for (size_t I = Begin; I != End; ++I)
+      DAGs.push_back(std::make_unique<BuildDAG>(*Todo[I],
+                                                *Workers[I - Begin]));
+    for (size_t I = Begin; I != End; ++I)
+      Pool.async([&, I] {
+        Workers[I - Begin]->computeCandidates(*Todo[I], *DAGs[I - Begin],
+                                              Kinds);
+      });
+    Pool.wait();
+  }
 }
 
 void GCNIterativeScheduler::scheduleBest(Region &R) {
@@ -350,6 +439,17 @@ void GCNIterativeScheduler::scheduleBest(Region &R) {
   R.BestSchedule.reset();
 }
 
+// Commit a detached schedule to R outside of any DAG scope.
+void GCNIterativeScheduler::scheduleTentative(
+    Region &R, const TentativeSchedule &Schedule) {
+  auto BB = R.Begin->getParent();
+  BaseClass::startBlock(BB);
+  BaseClass::enterRegion(BB, R.Begin, R.End, R.NumRegionInstrs);
+  scheduleRegion(R, Schedule.Schedule, Schedule.MaxPressure);
+  BaseClass::exitRegion();
+  BaseClass::finishBlock();
+}
+
 // minimal required region scheduler, works for ranges of SUnits*,
 // SUnits or MachineIntrs*
 template <typename Range>
@@ -438,6 +538,15 @@ unsigned GCNIterativeScheduler::tryMaximizeOccupancy(unsigned TargetOcc) {
   LLVM_DEBUG(dbgs() << "Trying to improve occupancy, target = " << TargetOcc
                     << ", current = " << Occ << '\n');
 
+  // Only the regions that don't reach the target yet are visited below, so
+  // their minreg schedules can be computed concurrently up front.
+  if (IterativeSchedThreads > 1)
+    computeCandidateSchedules(
+        makeArrayRef(Regions).take_while([&](const Region *R) {
+          return R->MaxPressure.getOccupancy(ST) < TargetOcc;
+        }),
+        CANDIDATE_MINREG);
+
   auto NewOcc = TargetOcc;
   for (auto R : Regions) {
     if (R->MaxPressure.getOccupancy(ST) >= NewOcc)
@@ -446,9 +555,13 @@ unsigned GCNIterativeScheduler::tryMaximizeOccupancy(unsigned TargetOcc) {
     LLVM_DEBUG(printRegion(dbgs(), R->Begin, R->End, LIS, 3);
                printLivenessInfo(dbgs(), R->Begin, R->End, LIS));
 
-    BuildDAG DAG(*R, *this);
-    const auto MinSchedule = makeMinRegSchedule(DAG.getTopRoots(), *this);
-    const auto MaxRP = getSchedulePressure(*R, MinSchedule);
+    computeCandidateSchedules(R, CANDIDATE_MINREG);
+    if (!R->MinRegSchedule) {
+      LLVM_DEBUG(dbgs() << "Compile-time budget exhausted\n");
+      NewOcc = Occ;
+      break;
+    }
+    const auto MaxRP = R->MinRegSchedule->MaxPressure;
     LLVM_DEBUG(dbgs() << "Occupancy improvement attempt:\n";
                printSchedRP(dbgs(), R->MaxPressure, MaxRP));
 
@@ -456,7 +569,7 @@ unsigned GCNIterativeScheduler::tryMaximizeOccupancy(unsigned TargetOcc) {
     if (NewOcc <= Occ)
       break;
 
-    setBestSchedule(*R, MinSchedule, MaxRP);
+    R->BestSchedule = std::move(R->MinRegSchedule);
   }
   LLVM_DEBUG(dbgs() << "New occupancy = " << NewOcc
                     << ", prev occupancy = " << Occ << '\n');
@@ -490,12 +603,20 @@ void GCNIterativeScheduler::scheduleLegacyMaxOccupancy(
                     << TgtOcc << '\n');
   GCNMaxOccupancySchedStrategy LStrgy(Context);
   unsigned FinalOccupancy = std::min(Occ, MFI->getOccupancy());
+  // Regions whose legacy schedule was thrown away by the first pass.
+  SmallPtrSet<const Region *, 16> Restored;
 
   for (int I = 0; I < NumPasses; ++I) {
     // running first pass with TargetOccupancy = 0 mimics previous scheduling
     // approach and is a performance magic
     LStrgy.setTargetOccupancy(I == 0 ? 0 : TgtOcc);
     for (auto R : Regions) {
+      // With a compile-time budget, the second pass skips the regions the
+      // first pass had to restore, and stops when the budget runs out.
+      if (I > 0 && IterativeSchedBudget &&
+          (Restored.count(R) || !takeBudget(*R)))
+        continue;
+
       OverrideLegacyStrategy Ovr(*R, LStrgy, *this);
 
       Ovr.schedule();
@@ -512,6 +633,8 @@ void GCNIterativeScheduler::scheduleLegacyMaxOccupancy(
           LLVM_DEBUG(dbgs() << ", restoring\n");
           Ovr.restoreOrder();
           assert(R->MaxPressure.getOccupancy(ST) >= TgtOcc);
+          if (I == 0)
+            Restored.insert(R);
         }
       }
       FinalOccupancy = std::min(FinalOccupancy, RP.getOccupancy(ST));
@@ -529,15 +652,27 @@ void GCNIterativeScheduler::scheduleMinReg(bool force) {
   const auto TgtOcc = MFI->getOccupancy();
   sortRegionsByPressure(TgtOcc);
 
+  // Which regions are visited below depends on the pressure of the previous
+  // ones, so computing the candidates up front is speculative unless forced.
+  // Speculation must not use up the budget, which is then charged region by
+  // region in the loop.
+  if (IterativeSchedThreads > 1 && (force || !IterativeSchedBudget))
+    computeCandidateSchedules(Regions, CANDIDATE_MINREG);
+
   auto MaxPressure = Regions.front()->MaxPressure;
   for (auto R : Regions) {
     if (!force && R->MaxPressure.less(ST, MaxPressure, TgtOcc))
       break;
 
-    BuildDAG DAG(*R, *this);
-    const auto MinSchedule = makeMinRegSchedule(DAG.getTopRoots(), *this);
+    computeCandidateSchedules(R, CANDIDATE_MINREG);
+    if (!R->MinRegSchedule) {
+      LLVM_DEBUG(dbgs() << "Compile-time budget exhausted\n");
+      break;
+    }
+    const std::unique_ptr<TentativeSchedule> MinSchedule =
+        std::move(R->MinRegSchedule);
 
-    const auto RP = getSchedulePressure(*R, MinSchedule);
+    const auto RP = MinSchedule->MaxPressure;
     LLVM_DEBUG(if (R->MaxPressure.less(ST, RP, TgtOcc)) {
       dbgs() << "\nWarning: Pressure becomes worse after minreg!";
       printSchedRP(dbgs(), R->MaxPressure, RP);
@@ -546,7 +681,7 @@ void GCNIterativeScheduler::scheduleMinReg(bool force) {
     if (!force && MaxPressure.less(ST, RP, TgtOcc))
       break;
 
-    scheduleRegion(*R, MinSchedule, RP);
+    scheduleTentative(*R, *MinSchedule);
     LLVM_DEBUG(printSchedResult(dbgs(), R, RP));
 
     MaxPressure = RP;
@@ -565,6 +700,16 @@ void GCNIterativeScheduler::scheduleILP(
   sortRegionsByPressure(TgtOcc);
   auto Occ = Regions.front()->MaxPressure.getOccupancy(ST);
 
+  // Every region gets an ILP schedule. Regions that may be visited when
+  // maximizing occupancy also get their minreg schedule from the same DAG.
+  if (TryMaximizeOccupancy && Occ < TgtOcc)
+    computeCandidateSchedules(
+        makeArrayRef(Regions).take_while([&](const Region *R) {
+          return R->MaxPressure.getOccupancy(ST) < TgtOcc;
+        }),
+        CANDIDATE_MINREG | CANDIDATE_ILP);
+  computeCandidateSchedules(Regions, CANDIDATE_ILP);
+
   if (TryMaximizeOccupancy && Occ < TgtOcc)
     Occ = tryMaximizeOccupancy(TgtOcc);
 
@@ -575,10 +720,17 @@ void GCNIterativeScheduler::scheduleILP(
 
   unsigned FinalOccupancy = std::min(Occ, MFI->getOccupancy());
   for (auto R : Regions) {
-    BuildDAG DAG(*R, *this);
-    const auto ILPSchedule = makeGCNILPScheduler(DAG.getBottomRoots(), *this);
+    R->MinRegSchedule.reset();
+    if (!R->ILPSchedule) {
+      // Out of budget, keep the current order.
+      FinalOccupancy =
+          std::min(FinalOccupancy, R->MaxPressure.getOccupancy(ST));
+      continue;
+    }
+    const std::unique_ptr<TentativeSchedule> ILPSchedule =
+        std::move(R->ILPSchedule);
 
-    const auto RP = getSchedulePressure(*R, ILPSchedule);
+    const auto RP = ILPSchedule->MaxPressure;
     LLVM_DEBUG(printSchedRP(dbgs(), R->MaxPressure, RP));
 
     if (RP.getOccupancy(ST) < TgtOcc) {
@@ -586,10 +738,11 @@ void GCNIterativeScheduler::scheduleILP(
       if (R->BestSchedule.get() &&
         R->BestSchedule->MaxPressure.getOccupancy(ST) >= TgtOcc) {
         LLVM_DEBUG(dbgs() << ", scheduling minimal register\n");
-        scheduleBest(*R);
+        scheduleTentative(*R, *R->BestSchedule);
+        R->BestSchedule.reset();
       }
     } else {
-      scheduleRegion(*R, ILPSchedule, RP);
+      scheduleTentative(*R, *ILPSchedule);
       LLVM_DEBUG(printSchedResult(dbgs(), R, RP));
       FinalOccupancy = std::min(FinalOccupancy, RP.getOccupancy(ST));
     }
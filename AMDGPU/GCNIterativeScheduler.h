@@ -68,6 +68,16 @@ protected:
 
     // best schedule for the region so far (not scheduled yet)
     std::unique_ptr<TentativeSchedule> BestSchedule;
+
+    // Candidate schedules computed from a single build of the region's DAG,
+    // kept until a strategy commits or discards them.
+    std::unique_ptr<TentativeSchedule> MinRegSchedule;
+    std::unique_ptr<TentativeSchedule> ILPSchedule;
+  };
+
+  enum CandidateKind {
+    CANDIDATE_MINREG = 1 << 0,
+    CANDIDATE_ILP = 1 << 1
   };
 
   SpecificBumpPtrAllocator<Region> Alloc;
@@ -77,6 +87,10 @@ protected:
   const StrategyKind Strategy;
   mutable GCNUpwardRPTracker UPTracker;
 
+  // Number of instructions that may still be scheduled tentatively, see
+  // -amdgpu-iterative-sched-budget.
+  unsigned BudgetLeft = std::numeric_limits<unsigned>::max();
+
   class BuildDAG;
   class OverrideLegacyStrategy;
 
@@ -91,11 +105,13 @@ protected:
     return getRegionPressure(R.Begin, R.End);
   }
 
-  void setBestSchedule(Region &R,
-                       ScheduleRef Schedule,
-                       const GCNRegPressure &MaxRP = GCNRegPressure());
+  bool takeBudget(const Region &R);
+
+  void computeCandidates(Region &R, const BuildDAG &DAG, unsigned Kinds);
+  void computeCandidateSchedules(ArrayRef<Region *> Rgns, unsigned Kinds);
 
   void scheduleBest(Region &R);
+  void scheduleTentative(Region &R, const TentativeSchedule &Schedule);
 
   std::vector<MachineInstr*> detachSchedule(ScheduleRef Schedule) const;
 
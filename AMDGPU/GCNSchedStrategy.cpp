@@ -13,11 +13,20 @@
 
 #include "GCNSchedStrategy.h"
 #include "SIMachineFunctionInfo.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
 
 #define DEBUG_TYPE "machine-scheduler"
 
 using namespace llvm;
 
+static cl::opt<bool> EnableOccupancyAutotune(
+    "amdgpu-sched-autotune-occupancy", cl::Hidden, cl::init(false),
+    cl::desc("Schedule kernels for several occupancy targets and keep the one "
+             "with the lowest estimated cycle count"));
+
 GCNMaxOccupancySchedStrategy::GCNMaxOccupancySchedStrategy(
     const MachineSchedContext *C) :
     GenericScheduler(C), TargetOccupancy(0), MF(nullptr) { }
@@ -302,6 +311,16 @@ void GCNScheduleDAGMILive::schedule() {
     return;
   }
 
+  if (Stage == OccupancyAutotune) {
+    // Candidate schedules are kept as they are, autotuneOccupancy() compares
+    // them for the whole function.
+    ScheduleDAGMILive::schedule();
+    Regions[RegionIdx] = std::make_pair(RegionBegin, RegionEnd);
+    Pressure[RegionIdx] = getRealRegPressure();
+    CycleEstimates[RegionIdx] = estimateRegionCycles();
+    return;
+  }
+
   std::vector<MachineInstr*> Unsched;
   Unsched.reserve(NumRegionInstrs);
   for (auto &I : *this) {
@@ -525,8 +544,6 @@ void GCNScheduleDAGMILive::finalizeSchedule() {
 
   do {
     Stage++;
-    RegionIdx = 0;
-    MachineBasicBlock *MBB = nullptr;
 
     if (Stage > InitialSchedule) {
       if (!LIS)
@@ -560,48 +577,182 @@ void GCNScheduleDAGMILive::finalizeSchedule() {
     if (Stage == UnclusteredReschedule)
       SavedMutations.swap(Mutations);
 
-    for (auto Region : Regions) {
-      if (Stage == UnclusteredReschedule && !RescheduleRegions[RegionIdx]) {
-        ++RegionIdx;
-        continue;
-      }
+    scheduleRegionsForStage();
 
-      RegionBegin = Region.first;
-      RegionEnd = Region.second;
+    if (Stage == UnclusteredReschedule)
+      SavedMutations.swap(Mutations);
+  } while (Stage != LastStage);
 
-      if (RegionBegin->getParent() != MBB) {
-        if (MBB) finishBlock();
-        MBB = RegionBegin->getParent();
-        startBlock(MBB);
-        if (Stage == InitialSchedule)
-          computeBlockPressure(MBB);
-      }
+  if (EnableOccupancyAutotune && LIS && MFI.isEntryFunction() &&
+      !Regions.empty())
+    autotuneOccupancy();
+}
 
-      unsigned NumRegionInstrs = std::distance(begin(), end());
-      enterRegion(MBB, begin(), end(), NumRegionInstrs);
+void GCNScheduleDAGMILive::scheduleRegionsForStage() {
+  RegionIdx = 0;
+  MachineBasicBlock *MBB = nullptr;
 
-      // Skip empty scheduling regions (0 or 1 schedulable instructions).
-      if (begin() == end() || begin() == std::prev(end())) {
-        exitRegion();
-        continue;
-      }
+  for (auto Region : Regions) {
+    if (Stage == UnclusteredReschedule && !RescheduleRegions[RegionIdx]) {
+      ++RegionIdx;
+      continue;
+    }
 
-      LLVM_DEBUG(dbgs() << "********** MI Scheduling **********\n");
-      LLVM_DEBUG(dbgs() << MF.getName() << ":" << printMBBReference(*MBB) << " "
-                        << MBB->getName() << "\n  From: " << *begin()
-                        << "    To: ";
-                 if (RegionEnd != MBB->end()) dbgs() << *RegionEnd;
-                 else dbgs() << "End";
-                 dbgs() << " RegionInstrs: " << NumRegionInstrs << '\n');
+    RegionBegin = Region.first;
+    RegionEnd = Region.second;
 
-      schedule();
+    if (RegionBegin->getParent() != MBB) {
+      if (MBB) finishBlock();
+      MBB = RegionBegin->getParent();
+      startBlock(MBB);
+      if (Stage == InitialSchedule)
+        computeBlockPressure(MBB);
+    }
+
+    unsigned NumRegionInstrs = std::distance(begin(), end());
+    enterRegion(MBB, begin(), end(), NumRegionInstrs);
 
+    // Skip empty scheduling regions (0 or 1 schedulable instructions).
+    if (begin() == end() || begin() == std::prev(end())) {
       exitRegion();
-      ++RegionIdx;
+      continue;
     }
-    finishBlock();
 
-    if (Stage == UnclusteredReschedule)
-      SavedMutations.swap(Mutations);
-  } while (Stage != LastStage);
+    LLVM_DEBUG(dbgs() << "********** MI Scheduling **********\n");
+    LLVM_DEBUG(dbgs() << MF.getName() << ":" << printMBBReference(*MBB) << " "
+                      << MBB->getName() << "\n  From: " << *begin()
+                      << "    To: ";
+               if (RegionEnd != MBB->end()) dbgs() << *RegionEnd;
+               else dbgs() << "End";
+               dbgs() << " RegionInstrs: " << NumRegionInstrs << '\n');
+
+    schedule();
+
+    exitRegion();
+    ++RegionIdx;
+  }
+  finishBlock();
+}
+
+GCNScheduleDAGMILive::RegionCycleEstimate
+GCNScheduleDAGMILive::estimateRegionCycles() const {
+  // Issue the region in order, one instruction per cycle, where each
+  // instruction waits for its predecessors with the latencies of the
+  // scheduling model. This is the time one wave needs on its own; stalls are
+  // what other waves on the SIMD can hide.
+  RegionCycleEstimate Est;
+  std::vector<unsigned> IssueCycle(SUnits.size());
+  unsigned Cycle = 0;
+  for (MachineInstr &MI : *this) {
+    SUnit *SU = getSUnit(&MI);
+    if (!SU)
+      continue;
+    unsigned Start = Est.NumInstrs ? Cycle + 1 : 0;
+    for (const SDep &Pred : SU->Preds) {
+      const SUnit *PredSU = Pred.getSUnit();
+      if (!PredSU->isBoundaryNode())
+        Start =
+            std::max(Start, IssueCycle[PredSU->NodeNum] + Pred.getLatency());
+    }
+    IssueCycle[SU->NodeNum] = Cycle = Start;
+    Est.Latency = std::max(Est.Latency, Start + SU->Latency);
+    ++Est.NumInstrs;
+  }
+
+  unsigned LoopDepth = MLI ? MLI->getLoopDepth(BB) : 0;
+  Est.Weight = 1u << (3 * std::min(LoopDepth, 3u));
+  return Est;
+}
+
+void GCNScheduleDAGMILive::autotuneOccupancy() {
+  GCNMaxOccupancySchedStrategy &S = (GCNMaxOccupancySchedStrategy&)*SchedImpl;
+  unsigned MaxVGPRs = ST.getMaxNumVGPRs(MF);
+  unsigned MaxSGPRs = ST.getMaxNumSGPRs(MF);
+
+  // Reschedule the function for the given target and return the occupancy
+  // it reaches. Spills is set if a region exceeds the register budget.
+  auto ScheduleFor = [&](unsigned Target, bool &Spills) {
+    S.setTargetOccupancy(Target);
+    CycleEstimates.assign(Regions.size(), RegionCycleEstimate());
+    scheduleRegionsForStage();
+
+    unsigned Occ = StartingOccupancy;
+    Spills = false;
+    for (const GCNRegPressure &RP : Pressure) {
+      Occ = std::min(Occ, RP.getOccupancy(ST));
+      Spills |= RP.getVGPRNum() > MaxVGPRs || RP.getSGPRNum() > MaxSGPRs;
+    }
+    return std::max(Occ, 1u);
+  };
+
+  struct Candidate {
+    unsigned Target;
+    unsigned Occupancy;
+    uint64_t Cycles;
+    bool Spills;
+  };
+  SmallVector<Candidate, 10> Candidates;
+
+  // Waves on a SIMD interleave, so a region takes about max(issue, latency /
+  // waves) cycles per wave. Try every target from the starting occupancy down
+  // to the point where the default heuristics would allow memory bound
+  // kernels to go.
+  Stage = OccupancyAutotune;
+  unsigned LowestTarget = std::min(MinOccupancy, 4u);
+  for (unsigned Target = StartingOccupancy; Target >= LowestTarget; --Target) {
+    Candidate C = {Target, 0, 0, false};
+    C.Occupancy = ScheduleFor(Target, C.Spills);
+    for (const RegionCycleEstimate &Est : CycleEstimates)
+      C.Cycles += uint64_t(Est.Weight) *
+                  std::max<uint64_t>(Est.NumInstrs,
+                                     divideCeil(Est.Latency, C.Occupancy));
+    LLVM_DEBUG(dbgs() << "Occupancy target " << Target << ": " << C.Occupancy
+                      << " waves, " << C.Cycles << " estimated cycles"
+                      << (C.Spills ? ", spills" : "") << ".\n");
+    Candidates.push_back(C);
+    if (Target == 1)
+      break;
+  }
+
+  // Prefer the fewest cycles without spilling; on ties the higher occupancy,
+  // which comes first. If every candidate spills, take the lowest target.
+  const Candidate *Best = nullptr;
+  for (const Candidate &C : Candidates)
+    if (!C.Spills && (!Best || C.Cycles < Best->Cycles))
+      Best = &C;
+  if (!Best)
+    Best = &Candidates.back();
+
+  unsigned Occ = Best->Occupancy;
+  if (Best != &Candidates.back()) {
+    bool Spills;
+    Occ = ScheduleFor(Best->Target, Spills);
+  }
+
+  MinOccupancy = Occ;
+  if (Occ > MFI.getOccupancy())
+    MFI.increaseOccupancy(MF, Occ);
+  else
+    MFI.limitOccupancy(Occ);
+  LLVM_DEBUG(dbgs() << "Selected occupancy target " << Best->Target
+                    << ", function occupancy is " << MFI.getOccupancy()
+                    << ".\n");
+
+  MachineOptimizationRemarkEmitter ORE(MF, nullptr);
+  ORE.emit([&]() {
+    MachineOptimizationRemarkAnalysis R(
+        DEBUG_TYPE, "OccupancyAutotune",
+        DiagnosticLocation(MF.getFunction().getSubprogram()), &MF.front());
+    R << "selected occupancy target " << ore::NV("Target", Best->Target)
+      << " (" << ore::NV("Occupancy", MFI.getOccupancy()) << " waves) from";
+    for (const Candidate &C : Candidates) {
+      R << " [target " << ore::NV("CandidateTarget", C.Target) << ": "
+        << ore::NV("CandidateOccupancy", C.Occupancy) << " waves, "
+        << ore::NV("EstimatedCycles", C.Cycles) << " cycles";
+      if (C.Spills)
+        R << ", spills";
+      R << "]";
+    }
+    return R;
+  });
 }
@@ -69,7 +69,19 @@ class GCNScheduleDAGMILive final : public ScheduleDAGMILive {
     InitialSchedule,
     UnclusteredReschedule,
     ClusteredLowOccupancyReschedule,
-    LastStage = ClusteredLowOccupancyReschedule
+    LastStage = ClusteredLowOccupancyReschedule,
+    // Not part of the regular stage sequence, see autotuneOccupancy().
+    OccupancyAutotune
+  };
+
+  // Estimate for one region, as scheduled during occupancy autotuning.
+  struct RegionCycleEstimate {
+    // Number of scheduled instructions, i.e. issue cycles of one wave.
+    unsigned NumInstrs = 0;
+    // Cycles until the last result of a single wave is available.
+    unsigned Latency = 0;
+    // Relative execution frequency derived from the loop depth.
+    unsigned Weight = 1;
   };
 
   const GCNSubtarget &ST;
@@ -114,6 +126,18 @@ class GCNScheduleDAGMILive final : public ScheduleDAGMILive {
   // Compute and cache live-ins and pressure for all regions in block.
   void computeBlockPressure(const MachineBasicBlock *MBB);
 
+  // Schedule all regions recorded for the function in the current stage.
+  void scheduleRegionsForStage();
+
+  // Per region cycle estimates of the last autotuning round.
+  SmallVector<RegionCycleEstimate, 32> CycleEstimates;
+
+  // Estimate the cycles of the region that was just scheduled.
+  RegionCycleEstimate estimateRegionCycles() const;
+
+  // Schedule the function for a range of occupancy targets and keep the one
+  // with the lowest estimated cycle count.
+  void autotuneOccupancy();
 
 public:
   GCNScheduleDAGMILive(MachineSchedContext *C,
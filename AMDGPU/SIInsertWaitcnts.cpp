@@ -29,6 +29,8 @@
 #include "SIMachineFunctionInfo.h"
 #include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
 #include "llvm/CodeGen/MachinePostDominators.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/Support/DebugCounter.h"
@@ -49,6 +51,13 @@ static cl::opt<bool> ForceEmitZeroFlag(
   cl::desc("Force all waitcnt instrs to be emitted as s_waitcnt vmcnt(0) expcnt(0) lgkmcnt(0)"),
   cl::init(false), cl::Hidden);
 
+static cl::opt<bool> CrossBlockWaitcnt(
+  "amdgpu-waitcnt-cross-block",
+  cl::desc("Flush vmcnt in the preheader of loops that use values loaded "
+           "outside of the loop, and do not wait for outstanding stores on "
+           "function entry"),
+  cl::init(false), cl::Hidden);
+
 namespace {
 
 template <typename EnumT>
@@ -265,6 +274,15 @@ public:
     return Events & (Events - 1);
   }
 
+  // Outstanding stores of the caller are not waited for on entry to a callee.
+  // They carry no register dependencies, so model them as the maximum number
+  // of pending VS_CNT events and let the uses that need them, such as the
+  // return, wait.
+  void setStateOnFunctionEntry() {
+    setScoreUB(VS_CNT, getScoreUB(VS_CNT) + getWaitCountMax(VS_CNT));
+    PendingEvents |= WaitEventMaskForInst[VS_CNT];
+  }
+
   bool hasPendingFlat() const {
     return ((LastFlat[LGKM_CNT] > ScoreLBs[LGKM_CNT] &&
              LastFlat[LGKM_CNT] <= ScoreUBs[LGKM_CNT]) ||
@@ -361,6 +379,14 @@ private:
   DenseSet<MachineInstr *> TrackedWaitcntSet;
   DenseMap<const Value *, MachineBasicBlock *> SLoadAddresses;
   MachinePostDominatorTree *PDT;
+  MachineLoopInfo *MLI;
+  MachineOptimizationRemarkEmitter *ORE;
+
+  // Whether vmcnt is flushed at the end of a loop preheader, decided the first
+  // time the block is visited.
+  DenseMap<MachineBasicBlock *, bool> PreheadersToFlush;
+  unsigned NumFlushedLoops = 0;
+  unsigned FlushedCyclesPerIteration = 0;
 
   struct BlockInfo {
     MachineBasicBlock *MBB;
@@ -395,6 +421,8 @@ public:
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.setPreservesCFG();
     AU.addRequired<MachinePostDominatorTree>();
+    AU.addRequired<MachineLoopInfo>();
+    AU.addRequired<MachineOptimizationRemarkEmitterPass>();
     MachineFunctionPass::getAnalysisUsage(AU);
   }
 
@@ -434,9 +462,21 @@ public:
 
   bool mayAccessVMEMThroughFlat(const MachineInstr &MI) const;
   bool mayAccessLDSThroughFlat(const MachineInstr &MI) const;
+  bool shouldFlushVmCnt(MachineLoop *ML, WaitcntBrackets &Brackets,
+                        unsigned &StallCycles);
+  bool isPreheaderToFlush(MachineBasicBlock &MBB,
+                          WaitcntBrackets &ScoreBrackets);
   bool generateWaitcntInstBefore(MachineInstr &MI,
                                  WaitcntBrackets &ScoreBrackets,
-                                 MachineInstr *OldWaitcntInstr);
+                                 MachineInstr *OldWaitcntInstr,
+                                 bool FlushVmCnt);
+  bool generateWaitcntBlockEnd(MachineBasicBlock &Block,
+                               WaitcntBrackets &ScoreBrackets,
+                               MachineInstr *OldWaitcntInstr);
+  bool generateWaitcnt(AMDGPU::Waitcnt Wait,
+                       MachineBasicBlock::instr_iterator It,
+                       MachineBasicBlock &Block, WaitcntBrackets &ScoreBrackets,
+                       MachineInstr *OldWaitcntInstr);
   void updateEventWaitcntAfter(MachineInstr &Inst,
                                WaitcntBrackets *ScoreBrackets);
   bool insertWaitcntInBlock(MachineFunction &MF, MachineBasicBlock &Block,
@@ -783,6 +823,8 @@ bool WaitcntBrackets::counterOutOfOrder(InstCounterType T) const {
 INITIALIZE_PASS_BEGIN(SIInsertWaitcnts, DEBUG_TYPE, "SI Insert Waitcnts", false,
                       false)
 INITIALIZE_PASS_DEPENDENCY(MachinePostDominatorTree)
+INITIALIZE_PASS_DEPENDENCY(MachineLoopInfo)
+INITIALIZE_PASS_DEPENDENCY(MachineOptimizationRemarkEmitterPass)
 INITIALIZE_PASS_END(SIInsertWaitcnts, DEBUG_TYPE, "SI Insert Waitcnts", false,
                     false)
 
@@ -827,9 +869,8 @@ static bool callWaitsOnFunctionReturn(const MachineInstr &MI) {
 ///  scores (*_score_LB and *_score_ub respectively).
 bool SIInsertWaitcnts::generateWaitcntInstBefore(
     MachineInstr &MI, WaitcntBrackets &ScoreBrackets,
-    MachineInstr *OldWaitcntInstr) {
+    MachineInstr *OldWaitcntInstr, bool FlushVmCnt) {
   setForceEmitWaitcnt();
-  bool IsForceEmitWaitcnt = isForceEmitWaitcnt();
 
   if (MI.isMetaInstruction())
     return false;
@@ -1049,12 +1090,39 @@ bool SIInsertWaitcnts::generateWaitcntInstBefore(
     }
   }
 
+  // Wait for all outstanding vector memory operations before entering a loop
+  // that would otherwise wait for them in every iteration.
+  if (FlushVmCnt)
+    Wait.VmCnt = 0;
+
+  return generateWaitcnt(Wait, MI.getIterator(), *MI.getParent(),
+                         ScoreBrackets, OldWaitcntInstr);
+}
+
+/// Flush vmcnt at the end of \p Block, which falls through into a loop.
+bool SIInsertWaitcnts::generateWaitcntBlockEnd(MachineBasicBlock &Block,
+                                               WaitcntBrackets &ScoreBrackets,
+                                               MachineInstr *OldWaitcntInstr) {
+  AMDGPU::Waitcnt Wait;
+  Wait.VmCnt = 0;
+  return generateWaitcnt(Wait, Block.instr_end(), Block, ScoreBrackets,
+                         OldWaitcntInstr);
+}
+
+/// Insert s_waitcnt instructions satisfying \p Wait before \p It, reusing the
+/// waits starting at \p OldWaitcntInstr that were inserted by an earlier
+/// iteration or were already present.
+bool SIInsertWaitcnts::generateWaitcnt(AMDGPU::Waitcnt Wait,
+                                       MachineBasicBlock::instr_iterator It,
+                                       MachineBasicBlock &Block,
+                                       WaitcntBrackets &ScoreBrackets,
+                                       MachineInstr *OldWaitcntInstr) {
   // Early-out if no wait is indicated.
-  if (!ScoreBrackets.simplifyWaitcnt(Wait) && !IsForceEmitWaitcnt) {
+  if (!ScoreBrackets.simplifyWaitcnt(Wait) && !isForceEmitWaitcnt()) {
     bool Modified = false;
     if (OldWaitcntInstr) {
       for (auto II = OldWaitcntInstr->getIterator(), NextI = std::next(II);
-           &*II != &MI; II = NextI, ++NextI) {
+           II != It; II = NextI, ++NextI) {
         if (II->isDebugInstr())
           continue;
 
@@ -1095,7 +1163,7 @@ bool SIInsertWaitcnts::generateWaitcntInstBefore(
 
   if (OldWaitcntInstr) {
     for (auto II = OldWaitcntInstr->getIterator(), NextI = std::next(II);
-         &*II != &MI; II = NextI, NextI++) {
+         II != It; II = NextI, NextI++) {
       if (II->isDebugInstr())
         continue;
 
@@ -1129,42 +1197,50 @@ bool SIInsertWaitcnts::generateWaitcntInstBefore(
         Wait.VsCnt = ~0u;
       }
 
-      LLVM_DEBUG(dbgs() << "generateWaitcntInstBefore\n"
-                        << "Old Instr: " << MI
-                        << "New Instr: " << *II << '\n');
+      LLVM_DEBUG({
+        dbgs() << "generateWaitcnt\n";
+        if (It != Block.instr_end())
+          dbgs() << "Old Instr: " << *It;
+        dbgs() << "New Instr: " << *II << '\n';
+      });
 
       if (!Wait.hasWait())
         return Modified;
     }
   }
 
+  DebugLoc DL = Block.findDebugLoc(It);
   if (Wait.VmCnt != ~0u || Wait.LgkmCnt != ~0u || Wait.ExpCnt != ~0u) {
     unsigned Enc = AMDGPU::encodeWaitcnt(IV, Wait);
-    auto SWaitInst = BuildMI(*MI.getParent(), MI.getIterator(),
-                             MI.getDebugLoc(), TII->get(AMDGPU::S_WAITCNT))
-                         .addImm(Enc);
+    auto SWaitInst =
+        BuildMI(Block, It, DL, TII->get(AMDGPU::S_WAITCNT)).addImm(Enc);
     TrackedWaitcntSet.insert(SWaitInst);
     Modified = true;
 
-    LLVM_DEBUG(dbgs() << "generateWaitcntInstBefore\n"
-                      << "Old Instr: " << MI
-                      << "New Instr: " << *SWaitInst << '\n');
+    LLVM_DEBUG({
+      dbgs() << "generateWaitcnt\n";
+      if (It != Block.instr_end())
+        dbgs() << "Old Instr: " << *It;
+      dbgs() << "New Instr: " << *SWaitInst << '\n';
+    });
   }
 
   if (Wait.VsCnt != ~0u) {
     assert(ST->hasVscnt());
 
     auto SWaitInst =
-        BuildMI(*MI.getParent(), MI.getIterator(), MI.getDebugLoc(),
-                TII->get(AMDGPU::S_WAITCNT_VSCNT))
+        BuildMI(Block, It, DL, TII->get(AMDGPU::S_WAITCNT_VSCNT))
             .addReg(AMDGPU::SGPR_NULL, RegState::Undef)
             .addImm(Wait.VsCnt);
     TrackedWaitcntSet.insert(SWaitInst);
     Modified = true;
 
-    LLVM_DEBUG(dbgs() << "generateWaitcntInstBefore\n"
-                      << "Old Instr: " << MI
-                      << "New Instr: " << *SWaitInst << '\n');
+    LLVM_DEBUG({
+      dbgs() << "generateWaitcnt\n";
+      if (It != Block.instr_end())
+        dbgs() << "Old Instr: " << *It;
+      dbgs() << "New Instr: " << *SWaitInst << '\n';
+    });
   }
 
   return Modified;
@@ -1418,6 +1494,7 @@ bool SIInsertWaitcnts::insertWaitcntInBlock(MachineFunction &MF,
 
   // Walk over the instructions.
   MachineInstr *OldWaitcntInstr = nullptr;
+  MachineBasicBlock::instr_iterator FirstTerm = Block.getFirstInstrTerminator();
 
   for (MachineBasicBlock::instr_iterator Iter = Block.instr_begin(),
                                          E = Block.instr_end();
@@ -1436,7 +1513,10 @@ bool SIInsertWaitcnts::insertWaitcntInBlock(MachineFunction &MF,
     }
 
     // Generate an s_waitcnt instruction to be placed before Inst, if needed.
-    Modified |= generateWaitcntInstBefore(Inst, ScoreBrackets, OldWaitcntInstr);
+    bool FlushVmCnt =
+        Iter == FirstTerm && isPreheaderToFlush(Block, ScoreBrackets);
+    Modified |= generateWaitcntInstBefore(Inst, ScoreBrackets, OldWaitcntInstr,
+                                          FlushVmCnt);
     OldWaitcntInstr = nullptr;
 
     // Restore vccz if it's not known to be correct already.
@@ -1517,9 +1597,105 @@ bool SIInsertWaitcnts::insertWaitcntInBlock(MachineFunction &MF,
     ++Iter;
   }
 
+  if (FirstTerm == Block.instr_end() &&
+      isPreheaderToFlush(Block, ScoreBrackets))
+    Modified |= generateWaitcntBlockEnd(Block, ScoreBrackets, OldWaitcntInstr);
+
   return Modified;
 }
 
+/// \returns true if vmcnt should be flushed at the end of \p MBB because it is
+/// the preheader of a loop for which shouldFlushVmCnt holds.
+bool SIInsertWaitcnts::isPreheaderToFlush(MachineBasicBlock &MBB,
+                                          WaitcntBrackets &ScoreBrackets) {
+  if (!CrossBlockWaitcnt)
+    return false;
+
+  auto It = PreheadersToFlush.find(&MBB);
+  if (It != PreheadersToFlush.end())
+    return It->second;
+
+  bool Flush = false;
+  unsigned StallCycles = 0;
+  MachineBasicBlock *Succ = MBB.getSingleSuccessor();
+  MachineLoop *ML = Succ ? MLI->getLoopFor(Succ) : nullptr;
+  if (ML && ML->getLoopPreheader() == &MBB &&
+      shouldFlushVmCnt(ML, ScoreBrackets, StallCycles)) {
+    Flush = true;
+    ++NumFlushedLoops;
+    FlushedCyclesPerIteration += StallCycles;
+  }
+  PreheadersToFlush[&MBB] = Flush;
+  return Flush;
+}
+
+/// \returns true if it is better to wait for all outstanding vector memory
+/// operations in the preheader of \p ML than inside of it.
+///
+/// A use inside the loop of a vgpr loaded outside of it gets an s_waitcnt that
+/// is executed in every iteration. Since the scores of the loads issued by
+/// the loop itself are merged in at the header, that wait also waits for them,
+/// even though the value it protects arrived long ago. Flushing in the
+/// preheader instead pays for the outside loads once. This is only done if
+/// the values loaded inside the loop are not used inside of it, or if the
+/// loop does not load at all but its stores share vmcnt with the loads
+/// (targets without vscnt); otherwise the waits in the loop are needed anyway
+/// and the per-use counts they compute are already as weak as possible.
+///
+/// \p StallCycles is set to the latency of the slowest vector memory
+/// operation in the loop, which bounds the stall avoided in each iteration.
+bool SIInsertWaitcnts::shouldFlushVmCnt(MachineLoop *ML,
+                                        WaitcntBrackets &Brackets,
+                                        unsigned &StallCycles) {
+  bool HasVMemLoad = false;
+  bool HasVMemStore = false;
+  bool UsesVgprLoadedOutside = false;
+  DenseSet<int> VgprUse;
+  DenseSet<int> VgprDef;
+
+  for (MachineBasicBlock *MBB : ML->blocks()) {
+    for (MachineInstr &MI : *MBB) {
+      if (SIInstrInfo::isVMEM(MI)) {
+        HasVMemLoad |= MI.mayLoad();
+        HasVMemStore |= MI.mayStore();
+        StallCycles = std::max(StallCycles, TII->getInstrLatency(nullptr, MI));
+      }
+      for (unsigned I = 0, E = MI.getNumOperands(); I != E; ++I) {
+        MachineOperand &Op = MI.getOperand(I);
+        if (!Op.isReg() || !TRI->isVGPR(*MRI, Op.getReg()))
+          continue;
+        RegInterval Interval = Brackets.getRegInterval(&MI, TII, MRI, TRI, I);
+        if (Op.isUse()) {
+          for (int RegNo = Interval.first; RegNo < Interval.second; ++RegNo) {
+            // A value loaded inside the loop is used inside of it, so the
+            // loop has to wait anyway.
+            if (VgprDef.count(RegNo))
+              return false;
+            VgprUse.insert(RegNo);
+            // A pending score on entry to the loop means the value is loaded
+            // outside of it.
+            if (Brackets.getRegScore(RegNo, VM_CNT) >
+                Brackets.getScoreLB(VM_CNT))
+              UsesVgprLoadedOutside = true;
+          }
+        } else if (SIInstrInfo::isVMEM(MI) && MI.mayLoad()) {
+          for (int RegNo = Interval.first; RegNo < Interval.second; ++RegNo) {
+            // The value loaded here is used earlier in the loop, i.e. in the
+            // next iteration.
+            if (VgprUse.count(RegNo))
+              return false;
+            VgprDef.insert(RegNo);
+          }
+        }
+      }
+    }
+  }
+
+  if (!ST->hasVscnt() && HasVMemStore && !HasVMemLoad && UsesVgprLoadedOutside)
+    return true;
+  return HasVMemLoad && UsesVgprLoadedOutside;
+}
+
 bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
   ST = &MF.getSubtarget<GCNSubtarget>();
   TII = ST->getInstrInfo();
@@ -1528,6 +1704,8 @@ bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
   IV = AMDGPU::getIsaVersion(ST->getCPU());
   const SIMachineFunctionInfo *MFI = MF.getInfo<SIMachineFunctionInfo>();
   PDT = &getAnalysis<MachinePostDominatorTree>();
+  MLI = &getAnalysis<MachineLoopInfo>();
+  ORE = &getAnalysis<MachineOptimizationRemarkEmitterPass>().getORE();
 
   ForceEmitZeroWaitcnts = ForceEmitZeroFlag;
   for (auto T : inst_counter_types())
@@ -1550,12 +1728,25 @@ bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
 
   TrackedWaitcntSet.clear();
   BlockInfos.clear();
+  PreheadersToFlush.clear();
+  NumFlushedLoops = 0;
+  FlushedCyclesPerIteration = 0;
 
   // Keep iterating over the blocks in reverse post order, inserting and
   // updating s_waitcnt where needed, until a fix point is reached.
   for (auto *MBB : ReversePostOrderTraversal<MachineFunction *>(&MF))
     BlockInfos.insert({MBB, BlockInfo(MBB)});
 
+  // Callees only wait for the outstanding stores of the caller where needed,
+  // instead of on entry.
+  const bool SinkEntryVscnt =
+      CrossBlockWaitcnt && ST->hasVscnt() && !MFI->isEntryFunction();
+  if (SinkEntryVscnt) {
+    BlockInfo &EntryBI = BlockInfos.front().second;
+    EntryBI.Incoming = std::make_unique<WaitcntBrackets>(ST);
+    EntryBI.Incoming->setStateOnFunctionEntry();
+  }
+
   std::unique_ptr<WaitcntBrackets> Brackets;
   bool Modified = false;
   bool Repeat;
@@ -1670,7 +1861,7 @@ bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
          I != E && (I->isPHI() || I->isMetaInstruction()); ++I)
       ;
     BuildMI(EntryBB, I, DebugLoc(), TII->get(AMDGPU::S_WAITCNT)).addImm(0);
-    if (ST->hasVscnt())
+    if (ST->hasVscnt() && !SinkEntryVscnt)
       BuildMI(EntryBB, I, DebugLoc(), TII->get(AMDGPU::S_WAITCNT_VSCNT))
           .addReg(AMDGPU::SGPR_NULL, RegState::Undef)
           .addImm(0);
@@ -1678,5 +1869,27 @@ bool SIInsertWaitcnts::runOnMachineFunction(MachineFunction &MF) {
     Modified = true;
   }
 
+  ORE->emit([&]() {
+    unsigned NumWaitcnts = 0;
+    unsigned NumLoopWaitcnts = 0;
+    for (MachineInstr *Waitcnt : TrackedWaitcntSet) {
+      ++NumWaitcnts;
+      if (MLI->getLoopFor(Waitcnt->getParent()))
+        ++NumLoopWaitcnts;
+    }
+    MachineOptimizationRemarkAnalysis R(DEBUG_TYPE, "WaitcntPlacement",
+                                        MF.getFunction().getSubprogram(),
+                                        &MF.front());
+    R << ore::NV("NumWaitcnts", NumWaitcnts) << " waits inserted, "
+      << ore::NV("NumLoopWaitcnts", NumLoopWaitcnts) << " in loops; vmcnt "
+      << "flushed before " << ore::NV("NumFlushedLoops", NumFlushedLoops)
+      << " loops, saving up to "
+      << ore::NV("WaitCyclesSaved", FlushedCyclesPerIteration)
+      << " wait cycles per iteration";
+    if (SinkEntryVscnt)
+      R << "; outstanding stores not waited for on function entry";
+    return R;
+  });
+
   return Modified;
 }
@@ -19,6 +19,18 @@
 // ==>
 //  s_buffer_load_dwordx2 s[4:5], s[0:3], 4
 //
+// and for dword global and flat accesses:
+//  global_load_dword v0, v[2:3], off offset:16
+//  global_load_dword v1, v[2:3], off offset:20
+// ==>
+//  global_load_dwordx2 v[0:1], v[2:3], off offset:16
+//
+// With -amdgpu-load-store-opt-cross-block, merging is not limited to a single
+// basic block. A block with a single successor, which in turn has no other
+// predecessor, is executed exactly when the successor is, so such
+// straight-line chains of blocks are scanned as one region and the first
+// instruction of a pair may be sunk into a later block.
+//
 // This pass also tries to promote constant offset to the immediate by
 // adjusting the base. It tries to use a base from the nearby instructions that
 // allows it to have a 13bit constant offset and then promotes the 13bit offset
@@ -60,6 +72,7 @@
 #include "AMDGPU.h"
 #include "GCNSubtarget.h"
 #include "MCTargetDesc/AMDGPUMCTargetDesc.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/InitializePasses.h"
@@ -68,6 +81,16 @@ using namespace llvm;
 
 #define DEBUG_TYPE "si-load-store-opt"
 
+STATISTIC(NumMergedInsts, "Number of memory instructions merged");
+STATISTIC(NumCrossBlockMerges,
+          "Number of merges across a basic block boundary");
+
+static cl::opt<bool> EnableCrossBlockMerge(
+    "amdgpu-load-store-opt-cross-block",
+    cl::desc("Merge memory instructions across straight-line basic block "
+             "boundaries"),
+    cl::init(false), cl::Hidden);
+
 namespace {
 enum InstClassEnum {
   UNKNOWN,
@@ -79,6 +102,12 @@ enum InstClassEnum {
   MIMG,
   TBUFFER_LOAD,
   TBUFFER_STORE,
+  GLOBAL_LOAD,
+  GLOBAL_LOAD_SADDR,
+  GLOBAL_STORE,
+  GLOBAL_STORE_SADDR,
+  FLAT_LOAD,
+  FLAT_STORE,
 };
 
 struct AddressRegs {
@@ -86,6 +115,7 @@ struct AddressRegs {
   bool SBase = false;
   bool SRsrc = false;
   bool SOffset = false;
+  bool SAddr = false;
   bool VAddr = false;
   bool Addr = false;
   bool SSamp = false;
@@ -187,6 +217,10 @@ private:
   AliasAnalysis *AA = nullptr;
   bool OptimizeAgain;
 
+  // Maps a block to its straight-line successor if both are part of the same
+  // merge region.
+  DenseMap<const MachineBasicBlock *, MachineBasicBlock *> RegionSucc;
+
   static bool dmasksCanBeCombined(const CombineInfo &CI,
                                   const SIInstrInfo &TII,
                                   const CombineInfo &Paired);
@@ -232,6 +266,19 @@ private:
   MachineBasicBlock::iterator
   mergeTBufferStorePair(CombineInfo &CI, CombineInfo &Paired,
                         const SmallVectorImpl<MachineInstr *> &InstsToMove);
+  MachineBasicBlock::iterator
+  mergeFlatLoadPair(CombineInfo &CI, CombineInfo &Paired,
+                    const SmallVectorImpl<MachineInstr *> &InstsToMove);
+  MachineBasicBlock::iterator
+  mergeFlatStorePair(CombineInfo &CI, CombineInfo &Paired,
+                     const SmallVectorImpl<MachineInstr *> &InstsToMove);
+
+  void skipToRegionInst(MachineBasicBlock *&MBB,
+                        MachineBasicBlock::iterator &I) const;
+  void advanceInRegion(MachineBasicBlock *&MBB,
+                       MachineBasicBlock::iterator &I) const;
+  void formMergeRegions(MachineFunction &MF,
+                        SmallVectorImpl<MachineBasicBlock *> &Heads);
 
   void updateBaseAndOffset(MachineInstr &I, Register NewBase,
                            int32_t NewOffset) const;
@@ -299,10 +346,35 @@ static unsigned getOpcodeWidth(const MachineInstr &MI, const SIInstrInfo &TII) {
 
   switch (Opc) {
   case AMDGPU::S_BUFFER_LOAD_DWORD_IMM:
+  case AMDGPU::GLOBAL_LOAD_DWORD:
+  case AMDGPU::GLOBAL_LOAD_DWORD_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORD:
+  case AMDGPU::GLOBAL_STORE_DWORD_SADDR:
+  case AMDGPU::FLAT_LOAD_DWORD:
+  case AMDGPU::FLAT_STORE_DWORD:
     return 1;
   case AMDGPU::S_BUFFER_LOAD_DWORDX2_IMM:
+  case AMDGPU::GLOBAL_LOAD_DWORDX2:
+  case AMDGPU::GLOBAL_LOAD_DWORDX2_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX2:
+  case AMDGPU::GLOBAL_STORE_DWORDX2_SADDR:
+  case AMDGPU::FLAT_LOAD_DWORDX2:
+  case AMDGPU::FLAT_STORE_DWORDX2:
     return 2;
+  case AMDGPU::GLOBAL_LOAD_DWORDX3:
+  case AMDGPU::GLOBAL_LOAD_DWORDX3_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX3:
+  case AMDGPU::GLOBAL_STORE_DWORDX3_SADDR:
+  case AMDGPU::FLAT_LOAD_DWORDX3:
+  case AMDGPU::FLAT_STORE_DWORDX3:
+    return 3;
   case AMDGPU::S_BUFFER_LOAD_DWORDX4_IMM:
+  case AMDGPU::GLOBAL_LOAD_DWORDX4:
+  case AMDGPU::GLOBAL_LOAD_DWORDX4_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX4:
+  case AMDGPU::GLOBAL_STORE_DWORDX4_SADDR:
+  case AMDGPU::FLAT_LOAD_DWORDX4:
+  case AMDGPU::FLAT_STORE_DWORDX4:
     return 4;
   default:
     return 0;
@@ -371,6 +443,36 @@ static InstClassEnum getInstClass(unsigned Opc, const SIInstrInfo &TII) {
   case AMDGPU::DS_WRITE_B64:
   case AMDGPU::DS_WRITE_B64_gfx9:
     return DS_WRITE;
+  case AMDGPU::GLOBAL_LOAD_DWORD:
+  case AMDGPU::GLOBAL_LOAD_DWORDX2:
+  case AMDGPU::GLOBAL_LOAD_DWORDX3:
+  case AMDGPU::GLOBAL_LOAD_DWORDX4:
+    return GLOBAL_LOAD;
+  case AMDGPU::GLOBAL_LOAD_DWORD_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX2_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX3_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX4_SADDR:
+    return GLOBAL_LOAD_SADDR;
+  case AMDGPU::GLOBAL_STORE_DWORD:
+  case AMDGPU::GLOBAL_STORE_DWORDX2:
+  case AMDGPU::GLOBAL_STORE_DWORDX3:
+  case AMDGPU::GLOBAL_STORE_DWORDX4:
+    return GLOBAL_STORE;
+  case AMDGPU::GLOBAL_STORE_DWORD_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX2_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX3_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX4_SADDR:
+    return GLOBAL_STORE_SADDR;
+  case AMDGPU::FLAT_LOAD_DWORD:
+  case AMDGPU::FLAT_LOAD_DWORDX2:
+  case AMDGPU::FLAT_LOAD_DWORDX3:
+  case AMDGPU::FLAT_LOAD_DWORDX4:
+    return FLAT_LOAD;
+  case AMDGPU::FLAT_STORE_DWORD:
+  case AMDGPU::FLAT_STORE_DWORDX2:
+  case AMDGPU::FLAT_STORE_DWORDX3:
+  case AMDGPU::FLAT_STORE_DWORDX4:
+    return FLAT_STORE;
   case AMDGPU::IMAGE_BVH_INTERSECT_RAY_sa:
   case AMDGPU::IMAGE_BVH64_INTERSECT_RAY_sa:
   case AMDGPU::IMAGE_BVH_INTERSECT_RAY_a16_sa:
@@ -411,6 +513,36 @@ static unsigned getInstSubclass(unsigned Opc, const SIInstrInfo &TII) {
   case AMDGPU::S_BUFFER_LOAD_DWORDX2_IMM:
   case AMDGPU::S_BUFFER_LOAD_DWORDX4_IMM:
     return AMDGPU::S_BUFFER_LOAD_DWORD_IMM;
+  case AMDGPU::GLOBAL_LOAD_DWORD:
+  case AMDGPU::GLOBAL_LOAD_DWORDX2:
+  case AMDGPU::GLOBAL_LOAD_DWORDX3:
+  case AMDGPU::GLOBAL_LOAD_DWORDX4:
+    return AMDGPU::GLOBAL_LOAD_DWORD;
+  case AMDGPU::GLOBAL_LOAD_DWORD_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX2_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX3_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX4_SADDR:
+    return AMDGPU::GLOBAL_LOAD_DWORD_SADDR;
+  case AMDGPU::GLOBAL_STORE_DWORD:
+  case AMDGPU::GLOBAL_STORE_DWORDX2:
+  case AMDGPU::GLOBAL_STORE_DWORDX3:
+  case AMDGPU::GLOBAL_STORE_DWORDX4:
+    return AMDGPU::GLOBAL_STORE_DWORD;
+  case AMDGPU::GLOBAL_STORE_DWORD_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX2_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX3_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX4_SADDR:
+    return AMDGPU::GLOBAL_STORE_DWORD_SADDR;
+  case AMDGPU::FLAT_LOAD_DWORD:
+  case AMDGPU::FLAT_LOAD_DWORDX2:
+  case AMDGPU::FLAT_LOAD_DWORDX3:
+  case AMDGPU::FLAT_LOAD_DWORDX4:
+    return AMDGPU::FLAT_LOAD_DWORD;
+  case AMDGPU::FLAT_STORE_DWORD:
+  case AMDGPU::FLAT_STORE_DWORDX2:
+  case AMDGPU::FLAT_STORE_DWORDX3:
+  case AMDGPU::FLAT_STORE_DWORDX4:
+    return AMDGPU::FLAT_STORE_DWORD;
   }
 }
 
@@ -472,6 +604,34 @@ static AddressRegs getRegs(unsigned Opc, const SIInstrInfo &TII) {
   case AMDGPU::DS_WRITE_B64_gfx9:
     Result.Addr = true;
     return Result;
+  case AMDGPU::GLOBAL_LOAD_DWORD_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX2_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX3_SADDR:
+  case AMDGPU::GLOBAL_LOAD_DWORDX4_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORD_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX2_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX3_SADDR:
+  case AMDGPU::GLOBAL_STORE_DWORDX4_SADDR:
+    Result.SAddr = true;
+    LLVM_FALLTHROUGH;
+  case AMDGPU::GLOBAL_LOAD_DWORD:
+  case AMDGPU::GLOBAL_LOAD_DWORDX2:
+  case AMDGPU::GLOBAL_LOAD_DWORDX3:
+  case AMDGPU::GLOBAL_LOAD_DWORDX4:
+  case AMDGPU::GLOBAL_STORE_DWORD:
+  case AMDGPU::GLOBAL_STORE_DWORDX2:
+  case AMDGPU::GLOBAL_STORE_DWORDX3:
+  case AMDGPU::GLOBAL_STORE_DWORDX4:
+  case AMDGPU::FLAT_LOAD_DWORD:
+  case AMDGPU::FLAT_LOAD_DWORDX2:
+  case AMDGPU::FLAT_LOAD_DWORDX3:
+  case AMDGPU::FLAT_LOAD_DWORDX4:
+  case AMDGPU::FLAT_STORE_DWORD:
+  case AMDGPU::FLAT_STORE_DWORDX2:
+  case AMDGPU::FLAT_STORE_DWORDX3:
+  case AMDGPU::FLAT_STORE_DWORDX4:
+    Result.VAddr = true;
+    return Result;
   }
 }
 
@@ -546,6 +706,9 @@ void SILoadStoreOptimizer::CombineInfo::setMI(MachineBasicBlock::iterator MI,
   if (Regs.SOffset)
     AddrIdx[NumAddresses++] =
         AMDGPU::getNamedOperandIdx(Opc, AMDGPU::OpName::soffset);
+  if (Regs.SAddr)
+    AddrIdx[NumAddresses++] =
+        AMDGPU::getNamedOperandIdx(Opc, AMDGPU::OpName::saddr);
   if (Regs.VAddr)
     AddrIdx[NumAddresses++] =
         AMDGPU::getNamedOperandIdx(Opc, AMDGPU::OpName::vaddr);
@@ -597,6 +760,17 @@ static void addDefsUsesToList(const MachineInstr &MI,
   }
 }
 
+// Return true if MI does not refer to any physical register that would have
+// to be tracked in the live-ins if MI is sunk into a straight-line successor.
+static bool canSinkIntoSuccessor(const MachineInstr &MI,
+                                 const MachineRegisterInfo &MRI) {
+  for (const MachineOperand &Op : MI.operands()) {
+    if (Op.isReg() && Op.getReg().isPhysical() && !MRI.isReserved(Op.getReg()))
+      return false;
+  }
+  return true;
+}
+
 static bool memAccessesCanBeReordered(MachineBasicBlock::iterator A,
                                       MachineBasicBlock::iterator B,
                                       AliasAnalysis *AA) {
@@ -841,7 +1015,7 @@ bool SILoadStoreOptimizer::widthsFit(const GCNSubtarget &STM,
   }
 }
 
-/// This function assumes that CI comes before Paired in a basic block.
+/// This function assumes that CI comes before Paired in a merge region.
 bool SILoadStoreOptimizer::checkAndPrepareMerge(
     CombineInfo &CI, CombineInfo &Paired,
     SmallVectorImpl<MachineInstr *> &InstsToMove) {
@@ -873,14 +1047,15 @@ bool SILoadStoreOptimizer::checkAndPrepareMerge(
   DenseSet<Register> PhysRegUsesToMove;
   addDefsUsesToList(*CI.I, RegDefsToMove, PhysRegUsesToMove);
 
-  MachineBasicBlock::iterator E = std::next(Paired.I);
-  MachineBasicBlock::iterator MBBI = std::next(CI.I);
-  MachineBasicBlock::iterator MBBE = CI.I->getParent()->end();
-  for (; MBBI != E; ++MBBI) {
+  // The scan ends at Paired. Its successor can't serve as an end iterator,
+  // since advanceInRegion skips over the terminators of a block.
+  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock::iterator MBBI = CI.I;
+  for (advanceInRegion(MBB, MBBI);; advanceInRegion(MBB, MBBI)) {
 
-    if (MBBI == MBBE) {
+    if (MBBI == MBB->end()) {
       // CombineInfo::Order is a hint on the instruction ordering within the
-      // basic block. This hint suggests that CI precedes Paired, which is
+      // merge region. This hint suggests that CI precedes Paired, which is
       // true most of the time. However, moveInstsAfter() processing a
       // previous list may have changed this order in a situation when it
       // moves an instruction which exists in some other merge list.
@@ -937,10 +1112,23 @@ bool SILoadStoreOptimizer::checkAndPrepareMerge(
     // where the DS_READ_B32 ends up in InstsToMove and therefore prevents
     // merging of the two writes.
     if (addToListsIfDependent(*MBBI, RegDefsToMove, PhysRegUsesToMove,
-                              InstsToMove))
+                              InstsToMove)) {
+      // Paired itself depends on CI, so they can't be merged.
+      if (&*MBBI == &*Paired.I)
+        return false;
       continue;
+    }
 
     if (&*MBBI == &*Paired.I) {
+      // Instructions taken from an earlier block of the region end up in
+      // Paired's block, where their physical registers are not live-in.
+      if (MBB != CI.I->getParent() &&
+          (!canSinkIntoSuccessor(*CI.I, *MRI) ||
+           llvm::any_of(InstsToMove, [&](const MachineInstr *MI) {
+             return MI->getParent() != MBB && !canSinkIntoSuccessor(*MI, *MRI);
+           })))
+        return false;
+
       // We need to go through the list of instructions that we plan to
       // move and make sure they are all safe to move down past the merged
       // instruction.
@@ -986,7 +1174,7 @@ unsigned SILoadStoreOptimizer::read2ST64Opcode(unsigned EltSize) const {
 MachineBasicBlock::iterator
 SILoadStoreOptimizer::mergeRead2Pair(CombineInfo &CI, CombineInfo &Paired,
     const SmallVectorImpl<MachineInstr *> &InstsToMove) {
-  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock *MBB = Paired.I->getParent();
 
   // Be careful, since the addresses could be subregisters themselves in weird
   // cases, like vectors of pointers.
@@ -1086,7 +1274,7 @@ unsigned SILoadStoreOptimizer::write2ST64Opcode(unsigned EltSize) const {
 MachineBasicBlock::iterator
 SILoadStoreOptimizer::mergeWrite2Pair(CombineInfo &CI, CombineInfo &Paired,
                                       const SmallVectorImpl<MachineInstr *> &InstsToMove) {
-  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock *MBB = Paired.I->getParent();
 
   // Be sure to use .addOperand(), and not .addReg() with these. We want to be
   // sure we preserve the subregister index and any register flags set on them.
@@ -1154,7 +1342,7 @@ SILoadStoreOptimizer::mergeWrite2Pair(CombineInfo &CI, CombineInfo &Paired,
 MachineBasicBlock::iterator
 SILoadStoreOptimizer::mergeImagePair(CombineInfo &CI, CombineInfo &Paired,
                            const SmallVectorImpl<MachineInstr *> &InstsToMove) {
-  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock *MBB = Paired.I->getParent();
   DebugLoc DL = CI.I->getDebugLoc();
   const unsigned Opcode = getNewOpcode(CI, Paired);
 
@@ -1208,7 +1396,7 @@ SILoadStoreOptimizer::mergeImagePair(CombineInfo &CI, CombineInfo &Paired,
 MachineBasicBlock::iterator SILoadStoreOptimizer::mergeSBufferLoadImmPair(
     CombineInfo &CI, CombineInfo &Paired,
     const SmallVectorImpl<MachineInstr *> &InstsToMove) {
-  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock *MBB = Paired.I->getParent();
   DebugLoc DL = CI.I->getDebugLoc();
   const unsigned Opcode = getNewOpcode(CI, Paired);
 
@@ -1259,7 +1447,7 @@ MachineBasicBlock::iterator SILoadStoreOptimizer::mergeSBufferLoadImmPair(
 MachineBasicBlock::iterator SILoadStoreOptimizer::mergeBufferLoadPair(
     CombineInfo &CI, CombineInfo &Paired,
     const SmallVectorImpl<MachineInstr *> &InstsToMove) {
-  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock *MBB = Paired.I->getParent();
   DebugLoc DL = CI.I->getDebugLoc();
 
   const unsigned Opcode = getNewOpcode(CI, Paired);
@@ -1322,7 +1510,7 @@ MachineBasicBlock::iterator SILoadStoreOptimizer::mergeBufferLoadPair(
 MachineBasicBlock::iterator SILoadStoreOptimizer::mergeTBufferLoadPair(
     CombineInfo &CI, CombineInfo &Paired,
     const SmallVectorImpl<MachineInstr *> &InstsToMove) {
-  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock *MBB = Paired.I->getParent();
   DebugLoc DL = CI.I->getDebugLoc();
 
   const unsigned Opcode = getNewOpcode(CI, Paired);
@@ -1390,7 +1578,7 @@ MachineBasicBlock::iterator SILoadStoreOptimizer::mergeTBufferLoadPair(
 MachineBasicBlock::iterator SILoadStoreOptimizer::mergeTBufferStorePair(
     CombineInfo &CI, CombineInfo &Paired,
     const SmallVectorImpl<MachineInstr *> &InstsToMove) {
-  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock *MBB = Paired.I->getParent();
   DebugLoc DL = CI.I->getDebugLoc();
 
   const unsigned Opcode = getNewOpcode(CI, Paired);
@@ -1451,6 +1639,118 @@ MachineBasicBlock::iterator SILoadStoreOptimizer::mergeTBufferStorePair(
   return New;
 }
 
+MachineBasicBlock::iterator SILoadStoreOptimizer::mergeFlatLoadPair(
+    CombineInfo &CI, CombineInfo &Paired,
+    const SmallVectorImpl<MachineInstr *> &InstsToMove) {
+  MachineBasicBlock *MBB = Paired.I->getParent();
+  DebugLoc DL = CI.I->getDebugLoc();
+
+  const unsigned Opcode = getNewOpcode(CI, Paired);
+
+  const TargetRegisterClass *SuperRC = getTargetRegisterClass(CI, Paired);
+  Register DestReg = MRI->createVirtualRegister(SuperRC);
+
+  // The immediate offset is signed for global instructions. Adjacent offsets
+  // have the same sign, so the unsigned minimum is the right one.
+  int32_t MergedOffset = std::min(CI.Offset, Paired.Offset);
+
+  auto MIB = BuildMI(*MBB, Paired.I, DL, TII->get(Opcode), DestReg);
+
+  if (const auto *SAddr = TII->getNamedOperand(*CI.I, AMDGPU::OpName::saddr))
+    MIB.add(*SAddr);
+
+  assert(CI.I->hasOneMemOperand() && Paired.I->hasOneMemOperand());
+
+  const MachineMemOperand *MMOa = *CI.I->memoperands_begin();
+  const MachineMemOperand *MMOb = *Paired.I->memoperands_begin();
+
+  MachineInstr *New =
+      MIB.add(*TII->getNamedOperand(*CI.I, AMDGPU::OpName::vaddr))
+          .addImm(MergedOffset) // offset
+          .addImm(CI.GLC)       // glc
+          .addImm(CI.SLC)       // slc
+          .addImm(CI.DLC)       // dlc
+          .addMemOperand(
+              combineKnownAdjacentMMOs(*MBB->getParent(), MMOa, MMOb));
+
+  std::pair<unsigned, unsigned> SubRegIdx = getSubRegIdxs(CI, Paired);
+  const unsigned SubRegIdx0 = std::get<0>(SubRegIdx);
+  const unsigned SubRegIdx1 = std::get<1>(SubRegIdx);
+
+  // Copy to the old destination registers.
+  const MCInstrDesc &CopyDesc = TII->get(TargetOpcode::COPY);
+  const auto *Dest0 = TII->getNamedOperand(*CI.I, AMDGPU::OpName::vdst);
+  const auto *Dest1 = TII->getNamedOperand(*Paired.I, AMDGPU::OpName::vdst);
+
+  BuildMI(*MBB, Paired.I, DL, CopyDesc)
+      .add(*Dest0) // Copy to same destination including flags and sub reg.
+      .addReg(DestReg, 0, SubRegIdx0);
+  MachineInstr *Copy1 = BuildMI(*MBB, Paired.I, DL, CopyDesc)
+                            .add(*Dest1)
+                            .addReg(DestReg, RegState::Kill, SubRegIdx1);
+
+  moveInstsAfter(Copy1, InstsToMove);
+
+  CI.I->eraseFromParent();
+  Paired.I->eraseFromParent();
+  return New;
+}
+
+MachineBasicBlock::iterator SILoadStoreOptimizer::mergeFlatStorePair(
+    CombineInfo &CI, CombineInfo &Paired,
+    const SmallVectorImpl<MachineInstr *> &InstsToMove) {
+  MachineBasicBlock *MBB = Paired.I->getParent();
+  DebugLoc DL = CI.I->getDebugLoc();
+
+  const unsigned Opcode = getNewOpcode(CI, Paired);
+
+  std::pair<unsigned, unsigned> SubRegIdx = getSubRegIdxs(CI, Paired);
+  const unsigned SubRegIdx0 = std::get<0>(SubRegIdx);
+  const unsigned SubRegIdx1 = std::get<1>(SubRegIdx);
+
+  // Copy to the new source register.
+  const TargetRegisterClass *SuperRC = getTargetRegisterClass(CI, Paired);
+  Register SrcReg = MRI->createVirtualRegister(SuperRC);
+
+  const auto *Src0 = TII->getNamedOperand(*CI.I, AMDGPU::OpName::vdata);
+  const auto *Src1 = TII->getNamedOperand(*Paired.I, AMDGPU::OpName::vdata);
+
+  BuildMI(*MBB, Paired.I, DL, TII->get(AMDGPU::REG_SEQUENCE), SrcReg)
+      .add(*Src0)
+      .addImm(SubRegIdx0)
+      .add(*Src1)
+      .addImm(SubRegIdx1);
+
+  // See mergeFlatLoadPair for the sign of the offset.
+  int32_t MergedOffset = std::min(CI.Offset, Paired.Offset);
+
+  auto MIB = BuildMI(*MBB, Paired.I, DL, TII->get(Opcode))
+                 .add(*TII->getNamedOperand(*CI.I, AMDGPU::OpName::vaddr))
+                 .addReg(SrcReg, RegState::Kill);
+
+  if (const auto *SAddr = TII->getNamedOperand(*CI.I, AMDGPU::OpName::saddr))
+    MIB.add(*SAddr);
+
+  assert(CI.I->hasOneMemOperand() && Paired.I->hasOneMemOperand());
+
+  const MachineMemOperand *MMOa = *CI.I->memoperands_begin();
+  const MachineMemOperand *MMOb = *Paired.I->memoperands_begin();
+
+  MachineInstr *New =
+      MIB.addImm(MergedOffset) // offset
+          .addImm(CI.GLC)      // glc
+          .addImm(CI.SLC)      // slc
+          .addImm(CI.DLC)      // dlc
+          .addMemOperand(
+              combineKnownAdjacentMMOs(*MBB->getParent(), MMOa, MMOb));
+
+  moveInstsAfter(MIB, InstsToMove);
+
+  CI.I->eraseFromParent();
+  Paired.I->eraseFromParent();
+  return New;
+}
+
 unsigned SILoadStoreOptimizer::getNewOpcode(const CombineInfo &CI,
                                             const CombineInfo &Paired) {
   const unsigned Width = CI.Width + Paired.Width;
@@ -1480,6 +1780,72 @@ unsigned SILoadStoreOptimizer::getNewOpcode(const CombineInfo &CI,
   case MIMG:
     assert("No overlaps" && (countPopulation(CI.DMask | Paired.DMask) == Width));
     return AMDGPU::getMaskedMIMGOp(CI.I->getOpcode(), Width);
+  case GLOBAL_LOAD:
+    switch (Width) {
+    default:
+      return 0;
+    case 2:
+      return AMDGPU::GLOBAL_LOAD_DWORDX2;
+    case 3:
+      return AMDGPU::GLOBAL_LOAD_DWORDX3;
+    case 4:
+      return AMDGPU::GLOBAL_LOAD_DWORDX4;
+    }
+  case GLOBAL_LOAD_SADDR:
+    switch (Width) {
+    default:
+      return 0;
+    case 2:
+      return AMDGPU::GLOBAL_LOAD_DWORDX2_SADDR;
+    case 3:
+      return AMDGPU::GLOBAL_LOAD_DWORDX3_SADDR;
+    case 4:
+      return AMDGPU::GLOBAL_LOAD_DWORDX4_SADDR;
+    }
+  case GLOBAL_STORE:
+    switch (Width) {
+    default:
+      return 0;
+    case 2:
+      return AMDGPU::GLOBAL_STORE_DWORDX2;
+    case 3:
+      return AMDGPU::GLOBAL_STORE_DWORDX3;
+    case 4:
+      return AMDGPU::GLOBAL_STORE_DWORDX4;
+    }
+  case GLOBAL_STORE_SADDR:
+    switch (Width) {
+    default:
+      return 0;
+    case 2:
+      return AMDGPU::GLOBAL_STORE_DWORDX2_SADDR;
+    case 3:
+      return AMDGPU::GLOBAL_STORE_DWORDX3_SADDR;
+    case 4:
+      return AMDGPU::GLOBAL_STORE_DWORDX4_SADDR;
+    }
+  case FLAT_LOAD:
+    switch (Width) {
+    default:
+      return 0;
+    case 2:
+      return AMDGPU::FLAT_LOAD_DWORDX2;
+    case 3:
+      return AMDGPU::FLAT_LOAD_DWORDX3;
+    case 4:
+      return AMDGPU::FLAT_LOAD_DWORDX4;
+    }
+  case FLAT_STORE:
+    switch (Width) {
+    default:
+      return 0;
+    case 2:
+      return AMDGPU::FLAT_STORE_DWORDX2;
+    case 3:
+      return AMDGPU::FLAT_STORE_DWORDX3;
+    case 4:
+      return AMDGPU::FLAT_STORE_DWORDX4;
+    }
   }
 }
 
@@ -1553,7 +1919,7 @@ SILoadStoreOptimizer::getTargetRegisterClass(const CombineInfo &CI,
 MachineBasicBlock::iterator SILoadStoreOptimizer::mergeBufferStorePair(
     CombineInfo &CI, CombineInfo &Paired,
     const SmallVectorImpl<MachineInstr *> &InstsToMove) {
-  MachineBasicBlock *MBB = CI.I->getParent();
+  MachineBasicBlock *MBB = Paired.I->getParent();
   DebugLoc DL = CI.I->getDebugLoc();
 
   const unsigned Opcode = getNewOpcode(CI, Paired);
@@ -1922,6 +2288,84 @@ bool SILoadStoreOptimizer::promoteConstantOffsetToImm(
   return false;
 }
 
+// Return the block that is entered if and only if MBB is executed, or null if
+// there is no such block that instructions of MBB can be sunk into.
+static MachineBasicBlock *getStraightLineSuccessor(MachineBasicBlock &MBB) {
+  if (MBB.succ_size() != 1)
+    return nullptr;
+
+  MachineBasicBlock *Succ = *MBB.succ_begin();
+  if (Succ == &MBB || Succ->pred_size() != 1 || Succ->isEHPad() ||
+      Succ->hasAddressTaken() || !Succ->phis().empty())
+    return nullptr;
+
+  // Control flow pseudos may change EXEC, so only a plain branch may separate
+  // the two blocks.
+  for (const MachineInstr &Term : MBB.terminators()) {
+    if (!Term.isUnconditionalBranch())
+      return nullptr;
+  }
+  return Succ;
+}
+
+// Chain straight-line blocks into merge regions, and collect the first block
+// of each region in \p Heads.
+void SILoadStoreOptimizer::formMergeRegions(
+    MachineFunction &MF, SmallVectorImpl<MachineBasicBlock *> &Heads) {
+  DenseMap<MachineBasicBlock *, MachineBasicBlock *> Candidates;
+  SmallPtrSet<MachineBasicBlock *, 16> HasCandidatePred;
+  if (EnableCrossBlockMerge) {
+    for (MachineBasicBlock &MBB : MF) {
+      if (MachineBasicBlock *Succ = getStraightLineSuccessor(MBB)) {
+        Candidates[&MBB] = Succ;
+        HasCandidatePred.insert(Succ);
+      }
+    }
+  }
+
+  SmallPtrSet<MachineBasicBlock *, 16> Placed;
+  auto FormRegion = [&](MachineBasicBlock &Head) {
+    if (!Placed.insert(&Head).second)
+      return;
+    Heads.push_back(&Head);
+    MachineBasicBlock *Cur = &Head;
+    while (MachineBasicBlock *Succ = Candidates.lookup(Cur)) {
+      if (!Placed.insert(Succ).second)
+        break;
+      RegionSucc[Cur] = Succ;
+      Cur = Succ;
+    }
+  };
+
+  for (MachineBasicBlock &MBB : MF) {
+    if (!HasCandidatePred.count(&MBB))
+      FormRegion(MBB);
+  }
+  // Whatever is left is a cycle of straight-line blocks, which is cut at an
+  // arbitrary block.
+  for (MachineBasicBlock &MBB : MF)
+    FormRegion(MBB);
+}
+
+// Move I past any terminators and block ends inside the region, so that it
+// points to an instruction or to the end of the last block of the region.
+void SILoadStoreOptimizer::skipToRegionInst(
+    MachineBasicBlock *&MBB, MachineBasicBlock::iterator &I) const {
+  while (I == MBB->end() || I->isTerminator()) {
+    MachineBasicBlock *Succ = RegionSucc.lookup(MBB);
+    if (!Succ)
+      return;
+    MBB = Succ;
+    I = MBB->begin();
+  }
+}
+
+void SILoadStoreOptimizer::advanceInRegion(
+    MachineBasicBlock *&MBB, MachineBasicBlock::iterator &I) const {
+  ++I;
+  skipToRegionInst(MBB, I);
+}
+
 void SILoadStoreOptimizer::addInstToMergeableList(const CombineInfo &CI,
                  std::list<std::list<CombineInfo> > &MergeableInsts) const {
   for (std::list<CombineInfo> &AddrList : MergeableInsts) {
@@ -1945,8 +2389,9 @@ SILoadStoreOptimizer::collectMergeableInsts(
 
   // Sort potential mergeable instructions into lists.  One list per base address.
   unsigned Order = 0;
+  MachineBasicBlock *MBB = Begin->getParent();
   MachineBasicBlock::iterator BlockI = Begin;
-  for (; BlockI != End; ++BlockI) {
+  for (; BlockI != End; advanceInRegion(MBB, BlockI)) {
     MachineInstr &MI = *BlockI;
 
     // We run this before checking if an address is mergeable, because it can produce
@@ -1960,7 +2405,7 @@ SILoadStoreOptimizer::collectMergeableInsts(
       LLVM_DEBUG(dbgs() << "Breaking search on memory fence: " << MI);
 
       // Search will resume after this instruction in a separate merge list.
-      ++BlockI;
+      advanceInRegion(MBB, BlockI);
       break;
     }
 
@@ -2075,6 +2520,10 @@ SILoadStoreOptimizer::optimizeInstsWithSameBaseAddr(
 
     LLVM_DEBUG(dbgs() << "Merging: " << *CI.I << "   with: " << *Paired.I);
 
+    ++NumMergedInsts;
+    if (CI.I->getParent() != Paired.I->getParent())
+      ++NumCrossBlockMerges;
+
     switch (CI.InstClass) {
     default:
       llvm_unreachable("unknown InstClass");
@@ -2133,6 +2582,24 @@ SILoadStoreOptimizer::optimizeInstsWithSameBaseAddr(
       OptimizeListAgain |= (CI.Width + Paired.Width) < 4;
       break;
     }
+    case GLOBAL_LOAD:
+    case GLOBAL_LOAD_SADDR:
+    case FLAT_LOAD: {
+      MachineBasicBlock::iterator NewMI =
+          mergeFlatLoadPair(CI, Paired, InstsToMove);
+      CI.setMI(NewMI, *TII, *STM);
+      OptimizeListAgain |= (CI.Width + Paired.Width) < 4;
+      break;
+    }
+    case GLOBAL_STORE:
+    case GLOBAL_STORE_SADDR:
+    case FLAT_STORE: {
+      MachineBasicBlock::iterator NewMI =
+          mergeFlatStorePair(CI, Paired, InstsToMove);
+      CI.setMI(NewMI, *TII, *STM);
+      OptimizeListAgain |= (CI.Width + Paired.Width) < 4;
+      break;
+    }
     }
     CI.Order = Paired.Order;
     if (I == Second)
@@ -2163,13 +2630,24 @@ bool SILoadStoreOptimizer::runOnMachineFunction(MachineFunction &MF) {
   bool Modified = false;
 
   // Contains the list of instructions for which constant offsets are being
-  // promoted to the IMM. This is tracked for an entire block at time.
+  // promoted to the IMM. This is tracked for an entire region at time.
   SmallPtrSet<MachineInstr *, 4> AnchorList;
   MemInfoMap Visited;
 
-  for (MachineBasicBlock &MBB : MF) {
+  SmallVector<MachineBasicBlock *, 32> RegionHeads;
+  formMergeRegions(MF, RegionHeads);
+
+  for (MachineBasicBlock *Head : RegionHeads) {
+    MachineBasicBlock *Last = Head;
+    while (MachineBasicBlock *Succ = RegionSucc.lookup(Last))
+      Last = Succ;
+
+    MachineBasicBlock *MBB = Head;
+    MachineBasicBlock::iterator Begin = Head->begin();
+    skipToRegionInst(MBB, Begin);
+
     MachineBasicBlock::iterator SectionEnd;
-    for (MachineBasicBlock::iterator I = MBB.begin(), E = MBB.end(); I != E;
+    for (MachineBasicBlock::iterator I = Begin, E = Last->end(); I != E;
          I = SectionEnd) {
       bool CollectModified;
       std::list<std::list<CombineInfo>> MergeableInsts;
@@ -2191,5 +2669,6 @@ bool SILoadStoreOptimizer::runOnMachineFunction(MachineFunction &MF) {
     AnchorList.clear();
   }
 
+  RegionSucc.clear();
   return Modified;
 }
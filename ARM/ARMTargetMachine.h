@@ -21,6 +21,7 @@
 #include "llvm/Support/CodeGen.h"
 #include "llvm/Target/TargetMachine.h"
 #include <memory>
+#include <mutex>
 
 namespace llvm {
 
@@ -37,6 +38,7 @@ protected:
   std::unique_ptr<TargetLoweringObjectFile> TLOF;
   bool isLittle;
   mutable StringMap<std::unique_ptr<ARMSubtarget>> SubtargetMap;
+  mutable std::mutex SubtargetMapMutex;
 
 public:
   ARMBaseTargetMachine(const Target &T, const Triple &TT, StringRef CPU,
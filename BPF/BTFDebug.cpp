@@ -14,6 +14,7 @@
 #include "BPF.h"
 #include "BPFCORE.h"
 #include "MCTargetDesc/BPFMCTargetDesc.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/BinaryFormat/ELF.h"
 #include "llvm/CodeGen/AsmPrinter.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
@@ -21,11 +22,16 @@
 #include "llvm/MC/MCObjectFileInfo.h"
 #include "llvm/MC/MCSectionELF.h"
 #include "llvm/MC/MCStreamer.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/LineIterator.h"
 #include "llvm/Target/TargetLoweringObjectFile.h"
 
 using namespace llvm;
 
+static cl::opt<bool>
+    BTFDedup("bpf-btf-dedup", cl::Hidden, cl::init(false),
+             cl::desc("Merge structurally identical BTF types"));
+
 static const char *BTFKindStr[] = {
 #define HANDLE_BTF_KIND(ID, NAME) "BTF_KIND_" #NAME,
 #include "BTF.def"
@@ -41,6 +47,13 @@ void BTFTypeBase::emitType(MCStreamer &OS) {
   OS.emitInt32(BTFType.Size);
 }
 
+/// The "Size" field is only part of the key for the kinds where it is not a
+/// type id, so it is added by the subclasses.
+void BTFTypeBase::getDedupKey(SmallVectorImpl<uint32_t> &Key) {
+  Key.push_back(BTFType.NameOff);
+  Key.push_back(BTFType.Info);
+}
+
 BTFTypeDerived::BTFTypeDerived(const DIDerivedType *DTy, unsigned Tag,
                                bool NeedsFixup)
     : DTy(DTy), NeedsFixup(NeedsFixup) {
@@ -90,6 +103,10 @@ void BTFTypeDerived::completeType(BTFDebug &BDebug) {
 
 void BTFTypeDerived::emitType(MCStreamer &OS) { BTFTypeBase::emitType(OS); }
 
+void BTFTypeDerived::getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) {
+  Refs.push_back(&BTFType.Type);
+}
+
 void BTFTypeDerived::setPointeeType(uint32_t PointeeType) {
   BTFType.Type = PointeeType;
 }
@@ -152,6 +169,12 @@ void BTFTypeInt::emitType(MCStreamer &OS) {
   OS.emitInt32(IntVal);
 }
 
+void BTFTypeInt::getDedupKey(SmallVectorImpl<uint32_t> &Key) {
+  BTFTypeBase::getDedupKey(Key);
+  Key.push_back(BTFType.Size);
+  Key.push_back(IntVal);
+}
+
 BTFTypeEnum::BTFTypeEnum(const DICompositeType *ETy, uint32_t VLen) : ETy(ETy) {
   Kind = BTF::BTF_KIND_ENUM;
   BTFType.Info = Kind << 24 | VLen;
@@ -190,6 +213,15 @@ void BTFTypeEnum::emitType(MCStreamer &OS) {
   }
 }
 
+void BTFTypeEnum::getDedupKey(SmallVectorImpl<uint32_t> &Key) {
+  BTFTypeBase::getDedupKey(Key);
+  Key.push_back(BTFType.Size);
+  for (const auto &Enum : EnumValues) {
+    Key.push_back(Enum.NameOff);
+    Key.push_back(Enum.Val);
+  }
+}
+
 BTFTypeArray::BTFTypeArray(uint32_t ElemTypeId, uint32_t NumElems) {
   Kind = BTF::BTF_KIND_ARRAY;
   BTFType.NameOff = 0;
@@ -220,6 +252,16 @@ void BTFTypeArray::emitType(MCStreamer &OS) {
   OS.emitInt32(ArrayInfo.Nelems);
 }
 
+void BTFTypeArray::getDedupKey(SmallVectorImpl<uint32_t> &Key) {
+  BTFTypeBase::getDedupKey(Key);
+  Key.push_back(ArrayInfo.Nelems);
+}
+
+void BTFTypeArray::getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) {
+  Refs.push_back(&ArrayInfo.ElemType);
+  Refs.push_back(&ArrayInfo.IndexType);
+}
+
 /// Represent either a struct or a union.
 BTFTypeStruct::BTFTypeStruct(const DICompositeType *STy, bool IsStruct,
                              bool HasBitField, uint32_t Vlen)
@@ -265,6 +307,20 @@ void BTFTypeStruct::emitType(MCStreamer &OS) {
   }
 }
 
+void BTFTypeStruct::getDedupKey(SmallVectorImpl<uint32_t> &Key) {
+  BTFTypeBase::getDedupKey(Key);
+  Key.push_back(BTFType.Size);
+  for (const auto &Member : Members) {
+    Key.push_back(Member.NameOff);
+    Key.push_back(Member.Offset);
+  }
+}
+
+void BTFTypeStruct::getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) {
+  for (auto &Member : Members)
+    Refs.push_back(&Member.Type);
+}
+
 std::string BTFTypeStruct::getName() { return std::string(STy->getName()); }
 
 /// The Func kind represents both subprogram and pointee of function
@@ -314,6 +370,18 @@ void BTFTypeFuncProto::emitType(MCStreamer &OS) {
   }
 }
 
+void BTFTypeFuncProto::getDedupKey(SmallVectorImpl<uint32_t> &Key) {
+  BTFTypeBase::getDedupKey(Key);
+  for (const auto &Param : Parameters)
+    Key.push_back(Param.NameOff);
+}
+
+void BTFTypeFuncProto::getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) {
+  Refs.push_back(&BTFType.Type);
+  for (auto &Param : Parameters)
+    Refs.push_back(&Param.Type);
+}
+
 BTFTypeFunc::BTFTypeFunc(StringRef FuncName, uint32_t ProtoTypeId,
     uint32_t Scope)
     : Name(FuncName) {
@@ -332,6 +400,10 @@ void BTFTypeFunc::completeType(BTFDebug &BDebug) {
 
 void BTFTypeFunc::emitType(MCStreamer &OS) { BTFTypeBase::emitType(OS); }
 
+void BTFTypeFunc::getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) {
+  Refs.push_back(&BTFType.Type);
+}
+
 BTFKindVar::BTFKindVar(StringRef VarName, uint32_t TypeId, uint32_t VarInfo)
     : Name(VarName) {
   Kind = BTF::BTF_KIND_VAR;
@@ -349,6 +421,10 @@ void BTFKindVar::emitType(MCStreamer &OS) {
   OS.emitInt32(Info);
 }
 
+void BTFKindVar::getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) {
+  Refs.push_back(&BTFType.Type);
+}
+
 BTFKindDataSec::BTFKindDataSec(AsmPrinter *AsmPrt, std::string SecName)
     : Asm(AsmPrt), Name(SecName) {
   Kind = BTF::BTF_KIND_DATASEC;
@@ -371,6 +447,11 @@ void BTFKindDataSec::emitType(MCStreamer &OS) {
   }
 }
 
+void BTFKindDataSec::getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) {
+  for (auto &V : Vars)
+    Refs.push_back(&std::get<0>(V));
+}
+
 BTFTypeFloat::BTFTypeFloat(uint32_t SizeInBits, StringRef TypeName)
     : Name(TypeName) {
   Kind = BTF::BTF_KIND_FLOAT;
@@ -386,24 +467,25 @@ void BTFTypeFloat::completeType(BTFDebug &BDebug) {
   BTFType.NameOff = BDebug.addString(Name);
 }
 
+void BTFTypeFloat::getDedupKey(SmallVectorImpl<uint32_t> &Key) {
+  BTFTypeBase::getDedupKey(Key);
+  Key.push_back(BTFType.Size);
+}
+
 uint32_t BTFStringTable::addString(StringRef S) {
-  // Check whether the string already exists.
-  for (auto &OffsetM : OffsetToIdMap) {
-    if (Table[OffsetM.second] == S)
-      return OffsetM.first;
+  // Add the string unless it already exists.
+  auto Res = StringToOffsetMap.try_emplace(S, Data.size());
+  if (Res.second) {
+    Data.append(S.begin(), S.end());
+    Data.push_back('\0');
   }
-  // Not find, add to the string table.
-  uint32_t Offset = Size;
-  OffsetToIdMap[Offset] = Table.size();
-  Table.push_back(std::string(S));
-  Size += S.size() + 1;
-  return Offset;
+  return Res.first->second;
 }
 
 BTFDebug::BTFDebug(AsmPrinter *AP)
     : DebugHandlerBase(AP), OS(*Asm->OutStreamer), SkipInstruction(false),
       LineInfoGenerated(false), SecNameOff(0), ArrayIndexTypeId(0),
-      MapDefNotCollected(true) {
+      MapDefNotCollected(true), TypeIdsInText(false) {
   addString("\0");
 }
 
@@ -749,20 +831,21 @@ std::string BTFDebug::populateFileContent(const DISubprogram *SP) {
     for (line_iterator I(*Buf, false), E; I != E; ++I)
       Content.push_back(std::string(*I));
 
-  FileContent[FileName] = Content;
+  FileContent[FileName] = std::move(Content);
   return FileName;
 }
 
 void BTFDebug::constructLineInfo(const DISubprogram *SP, MCSymbol *Label,
                                  uint32_t Line, uint32_t Column) {
   std::string FileName = populateFileContent(SP);
+  const std::vector<std::string> &Lines = FileContent[FileName];
   BTFLineInfo LineInfo;
 
   LineInfo.Label = Label;
   LineInfo.FileNameOff = addString(FileName);
   // If file content is not available, let LineOff = 0.
-  if (Line < FileContent[FileName].size())
-    LineInfo.LineOff = addString(FileContent[FileName][Line]);
+  if (Line < Lines.size())
+    LineInfo.LineOff = addString(Lines[Line]);
   else
     LineInfo.LineOff = 0;
   LineInfo.LineNum = Line;
@@ -803,13 +886,20 @@ void BTFDebug::emitBTFSection() {
   for (const auto &TypeEntry : TypeEntries)
     TypeEntry->emitType(OS);
 
-  // Emit string table.
-  uint32_t StringOffset = 0;
-  for (const auto &S : StringTable.getTable()) {
+  // Emit string table. It is already laid out, so write it out in one
+  // piece unless the individual strings are annotated.
+  StringRef Strings = StringTable.getData();
+  if (!OS.isVerboseAsm()) {
+    OS.emitBytes(Strings);
+    return;
+  }
+  size_t StringOffset = 0;
+  while (StringOffset < Strings.size()) {
+    size_t End = Strings.find('\0', StringOffset);
     OS.AddComment("string offset=" + std::to_string(StringOffset));
-    OS.emitBytes(S);
+    OS.emitBytes(Strings.slice(StringOffset, End));
     OS.emitBytes(StringRef("\0", 1));
-    StringOffset += S.size() + 1;
+    StringOffset = End + 1;
   }
 }
 
@@ -905,6 +995,106 @@ void BTFDebug::emitBTFExtSection() {
   }
 }
 
+namespace {
+struct DedupKeyHash {
+  size_t operator()(const std::vector<uint32_t> &Key) const {
+    return hash_combine_range(Key.begin(), Key.end());
+  }
+};
+} // namespace
+
+/// Merge structurally identical types, similar to the libbpf BTF dedup. This
+/// mostly catches types which are defined in several compile units of a
+/// linked module, e.g. from common kernel headers. Types are first grouped by
+/// their own contents without the referenced type ids. The groups are then
+/// split by the groups of the referenced types until they are stable, so two
+/// types stay in the same group only if everything reachable from them is
+/// identical as well, including through self-referencing structs. The first
+/// type of each group represents it in the output.
+void BTFDebug::dedupTypes() {
+  uint32_t NumTypes = TypeEntries.size();
+  std::vector<SmallVector<uint32_t *, 4>> Refs(NumTypes);
+  // Group of each type id. Group 0 is reserved for void.
+  std::vector<uint32_t> Groups(NumTypes + 1, 0);
+  std::unordered_map<std::vector<uint32_t>, uint32_t, DedupKeyHash> KeyToGroup;
+  std::vector<uint32_t> Key;
+  uint32_t NumGroups = 0;
+
+  for (uint32_t I = 0; I < NumTypes; ++I) {
+    BTFTypeBase *TypeEntry = TypeEntries[I].get();
+    TypeEntry->getTypeRefs(Refs[I]);
+    if (!TypeEntry->canDedup()) {
+      Groups[I + 1] = ++NumGroups;
+      continue;
+    }
+    SmallVector<uint32_t, 16> Fields;
+    TypeEntry->getDedupKey(Fields);
+    Key.assign(Fields.begin(), Fields.end());
+    auto Res = KeyToGroup.try_emplace(Key, NumGroups + 1);
+    if (Res.second)
+      ++NumGroups;
+    Groups[I + 1] = Res.first->second;
+  }
+
+  // Each round only splits groups, so it is done once no group was split.
+  std::vector<uint32_t> NewGroups(NumTypes + 1, 0);
+  while (true) {
+    KeyToGroup.clear();
+    uint32_t NumNewGroups = 0;
+    for (uint32_t I = 0; I < NumTypes; ++I) {
+      Key.clear();
+      Key.push_back(Groups[I + 1]);
+      for (uint32_t *Ref : Refs[I]) {
+        assert(*Ref <= NumTypes && "Invalid type id");
+        Key.push_back(Groups[*Ref]);
+      }
+      auto Res = KeyToGroup.try_emplace(Key, NumNewGroups + 1);
+      if (Res.second)
+        ++NumNewGroups;
+      NewGroups[I + 1] = Res.first->second;
+    }
+    Groups.swap(NewGroups);
+    if (NumNewGroups == NumGroups)
+      break;
+    NumGroups = NumNewGroups;
+  }
+
+  // Number the groups in the order of their first type.
+  std::vector<uint32_t> GroupToId(NumGroups + 1, 0);
+  std::vector<uint32_t> NewIds(NumTypes + 1, 0);
+  uint32_t NumKept = 0;
+  for (uint32_t I = 1; I <= NumTypes; ++I) {
+    uint32_t &Id = GroupToId[Groups[I]];
+    if (!Id)
+      Id = ++NumKept;
+    NewIds[I] = Id;
+  }
+  if (NumKept == NumTypes)
+    return;
+
+  std::vector<std::unique_ptr<BTFTypeBase>> KeptEntries;
+  KeptEntries.reserve(NumKept);
+  for (uint32_t I = 0; I < NumTypes; ++I) {
+    // Skip the types whose group already has a representative.
+    if (NewIds[I + 1] != KeptEntries.size() + 1)
+      continue;
+    for (uint32_t *Ref : Refs[I])
+      *Ref = NewIds[*Ref];
+    TypeEntries[I]->setId(NewIds[I + 1]);
+    KeptEntries.push_back(std::move(TypeEntries[I]));
+  }
+  TypeEntries = std::move(KeptEntries);
+  StructTypes.clear();
+
+  // .BTF.ext refers to the types as well.
+  for (auto &FuncSec : FuncInfoTable)
+    for (auto &FuncInfo : FuncSec.second)
+      FuncInfo.TypeId = NewIds[FuncInfo.TypeId];
+  for (auto &FieldRelocSec : FieldRelocTable)
+    for (auto &FieldReloc : FieldRelocSec.second)
+      FieldReloc.TypeID = NewIds[FieldReloc.TypeID];
+}
+
 void BTFDebug::beginFunctionImpl(const MachineFunction *MF) {
   auto *SP = MF->getFunction().getSubprogram();
   auto *Unit = SP->getUnit();
@@ -1026,6 +1216,9 @@ void BTFDebug::generatePatchImmReloc(const MCSymbol *ORSym, uint32_t RootId,
     FieldReloc.OffsetNameOff = addString("0");
     FieldReloc.RelocKind = std::stoull(std::string(RelocStr));
     PatchImms[GVar] = std::make_pair(RootId, FieldReloc.RelocKind);
+    // The type id is emitted as an instruction immediate before the types
+    // are finalized, so it must not be renumbered later.
+    TypeIdsInText = true;
   }
   FieldRelocTable[SecNameOff].push_back(FieldReloc);
 }
@@ -1360,6 +1553,9 @@ void BTFDebug::endModule() {
   for (const auto &TypeEntry : TypeEntries)
     TypeEntry->completeType(*this);
 
+  if (BTFDedup && !TypeIdsInText)
+    dedupTypes();
+
   // Emit BTF sections.
   emitBTFSection();
   emitBTFExtSection();
@@ -14,6 +14,7 @@
 #ifndef LLVM_LIB_TARGET_BPF_BTFDEBUG_H
 #define LLVM_LIB_TARGET_BPF_BTFDEBUG_H
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/CodeGen/DebugHandlerBase.h"
 #include <cstdint>
@@ -57,6 +58,17 @@ public:
   virtual void completeType(BTFDebug &BDebug) {}
   /// Emit types for this BTF type entry.
   virtual void emitType(MCStreamer &OS);
+
+  /// Type deduplication support. Only valid after completeType.
+  /// @{
+  /// Whether this entry may be merged with a structurally identical one.
+  virtual bool canDedup() { return true; }
+  /// Append all fields of this entry, except for type ids, to \p Key.
+  virtual void getDedupKey(SmallVectorImpl<uint32_t> &Key);
+  /// Append the fields of this entry holding type ids to \p Refs, so they
+  /// can be compared and renumbered.
+  virtual void getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) {}
+  /// @}
 };
 
 /// Handle several derived types include pointer, const,
@@ -69,6 +81,7 @@ public:
   BTFTypeDerived(const DIDerivedType *Ty, unsigned Tag, bool NeedsFixup);
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  void getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) override;
   void setPointeeType(uint32_t PointeeType);
 };
 
@@ -93,6 +106,7 @@ public:
   uint32_t getSize() override { return BTFTypeBase::getSize() + sizeof(uint32_t); }
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  void getDedupKey(SmallVectorImpl<uint32_t> &Key) override;
 };
 
 /// Handle enumerate type.
@@ -107,6 +121,7 @@ public:
   }
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  void getDedupKey(SmallVectorImpl<uint32_t> &Key) override;
 };
 
 /// Handle array type.
@@ -118,6 +133,8 @@ public:
   uint32_t getSize() override { return BTFTypeBase::getSize() + BTF::BTFArraySize; }
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  void getDedupKey(SmallVectorImpl<uint32_t> &Key) override;
+  void getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) override;
 };
 
 /// Handle struct/union type.
@@ -134,6 +151,8 @@ public:
   }
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  void getDedupKey(SmallVectorImpl<uint32_t> &Key) override;
+  void getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) override;
   std::string getName();
 };
 
@@ -151,6 +170,8 @@ public:
   }
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  void getDedupKey(SmallVectorImpl<uint32_t> &Key) override;
+  void getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) override;
 };
 
 /// Handle subprogram
@@ -162,6 +183,8 @@ public:
   uint32_t getSize() override { return BTFTypeBase::getSize(); }
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  bool canDedup() override { return false; }
+  void getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) override;
 };
 
 /// Handle variable instances
@@ -174,6 +197,8 @@ public:
   uint32_t getSize() override { return BTFTypeBase::getSize() + 4; }
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  bool canDedup() override { return false; }
+  void getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) override;
 };
 
 /// Handle data sections
@@ -193,6 +218,8 @@ public:
   std::string getName() { return Name; }
   void completeType(BTFDebug &BDebug) override;
   void emitType(MCStreamer &OS) override;
+  bool canDedup() override { return false; }
+  void getTypeRefs(SmallVectorImpl<uint32_t *> &Refs) override;
 };
 
 /// Handle binary floating point type.
@@ -202,23 +229,22 @@ class BTFTypeFloat : public BTFTypeBase {
 public:
   BTFTypeFloat(uint32_t SizeInBits, StringRef TypeName);
   void completeType(BTFDebug &BDebug) override;
+  void getDedupKey(SmallVectorImpl<uint32_t> &Key) override;
 };
 
 /// String table.
 class BTFStringTable {
-  /// String table size in bytes.
-  uint32_t Size;
-  /// A mapping from string table offset to the index
-  /// of the Table. It is used to avoid putting
-  /// duplicated strings in the table.
-  std::map<uint32_t, uint32_t> OffsetToIdMap;
-  /// A vector of strings to represent the string table.
-  std::vector<std::string> Table;
+  /// The string table as it is emitted, with every string
+  /// followed by a null byte.
+  std::string Data;
+  /// A mapping from a string to its offset in Data.
+  /// It is used to avoid putting duplicated strings
+  /// in the table.
+  StringMap<uint32_t> StringToOffsetMap;
 
 public:
-  BTFStringTable() : Size(0) {}
-  uint32_t getSize() { return Size; }
-  std::vector<std::string> &getTable() { return Table; }
+  uint32_t getSize() { return Data.size(); }
+  StringRef getData() { return Data; }
   /// Add a string to the string table and returns its offset
   /// in the table.
   uint32_t addString(StringRef S);
@@ -255,6 +281,7 @@ class BTFDebug : public DebugHandlerBase {
   uint32_t SecNameOff;
   uint32_t ArrayIndexTypeId;
   bool MapDefNotCollected;
+  bool TypeIdsInText;
   BTFStringTable StringTable;
   std::vector<std::unique_ptr<BTFTypeBase>> TypeEntries;
   std::unordered_map<const DIType *, uint32_t> DIToIdMap;
@@ -323,6 +350,9 @@ class BTFDebug : public DebugHandlerBase {
   /// Process relocation instructions.
   void processReloc(const MachineOperand &MO);
 
+  /// Merge structurally identical types and renumber the remaining ones.
+  void dedupTypes();
+
   /// Emit common header of .BTF and .BTF.ext sections.
   void emitCommonHeader();
 
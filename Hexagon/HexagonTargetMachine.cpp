@@ -255,6 +255,7 @@ HexagonTargetMachine::getSubtargetImpl(const Function &F) const {
       F.getFnAttribute("unsafe-fp-math").getValueAsString() == "true")
     FS = FS.empty() ? "+unsafe-fp" : "+unsafe-fp," + FS;
 
+  std::lock_guard<std::mutex> Lock(SubtargetMapMutex);
   auto &I = SubtargetMap[CPU + FS];
   if (!I) {
     // This needs to be done before we create a new subtarget since any
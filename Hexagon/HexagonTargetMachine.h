@@ -17,6 +17,7 @@
 #include "HexagonSubtarget.h"
 #include "HexagonTargetObjectFile.h"
 #include "llvm/Target/TargetMachine.h"
+#include <mutex>
 
 namespace llvm {
 
@@ -25,6 +26,7 @@ class Module;
 class HexagonTargetMachine : public LLVMTargetMachine {
   std::unique_ptr<TargetLoweringObjectFile> TLOF;
   mutable StringMap<std::unique_ptr<HexagonSubtarget>> SubtargetMap;
+  mutable std::mutex SubtargetMapMutex;
 
 public:
   HexagonTargetMachine(const Target &T, const Triple &TT, StringRef CPU,
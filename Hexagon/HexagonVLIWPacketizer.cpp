@@ -24,6 +24,8 @@
 #include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
@@ -55,6 +57,9 @@ using namespace llvm;
 
 #define DEBUG_TYPE "packets"
 
+STATISTIC(NumDepEdgesScanned,
+          "Number of dependence edges examined to form packets");
+
 static cl::opt<bool> DisablePacketizer("disable-packetizer", cl::Hidden,
   cl::ZeroOrMore, cl::init(false),
   cl::desc("Disable Hexagon packetizer pass"));
@@ -325,6 +330,26 @@ bool HexagonPacketizerList::isCallDependent(const MachineInstr &MI,
   return false;
 }
 
+// Collect the dependences of To on From, in the order they were added. In
+// large blocks a producer can have thousands of successors (e.g. a base
+// register used by every load of an unrolled loop), so walk the shorter of
+// the two edge lists. Edges between the same two nodes appear in the same
+// order in both.
+static void getDepsBetween(const SUnit *From, const SUnit *To,
+                           SmallVectorImpl<SDep> &Deps) {
+  if (To->Preds.size() < From->Succs.size()) {
+    NumDepEdgesScanned += To->Preds.size();
+    for (const SDep &Pred : To->Preds)
+      if (Pred.getSUnit() == From)
+        Deps.push_back(Pred);
+  } else {
+    NumDepEdgesScanned += From->Succs.size();
+    for (const SDep &Succ : From->Succs)
+      if (Succ.getSUnit() == To)
+        Deps.push_back(Succ);
+  }
+}
+
 static bool isRegDependence(const SDep::Kind DepType) {
   return DepType == SDep::Data || DepType == SDep::Anti ||
          DepType == SDep::Output;
@@ -932,14 +957,11 @@ bool HexagonPacketizerList::restrictingDepExistInPacket(MachineInstr &MI,
     // Look at dependencies between current members of the packet and
     // predicate defining instruction MI. Make sure that dependency is
     // on the exact register we care about.
-    if (PacketSU->isSucc(PacketSUDep)) {
-      for (unsigned i = 0; i < PacketSU->Succs.size(); ++i) {
-        auto &Dep = PacketSU->Succs[i];
-        if (Dep.getSUnit() == PacketSUDep && Dep.getKind() == SDep::Anti &&
-            Dep.getReg() == DepReg)
-          return true;
-      }
-    }
+    SmallVector<SDep, 4> Deps;
+    getDepsBetween(PacketSU, PacketSUDep, Deps);
+    for (const SDep &Dep : Deps)
+      if (Dep.getKind() == SDep::Anti && Dep.getReg() == DepReg)
+        return true;
   }
 
   return false;
@@ -996,23 +1018,22 @@ bool HexagonPacketizerList::arePredicatesComplements(MachineInstr &MI1,
     SUnit *PacketSU = MIToSUnit.find(I)->second;
 
     // If this instruction in the packet is succeeded by the candidate...
-    if (PacketSU->isSucc(SU)) {
-      for (unsigned i = 0; i < PacketSU->Succs.size(); ++i) {
-        auto Dep = PacketSU->Succs[i];
-        // The corner case exist when there is true data dependency between
-        // candidate and one of current packet members, this dep is on
-        // predicate reg, and there already exist anti dep on the same pred in
-        // the packet.
-        if (Dep.getSUnit() == SU && Dep.getKind() == SDep::Data &&
-            Hexagon::PredRegsRegClass.contains(Dep.getReg())) {
-          // Here I know that I is predicate setting instruction with true
-          // data dep to candidate on the register we care about - c) in the
-          // above example. Now I need to see if there is an anti dependency
-          // from c) to any other instruction in the same packet on the pred
-          // reg of interest.
-          if (restrictingDepExistInPacket(*I, Dep.getReg()))
-            return false;
-        }
+    SmallVector<SDep, 4> Deps;
+    getDepsBetween(PacketSU, SU, Deps);
+    for (const SDep &Dep : Deps) {
+      // The corner case exist when there is true data dependency between
+      // candidate and one of current packet members, this dep is on
+      // predicate reg, and there already exist anti dep on the same pred in
+      // the packet.
+      if (Dep.getKind() == SDep::Data &&
+          Hexagon::PredRegsRegClass.contains(Dep.getReg())) {
+        // Here I know that I is predicate setting instruction with true
+        // data dep to candidate on the register we care about - c) in the
+        // above example. Now I need to see if there is an anti dependency
+        // from c) to any other instruction in the same packet on the pred
+        // reg of interest.
+        if (restrictingDepExistInPacket(*I, Dep.getReg()))
+          return false;
       }
     }
   }
@@ -1396,18 +1417,18 @@ bool HexagonPacketizerList::isLegalToPacketizeTogether(SUnit *SUI, SUnit *SUJ) {
       return false;
   }
 
+  SmallVector<SDep, 4> Deps;
+  getDepsBetween(SUJ, SUI, Deps);
+
   // There no dependency between a prolog instruction and its successor.
-  if (!SUJ->isSucc(SUI))
+  if (Deps.empty())
     return true;
 
-  for (unsigned i = 0; i < SUJ->Succs.size(); ++i) {
+  for (unsigned i = 0; i < Deps.size(); ++i) {
     if (FoundSequentialDependence)
       break;
 
-    if (SUJ->Succs[i].getSUnit() != SUI)
-      continue;
-
-    SDep::Kind DepType = SUJ->Succs[i].getKind();
+    SDep::Kind DepType = Deps[i].getKind();
     // For direct calls:
     // Ignore register dependences for call instructions for packetization
     // purposes except for those due to r31 and predicate registers.
@@ -1426,14 +1447,14 @@ bool HexagonPacketizerList::isLegalToPacketizeTogether(SUnit *SUI, SUnit *SUJ) {
     unsigned DepReg = 0;
     const TargetRegisterClass *RC = nullptr;
     if (DepType == SDep::Data) {
-      DepReg = SUJ->Succs[i].getReg();
+      DepReg = Deps[i].getReg();
       RC = HRI->getMinimalPhysRegClass(DepReg);
     }
 
     if (I.isCall() || HII->isJumpR(I) || I.isReturn() || HII->isTailCall(I)) {
       if (!isRegDependence(DepType))
         continue;
-      if (!isCallDependent(I, DepType, SUJ->Succs[i].getReg()))
+      if (!isCallDependent(I, DepType, Deps[i].getReg()))
         continue;
     }
 
@@ -24,5 +24,6 @@ class FunctionPass;
 
 FunctionPass *createM88kISelDag(M88kTargetMachine &TM,
                                 CodeGenOpt::Level OptLevel);
+FunctionPass *createM88kDelaySlotFillerPass();
 } // end namespace llvm
 #endif
\ No newline at end of file
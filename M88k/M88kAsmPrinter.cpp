@@ -72,19 +72,28 @@ bool M88kAsmPrinter::PrintAsmOperand(const MachineInstr *MI, unsigned OpNo,
 }
 
 void M88kAsmPrinter::emitInstruction(const MachineInstr *MI) {
-  MCInst LoweredMI;
-  switch (MI->getOpcode()) {
-  case M88k::RET:
-    LoweredMI = MCInstBuilder(M88k::JMP).addReg(M88k::R1);
-    break;
+  // A bundle is a branch followed by the instruction in its delay slot.
+  MachineBasicBlock::const_instr_iterator I = MI->getIterator();
+  MachineBasicBlock::const_instr_iterator E = MI->getParent()->instr_end();
+  do {
+    MCInst LoweredMI;
+    switch (I->getOpcode()) {
+    case M88k::RET:
+      LoweredMI = MCInstBuilder(M88k::JMP).addReg(M88k::R1);
+      break;
 
-  default:
-    M88kMCInstLower Lower(MF->getContext(), *this);
-    Lower.lower(MI, LoweredMI);
-    // doLowerInstr(MI, LoweredMI);
-    break;
-  }
-  EmitToStreamer(*OutStreamer, LoweredMI);
+    case M88k::RETn:
+      LoweredMI = MCInstBuilder(M88k::JMPn).addReg(M88k::R1);
+      break;
+
+    default:
+      M88kMCInstLower Lower(MF->getContext(), *this);
+      Lower.lower(&*I, LoweredMI);
+      // doLowerInstr(MI, LoweredMI);
+      break;
+    }
+    EmitToStreamer(*OutStreamer, LoweredMI);
+  } while ((++I != E) && I->isInsideBundle());
 }
 
 // Force static initialization.
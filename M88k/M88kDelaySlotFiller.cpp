@@ -0,0 +1,251 @@
+//===-- M88kDelaySlotFiller.cpp - M88k delay slot filler ------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This is a simple local pass that moves instructions into the delay slot of
+// branches, calls and returns. The M88k flow control instructions come in two
+// forms: the plain form has no delay slot, and the .n form always executes the
+// next instruction before control is transferred. If an earlier instruction
+// of the block can be executed after the branch without changing the result,
+// it is moved behind the branch, the branch is changed into the .n form and
+// both are bundled. Unlike on SPARC, no nop is needed when the slot cannot be
+// filled, since the plain form is kept.
+//
+//===----------------------------------------------------------------------===//
+
+#include "M88k.h"
+#include "M88kInstrInfo.h"
+#include "M88kSubtarget.h"
+#include "llvm/ADT/SmallSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineInstrBundle.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/TargetRegisterInfo.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "m88k-delay-slot-filler"
+
+STATISTIC(FilledSlots, "Number of delay slots filled");
+
+static cl::opt<bool> DisableDelaySlotFiller(
+    "disable-m88k-delay-filler", cl::init(false),
+    cl::desc("Disable the M88k delay slot filler."), cl::Hidden);
+
+namespace {
+
+class M88kDelaySlotFiller : public MachineFunctionPass {
+  const TargetInstrInfo *TII = nullptr;
+  const TargetRegisterInfo *TRI = nullptr;
+
+public:
+  static char ID;
+  M88kDelaySlotFiller() : MachineFunctionPass(ID) {}
+
+  StringRef getPassName() const override { return "M88k Delay Slot Filler"; }
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+  MachineFunctionProperties getRequiredProperties() const override {
+    return MachineFunctionProperties().set(
+        MachineFunctionProperties::Property::NoVRegs);
+  }
+
+private:
+  bool runOnMachineBasicBlock(MachineBasicBlock &MBB);
+
+  MachineBasicBlock::iterator findDelayInstr(MachineBasicBlock &MBB,
+                                             MachineBasicBlock::iterator Slot);
+
+  void insertDefsUses(const MachineInstr &MI, SmallSet<unsigned, 32> &RegDefs,
+                      SmallSet<unsigned, 32> &RegUses) const;
+
+  bool isRegInSet(const SmallSet<unsigned, 32> &RegSet, unsigned Reg) const;
+
+  bool delayHasHazard(const MachineInstr &Candidate, bool SawLoad,
+                      bool SawStore, const SmallSet<unsigned, 32> &RegDefs,
+                      const SmallSet<unsigned, 32> &RegUses) const;
+};
+
+char M88kDelaySlotFiller::ID = 0;
+
+} // end anonymous namespace
+
+// Return the .n form of a flow control instruction, or 0 if it has none.
+static unsigned getDelaySlotOpcode(unsigned Opcode) {
+  switch (Opcode) {
+  case M88k::BR:
+    return M88k::BRn;
+  case M88k::JMP:
+    return M88k::JMPn;
+  case M88k::JSR:
+    return M88k::JSRn;
+  case M88k::RET:
+    return M88k::RETn;
+  default:
+    return 0;
+  }
+}
+
+// Return true if MI may not be moved across, so that the search for a delay
+// slot candidate has to stop there.
+static bool isSearchBarrier(const MachineInstr &MI) {
+  return MI.isBundled() || MI.isTerminator() || MI.isCall() ||
+         MI.isBranch() || MI.hasDelaySlot() || MI.isInlineAsm() ||
+         MI.isPosition() || MI.hasUnmodeledSideEffects();
+}
+
+bool M88kDelaySlotFiller::runOnMachineFunction(MachineFunction &MF) {
+  if (DisableDelaySlotFiller || skipFunction(MF.getFunction()))
+    return false;
+
+  TII = MF.getSubtarget().getInstrInfo();
+  TRI = MF.getSubtarget().getRegisterInfo();
+
+  // This pass invalidates liveness information when it reorders
+  // instructions to fill delay slot.
+  MF.getRegInfo().invalidateLiveness();
+
+  bool Changed = false;
+  for (MachineBasicBlock &MBB : MF)
+    Changed |= runOnMachineBasicBlock(MBB);
+  return Changed;
+}
+
+/// runOnMachineBasicBlock - Fill in delay slots for the given basic block.
+/// There is only one delay slot per delayed instruction.
+bool M88kDelaySlotFiller::runOnMachineBasicBlock(MachineBasicBlock &MBB) {
+  bool Changed = false;
+
+  for (MachineBasicBlock::iterator I = MBB.begin(); I != MBB.end();) {
+    MachineBasicBlock::iterator MI = I;
+    ++I;
+
+    unsigned DelayOpc = getDelaySlotOpcode(MI->getOpcode());
+    if (!DelayOpc || MI->isBundled())
+      continue;
+
+    MachineBasicBlock::iterator D = findDelayInstr(MBB, MI);
+    if (D == MBB.end())
+      continue;
+
+    LLVM_DEBUG(dbgs() << "Moving into delay slot: " << *D);
+    MBB.splice(I, &MBB, D);
+    MI->setDesc(TII->get(DelayOpc));
+    // Bundle the delay slot instruction with the branch, so that nothing is
+    // placed between them.
+    MIBundleBuilder(MBB, MI, I);
+    ++FilledSlots;
+    Changed = true;
+  }
+  return Changed;
+}
+
+/// Search backwards from Slot for an instruction which can be executed after
+/// it instead. Returns MBB.end() if there is none.
+MachineBasicBlock::iterator
+M88kDelaySlotFiller::findDelayInstr(MachineBasicBlock &MBB,
+                                    MachineBasicBlock::iterator Slot) {
+  SmallSet<unsigned, 32> RegDefs;
+  SmallSet<unsigned, 32> RegUses;
+  bool SawLoad = false;
+  bool SawStore = false;
+
+  // The candidate executes after the branch has read and written its
+  // registers. A call also overwrites the return address register.
+  insertDefsUses(*Slot, RegDefs, RegUses);
+  if (Slot->isCall())
+    RegDefs.insert(M88k::R1);
+
+  if (Slot == MBB.begin())
+    return MBB.end();
+
+  MachineBasicBlock::reverse_iterator I = ++Slot.getReverse();
+  for (MachineBasicBlock::reverse_iterator E = MBB.rend(); I != E; ++I) {
+    MachineInstr &Candidate = *I;
+
+    // Skip debug value.
+    if (Candidate.isDebugInstr())
+      continue;
+
+    if (isSearchBarrier(Candidate))
+      break;
+
+    // Pseudo instructions may expand to any number of instructions. Step over
+    // them, but keep track of what they touch.
+    if (!Candidate.isPseudo() &&
+        !delayHasHazard(Candidate, SawLoad, SawStore, RegDefs, RegUses))
+      return Candidate.getIterator();
+
+    insertDefsUses(Candidate, RegDefs, RegUses);
+    SawLoad |= Candidate.mayLoad();
+    SawStore |= Candidate.mayStore();
+  }
+  return MBB.end();
+}
+
+/// Return true if moving Candidate behind all instructions whose registers
+/// and memory accesses have been collected so far changes the semantics.
+bool M88kDelaySlotFiller::delayHasHazard(
+    const MachineInstr &Candidate, bool SawLoad, bool SawStore,
+    const SmallSet<unsigned, 32> &RegDefs,
+    const SmallSet<unsigned, 32> &RegUses) const {
+  // Loads may not be moved across stores, and stores may not be moved across
+  // any memory access.
+  if (Candidate.mayLoad() && SawStore)
+    return true;
+  if (Candidate.mayStore() && (SawStore || SawLoad))
+    return true;
+
+  for (const MachineOperand &MO : Candidate.operands()) {
+    if (MO.isRegMask())
+      return true;
+    if (!MO.isReg() || !MO.getReg())
+      continue;
+
+    Register Reg = MO.getReg();
+    if (MO.isDef()) {
+      // Reg is read or written by a later instruction.
+      if (isRegInSet(RegUses, Reg) || isRegInSet(RegDefs, Reg))
+        return true;
+    } else if (isRegInSet(RegDefs, Reg)) {
+      // Reg is written by a later instruction.
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Insert the registers defined and used by MI into the sets.
+void M88kDelaySlotFiller::insertDefsUses(
+    const MachineInstr &MI, SmallSet<unsigned, 32> &RegDefs,
+    SmallSet<unsigned, 32> &RegUses) const {
+  for (const MachineOperand &MO : MI.operands()) {
+    if (!MO.isReg() || !MO.getReg())
+      continue;
+    if (MO.isDef())
+      RegDefs.insert(MO.getReg());
+    else
+      RegUses.insert(MO.getReg());
+  }
+}
+
+/// Return true if any register in RegSet overlaps Reg.
+bool M88kDelaySlotFiller::isRegInSet(const SmallSet<unsigned, 32> &RegSet,
+                                     unsigned Reg) const {
+  return llvm::any_of(RegSet, [&](unsigned SetReg) {
+    return TRI->regsOverlap(SetReg, Reg);
+  });
+}
+
+/// Returns a pass that fills in delay slots in M88k MachineFunctions.
+FunctionPass *llvm::createM88kDelaySlotFillerPass() {
+  return new M88kDelaySlotFiller();
+}
\ No newline at end of file
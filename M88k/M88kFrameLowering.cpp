@@ -9,10 +9,12 @@
 #include "M88kFrameLowering.h"
 //#include "M88kCallingConv.h"
 //#include "M88kInstrBuilder.h"
-//#include "M88kInstrInfo.h"
+#include "M88kInstrInfo.h"
 //#include "M88kMachineFunctionInfo.h"
 #include "M88kRegisterInfo.h"
 #include "M88kSubtarget.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/RegisterScavenging.h"
@@ -26,10 +28,256 @@ M88kFrameLowering::M88kFrameLowering()
                           Align(8), false /* StackRealignable */),
       RegSpillOffsets(0) {}
 
+// The stack frame follows the 88open ELF ABI. Once the prologue has run, the
+// stack pointer r31 points to the bottom of the frame and all objects are at
+// positive offsets from it. If a frame pointer is needed, r30 is set to the
+// same address, so that the offsets stay valid when the stack pointer moves.
+//
+//   +------------------------+  <- incoming r31
+//   | callee saved registers |
+//   | (r1, pairs via st.d)   |
+//   +------------------------+
+//   | locals and spill slots |
+//   +------------------------+
+//   | outgoing arguments     |
+//   +------------------------+  <- r31 (and r30)
+//
+// Leaf functions which need no stack do not allocate a frame at all.
+
+// Add Amount to the stack pointer.
+void M88kFrameLowering::adjustStackPtr(MachineBasicBlock &MBB,
+                                       MachineBasicBlock::iterator MBBI,
+                                       const DebugLoc &DL, int64_t Amount,
+                                       MachineInstr::MIFlag Flag) const {
+  const TargetInstrInfo &TII = *MBB.getParent()->getSubtarget().getInstrInfo();
+  uint64_t AbsAmount = Amount < 0 ? -static_cast<uint64_t>(Amount) : Amount;
+  assert(isUInt<32>(AbsAmount) && "Stack frame too large");
+
+  if (isUInt<16>(AbsAmount)) {
+    BuildMI(MBB, MBBI, DL, TII.get(Amount < 0 ? M88k::SUBUri : M88k::ADDUri),
+            M88k::R31)
+        .addReg(M88k::R31)
+        .addImm(AbsAmount)
+        .setMIFlag(Flag);
+    return;
+  }
+
+  // Materialize the amount in r13. It is a temporary register which is
+  // neither used to pass arguments nor to return values, so it is free at
+  // function entry and exit.
+  BuildMI(MBB, MBBI, DL, TII.get(M88k::ORriu), M88k::R13)
+      .addReg(M88k::R0)
+      .addImm(AbsAmount >> 16)
+      .setMIFlag(Flag);
+  BuildMI(MBB, MBBI, DL, TII.get(M88k::ORri), M88k::R13)
+      .addReg(M88k::R13, RegState::Kill)
+      .addImm(AbsAmount & 0xffff)
+      .setMIFlag(Flag);
+  BuildMI(MBB, MBBI, DL, TII.get(Amount < 0 ? M88k::SUBUrr : M88k::ADDUrr),
+          M88k::R31)
+      .addReg(M88k::R31)
+      .addReg(M88k::R13, RegState::Kill)
+      .setMIFlag(Flag);
+}
+
 void M88kFrameLowering::emitPrologue(MachineFunction &MF,
-                                     MachineBasicBlock &MBB) const {}
+                                     MachineBasicBlock &MBB) const {
+  assert(&MF.front() == &MBB && "Shrink-wrapping not yet supported");
+  MachineFrameInfo &MFI = MF.getFrameInfo();
+  const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+  MachineBasicBlock::iterator MBBI = MBB.begin();
+  DebugLoc DL = MBBI != MBB.end() ? MBBI->getDebugLoc() : DebugLoc();
+
+  // The stack pointer must always be aligned, also in leaf functions.
+  uint64_t StackSize = alignTo(MFI.getStackSize(), getStackAlign());
+  MFI.setStackSize(StackSize);
+
+  // Leaf functions without locals and spills don't need a frame.
+  if (StackSize == 0)
+    return;
+
+  // Allocate the frame. The callee saved registers are stored after this,
+  // at positive offsets from the new stack pointer.
+  adjustStackPtr(MBB, MBBI, DL, -static_cast<int64_t>(StackSize),
+                 MachineInstr::FrameSetup);
+
+  if (hasFP(MF)) {
+    // Set up the frame pointer after the old value has been saved.
+    while (MBBI != MBB.end() && MBBI->getFlag(MachineInstr::FrameSetup))
+      ++MBBI;
+    BuildMI(MBB, MBBI, DL, TII.get(M88k::ORrr), M88k::R30)
+        .addReg(M88k::R31)
+        .addReg(M88k::R0)
+        .setMIFlag(MachineInstr::FrameSetup);
+  }
+}
 
 void M88kFrameLowering::emitEpilogue(MachineFunction &MF,
-                                     MachineBasicBlock &MBB) const {}
+                                     MachineBasicBlock &MBB) const {
+  const MachineFrameInfo &MFI = MF.getFrameInfo();
+  const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+  MachineBasicBlock::iterator MBBI = MBB.getLastNonDebugInstr();
+  DebugLoc DL = MBBI != MBB.end() ? MBBI->getDebugLoc() : DebugLoc();
+
+  uint64_t StackSize = MFI.getStackSize();
+  if (StackSize == 0)
+    return;
+
+  if (hasFP(MF)) {
+    // The stack pointer may have been moved by dynamic allocations. Reset it
+    // from the frame pointer before the callee saved registers are restored,
+    // since restoring them overwrites the frame pointer.
+    MachineBasicBlock::iterator I = MBBI;
+    while (I != MBB.begin() &&
+           std::prev(I)->getFlag(MachineInstr::FrameDestroy))
+      --I;
+    BuildMI(MBB, I, DL, TII.get(M88k::ORrr), M88k::R31)
+        .addReg(M88k::R30)
+        .addReg(M88k::R0)
+        .setMIFlag(MachineInstr::FrameDestroy);
+  }
+
+  // Deallocate the frame.
+  adjustStackPtr(MBB, MBBI, DL, StackSize, MachineInstr::FrameDestroy);
+}
+
+bool M88kFrameLowering::hasFP(const MachineFunction &MF) const {
+  const MachineFrameInfo &MFI = MF.getFrameInfo();
+  return MF.getTarget().Options.DisableFramePointerElim(MF) ||
+         MFI.hasVarSizedObjects() || MFI.isFrameAddressTaken();
+}
+
+void M88kFrameLowering::determineCalleeSaves(MachineFunction &MF,
+                                             BitVector &SavedRegs,
+                                             RegScavenger *RS) const {
+  TargetFrameLowering::determineCalleeSaves(MF, SavedRegs, RS);
+
+  // Calls overwrite the return address in r1.
+  if (MF.getFrameInfo().hasCalls())
+    SavedRegs.set(M88k::R1);
+
+  // The caller's frame pointer is overwritten if this function sets up its
+  // own.
+  if (hasFP(MF))
+    SavedRegs.set(M88k::R30);
+}
+
+// Return the index of the register which is saved together with CSI[Idx]
+// by a double word store, or -1 if it is saved alone. Both registers share
+// one 8 byte stack slot, see assignCalleeSavedSpillSlots().
+static int getPairedCSIIndex(ArrayRef<CalleeSavedInfo> CSI, unsigned Idx) {
+  for (unsigned I = 0, E = CSI.size(); I != E; ++I)
+    if (I != Idx && CSI[I].getFrameIdx() == CSI[Idx].getFrameIdx())
+      return I;
+  return -1;
+}
+
+bool M88kFrameLowering::assignCalleeSavedSpillSlots(
+    MachineFunction &MF, const TargetRegisterInfo *TRI,
+    std::vector<CalleeSavedInfo> &CSI) const {
+  MachineFrameInfo &MFI = MF.getFrameInfo();
+
+  // Registers rN (N even) and rN+1 can be saved and restored with a single
+  // st.d/ld.d if both need saving. Such a pair gets one 8 byte aligned slot,
+  // with rN at the lower address.
+  SmallVector<bool, 16> Assigned(CSI.size(), false);
+  for (unsigned I = 0, E = CSI.size(); I != E; ++I) {
+    if (Assigned[I])
+      continue;
+    unsigned Enc = TRI->getEncodingValue(CSI[I].getReg());
+    int Partner = -1;
+    if (Enc % 2 == 0)
+      for (unsigned J = 0; J != E; ++J)
+        if (!Assigned[J] && TRI->getEncodingValue(CSI[J].getReg()) == Enc + 1)
+          Partner = J;
+
+    if (Partner >= 0) {
+      int FrameIdx = MFI.CreateStackObject(8, Align(8), true);
+      CSI[I].setFrameIdx(FrameIdx);
+      CSI[Partner].setFrameIdx(FrameIdx);
+      Assigned[Partner] = true;
+    } else {
+      CSI[I].setFrameIdx(MFI.CreateStackObject(4, Align(4), true));
+    }
+    Assigned[I] = true;
+  }
+  return true;
+}
+
+bool M88kFrameLowering::spillCalleeSavedRegisters(
+    MachineBasicBlock &MBB, MachineBasicBlock::iterator MBBI,
+    ArrayRef<CalleeSavedInfo> CSI, const TargetRegisterInfo *TRI) const {
+  if (CSI.empty())
+    return false;
+
+  MachineFunction &MF = *MBB.getParent();
+  const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+  DebugLoc DL = MBBI != MBB.end() ? MBBI->getDebugLoc() : DebugLoc();
+
+  for (unsigned I = 0, E = CSI.size(); I != E; ++I) {
+    Register Reg = CSI[I].getReg();
+    int Partner = getPairedCSIIndex(CSI, I);
+    // The even register of a pair stores both.
+    if (Partner >= 0 && TRI->getEncodingValue(Reg) >
+                            TRI->getEncodingValue(CSI[Partner].getReg()))
+      continue;
+
+    // Add the callee-saved register as live-in. It's killed at the spill.
+    MBB.addLiveIn(Reg);
+    MachineInstrBuilder MIB =
+        BuildMI(MBB, MBBI, DL,
+                TII.get(Partner >= 0 ? M88k::STrid : M88k::STriw))
+            .addReg(Reg, RegState::Kill)
+            .addFrameIndex(CSI[I].getFrameIdx())
+            .addImm(0)
+            .setMIFlag(MachineInstr::FrameSetup);
+    if (Partner >= 0) {
+      Register PartnerReg = CSI[Partner].getReg();
+      MBB.addLiveIn(PartnerReg);
+      MIB.addReg(PartnerReg, RegState::Implicit | RegState::Kill);
+    }
+  }
+  return true;
+}
+
+bool M88kFrameLowering::restoreCalleeSavedRegisters(
+    MachineBasicBlock &MBB, MachineBasicBlock::iterator MBBI,
+    MutableArrayRef<CalleeSavedInfo> CSI, const TargetRegisterInfo *TRI) const {
+  if (CSI.empty())
+    return false;
+
+  MachineFunction &MF = *MBB.getParent();
+  const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+  DebugLoc DL = MBBI != MBB.end() ? MBBI->getDebugLoc() : DebugLoc();
+
+  for (unsigned I = 0, E = CSI.size(); I != E; ++I) {
+    Register Reg = CSI[I].getReg();
+    int Partner = getPairedCSIIndex(CSI, I);
+    // The even register of a pair loads both.
+    if (Partner >= 0 && TRI->getEncodingValue(Reg) >
+                            TRI->getEncodingValue(CSI[Partner].getReg()))
+      continue;
+
+    MachineInstrBuilder MIB =
+        BuildMI(MBB, MBBI, DL,
+                TII.get(Partner >= 0 ? M88k::LDrid : M88k::LDriw), Reg)
+            .addFrameIndex(CSI[I].getFrameIdx())
+            .addImm(0)
+            .setMIFlag(MachineInstr::FrameDestroy);
+    if (Partner >= 0)
+      MIB.addReg(CSI[Partner].getReg(), RegState::ImplicitDefine);
+  }
+  return true;
+}
 
-bool M88kFrameLowering::hasFP(const MachineFunction &MF) const { return false; }
\ No newline at end of file
+void M88kFrameLowering::processFunctionBeforeFrameFinalized(
+    MachineFunction &MF, RegScavenger *RS) const {
+  // The memory instructions only have 16 bit unsigned offsets. If the frame
+  // may be larger than that, reserve an emergency spill slot for the register
+  // scavenger, which is needed to materialize large offsets.
+  MachineFrameInfo &MFI = MF.getFrameInfo();
+  if (RS && !isUInt<16>(MFI.estimateStackSize(MF))) {
+    int FrameIdx = MFI.CreateStackObject(4, Align(4), false);
+    RS->addScavengingFrameIndex(FrameIdx);
+  }
+}
\ No newline at end of file
@@ -371,7 +371,10 @@ M88kTargetLowering::LowerReturn(SDValue Chain, CallingConv::ID CallConv,
 
 SDValue M88kTargetLowering::LowerCall(CallLoweringInfo &CLI,
                                       SmallVectorImpl<SDValue> &InVals) const {
-  llvm_unreachable("M88k - LowerCall - Not Implemented");
+  // TODO Calls need call frame pseudos, a call node selected to bsr/jsr and
+  // relocations for the callee. Until then, the R1 save in the prologue is
+  // never exercised.
+  report_fatal_error("M88k - LowerCall - Calls are not supported yet");
 }
 
 const char *M88kTargetLowering::getTargetNodeName(unsigned Opcode) const {
@@ -51,4 +51,66 @@ using namespace llvm;
 void M88kInstrInfo::anchor() {}
 
 M88kInstrInfo::M88kInstrInfo(M88kSubtarget &STI)
-    : M88kGenInstrInfo(), RI(), STI(STI) {}
\ No newline at end of file
+    : M88kGenInstrInfo(), RI(), STI(STI) {}
+
+void M88kInstrInfo::copyPhysReg(MachineBasicBlock &MBB,
+                                MachineBasicBlock::iterator MBBI,
+                                const DebugLoc &DL, MCRegister DestReg,
+                                MCRegister SrcReg, bool KillSrc) const {
+  if (M88k::GPRRegClass.contains(DestReg, SrcReg)) {
+    // or rd, rs, r0
+    BuildMI(MBB, MBBI, DL, get(M88k::ORrr), DestReg)
+        .addReg(SrcReg, getKillRegState(KillSrc))
+        .addReg(M88k::R0);
+    return;
+  }
+  llvm_unreachable("Impossible reg-to-reg copy");
+}
+
+void M88kInstrInfo::storeRegToStackSlot(MachineBasicBlock &MBB,
+                                        MachineBasicBlock::iterator MBBI,
+                                        Register SrcReg, bool IsKill,
+                                        int FrameIndex,
+                                        const TargetRegisterClass *RC,
+                                        const TargetRegisterInfo *TRI) const {
+  assert(RC == &M88k::GPRRegClass && "Unexpected register class");
+  DebugLoc DL;
+  if (MBBI != MBB.end())
+    DL = MBBI->getDebugLoc();
+
+  MachineFunction &MF = *MBB.getParent();
+  MachineFrameInfo &MFI = MF.getFrameInfo();
+  MachineMemOperand *MMO = MF.getMachineMemOperand(
+      MachinePointerInfo::getFixedStack(MF, FrameIndex),
+      MachineMemOperand::MOStore, MFI.getObjectSize(FrameIndex),
+      MFI.getObjectAlign(FrameIndex));
+
+  BuildMI(MBB, MBBI, DL, get(M88k::STriw))
+      .addReg(SrcReg, getKillRegState(IsKill))
+      .addFrameIndex(FrameIndex)
+      .addImm(0)
+      .addMemOperand(MMO);
+}
+
+void M88kInstrInfo::loadRegFromStackSlot(MachineBasicBlock &MBB,
+                                         MachineBasicBlock::iterator MBBI,
+                                         Register DestReg, int FrameIndex,
+                                         const TargetRegisterClass *RC,
+                                         const TargetRegisterInfo *TRI) const {
+  assert(RC == &M88k::GPRRegClass && "Unexpected register class");
+  DebugLoc DL;
+  if (MBBI != MBB.end())
+    DL = MBBI->getDebugLoc();
+
+  MachineFunction &MF = *MBB.getParent();
+  MachineFrameInfo &MFI = MF.getFrameInfo();
+  MachineMemOperand *MMO = MF.getMachineMemOperand(
+      MachinePointerInfo::getFixedStack(MF, FrameIndex),
+      MachineMemOperand::MOLoad, MFI.getObjectSize(FrameIndex),
+      MFI.getObjectAlign(FrameIndex));
+
+  BuildMI(MBB, MBBI, DL, get(M88k::LDriw), DestReg)
+      .addFrameIndex(FrameIndex)
+      .addImm(0)
+      .addMemOperand(MMO);
+}
\ No newline at end of file
@@ -19,6 +19,7 @@
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/TargetInstrInfo.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Support/CommandLine.h"
@@ -33,22 +34,76 @@ M88kRegisterInfo::M88kRegisterInfo() : M88kGenRegisterInfo(M88k::R1) {}
 
 const MCPhysReg *
 M88kRegisterInfo::getCalleeSavedRegs(const MachineFunction *MF) const {
-  return CSR_M88k_SaveList;
+  return CSR_M88k_SaveRA_SaveList;
 }
 
 BitVector M88kRegisterInfo::getReservedRegs(const MachineFunction &MF) const {
   BitVector Reserved(getNumRegs());
 
+  // R0 is hardwired to zero.
+  Reserved.set(M88k::R0);
+
   // R31 is the stack pointer.
   Reserved.set(M88k::R31);
 
+  // R30 is the frame pointer, if one is needed.
+  if (getFrameLowering(MF)->hasFP(MF))
+    Reserved.set(M88k::R30);
+
   return Reserved;
 }
 
-void M88kRegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator MI,
+void M88kRegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator II,
                                            int SPAdj, unsigned FIOperandNum,
-                                           RegScavenger *RS) const {}
+                                           RegScavenger *RS) const {
+  assert(SPAdj == 0 && "Unexpected non-zero SPAdj value");
+
+  MachineInstr &MI = *II;
+  MachineBasicBlock &MBB = *MI.getParent();
+  MachineFunction &MF = *MBB.getParent();
+  const MachineFrameInfo &MFI = MF.getFrameInfo();
+  const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+  DebugLoc DL = MI.getDebugLoc();
+
+  int FrameIndex = MI.getOperand(FIOperandNum).getIndex();
+
+  // The frame pointer, if any, is set to the stack pointer after the frame is
+  // allocated, so the offset is the same for both. Objects only have positive
+  // offsets from there, which fit the unsigned immediates of the memory
+  // instructions. The callee saved registers are spilled before the frame
+  // pointer is set up and restored after the stack pointer is reset from it,
+  // so their accesses always go through the stack pointer.
+  int64_t Offset = MFI.getObjectOffset(FrameIndex) + MFI.getStackSize() +
+                   MI.getOperand(FIOperandNum + 1).getImm();
+  assert(Offset >= 0 && "Negative offset from the stack pointer");
+  Register BaseReg = getFrameRegister(MF);
+  if (MI.getFlag(MachineInstr::FrameSetup) ||
+      MI.getFlag(MachineInstr::FrameDestroy))
+    BaseReg = M88k::R31;
+
+  if (isUInt<16>(Offset)) {
+    MI.getOperand(FIOperandNum).ChangeToRegister(BaseReg, false);
+    MI.getOperand(FIOperandNum + 1).ChangeToImmediate(Offset);
+    return;
+  }
+
+  // The offset does not fit into the immediate. Compute the address into a
+  // scavenged register.
+  MachineRegisterInfo &MRI = MF.getRegInfo();
+  Register ScratchReg = MRI.createVirtualRegister(&M88k::GPRRegClass);
+  BuildMI(MBB, II, DL, TII.get(M88k::ORriu), ScratchReg)
+      .addReg(M88k::R0)
+      .addImm(Offset >> 16);
+  BuildMI(MBB, II, DL, TII.get(M88k::ORri), ScratchReg)
+      .addReg(ScratchReg, RegState::Kill)
+      .addImm(Offset & 0xffff);
+  BuildMI(MBB, II, DL, TII.get(M88k::ADDUrr), ScratchReg)
+      .addReg(ScratchReg, RegState::Kill)
+      .addReg(BaseReg);
+  MI.getOperand(FIOperandNum).ChangeToRegister(ScratchReg, false, false, true);
+  MI.getOperand(FIOperandNum + 1).ChangeToImmediate(0);
+}
 
 Register M88kRegisterInfo::getFrameRegister(const MachineFunction &MF) const {
-  return M88k::R30;
+  return getFrameLowering(MF)->hasFP(MF) ? M88k::R30 : M88k::R31;
 }
\ No newline at end of file
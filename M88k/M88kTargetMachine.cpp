@@ -97,6 +97,7 @@ M88kTargetMachine::getSubtargetImpl(const Function &F) const {
                        ? FSAttr.getValueAsString().str()
                        : TargetFS;
 
+  std::lock_guard<std::mutex> Lock(SubtargetMapMutex);
   auto &I = SubtargetMap[CPU + FS];
   if (!I) {
     // This needs to be done before we create a new subtarget since any
@@ -136,4 +137,5 @@ bool M88kPassConfig::addInstSelector() {
 
 void M88kPassConfig::addPreEmitPass() {
   // TODO Add pass for div-by-zero check.
+  addPass(createM88kDelaySlotFillerPass());
 }
\ No newline at end of file
@@ -16,12 +16,14 @@
 #include "M88kSubtarget.h"
 #include "llvm/Target/TargetLoweringObjectFile.h"
 #include "llvm/Target/TargetMachine.h"
+#include <mutex>
 
 namespace llvm {
 
 class M88kTargetMachine : public LLVMTargetMachine {
   std::unique_ptr<TargetLoweringObjectFile> TLOF;
   mutable StringMap<std::unique_ptr<M88kSubtarget>> SubtargetMap;
+  mutable std::mutex SubtargetMapMutex;
 
 public:
   M88kTargetMachine(const Target &T, const Triple &TT, StringRef CPU,
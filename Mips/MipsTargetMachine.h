@@ -20,7 +20,9 @@
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/CodeGen.h"
 #include "llvm/Target/TargetMachine.h"
+#include <atomic>
 #include <memory>
+#include <mutex>
 
 namespace llvm {
 
@@ -29,12 +31,16 @@ class MipsTargetMachine : public LLVMTargetMachine {
   std::unique_ptr<TargetLoweringObjectFile> TLOF;
   // Selected ABI
   MipsABIInfo ABI;
-  const MipsSubtarget *Subtarget;
+  // The subtarget of the function most recently passed to resetSubtarget.
+  // This is shared by all functions compiled with this TargetMachine, so
+  // functions with different subtargets cannot be compiled concurrently yet.
+  std::atomic<const MipsSubtarget *> Subtarget;
   MipsSubtarget DefaultSubtarget;
   MipsSubtarget NoMips16Subtarget;
   MipsSubtarget Mips16Subtarget;
 
   mutable StringMap<std::unique_ptr<MipsSubtarget>> SubtargetMap;
+  mutable std::mutex SubtargetMapMutex;
 
 public:
   MipsTargetMachine(const Target &T, const Triple &TT, StringRef CPU,
@@ -46,8 +52,8 @@ public:
   TargetTransformInfo getTargetTransformInfo(const Function &F) override;
 
   const MipsSubtarget *getSubtargetImpl() const {
-    if (Subtarget)
-      return Subtarget;
+    if (const MipsSubtarget *ST = Subtarget)
+      return ST;
     return &DefaultSubtarget;
   }
 
@@ -14,32 +14,30 @@
 #ifndef LLVM_LIB_TARGET_NVPTX_MANAGEDSTRINGPOOL_H
 #define LLVM_LIB_TARGET_NVPTX_MANAGEDSTRINGPOOL_H
 
-#include "llvm/ADT/SmallVector.h"
-#include <string>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Allocator.h"
+#include <mutex>
 
 namespace llvm {
 
 /// ManagedStringPool - The strings allocated from a managed string pool are
 /// owned by the string pool and will be deleted together with the managed
-/// string pool.
+/// string pool. Strings are interned: equal strings share one nul-terminated
+/// copy, which is bump allocated and never moves. The pool may be shared by
+/// functions that are compiled concurrently, so lookups are serialized.
 class ManagedStringPool {
-  SmallVector<std::string *, 8> Pool;
+  StringSet<BumpPtrAllocator> Pool;
+  std::mutex PoolMutex;
 
 public:
   ManagedStringPool() = default;
 
-  ~ManagedStringPool() {
-    SmallVectorImpl<std::string *>::iterator Current = Pool.begin();
-    while (Current != Pool.end()) {
-      delete *Current;
-      ++Current;
-    }
-  }
-
-  std::string *getManagedString(const char *S) {
-    std::string *Str = new std::string(S);
-    Pool.push_back(Str);
-    return Str;
+  /// Return the pooled copy of \p S. Its data() is nul-terminated and stays
+  /// valid for the lifetime of the pool.
+  StringRef getManagedString(StringRef S) {
+    std::lock_guard<std::mutex> Lock(PoolMutex);
+    return Pool.insert(S).first->getKey();
   }
 };
 
@@ -73,6 +73,7 @@
 #include "llvm/MC/MCSymbol.h"
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/MachineValueType.h"
 #include "llvm/Support/Path.h"
@@ -81,9 +82,11 @@
 #include "llvm/Target/TargetLoweringObjectFile.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Utils/UnrollLoop.h"
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <iterator>
 #include <new>
 #include <string>
 #include <utility>
@@ -93,6 +96,11 @@ using namespace llvm;
 
 #define DEPOTNAME "__local_depot"
 
+static cl::opt<bool> PackAggregateInit(
+    "nvptx-pack-aggregate-init", cl::Hidden, cl::init(false),
+    cl::desc("Emit initializers of aggregate globals as hexadecimal .u32 or "
+             ".u64 words and leave out their trailing zeros"));
+
 /// DiscoverDependentGlobals - Return a set of GlobalVariables on which \p V
 /// depends.
 static void
@@ -204,9 +212,8 @@ void NVPTXAsmPrinter::lowerImageHandleSymbol(unsigned Index, MCOperand &MCOp) {
   NVPTXTargetMachine &nvTM = static_cast<NVPTXTargetMachine&>(TM);
   const NVPTXMachineFunctionInfo *MFI = MF->getInfo<NVPTXMachineFunctionInfo>();
   const char *Sym = MFI->getImageHandleSymbol(Index);
-  std::string *SymNamePtr =
-    nvTM.getManagedStrPool()->getManagedString(Sym);
-  MCOp = GetSymbolRef(OutContext.getOrCreateSymbol(StringRef(*SymNamePtr)));
+  StringRef SymName = nvTM.getManagedStrPool()->getManagedString(Sym);
+  MCOp = GetSymbolRef(OutContext.getOrCreateSymbol(SymName));
 }
 
 void NVPTXAsmPrinter::lowerToMCInst(const MachineInstr *MI, MCInst &OutMI) {
@@ -1125,10 +1132,10 @@ void NVPTXAsmPrinter::printModuleLevelGV(const GlobalVariable *GVar,
     O << " .attribute(.managed)";
   }
 
-  if (GVar->getAlignment() == 0)
-    O << " .align " << (int)DL.getPrefTypeAlignment(ETy);
-  else
-    O << " .align " << GVar->getAlignment();
+  unsigned Alignment = GVar->getAlignment();
+  if (Alignment == 0)
+    Alignment = DL.getPrefTypeAlignment(ETy);
+  O << " .align " << Alignment;
 
   if (ETy->isFloatingPointTy() || ETy->isPointerTy() ||
       (ETy->isIntegerTy() && ETy->getScalarSizeInBits() <= 64)) {
@@ -1200,10 +1207,14 @@ void NVPTXAsmPrinter::printModuleLevelGV(const GlobalVariable *GVar,
             }
             O << "]";
           } else {
-            O << " .b8 ";
+            unsigned WordSize = aggBuffer.selectWordSize(Alignment);
+            if (WordSize == 1)
+              O << " .b8 ";
+            else
+              O << " .u" << WordSize * 8 << " ";
             getSymbol(GVar)->print(O, MAI);
             O << "[";
-            O << ElementSize;
+            O << ElementSize / WordSize;
             O << "]";
           }
           O << " = {";
@@ -1900,6 +1911,72 @@ void NVPTXAsmPrinter::bufferLEByte(const Constant *CPV, int Bytes,
   }
 }
 
+unsigned NVPTXAsmPrinter::AggBuffer::selectWordSize(unsigned Alignment) {
+  assert(numSymbols == 0 && "Symbols are printed as pointer-sized words");
+  WordSize = 1;
+  if (PackAggregateInit) {
+    for (unsigned Size : {8u, 4u}) {
+      if (Alignment >= Size && size % Size == 0) {
+        WordSize = Size;
+        break;
+      }
+    }
+  }
+  return WordSize;
+}
+
+// Append V to Out, in hexadecimal if Hex is set. Aggregate initializers can
+// consist of millions of numbers, so this avoids the per-call overhead of the
+// raw_ostream integer formatting.
+static void appendUInt(SmallVectorImpl<char> &Out, uint64_t V, bool Hex) {
+  char Digits[20];
+  char *End = std::end(Digits);
+  char *P = End;
+  if (Hex && V >= 10) {
+    do {
+      *--P = hexdigit(V & 0xf, /*LowerCase=*/true);
+      V >>= 4;
+    } while (V);
+    Out.append({'0', 'x'});
+  } else {
+    do {
+      *--P = '0' + V % 10;
+      V /= 10;
+    } while (V);
+  }
+  Out.append(P, End);
+}
+
+void NVPTXAsmPrinter::AggBuffer::printWords() {
+  unsigned NumWords = size / WordSize;
+  if (PackAggregateInit) {
+    // Elements missing from the initializer list are zero-initialized, so
+    // stop after the last word that has a non-zero byte.
+    auto LastNonZero = std::find_if(buffer.rbegin(), buffer.rend(),
+                                    [](unsigned char C) { return C != 0; });
+    unsigned Used = buffer.rend() - LastNonZero;
+    NumWords = std::max(1u, (Used + WordSize - 1) / WordSize);
+  }
+
+  SmallString<512> Chunk;
+  for (unsigned I = 0; I != NumWords; ++I) {
+    if (I)
+      Chunk += ", ";
+    const unsigned char *Word = &buffer[I * WordSize];
+    if (WordSize == 8)
+      appendUInt(Chunk, support::endian::read64le(Word), /*Hex=*/true);
+    else if (WordSize == 4)
+      appendUInt(Chunk, support::endian::read32le(Word), /*Hex=*/true);
+    else
+      appendUInt(Chunk, *Word, /*Hex=*/false);
+    if (Chunk.size() >= 480) {
+      O << Chunk;
+      Chunk.clear();
+    }
+  }
+  O << Chunk;
+}
+
 void NVPTXAsmPrinter::bufferAggregateConstant(const Constant *CPV,
                                               AggBuffer *aggBuffer) {
   const DataLayout &DL = getDataLayout();
@@ -97,6 +97,8 @@ class LLVM_LIBRARY_VISIBILITY NVPTXAsmPrinter : public AsmPrinter {
     raw_ostream &O;
     NVPTXAsmPrinter &AP;
     bool EmitGeneric;
+    // Size of the elements printed for an aggregate without symbols.
+    unsigned WordSize = 1;
 
   public:
     AggBuffer(unsigned size, raw_ostream &O, NVPTXAsmPrinter &AP)
@@ -106,26 +108,19 @@ class LLVM_LIBRARY_VISIBILITY NVPTXAsmPrinter : public AsmPrinter {
       EmitGeneric = AP.EmitGeneric;
     }
 
+    // The buffer starts out zeroed and every byte is written at most once,
+    // so padding and zeros only need to advance curpos.
     unsigned addBytes(unsigned char *Ptr, int Num, int Bytes) {
       assert((curpos + Num) <= size);
       assert((curpos + Bytes) <= size);
-      for (int i = 0; i < Num; ++i) {
-        buffer[curpos] = Ptr[i];
-        curpos++;
-      }
-      for (int i = Num; i < Bytes; ++i) {
-        buffer[curpos] = 0;
-        curpos++;
-      }
+      std::copy(Ptr, Ptr + Num, buffer.begin() + curpos);
+      curpos += Bytes;
       return curpos;
     }
 
     unsigned addZeros(int Num) {
       assert((curpos + Num) <= size);
-      for (int i = 0; i < Num; ++i) {
-        buffer[curpos] = 0;
-        curpos++;
-      }
+      curpos += Num;
       return curpos;
     }
 
@@ -136,14 +131,14 @@ class LLVM_LIBRARY_VISIBILITY NVPTXAsmPrinter : public AsmPrinter {
       numSymbols++;
     }
 
+    // Choose the element size for an aggregate without symbols whose
+    // variable is aligned to Alignment bytes. This is 1 unless packing of
+    // initializers is enabled. Returns the chosen size in bytes.
+    unsigned selectWordSize(unsigned Alignment);
+
     void print() {
       if (numSymbols == 0) {
-        // print out in bytes
-        for (unsigned i = 0; i < size; i++) {
-          if (i)
-            O << ", ";
-          O << (unsigned int) buffer[i];
-        }
+        printWords();
       } else {
         // print out in 4-bytes or 8-bytes
         unsigned int pos = 0;
@@ -190,6 +185,10 @@ class LLVM_LIBRARY_VISIBILITY NVPTXAsmPrinter : public AsmPrinter {
         }
       }
     }
+
+  private:
+    // Print an aggregate without symbols as a list of WordSize-byte elements.
+    void printWords();
   };
 
   friend class AggBuffer;
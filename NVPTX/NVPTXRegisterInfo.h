@@ -14,8 +14,9 @@
 #define LLVM_LIB_TARGET_NVPTX_NVPTXREGISTERINFO_H
 
 #include "ManagedStringPool.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
 #include "llvm/CodeGen/TargetRegisterInfo.h"
-#include <sstream>
 
 #define GET_REGINFO_HEADER
 #include "NVPTXGenRegisterInfo.inc"
@@ -49,9 +50,10 @@ public:
   }
 
   const char *getName(unsigned RegNo) const {
-    std::stringstream O;
-    O << "reg" << RegNo;
-    return getStrPool()->getManagedString(O.str().c_str())->c_str();
+    SmallString<16> Name;
+    return getStrPool()
+        ->getManagedString(("reg" + Twine(RegNo)).toStringRef(Name))
+        .data();
   }
 
 };
@@ -17,6 +17,7 @@
 #include "PPCSubtarget.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Target/TargetMachine.h"
+#include <mutex>
 
 namespace llvm {
 
@@ -30,6 +31,7 @@ private:
   PPCABI TargetABI;
 
   mutable StringMap<std::unique_ptr<PPCSubtarget>> SubtargetMap;
+  mutable std::mutex SubtargetMapMutex;
 
 public:
   PPCTargetMachine(const Target &T, const Triple &TT, StringRef CPU,
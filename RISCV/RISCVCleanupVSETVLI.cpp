@@ -6,22 +6,138 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file implements a function pass that removes duplicate vsetvli
-// instructions within a basic block.
+// This file implements a function pass that removes redundant vsetvli
+// instructions. A forward dataflow analysis computes the VL/VTYPE
+// configuration known on entry to every basic block, so a vsetvli can be
+// removed when every path reaching it already established the same
+// configuration. Before that, a vsetvli in a loop header that configures the
+// whole loop with a loop-invariant AVL is hoisted into the preheader.
 //
 //===----------------------------------------------------------------------===//
 
 #include "RISCV.h"
 #include "RISCVSubtarget.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
 using namespace llvm;
 
 #define DEBUG_TYPE "riscv-cleanup-vsetvli"
 #define RISCV_CLEANUP_VSETVLI_NAME "RISCV Cleanup VSETVLI pass"
 
+STATISTIC(NumRemovedVSETVLI, "Number of redundant vsetvli removed");
+STATISTIC(NumHoistedVSETVLI, "Number of loop invariant vsetvli hoisted");
+
+static bool isVSETVLI(const MachineInstr &MI) {
+  return MI.getOpcode() == RISCV::PseudoVSETVLI ||
+         MI.getOpcode() == RISCV::PseudoVSETIVLI;
+}
+
 namespace {
 
+// The VL/VTYPE configuration known at a program point, as established by the
+// last vsetvli on every path reaching it.
+class VSETVLIInfo {
+  enum : uint8_t {
+    Uninitialized,
+    Known,
+    Unknown,
+  } State = Uninitialized;
+
+  unsigned Opcode = 0;
+  // The AVL register for PseudoVSETVLI, or the immediate for PseudoVSETIVLI.
+  Register AVLReg;
+  int64_t AVLImm = 0;
+  int64_t VTYPEImm = 0;
+  // True if the vsetvli kept the existing VL (AVL and output both X0).
+  bool KeepsVL = false;
+
+public:
+  static VSETVLIInfo getUnknown() {
+    VSETVLIInfo Info;
+    Info.State = Unknown;
+    return Info;
+  }
+
+  static VSETVLIInfo get(const MachineInstr &MI) {
+    assert(isVSETVLI(MI) && "Expected a vsetvli");
+    VSETVLIInfo Info;
+    Info.State = Known;
+    Info.Opcode = MI.getOpcode();
+    if (Info.Opcode == RISCV::PseudoVSETVLI) {
+      Info.AVLReg = MI.getOperand(1).getReg();
+      Info.KeepsVL = Info.AVLReg == RISCV::X0 &&
+                     MI.getOperand(0).getReg() == RISCV::X0;
+    } else {
+      Info.AVLImm = MI.getOperand(1).getImm();
+    }
+    Info.VTYPEImm = MI.getOperand(2).getImm();
+    return Info;
+  }
+
+  bool isUninitialized() const { return State == Uninitialized; }
+  bool isKnown() const { return State == Known; }
+
+  Register getAVLReg() const {
+    return isKnown() && Opcode == RISCV::PseudoVSETVLI ? AVLReg : Register();
+  }
+
+  bool operator==(const VSETVLIInfo &Other) const {
+    if (State != Other.State)
+      return false;
+    if (!isKnown())
+      return true;
+    return Opcode == Other.Opcode && AVLReg == Other.AVLReg &&
+           AVLImm == Other.AVLImm && VTYPEImm == Other.VTYPEImm &&
+           KeepsVL == Other.KeepsVL;
+  }
+  bool operator!=(const VSETVLIInfo &Other) const { return !(*this == Other); }
+
+  // Combine the configurations reaching a block along two edges.
+  VSETVLIInfo intersect(const VSETVLIInfo &Other) const {
+    if (isUninitialized())
+      return Other;
+    if (Other.isUninitialized())
+      return *this;
+    if (*this == Other)
+      return *this;
+    return getUnknown();
+  }
+
+  // Return true if executing MI when this configuration is in effect would
+  // not change VL or VTYPE.
+  bool makesRedundant(const MachineInstr &MI) const {
+    if (!isKnown())
+      return false;
+    // If a previous "set vl" instruction opcode is different from this one,
+    // we can't differentiate the AVL values.
+    if (Opcode != MI.getOpcode())
+      return false;
+    VSETVLIInfo New = get(MI);
+    // Does this VSET{I}VLI use the same AVL register/value and VTYPE
+    // immediate?
+    if (AVLReg != New.AVLReg || AVLImm != New.AVLImm ||
+        VTYPEImm != New.VTYPEImm)
+      return false;
+    // If the AVLReg is X0 we need to look at the output VL of both VSETVLIs.
+    // We can't remove if the previous VSETVLI left VL unchanged and the
+    // current instruction is setting it to VLMAX. Without knowing the VL
+    // before the previous instruction we don't know if this is a change.
+    if (AVLReg == RISCV::X0 && KeepsVL && !New.KeepsVL)
+      return false;
+    return true;
+  }
+};
+
 class RISCVCleanupVSETVLI : public MachineFunctionPass {
+  const MachineRegisterInfo *MRI = nullptr;
+  // The configuration on entry to and exit from each block, indexed by block
+  // number.
+  std::vector<VSETVLIInfo> BlockEntry;
+  std::vector<VSETVLIInfo> BlockExit;
+
 public:
   static char ID;
 
@@ -39,93 +155,145 @@ public:
   // This pass modifies the program, but does not modify the CFG
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.setPreservesCFG();
+    AU.addRequired<MachineLoopInfo>();
+    AU.addPreserved<MachineLoopInfo>();
     MachineFunctionPass::getAnalysisUsage(AU);
   }
 
   StringRef getPassName() const override { return RISCV_CLEANUP_VSETVLI_NAME; }
+
+private:
+  VSETVLIInfo transfer(const MachineInstr &MI, const VSETVLIInfo &Info) const;
+  void computeBlockInfo(MachineFunction &MF);
+  bool hoistLoopInvariantVSETVLI(MachineLoop &L);
 };
 
 } // end anonymous namespace
 
 char RISCVCleanupVSETVLI::ID = 0;
 
-INITIALIZE_PASS(RISCVCleanupVSETVLI, DEBUG_TYPE,
-                RISCV_CLEANUP_VSETVLI_NAME, false, false)
+INITIALIZE_PASS_BEGIN(RISCVCleanupVSETVLI, DEBUG_TYPE,
+                      RISCV_CLEANUP_VSETVLI_NAME, false, false)
+INITIALIZE_PASS_DEPENDENCY(MachineLoopInfo)
+INITIALIZE_PASS_END(RISCVCleanupVSETVLI, DEBUG_TYPE,
+                    RISCV_CLEANUP_VSETVLI_NAME, false, false)
 
-bool RISCVCleanupVSETVLI::runOnMachineBasicBlock(MachineBasicBlock &MBB) {
-  bool Changed = false;
-  MachineInstr *PrevVSETVLI = nullptr;
+// Return the configuration in effect after MI, given the one before it.
+VSETVLIInfo RISCVCleanupVSETVLI::transfer(const MachineInstr &MI,
+                                          const VSETVLIInfo &Info) const {
+  if (isVSETVLI(MI))
+    return VSETVLIInfo::get(MI);
+  if (!Info.isKnown())
+    return Info;
+  // Old VL/VTYPE is overwritten.
+  if (MI.isCall() || MI.modifiesRegister(RISCV::VL) ||
+      MI.modifiesRegister(RISCV::VTYPE))
+    return VSETVLIInfo::getUnknown();
+  // In a loop the AVL register may be redefined after the vsetvli that read
+  // it; the configuration then no longer matches a vsetvli using its new
+  // value.
+  Register AVLReg = Info.getAVLReg();
+  if (AVLReg.isVirtual() && MI.definesRegister(AVLReg))
+    return VSETVLIInfo::getUnknown();
+  return Info;
+}
 
-  for (auto MII = MBB.begin(), MIE = MBB.end(); MII != MIE;) {
-    MachineInstr &MI = *MII++;
+void RISCVCleanupVSETVLI::computeBlockInfo(MachineFunction &MF) {
+  BlockEntry.assign(MF.getNumBlockIDs(), VSETVLIInfo());
+  BlockExit.assign(MF.getNumBlockIDs(), VSETVLIInfo());
+  // Nothing is known about VL/VTYPE on entry to the function.
+  BlockEntry[MF.front().getNumber()] = VSETVLIInfo::getUnknown();
 
-    if (MI.getOpcode() != RISCV::PseudoVSETVLI &&
-        MI.getOpcode() != RISCV::PseudoVSETIVLI) {
-      if (PrevVSETVLI &&
-          (MI.isCall() || MI.modifiesRegister(RISCV::VL) ||
-           MI.modifiesRegister(RISCV::VTYPE))) {
-        // Old VL/VTYPE is overwritten.
-        PrevVSETVLI = nullptr;
-      }
-      continue;
-    }
+  ReversePostOrderTraversal<MachineFunction *> RPOT(&MF);
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (MachineBasicBlock *MBB : RPOT) {
+      VSETVLIInfo Entry = BlockEntry[MBB->getNumber()];
+      for (MachineBasicBlock *Pred : MBB->predecessors())
+        Entry = Entry.intersect(BlockExit[Pred->getNumber()]);
+      BlockEntry[MBB->getNumber()] = Entry;
 
-    // If we don't have a previous VSET{I}VLI or the VL output isn't dead, we
-    // can't remove this VSETVLI.
-    if (!PrevVSETVLI || !MI.getOperand(0).isDead()) {
-      PrevVSETVLI = &MI;
-      continue;
+      VSETVLIInfo Exit = Entry;
+      for (const MachineInstr &MI : *MBB)
+        Exit = transfer(MI, Exit);
+      if (Exit != BlockExit[MBB->getNumber()]) {
+        BlockExit[MBB->getNumber()] = Exit;
+        Changed = true;
+      }
     }
+  }
+}
 
-    // If a previous "set vl" instruction opcode is different from this one, we
-    // can't differentiate the AVL values.
-    if (PrevVSETVLI->getOpcode() != MI.getOpcode()) {
-      PrevVSETVLI = &MI;
-      continue;
-    }
+// Move a vsetvli that configures a whole loop into the loop preheader. This is
+// done when the loop header sets a configuration with a loop invariant AVL,
+// nothing in the loop reads VL/VTYPE before that, and nothing in the loop sets
+// a different configuration. Every path through the loop, including every path
+// leaving it, then sees the same configuration as before. The copies left in
+// the loop become redundant and are removed by the dataflow cleanup.
+bool RISCVCleanupVSETVLI::hoistLoopInvariantVSETVLI(MachineLoop &L) {
+  MachineBasicBlock *Preheader = L.getLoopPreheader();
+  if (!Preheader)
+    return false;
 
-    // The remaining two cases are
-    // 1. PrevVSETVLI = PseudoVSETVLI
-    //    MI = PseudoVSETVLI
-    //
-    // 2. PrevVSETVLI = PseudoVSETIVLI
-    //    MI = PseudoVSETIVLI
-    Register AVLReg;
-    bool SameAVL = false;
-    if (MI.getOpcode() == RISCV::PseudoVSETVLI) {
-      AVLReg = MI.getOperand(1).getReg();
-      SameAVL = PrevVSETVLI->getOperand(1).getReg() == AVLReg;
-    } else { // RISCV::PseudoVSETIVLI
-      SameAVL =
-          PrevVSETVLI->getOperand(1).getImm() == MI.getOperand(1).getImm();
+  MachineBasicBlock *Header = L.getHeader();
+  MachineInstr *HeaderVSETVLI = nullptr;
+  for (MachineInstr &MI : *Header) {
+    if (isVSETVLI(MI)) {
+      HeaderVSETVLI = &MI;
+      break;
     }
-    int64_t PrevVTYPEImm = PrevVSETVLI->getOperand(2).getImm();
-    int64_t VTYPEImm = MI.getOperand(2).getImm();
+    if (MI.readsRegister(RISCV::VL) || MI.readsRegister(RISCV::VTYPE))
+      return false;
+  }
+  if (!HeaderVSETVLI || !HeaderVSETVLI->getOperand(0).isDead())
+    return false;
 
-    // Does this VSET{I}VLI use the same AVL register/value and VTYPE immediate?
-    if (!SameAVL || PrevVTYPEImm != VTYPEImm) {
-      PrevVSETVLI = &MI;
-      continue;
-    }
+  VSETVLIInfo Info = VSETVLIInfo::get(*HeaderVSETVLI);
+  Register AVLReg = Info.getAVLReg();
+  if (AVLReg.isVirtual()) {
+    const MachineInstr *AVLDef = MRI->getVRegDef(AVLReg);
+    if (!AVLDef || L.contains(AVLDef))
+      return false;
+  }
 
-    // If the AVLReg is X0 we need to look at the output VL of both VSETVLIs.
-    if ((MI.getOpcode() == RISCV::PseudoVSETVLI) && (AVLReg == RISCV::X0)) {
-      assert((PrevVSETVLI->getOpcode() == RISCV::PseudoVSETVLI) &&
-             "Unexpected vsetvli opcode.");
-      Register PrevOutVL = PrevVSETVLI->getOperand(0).getReg();
-      Register OutVL = MI.getOperand(0).getReg();
-      // We can't remove if the previous VSETVLI left VL unchanged and the
-      // current instruction is setting it to VLMAX. Without knowing the VL
-      // before the previous instruction we don't know if this is a change.
-      if (PrevOutVL == RISCV::X0 && OutVL != RISCV::X0) {
-        PrevVSETVLI = &MI;
+  for (MachineBasicBlock *MBB : L.blocks()) {
+    for (const MachineInstr &MI : *MBB) {
+      if (isVSETVLI(MI)) {
+        if (VSETVLIInfo::get(MI) != Info)
+          return false;
         continue;
       }
+      if (MI.isCall() || MI.modifiesRegister(RISCV::VL) ||
+          MI.modifiesRegister(RISCV::VTYPE))
+        return false;
     }
+  }
+
+  HeaderVSETVLI->removeFromParent();
+  Preheader->insert(Preheader->getFirstTerminator(), HeaderVSETVLI);
+  ++NumHoistedVSETVLI;
+  return true;
+}
+
+bool RISCVCleanupVSETVLI::runOnMachineBasicBlock(MachineBasicBlock &MBB) {
+  bool Changed = false;
+  VSETVLIInfo Info = BlockEntry[MBB.getNumber()];
 
-    // This VSETVLI is redundant, remove it.
-    MI.eraseFromParent();
-    Changed = true;
+  for (auto MII = MBB.begin(), MIE = MBB.end(); MII != MIE;) {
+    MachineInstr &MI = *MII++;
+
+    // If the VL output isn't dead we can't remove this VSETVLI.
+    if (isVSETVLI(MI) && MI.getOperand(0).isDead() &&
+        Info.makesRedundant(MI)) {
+      // This VSETVLI is redundant, remove it.
+      MI.eraseFromParent();
+      ++NumRemovedVSETVLI;
+      Changed = true;
+      continue;
+    }
+
+    Info = transfer(MI, Info);
   }
 
   return Changed;
@@ -140,8 +308,24 @@ bool RISCVCleanupVSETVLI::runOnMachineFunction(MachineFunction &MF) {
   if (!ST.hasStdExtV())
     return false;
 
+  MRI = &MF.getRegInfo();
   bool Changed = false;
 
+  // Hoist from inner loops first so that an outer loop may hoist the same
+  // vsetvli again.
+  MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+  SmallVector<MachineLoop *, 8> Worklist(MLI.begin(), MLI.end());
+  SmallVector<MachineLoop *, 8> Loops;
+  while (!Worklist.empty()) {
+    MachineLoop *L = Worklist.pop_back_val();
+    Loops.push_back(L);
+    Worklist.append(L->begin(), L->end());
+  }
+  for (MachineLoop *L : reverse(Loops))
+    Changed |= hoistLoopInvariantVSETVLI(*L);
+
+  computeBlockInfo(MF);
+
   for (MachineBasicBlock &MBB : MF)
     Changed |= runOnMachineBasicBlock(MBB);
 
@@ -598,6 +598,19 @@ bool RISCVTargetLowering::isCheapToSpeculateCtlz() const {
   return Subtarget.hasStdExtZbb();
 }
 
+bool RISCVTargetLowering::allowsMisalignedMemoryAccesses(
+    EVT VT, unsigned AddrSpace, unsigned Align, MachineMemOperand::Flags Flags,
+    bool *Fast) const {
+  // Misaligned vector accesses are not supported, and misaligned scalar
+  // accesses are only used when the core handles them in hardware.
+  if (VT.isVector() || !Subtarget.enableUnalignedScalarMem())
+    return false;
+
+  if (Fast)
+    *Fast = true;
+  return true;
+}
+
 bool RISCVTargetLowering::isFPImmLegal(const APFloat &Imm, EVT VT,
                                        bool ForCodeSize) const {
   if (VT == MVT::f16 && !Subtarget.hasStdExtZfh())
@@ -40,6 +40,7 @@ RISCVSubtarget &RISCVSubtarget::initializeSubtargetDependencies(
   if (TuneCPUName.empty())
     TuneCPUName = CPUName;
   ParseSubtargetFeatures(CPUName, TuneCPUName, FS);
+  initializeProperties();
   if (Is64Bit) {
     XLenVT = MVT::i64;
     XLen = 64;
@@ -50,6 +51,18 @@ RISCVSubtarget &RISCVSubtarget::initializeSubtargetDependencies(
   return *this;
 }
 
+void RISCVSubtarget::initializeProperties() {
+  // Initialize CPU specific properties.
+  switch (RISCVProcFamily) {
+  case Others:
+    break;
+  case Rocket:
+  case SiFive7:
+    CacheLineSize = 64;
+    break;
+  }
+}
+
 RISCVSubtarget::RISCVSubtarget(const Triple &TT, StringRef CPU,
                                StringRef TuneCPU, StringRef FS,
                                StringRef ABIName, const TargetMachine &TM)
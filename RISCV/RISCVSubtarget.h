@@ -33,7 +33,19 @@ namespace llvm {
 class StringRef;
 
 class RISCVSubtarget : public RISCVGenSubtargetInfo {
+public:
+  enum RISCVProcFamilyEnum : uint8_t {
+    Others,
+    Rocket,
+    SiFive7,
+  };
+
+private:
   virtual void anchor();
+
+  /// RISCVProcFamily - RISC-V processor family used for tuning.
+  RISCVProcFamilyEnum RISCVProcFamily = Others;
+
   bool HasStdExtM = false;
   bool HasStdExtA = false;
   bool HasStdExtF = false;
@@ -60,8 +72,10 @@ class RISCVSubtarget : public RISCVGenSubtargetInfo {
   bool EnableLinkerRelax = false;
   bool EnableRVCHintInstrs = true;
   bool EnableSaveRestore = false;
+  bool EnableUnalignedScalarMem = false;
   unsigned XLen = 32;
   MVT XLenVT = MVT::i32;
+  unsigned CacheLineSize = 0;
   RISCVABI::ABI TargetABI = RISCVABI::ABI_Unknown;
   BitVector UserReservedRegister;
   RISCVFrameLowering FrameLowering;
@@ -78,6 +92,9 @@ class RISCVSubtarget : public RISCVGenSubtargetInfo {
                                                   StringRef FS,
                                                   StringRef ABIName);
 
+  /// Initialize properties based on the selected processor family.
+  void initializeProperties();
+
 public:
   // Initializes the data members to match that of the specified triple.
   RISCVSubtarget(const Triple &TT, StringRef CPU, StringRef TuneCPU,
@@ -101,6 +118,8 @@ public:
     return &TSInfo;
   }
   bool enableMachineScheduler() const override { return true; }
+  RISCVProcFamilyEnum getProcFamily() const { return RISCVProcFamily; }
+  unsigned getCacheLineSize() const override { return CacheLineSize; }
   bool hasStdExtM() const { return HasStdExtM; }
   bool hasStdExtA() const { return HasStdExtA; }
   bool hasStdExtF() const { return HasStdExtF; }
@@ -127,6 +146,7 @@ public:
   bool enableLinkerRelax() const { return EnableLinkerRelax; }
   bool enableRVCHintInstrs() const { return EnableRVCHintInstrs; }
   bool enableSaveRestore() const { return EnableSaveRestore; }
+  bool enableUnalignedScalarMem() const { return EnableUnalignedScalarMem; }
   MVT getXLenVT() const { return XLenVT; }
   unsigned getXLen() const { return XLen; }
   RISCVABI::ABI getTargetABI() const { return TargetABI; }
@@ -8,13 +8,21 @@
 
 #include "RISCVTargetTransformInfo.h"
 #include "MCTargetDesc/RISCVMatInt.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/CodeGen/BasicTTIImpl.h"
 #include "llvm/CodeGen/TargetLowering.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
 using namespace llvm;
 
 #define DEBUG_TYPE "riscvtti"
 
+// The number of bits an LMUL=1 vector register holds per vscale.
+static const unsigned RVVBitsPerBlock = 64;
+
+// The largest VLEN the V extension allows.
+static const unsigned RVVMaxBitsPerVector = 65536;
+
 int RISCVTTIImpl::getIntImmCost(const APInt &Imm, Type *Ty,
                                 TTI::TargetCostKind CostKind) {
   assert(Ty->isIntegerTy() &&
@@ -94,3 +102,249 @@ int RISCVTTIImpl::getIntImmCostIntrin(Intrinsic::ID IID, unsigned Idx,
   // Prevent hoisting in unknown cases.
   return TTI::TCC_Free;
 }
+
+void RISCVTTIImpl::getUnrollingPreferences(Loop *L, ScalarEvolution &SE,
+                                           TTI::UnrollingPreferences &UP) {
+  // Only tune for in-order cores which have a scheduling model. The generic
+  // CPUs keep the target independent defaults.
+  const MCSchedModel &SchedModel = ST->getSchedModel();
+  if (!SchedModel.hasInstrSchedModel() || SchedModel.isOutOfOrder())
+    return BaseT::getUnrollingPreferences(L, SE, UP);
+
+  // Disable loop unrolling for Oz and Os.
+  UP.OptSizeThreshold = 0;
+  UP.PartialOptSizeThreshold = 0;
+  if (L->getHeader()->getParent()->hasOptSize())
+    return;
+
+  SmallVector<BasicBlock *, 4> ExitingBlocks;
+  L->getExitingBlocks(ExitingBlocks);
+  LLVM_DEBUG(dbgs() << "Loop has:\n"
+                    << "Blocks: " << L->getNumBlocks() << "\n"
+                    << "Exit blocks: " << ExitingBlocks.size() << "\n");
+
+  // Only allow another exit other than the latch. This acts as an early exit
+  // as it mirrors the profitability calculation of the runtime unroller.
+  if (ExitingBlocks.size() > 2)
+    return;
+
+  // Limit the CFG of the loop body. Allowing 4 blocks permits if-then-else
+  // diamonds in the body.
+  if (L->getNumBlocks() > 4)
+    return;
+
+  // Don't unroll vectorized loops, including the remainder loop.
+  if (getBooleanLoopAttribute(L, "llvm.loop.isvectorized"))
+    return;
+
+  // Scan the loop: don't unroll loops with calls as this could prevent
+  // inlining.
+  unsigned Cost = 0;
+  for (auto *BB : L->getBlocks()) {
+    for (auto &I : *BB) {
+      if (isa<CallInst>(I) || isa<InvokeInst>(I)) {
+        if (const Function *F = cast<CallBase>(I).getCalledFunction()) {
+          if (!isLoweredToCall(F))
+            continue;
+        }
+        return;
+      }
+
+      SmallVector<const Value *, 4> Operands(I.operand_values());
+      Cost +=
+          getUserCost(&I, Operands, TargetTransformInfo::TCK_SizeAndLatency);
+    }
+  }
+
+  LLVM_DEBUG(dbgs() << "Cost of loop: " << Cost << "\n");
+
+  UP.Partial = true;
+  UP.Runtime = true;
+  UP.UpperBound = true;
+  UP.UnrollRemainder = true;
+
+  // An in-order pipeline stalls on the first use of a load. Unroll far enough
+  // that the loads of all copies can be issued before the first result is
+  // needed. Keep the count a power of two so the remainder is a mask.
+  UP.DefaultUnrollRuntimeCount = PowerOf2Floor(
+      std::max(2u, SchedModel.IssueWidth * SchedModel.LoadLatency));
+
+  // Force unrolling small loops can be very useful because of the branch
+  // taken cost of the backedge.
+  if (Cost < 12)
+    UP.Force = true;
+}
+
+TTI::MemCmpExpansionOptions
+RISCVTTIImpl::enableMemCmpExpansion(bool OptSize, bool IsZeroCmp) const {
+  TTI::MemCmpExpansionOptions Options;
+  Options.MaxNumLoads = TLI->getMaxExpandSizeMemcmp(OptSize);
+  Options.NumLoadsPerBlock = Options.MaxNumLoads;
+
+  // The operands of memcmp are rarely known to be aligned. Without fast
+  // misaligned accesses a wide load would be split into byte loads or trap
+  // to an emulator, so only expand small equality comparisons byte by byte.
+  if (!ST->enableUnalignedScalarMem()) {
+    if (!IsZeroCmp)
+      return TTI::MemCmpExpansionOptions();
+    Options.LoadSizes = {1};
+    return Options;
+  }
+
+  // Ordered comparisons have to byte swap the loaded values, which is only
+  // cheap with the rev8/grevi instructions of Zbb and Zbp.
+  if (!IsZeroCmp && !ST->hasStdExtZbb() && !ST->hasStdExtZbp())
+    return TTI::MemCmpExpansionOptions();
+
+  if (ST->is64Bit())
+    Options.LoadSizes = {8, 4, 2, 1};
+  else
+    Options.LoadSizes = {4, 2, 1};
+  return Options;
+}
+
+int RISCVTTIImpl::getRVVOpCost(Type *Ty) {
+  if (!ST->hasStdExtV() || !isa<ScalableVectorType>(Ty))
+    return 0;
+
+  std::pair<int, MVT> LT = TLI->getTypeLegalizationCost(DL, Ty);
+  if (!LT.second.isScalableVector())
+    return 0;
+
+  // An instruction on a group of LMUL registers is executed as LMUL
+  // operations on single registers. Fractional LMULs still use a whole
+  // register.
+  unsigned LMUL = std::max<unsigned>(
+      1, LT.second.getSizeInBits().getKnownMinSize() / RVVBitsPerBlock);
+  return LT.first * LMUL;
+}
+
+Optional<unsigned> RISCVTTIImpl::getMaxVScale() const {
+  if (ST->hasStdExtV())
+    return RVVMaxBitsPerVector / RVVBitsPerBlock;
+  return BaseT::getMaxVScale();
+}
+
+unsigned RISCVTTIImpl::getNumberOfRegisters(unsigned ClassID) const {
+  bool Vector = (ClassID == 1);
+  if (Vector)
+    return ST->hasStdExtV() ? 32 : 0;
+  return BaseT::getNumberOfRegisters(ClassID);
+}
+
+unsigned RISCVTTIImpl::getRegisterBitWidth(bool Vector) const {
+  // The vectorizers use this width to pick fixed-length VFs, but no
+  // fixed-length vector types are legal. RVV is only exposed through the
+  // scalable type hooks such as getMaxVScale.
+  if (Vector)
+    return 0;
+  return ST->getXLen();
+}
+
+int RISCVTTIImpl::getArithmeticInstrCost(
+    unsigned Opcode, Type *Ty, TTI::TargetCostKind CostKind,
+    TTI::OperandValueKind Opd1Info, TTI::OperandValueKind Opd2Info,
+    TTI::OperandValueProperties Opd1PropInfo,
+    TTI::OperandValueProperties Opd2PropInfo, ArrayRef<const Value *> Args,
+    const Instruction *CxtI) {
+  int Cost = getRVVOpCost(Ty);
+  if (!Cost || CostKind != TTI::TCK_RecipThroughput)
+    return BaseT::getArithmeticInstrCost(Opcode, Ty, CostKind, Opd1Info,
+                                         Opd2Info, Opd1PropInfo, Opd2PropInfo,
+                                         Args, CxtI);
+
+  switch (TLI->InstructionOpcodeToISD(Opcode)) {
+  case ISD::ADD:
+  case ISD::SUB:
+  case ISD::AND:
+  case ISD::OR:
+  case ISD::XOR:
+  case ISD::SHL:
+  case ISD::SRL:
+  case ISD::SRA:
+  case ISD::MUL:
+  case ISD::FADD:
+  case ISD::FSUB:
+  case ISD::FMUL:
+    return Cost;
+  case ISD::SDIV:
+  case ISD::UDIV:
+  case ISD::SREM:
+  case ISD::UREM:
+  case ISD::FDIV:
+    // Vector divisions are iterative and not pipelined.
+    return Cost * TTI::TCC_Expensive;
+  default:
+    return BaseT::getArithmeticInstrCost(Opcode, Ty, CostKind, Opd1Info,
+                                         Opd2Info, Opd1PropInfo, Opd2PropInfo,
+                                         Args, CxtI);
+  }
+}
+
+int RISCVTTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
+                                   TTI::CastContextHint CCH,
+                                   TTI::TargetCostKind CostKind,
+                                   const Instruction *I) {
+  int DstCost = getRVVOpCost(Dst);
+  int SrcCost = getRVVOpCost(Src);
+  if (!DstCost || !SrcCost || CostKind != TTI::TCK_RecipThroughput)
+    return BaseT::getCastInstrCost(Opcode, Dst, Src, CCH, CostKind, I);
+
+  unsigned DstBits = Dst->getScalarSizeInBits();
+  unsigned SrcBits = Src->getScalarSizeInBits();
+  switch (TLI->InstructionOpcodeToISD(Opcode)) {
+  case ISD::SIGN_EXTEND:
+  case ISD::ZERO_EXTEND:
+    // Extending a mask is a vmerge of two splats.
+    if (SrcBits == 1)
+      return DstCost;
+    // A single vsext/vzext, which needs a vsetvli to switch to the wider SEW.
+    return DstCost + 1;
+  case ISD::TRUNCATE:
+    // Truncating to a mask is a vand and a vmsne.
+    if (DstBits == 1)
+      return SrcCost * 2;
+    // The element width is halved by one vnsrl at a time, each of them
+    // with its own vsetvli.
+    return Log2_32(SrcBits / DstBits) * (DstCost + 1);
+  default:
+    return BaseT::getCastInstrCost(Opcode, Dst, Src, CCH, CostKind, I);
+  }
+}
+
+int RISCVTTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy,
+                                     Type *CondTy, CmpInst::Predicate VecPred,
+                                     TTI::TargetCostKind CostKind,
+                                     const Instruction *I) {
+  int Cost = getRVVOpCost(ValTy);
+  if (!Cost || CostKind != TTI::TCK_RecipThroughput)
+    return BaseT::getCmpSelInstrCost(Opcode, ValTy, CondTy, VecPred, CostKind,
+                                     I);
+
+  // Compares write a mask register with a single vms*/vmf* and selects are a
+  // single vmerge.
+  return Cost;
+}
+
+int RISCVTTIImpl::getMemoryOpCost(unsigned Opcode, Type *Src,
+                                  MaybeAlign Alignment, unsigned AddressSpace,
+                                  TTI::TargetCostKind CostKind,
+                                  const Instruction *I) {
+  int Cost = getRVVOpCost(Src);
+  if (!Cost || CostKind != TTI::TCK_RecipThroughput)
+    return BaseT::getMemoryOpCost(Opcode, Src, Alignment, AddressSpace,
+                                  CostKind, I);
+
+  // Scalable vectors are accessed with unit-stride vle/vse, which transfer
+  // one register of the group at a time.
+  return Cost;
+}
+
+int RISCVTTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *Tp,
+                                 int Index, VectorType *SubTp) {
+  // Splats are a single vmv.v.x or vfmv.v.f.
+  int Cost = getRVVOpCost(Tp);
+  if (Cost && Kind == TTI::SK_Broadcast)
+    return Cost;
+  return BaseT::getShuffleCost(Kind, Tp, Index, SubTp);
+}
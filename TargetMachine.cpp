@@ -47,7 +47,11 @@ bool TargetMachine::isPositionIndependent() const {
 
 /// Reset the target options based on the function's attributes.
 /// setFunctionAttributes should have made the raw attribute value consistent
-/// with the command line flag if used.
+/// with the command line flag if used. Targets call this while holding their
+/// subtarget map lock. An option is only written when its value changes, so
+/// functions that agree on these attributes can be compiled concurrently.
+/// Functions whose attributes differ can not: the options are shared by the
+/// whole TargetMachine and are read without the lock during codegen.
 //
 // FIXME: This function needs to go away for a number of reasons:
 // a) global state on the TargetMachine is terrible in general,
@@ -56,7 +60,9 @@ bool TargetMachine::isPositionIndependent() const {
 void TargetMachine::resetTargetOptions(const Function &F) const {
 #define RESET_OPTION(X, Y)                                              \
   do {                                                                  \
-    Options.X = (F.getFnAttribute(Y).getValueAsString() == "true");     \
+    bool NewValue = F.getFnAttribute(Y).getValueAsString() == "true";   \
+    if (Options.X != NewValue)                                          \
+      Options.X = NewValue;                                             \
   } while (0)
 
   RESET_OPTION(UnsafeFPMath, "unsafe-fp-math");
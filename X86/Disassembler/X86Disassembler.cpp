@@ -76,7 +76,10 @@
 #include "MCTargetDesc/X86BaseInfo.h"
 #include "MCTargetDesc/X86MCTargetDesc.h"
 #include "TargetInfo/X86TargetInfo.h"
+#include "X86Disassembler.h"
 #include "X86DisassemblerDecoder.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/MC/MCExpr.h"
@@ -1011,6 +1014,93 @@ static bool is64Bit(const char *name) {
   }
 }
 
+namespace llvm {
+namespace X86Disassembler {
+
+/// Per-opcode facts about instruction names that getInstructionID needs to
+/// resolve REX.W and OpSize ambiguities. They are derived once from the
+/// MCInstrInfo name table when the disassembler is created, so decoding an
+/// instruction never has to walk name strings for the common cases.
+class X86OpcodeSizeTables {
+  const MCInstrInfo *MII = nullptr;
+  // Set for opcodes whose name contains "64" (see is64Bit).
+  BitVector Is64Bit;
+  // Hash of each name with all of the characters that is16BitEquivalent
+  // treats as interchangeable folded together. Two names can only be 16-bit
+  // equivalents if their signatures match.
+  std::vector<uint32_t> SizeSignature;
+  // Set for opcodes that share their size signature with another opcode.
+  // Any other opcode can only be their 16-bit equivalent if this is set.
+  BitVector SharesSizeSignature;
+
+  static uint32_t computeSizeSignature(StringRef Name) {
+    // FNV-1a over the folded name.
+    uint32_t Hash = 2166136261u;
+    for (char C : Name) {
+      switch (C) {
+      case 'Q':
+      case 'L':
+        C = 'W';
+        break;
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '6':
+        C = '1';
+        break;
+      default:
+        break;
+      }
+      Hash = (Hash ^ static_cast<uint8_t>(C)) * 16777619u;
+    }
+    return Hash;
+  }
+
+public:
+  explicit X86OpcodeSizeTables(const MCInstrInfo *MII) : MII(MII) {
+    unsigned NumOpcodes = MII->getNumOpcodes();
+    Is64Bit.resize(NumOpcodes);
+    SizeSignature.resize(NumOpcodes);
+    SharesSizeSignature.resize(NumOpcodes);
+    for (unsigned Opc = 0; Opc != NumOpcodes; ++Opc) {
+      StringRef Name = MII->getName(Opc);
+      if (is64Bit(Name.data()))
+        Is64Bit.set(Opc);
+      SizeSignature[Opc] = computeSizeSignature(Name);
+    }
+    // Signatures can take any value, so count them in a sorted copy rather
+    // than a DenseMap, which reserves two keys.
+    std::vector<uint32_t> Sorted(SizeSignature);
+    llvm::sort(Sorted);
+    for (unsigned Opc = 0; Opc != NumOpcodes; ++Opc) {
+      auto Range = std::equal_range(Sorted.begin(), Sorted.end(),
+                                    SizeSignature[Opc]);
+      if (std::distance(Range.first, Range.second) > 1)
+        SharesSizeSignature.set(Opc);
+    }
+  }
+
+  bool is64BitOpcode(uint16_t Opc) const { return Is64Bit.test(Opc); }
+
+  /// Return true if some opcode other than Orig may be its 16-bit equivalent.
+  bool may16BitEquivalentExist(uint16_t Orig) const {
+    return SharesSizeSignature.test(Orig);
+  }
+
+  /// Return true if Equiv is the 16-bit equivalent of Orig. Only opcodes whose
+  /// size signatures collide need the exact comparison of their names.
+  bool is16BitEquivalentOpcode(uint16_t Orig, uint16_t Equiv) const {
+    if (SizeSignature[Orig] != SizeSignature[Equiv])
+      return false;
+    return is16BitEquivalent(MII->getName(Orig).data(),
+                             MII->getName(Equiv).data());
+  }
+};
+
+} // namespace X86Disassembler
+} // namespace llvm
+
 // Determine the ID of an instruction, consuming the ModR/M byte as appropriate
 // for extended and escape opcodes, and using a supplied attribute mask.
 static int getInstructionIDWithAttrMask(uint16_t *instructionID,
@@ -1063,7 +1153,7 @@ static int getInstructionIDWithAttrMask(uint16_t *instructionID,
 // for extended and escape opcodes. Determines the attributes and context for
 // the instruction before doing so.
 static int getInstructionID(struct InternalInstruction *insn,
-                            const MCInstrInfo *mii) {
+                            const X86OpcodeSizeTables &sizeTables) {
   uint16_t attrMask;
   uint16_t instructionID;
 
@@ -1229,9 +1319,8 @@ static int getInstructionID(struct InternalInstruction *insn,
         return 0;
       }
 
-      auto SpecName = mii->getName(instructionIDWithREXW);
       // If not a 64-bit instruction. Switch the opcode.
-      if (!is64Bit(SpecName.data())) {
+      if (!sizeTables.is64BitOpcode(instructionIDWithREXW)) {
         insn->instructionID = instructionIDWithREXW;
         insn->spec = &INSTRUCTIONS_SYM[instructionIDWithREXW];
         return 0;
@@ -1279,10 +1368,20 @@ static int getInstructionID(struct InternalInstruction *insn,
     // the right place we check if there's a 16-bit operation.
     const struct InstructionSpecifier *spec;
     uint16_t instructionIDWithOpsize;
-    llvm::StringRef specName, specWithOpSizeName;
 
     spec = &INSTRUCTIONS_SYM[instructionID];
 
+    // Skip the second lookup when its result can't change the instruction.
+    // The lookup may read the ModR/M byte, so this is only done once that has
+    // already been consumed.
+    if (insn->consumedModRM &&
+        (!((insn->mode == MODE_16BIT) ^ insn->hasOpSize) ||
+         !sizeTables.may16BitEquivalentExist(instructionID))) {
+      insn->instructionID = instructionID;
+      insn->spec = spec;
+      return 0;
+    }
+
     if (getInstructionIDWithAttrMask(&instructionIDWithOpsize, insn,
                                      attrMask | ATTR_OPSIZE)) {
       // ModRM required with OpSize but not present. Give up and return the
@@ -1292,11 +1391,9 @@ static int getInstructionID(struct InternalInstruction *insn,
       return 0;
     }
 
-    specName = mii->getName(instructionID);
-    specWithOpSizeName = mii->getName(instructionIDWithOpsize);
-
-    if (is16BitEquivalent(specName.data(), specWithOpSizeName.data()) &&
-        (insn->mode == MODE_16BIT) ^ insn->hasOpSize) {
+    if (((insn->mode == MODE_16BIT) ^ insn->hasOpSize) &&
+        sizeTables.is16BitEquivalentOpcode(instructionID,
+                                           instructionIDWithOpsize)) {
       insn->instructionID = instructionIDWithOpsize;
       insn->spec = &INSTRUCTIONS_SYM[instructionIDWithOpsize];
     } else {
@@ -1667,36 +1764,17 @@ namespace X86 {
 
 } // namespace llvm
 
+static unsigned translateOpcode(const InternalInstruction &source);
 static bool translateInstruction(MCInst &target,
                                 InternalInstruction &source,
                                 const MCDisassembler *Dis);
 
-namespace {
-
-/// Generic disassembler for all X86 platforms. All each platform class should
-/// have to do is subclass the constructor, and provide a different
-/// disassemblerMode value.
-class X86GenericDisassembler : public MCDisassembler {
-  std::unique_ptr<const MCInstrInfo> MII;
-public:
-  X86GenericDisassembler(const MCSubtargetInfo &STI, MCContext &Ctx,
-                         std::unique_ptr<const MCInstrInfo> MII);
-public:
-  DecodeStatus getInstruction(MCInst &instr, uint64_t &size,
-                              ArrayRef<uint8_t> Bytes, uint64_t Address,
-                              raw_ostream &cStream) const override;
-
-private:
-  DisassemblerMode              fMode;
-};
-
-} // namespace
-
 X86GenericDisassembler::X86GenericDisassembler(
                                          const MCSubtargetInfo &STI,
                                          MCContext &Ctx,
                                          std::unique_ptr<const MCInstrInfo> MII)
-  : MCDisassembler(STI, Ctx), MII(std::move(MII)) {
+  : MCDisassembler(STI, Ctx), MII(std::move(MII)),
+    SizeTables(std::make_unique<X86OpcodeSizeTables>(this->MII.get())) {
   const FeatureBitset &FB = STI.getFeatureBits();
   if (FB[X86::Mode16Bit]) {
     fMode = MODE_16BIT;
@@ -1712,12 +1790,11 @@ X86GenericDisassembler::X86GenericDisassembler(
   llvm_unreachable("Invalid CPU mode");
 }
 
-MCDisassembler::DecodeStatus X86GenericDisassembler::getInstruction(
-    MCInst &Instr, uint64_t &Size, ArrayRef<uint8_t> Bytes, uint64_t Address,
-    raw_ostream &CStream) const {
-  CommentStream = &CStream;
+X86GenericDisassembler::~X86GenericDisassembler() = default;
 
-  InternalInstruction Insn;
+bool X86GenericDisassembler::decodeInstruction(InternalInstruction &Insn,
+                                               ArrayRef<uint8_t> Bytes,
+                                               uint64_t Address) const {
   memset(&Insn, 0, sizeof(InternalInstruction));
   Insn.bytes = Bytes;
   Insn.startLocation = Address;
@@ -1725,38 +1802,96 @@ MCDisassembler::DecodeStatus X86GenericDisassembler::getInstruction(
   Insn.mode = fMode;
 
   if (Bytes.empty() || readPrefixes(&Insn) || readOpcode(&Insn) ||
-      getInstructionID(&Insn, MII.get()) || Insn.instructionID == 0 ||
-      readOperands(&Insn)) {
-    Size = Insn.readerCursor - Address;
-    return Fail;
-  }
+      getInstructionID(&Insn, *SizeTables) || Insn.instructionID == 0 ||
+      readOperands(&Insn))
+    return true;
 
   Insn.operands = x86OperandSets[Insn.spec->operands];
   Insn.length = Insn.readerCursor - Insn.startLocation;
-  Size = Insn.length;
-  if (Size > 15)
+  if (Insn.length > 15)
     LLVM_DEBUG(dbgs() << "Instruction exceeds 15-byte limit");
+  return false;
+}
+
+static void setPrefixFlags(MCInst &Instr, const InternalInstruction &Insn) {
+  unsigned Flags = X86::IP_NO_PREFIX;
+  if (Insn.hasAdSize)
+    Flags |= X86::IP_HAS_AD_SIZE;
+  if (!Insn.mandatoryPrefix) {
+    if (Insn.hasOpSize)
+      Flags |= X86::IP_HAS_OP_SIZE;
+    if (Insn.repeatPrefix == 0xf2)
+      Flags |= X86::IP_HAS_REPEAT_NE;
+    else if (Insn.repeatPrefix == 0xf3 &&
+             // It should not be 'pause' f3 90
+             Insn.opcode != 0x90)
+      Flags |= X86::IP_HAS_REPEAT;
+    if (Insn.hasLockPrefix)
+      Flags |= X86::IP_HAS_LOCK;
+  }
+  Instr.setFlags(Flags);
+}
+
+MCDisassembler::DecodeStatus X86GenericDisassembler::getInstruction(
+    MCInst &Instr, uint64_t &Size, ArrayRef<uint8_t> Bytes, uint64_t Address,
+    raw_ostream &CStream) const {
+  CommentStream = &CStream;
+
+  InternalInstruction Insn;
+  if (decodeInstruction(Insn, Bytes, Address)) {
+    Size = Insn.readerCursor - Address;
+    return Fail;
+  }
+  Size = Insn.length;
 
   bool Ret = translateInstruction(Instr, Insn, this);
-  if (!Ret) {
-    unsigned Flags = X86::IP_NO_PREFIX;
-    if (Insn.hasAdSize)
-      Flags |= X86::IP_HAS_AD_SIZE;
-    if (!Insn.mandatoryPrefix) {
-      if (Insn.hasOpSize)
-        Flags |= X86::IP_HAS_OP_SIZE;
-      if (Insn.repeatPrefix == 0xf2)
-        Flags |= X86::IP_HAS_REPEAT_NE;
-      else if (Insn.repeatPrefix == 0xf3 &&
-               // It should not be 'pause' f3 90
-               Insn.opcode != 0x90)
-        Flags |= X86::IP_HAS_REPEAT;
-      if (Insn.hasLockPrefix)
-        Flags |= X86::IP_HAS_LOCK;
+  if (!Ret)
+    setPrefixFlags(Instr, Insn);
+  return (!Ret) ? Success : Fail;
+}
+
+uint64_t X86GenericDisassembler::decodeRange(ArrayRef<uint8_t> Bytes,
+                                             uint64_t Address,
+                                             DecodeRangeCallback Callback,
+                                             bool LengthOnly) const {
+  // Symbolic operand and PC-load comments have nowhere to go during a sweep.
+  CommentStream = &nulls();
+
+  InternalInstruction Insn;
+  MCInst Inst;
+  uint64_t Offset = 0;
+  while (Offset < Bytes.size()) {
+    uint64_t InstAddress = Address + Offset;
+    DecodeStatus Status = Success;
+    uint64_t Size;
+    Inst.clear();
+    Inst.setOpcode(0);
+    Inst.setFlags(0);
+    if (decodeInstruction(Insn, Bytes.slice(Offset), InstAddress)) {
+      Status = Fail;
+      Size = Insn.readerCursor - InstAddress;
+    } else {
+      Size = Insn.length;
+      if (LengthOnly) {
+        Inst.setOpcode(translateOpcode(Insn));
+        setPrefixFlags(Inst, Insn);
+      } else if (translateInstruction(Inst, Insn, this)) {
+        Status = Fail;
+      } else {
+        setPrefixFlags(Inst, Insn);
+      }
     }
-    Instr.setFlags(Flags);
+    // Always make progress over undecodable bytes, like llvm-objdump does.
+    if (Status == Fail && Size == 0)
+      Size = 1;
+    Size = std::min<uint64_t>(Size, Bytes.size() - Offset);
+    Offset += Size;
+    if (!Callback(Inst, InstAddress, Size, Status))
+      break;
   }
-  return (!Ret) ? Success : Fail;
+
+  CommentStream = nullptr;
+  return Offset;
 }
 
 //
@@ -2308,6 +2443,23 @@ static bool translateOperand(MCInst &mcInst, const OperandSpecifier &operand,
   }
 }
 
+/// translateOpcode - Returns the MCInst opcode for an internal instruction.
+///
+/// @param insn         - The internal instruction.
+/// @return             - The opcode to use for the MCInst.
+static unsigned translateOpcode(const InternalInstruction &insn) {
+  // If when reading the prefix bytes we determined the overlapping 0xf2 or 0xf3
+  // prefix bytes should be disassembled as xrelease and xacquire then use
+  // those opcodes instead of the rep and repne opcodes.
+  if (insn.xAcquireRelease) {
+    if (insn.instructionID == X86::REP_PREFIX)
+      return X86::XRELEASE_PREFIX;
+    if (insn.instructionID == X86::REPNE_PREFIX)
+      return X86::XACQUIRE_PREFIX;
+  }
+  return insn.instructionID;
+}
+
 /// translateInstruction - Translates an internal instruction and all its
 ///   operands to an MCInst.
 ///
@@ -2323,16 +2475,7 @@ static bool translateInstruction(MCInst &mcInst,
   }
 
   mcInst.clear();
-  mcInst.setOpcode(insn.instructionID);
-  // If when reading the prefix bytes we determined the overlapping 0xf2 or 0xf3
-  // prefix bytes should be disassembled as xrelease and xacquire then set the
-  // opcode to those instead of the rep and repne opcodes.
-  if (insn.xAcquireRelease) {
-    if(mcInst.getOpcode() == X86::REP_PREFIX)
-      mcInst.setOpcode(X86::XRELEASE_PREFIX);
-    else if(mcInst.getOpcode() == X86::REPNE_PREFIX)
-      mcInst.setOpcode(X86::XACQUIRE_PREFIX);
-  }
+  mcInst.setOpcode(translateOpcode(insn));
 
   insn.numImmediatesTranslated = 0;
 
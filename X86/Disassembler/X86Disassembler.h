@@ -0,0 +1,82 @@
+//===-- X86Disassembler.h - Disassembler for x86 and x86_64 -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the X86 MCDisassembler. Besides the usual one instruction
+// at a time getInstruction interface, it offers decodeRange for linear sweeps
+// over a whole buffer. See X86Disassembler.cpp for an overview of how the
+// decoder is organized.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LIB_TARGET_X86_DISASSEMBLER_X86DISASSEMBLER_H
+#define LLVM_LIB_TARGET_X86_DISASSEMBLER_X86DISASSEMBLER_H
+
+#include "X86DisassemblerDecoder.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include <memory>
+
+namespace llvm {
+
+class MCInstrInfo;
+
+namespace X86Disassembler {
+class X86OpcodeSizeTables;
+} // namespace X86Disassembler
+
+/// Generic disassembler for all X86 platforms. All each platform class should
+/// have to do is subclass the constructor, and provide a different
+/// disassemblerMode value.
+class X86GenericDisassembler : public MCDisassembler {
+  std::unique_ptr<const MCInstrInfo> MII;
+  std::unique_ptr<const X86Disassembler::X86OpcodeSizeTables> SizeTables;
+
+public:
+  X86GenericDisassembler(const MCSubtargetInfo &STI, MCContext &Ctx,
+                         std::unique_ptr<const MCInstrInfo> MII);
+  ~X86GenericDisassembler() override;
+
+  DecodeStatus getInstruction(MCInst &instr, uint64_t &size,
+                              ArrayRef<uint8_t> Bytes, uint64_t Address,
+                              raw_ostream &cStream) const override;
+
+  /// Called by decodeRange for every instruction it visits, in address order.
+  /// \p Inst is only valid for the duration of the call; in length-only mode
+  /// it carries the same opcode and prefix flags as getInstruction would
+  /// produce, but no operands. For undecodable bytes \p Status is Fail and
+  /// \p Size is the number of bytes skipped. In length-only mode \p Status
+  /// only says whether the length could be decoded: operands are not
+  /// translated, so encodings that getInstruction rejects while translating
+  /// its operands are reported as Success. Returning false stops the sweep.
+  using DecodeRangeCallback =
+      function_ref<bool(const MCInst &Inst, uint64_t Address, uint64_t Size,
+                        DecodeStatus Status)>;
+
+  /// Linearly decode all of \p Bytes, which start at \p Address, invoking
+  /// \p Callback for each instruction. The decoder state and the MCInst
+  /// passed to the callback are reused across instructions, so a sweep does
+  /// not allocate per instruction once the operand list has grown to its
+  /// largest size. With \p LengthOnly set, operands are decoded only as far
+  /// as needed to find instruction boundaries and are not translated to
+  /// MCOperands. Returns the number of bytes visited.
+  uint64_t decodeRange(ArrayRef<uint8_t> Bytes, uint64_t Address,
+                       DecodeRangeCallback Callback,
+                       bool LengthOnly = false) const;
+
+private:
+  /// Run the decoder over \p Bytes at \p Address, filling in \p Insn. Returns
+  /// true if the bytes do not form a valid instruction.
+  bool decodeInstruction(X86Disassembler::InternalInstruction &Insn,
+                         ArrayRef<uint8_t> Bytes, uint64_t Address) const;
+
+  X86Disassembler::DisassemblerMode fMode;
+};
+
+} // end namespace llvm
+
+#endif // LLVM_LIB_TARGET_X86_DISASSEMBLER_X86DISASSEMBLER_H
@@ -13,7 +13,8 @@
 ///
 /// Thus, the optimization applies under the following conditions:
 ///   1. Consider as candidates only CMOVs in innermost loops (assume that
-///      most hotspots are represented by these loops).
+///      most hotspots are represented by these loops), and, when the function
+///      has profile data, CMOVs in hot blocks outside of them.
 ///   2. Given a group of CMOV instructions that are using the same EFLAGS def
 ///      instruction:
 ///      a. Consider them as candidates only if all have the same code condition
@@ -29,6 +30,18 @@
 ///         than the average cost of its true-value and false-value by 25% of
 ///         branch-misprediction-penalty. This assures no degradation even with
 ///         25% branch misprediction.
+///      c. If the select the CMOV group was lowered from carries branch
+///         weights or an unpredictable hint, the estimated mispredict rate
+///         replaces the assumed 25%, and the branch weights replace the
+///         assumed 75%/25% split of the values.
+///
+/// The pass also goes the other way: a conditional branch around a few cheap
+/// instructions whose mispredict rate is known to be high, either from an
+/// unpredictable hint or from profiled edge probabilities, is replaced by
+/// CMOVs when the expected mispredict cost exceeds the cost of speculating
+/// both sides. CMOVs created this way are never converted back.
+///
+/// Each decision on a candidate is reported as an optimization remark.
 ///
 /// Note: This pass is assumed to run on SSA machine code.
 //
@@ -44,32 +57,41 @@
 #include "X86InstrInfo.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/CodeGen/LazyMachineBlockFrequencyInfo.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineBranchProbabilityInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstr.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineLoopInfo.h"
 #include "llvm/CodeGen/MachineOperand.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/CodeGen/TargetInstrInfo.h"
 #include "llvm/CodeGen/TargetRegisterInfo.h"
 #include "llvm/CodeGen/TargetSchedule.h"
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
 #include "llvm/IR/DebugLoc.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/MC/MCSchedule.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/BranchProbability.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 #include <cassert>
 #include <iterator>
+#include <limits>
 #include <utility>
 
 using namespace llvm;
@@ -80,6 +102,9 @@ STATISTIC(NumOfSkippedCmovGroups, "Number of unsupported CMOV-groups");
 STATISTIC(NumOfCmovGroupCandidate, "Number of CMOV-group candidates");
 STATISTIC(NumOfLoopCandidate, "Number of CMOV-conversion profitable loops");
 STATISTIC(NumOfOptimizedCmovGroups, "Number of optimized CMOV-groups");
+STATISTIC(NumOfHotBlockCandidate, "Number of CMOV-conversion profitable "
+                                  "hot blocks outside of loops");
+STATISTIC(NumOfConvertedBranches, "Number of branches converted into CMOVs");
 
 // This internal switch can be used to turn off the cmov/branch optimization.
 static cl::opt<bool>
@@ -97,6 +122,36 @@ static cl::opt<bool> ForceMemOperand(
     cl::desc("Convert cmovs to branches whenever they have memory operands."),
     cl::init(true), cl::Hidden);
 
+static cl::opt<bool> UseProfileInfo(
+    "x86-cmov-converter-use-profile",
+    cl::desc("Use branch weights and unpredictable hints to estimate how "
+             "often a CMOV condition would be mispredicted."),
+    cl::init(true), cl::Hidden);
+
+static cl::opt<bool> ConvertHotBlocks(
+    "x86-cmov-converter-hot-blocks",
+    cl::desc("With profile data, also consider CMOVs in hot blocks outside "
+             "of innermost loops."),
+    cl::init(true), cl::Hidden);
+
+static cl::opt<bool> EnableBranchToCmov(
+    "x86-cmov-converter-branch-to-cmov",
+    cl::desc("Convert frequently mispredicted branches around cheap code "
+             "into CMOVs."),
+    cl::init(true), cl::Hidden);
+
+static cl::opt<unsigned> MispredictRateThreshold(
+    "x86-cmov-converter-mispredict-threshold",
+    cl::desc("Minimum estimated mispredict rate (in percent) of a branch to "
+             "be converted into CMOVs."),
+    cl::init(20), cl::Hidden);
+
+static cl::opt<unsigned> MaxSpeculatedInstrs(
+    "x86-cmov-converter-max-speculated",
+    cl::desc("Maximum number of instructions hoisted out of a branch that is "
+             "converted into CMOVs."),
+    cl::init(4), cl::Hidden);
+
 namespace {
 
 /// Converts X86 cmov instructions into branches when profitable.
@@ -115,12 +170,24 @@ private:
   MachineRegisterInfo *MRI = nullptr;
   const TargetInstrInfo *TII = nullptr;
   const TargetRegisterInfo *TRI = nullptr;
+  MachineLoopInfo *MLI = nullptr;
+  const MachineBranchProbabilityInfo *MBPI = nullptr;
+  MachineBlockFrequencyInfo *MBFI = nullptr;
+  ProfileSummaryInfo *PSI = nullptr;
+  MachineOptimizationRemarkEmitter *ORE = nullptr;
   TargetSchedModel TSchedModel;
 
+  /// CMOVs created from branches, which must not be turned back.
+  SmallPtrSet<MachineInstr *, 8> NewCmovs;
+
   /// List of consecutive CMOV instructions.
   using CmovGroup = SmallVector<MachineInstr *, 2>;
   using CmovGroups = SmallVector<CmovGroup, 2>;
 
+  /// Convert the profitable CMOV-group-candidates of \p Blocks into branches.
+  /// \returns true iff any group was converted.
+  bool convertProfitableCmovGroups(ArrayRef<MachineBasicBlock *> Blocks);
+
   /// Collect all CMOV-group-candidates in \p CurrLoop and update \p
   /// CmovInstGroups accordingly.
   ///
@@ -144,6 +211,22 @@ private:
   ///
   /// \param Group Consecutive CMOV instructions to be converted into branch.
   void convertCmovInstsToBranches(SmallVectorImpl<MachineInstr *> &Group) const;
+
+  /// Estimate how often the condition of \p Group would be mispredicted as
+  /// a branch. \returns None if nothing is known about it.
+  Optional<BranchProbability> getMispredictRate(const CmovGroup &Group) const;
+
+  /// Estimate how often the conditional branch from \p MBB to \p TBB is
+  /// mispredicted. \returns None if nothing is known about it.
+  Optional<BranchProbability>
+  getMispredictRate(const MachineBasicBlock &MBB,
+                    const MachineBasicBlock &TBB) const;
+
+  /// Replace the conditional branch ending \p MBB by CMOVs if it is
+  /// mispredicted often enough. Blocks whose instructions were hoisted into
+  /// \p MBB are added to \p DeadBlocks.
+  bool convertBranchToCmovs(MachineBasicBlock &MBB,
+                            SmallVectorImpl<MachineBasicBlock *> &DeadBlocks);
 };
 
 } // end anonymous namespace
@@ -153,6 +236,10 @@ char X86CmovConverterPass::ID = 0;
 void X86CmovConverterPass::getAnalysisUsage(AnalysisUsage &AU) const {
   MachineFunctionPass::getAnalysisUsage(AU);
   AU.addRequired<MachineLoopInfo>();
+  AU.addRequired<MachineBranchProbabilityInfo>();
+  AU.addRequired<ProfileSummaryInfoWrapperPass>();
+  AU.addRequired<LazyMachineBlockFrequencyInfoPass>();
+  AU.addRequired<MachineOptimizationRemarkEmitterPass>();
 }
 
 bool X86CmovConverterPass::runOnMachineFunction(MachineFunction &MF) {
@@ -165,12 +252,46 @@ bool X86CmovConverterPass::runOnMachineFunction(MachineFunction &MF) {
                     << "**********\n");
 
   bool Changed = false;
-  MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
   const TargetSubtargetInfo &STI = MF.getSubtarget();
   MRI = &MF.getRegInfo();
   TII = STI.getInstrInfo();
   TRI = STI.getRegisterInfo();
+  MLI = &getAnalysis<MachineLoopInfo>();
+  MBPI = &getAnalysis<MachineBranchProbabilityInfo>();
+  PSI = &getAnalysis<ProfileSummaryInfoWrapperPass>().getPSI();
+  MBFI = (PSI && PSI->hasProfileSummary()) ?
+         &getAnalysis<LazyMachineBlockFrequencyInfoPass>().getBFI() :
+         nullptr;
+  ORE = &getAnalysis<MachineOptimizationRemarkEmitterPass>().getORE();
   TSchedModel.init(&STI);
+  NewCmovs.clear();
+
+  // Turn frequently mispredicted branches into CMOVs first, while the block
+  // frequencies and edge probabilities still describe the CFG. The blocks
+  // that were hoisted are only unlinked here, so the walk stays valid.
+  if (EnableBranchToCmov && UseProfileInfo) {
+    SmallVector<MachineBasicBlock *, 4> DeadBlocks;
+    for (MachineBasicBlock &MBB : MF)
+      Changed |= convertBranchToCmovs(MBB, DeadBlocks);
+    for (MachineBasicBlock *MBB : DeadBlocks) {
+      MLI->removeBlock(MBB);
+      MBB->eraseFromParent();
+    }
+  }
+
+  // Hot blocks outside of innermost loops. Collect them before the CFG is
+  // changed by the conversions below, which do not update the frequencies.
+  SmallVector<MachineBasicBlock *, 8> HotBlocks;
+  if (ConvertHotBlocks && MBFI) {
+    for (MachineBasicBlock &MBB : MF) {
+      MachineLoop *L = MLI->getLoopFor(&MBB);
+      if (L && L->getSubLoops().empty())
+        continue;
+      Optional<uint64_t> Count = MBFI->getBlockProfileCount(&MBB);
+      if (Count && PSI->isHotCount(*Count))
+        HotBlocks.push_back(&MBB);
+    }
+  }
 
   // Before we handle the more subtle cases of register-register CMOVs inside
   // of potentially hot loops, we want to quickly remove all CMOVs with
@@ -191,6 +312,12 @@ bool X86CmovConverterPass::runOnMachineFunction(MachineFunction &MF) {
         // For CMOV groups which we can rewrite and which contain a memory load,
         // always rewrite them. On x86, a CMOV will dramatically amplify any
         // memory latency by blocking speculative execution.
+        ORE->emit([&]() {
+          return MachineOptimizationRemark(DEBUG_TYPE, "CmovToBranch",
+                                           Group.front()->getDebugLoc(),
+                                           Group.front()->getParent())
+                 << "converted CMOV group with a memory operand into a branch";
+        });
         Changed = true;
         convertCmovInstsToBranches(Group);
       }
@@ -200,7 +327,7 @@ bool X86CmovConverterPass::runOnMachineFunction(MachineFunction &MF) {
   //===--------------------------------------------------------------------===//
   // Register-operand Conversion Algorithm
   // ---------
-  //   For each inner most loop
+  //   For each inner most loop, and each hot block outside of them
   //     collectCmovCandidates() {
   //       Find all CMOV-group-candidates.
   //     }
@@ -221,7 +348,7 @@ bool X86CmovConverterPass::runOnMachineFunction(MachineFunction &MF) {
   //===--------------------------------------------------------------------===//
 
   // Build up the loops in pre-order.
-  SmallVector<MachineLoop *, 4> Loops(MLI.begin(), MLI.end());
+  SmallVector<MachineLoop *, 4> Loops(MLI->begin(), MLI->end());
   // Note that we need to check size on each iteration as we accumulate child
   // loops.
   for (int i = 0; i < (int)Loops.size(); ++i)
@@ -233,24 +360,39 @@ bool X86CmovConverterPass::runOnMachineFunction(MachineFunction &MF) {
     if (!CurrLoop->getSubLoops().empty())
       continue;
 
-    // List of consecutive CMOV instructions to be processed.
-    CmovGroups CmovInstGroups;
-
-    if (!collectCmovCandidates(CurrLoop->getBlocks(), CmovInstGroups))
-      continue;
-
-    if (!checkForProfitableCmovCandidates(CurrLoop->getBlocks(),
-                                          CmovInstGroups))
-      continue;
+    if (convertProfitableCmovGroups(CurrLoop->getBlocks())) {
+      ++NumOfLoopCandidate;
+      Changed = true;
+    }
+  }
 
-    Changed = true;
-    for (auto &Group : CmovInstGroups)
-      convertCmovInstsToBranches(Group);
+  // A hot block is treated as a loop body executing once per visit.
+  for (MachineBasicBlock *MBB : HotBlocks) {
+    if (convertProfitableCmovGroups(MBB)) {
+      ++NumOfHotBlockCandidate;
+      Changed = true;
+    }
   }
 
   return Changed;
 }
 
+bool X86CmovConverterPass::convertProfitableCmovGroups(
+    ArrayRef<MachineBasicBlock *> Blocks) {
+  // List of consecutive CMOV instructions to be processed.
+  CmovGroups CmovInstGroups;
+
+  if (!collectCmovCandidates(Blocks, CmovInstGroups))
+    return false;
+
+  if (!checkForProfitableCmovCandidates(Blocks, CmovInstGroups))
+    return false;
+
+  for (auto &Group : CmovInstGroups)
+    convertCmovInstsToBranches(Group);
+  return true;
+}
+
 bool X86CmovConverterPass::collectCmovCandidates(
     ArrayRef<MachineBasicBlock *> Blocks, CmovGroups &CmovInstGroups,
     bool IncludeLoads) {
@@ -304,8 +446,10 @@ bool X86CmovConverterPass::collectCmovCandidates(
         }
         Group.push_back(&I);
         // Check if it is a non-consecutive CMOV instruction or it has different
-        // condition code than FirstCC or FirstOppCC.
-        if (FoundNonCMOVInst || (CC != FirstCC && CC != FirstOppCC))
+        // condition code than FirstCC or FirstOppCC. Also keep the CMOVs that
+        // were just formed from a branch.
+        if (FoundNonCMOVInst || (CC != FirstCC && CC != FirstOppCC) ||
+            NewCmovs.count(&I))
           // Mark the SKipGroup indicator to skip current processed CMOV-Group.
           SkipGroup = true;
         if (I.mayLoad()) {
@@ -363,14 +507,72 @@ bool X86CmovConverterPass::collectCmovCandidates(
 /// \returns Depth of CMOV instruction as if it was converted into branch.
 /// \param TrueOpDepth depth cost of CMOV true value operand.
 /// \param FalseOpDepth depth cost of CMOV false value operand.
-static unsigned getDepthOfOptCmov(unsigned TrueOpDepth, unsigned FalseOpDepth) {
+/// \param LikelyProb probability of the more likely of the two values.
+static unsigned getDepthOfOptCmov(unsigned TrueOpDepth, unsigned FalseOpDepth,
+                                  BranchProbability LikelyProb) {
   // The depth of the result after branch conversion is
   // TrueOpDepth * TrueOpProbability + FalseOpDepth * FalseOpProbability.
-  // As we have no info about branch weight, we assume 75% for one and 25% for
-  // the other, and pick the result with the largest resulting depth.
+  // We do not know which of the values is the likely one, so pick the result
+  // with the largest resulting depth. Without branch weights, LikelyProb is
+  // assumed to be 75%.
+  uint64_t Likely = LikelyProb.getNumerator();
+  uint64_t Unlikely = LikelyProb.getCompl().getNumerator();
+  uint64_t Denominator = BranchProbability::getDenominator();
   return std::max(
-      divideCeil(TrueOpDepth * 3 + FalseOpDepth, 4),
-      divideCeil(FalseOpDepth * 3 + TrueOpDepth, 4));
+      divideCeil(TrueOpDepth * Likely + FalseOpDepth * Unlikely, Denominator),
+      divideCeil(FalseOpDepth * Likely + TrueOpDepth * Unlikely, Denominator));
+}
+
+/// \returns the mispredict rate of a branch taken with probability \p Prob,
+/// assuming the predictor guesses the likely direction.
+static BranchProbability getMispredictRateForProb(BranchProbability Prob) {
+  return std::min(Prob, Prob.getCompl());
+}
+
+/// \returns the mispredict rate implied by the unpredictable hint or the
+/// branch weights of \p I, or None if it has neither.
+static Optional<BranchProbability> getMispredictRate(const Instruction &I) {
+  if (I.hasMetadata(LLVMContext::MD_unpredictable))
+    return BranchProbability(1, 2);
+  uint64_t TrueWeight, FalseWeight;
+  if (!I.extractProfMetadata(TrueWeight, FalseWeight) ||
+      TrueWeight + FalseWeight == 0)
+    return None;
+  return getMispredictRateForProb(BranchProbability::getBranchProbability(
+      TrueWeight, TrueWeight + FalseWeight));
+}
+
+/// Find the select \p MI was lowered from. Machine instructions do not link
+/// back to IR, so match on the debug location, which sample profiles require
+/// anyway, and give up if more than one select of the block has it.
+static const SelectInst *findOriginalSelect(const MachineInstr &MI) {
+  const DebugLoc &DL = MI.getDebugLoc();
+  const BasicBlock *BB = MI.getParent()->getBasicBlock();
+  if (!DL || !BB)
+    return nullptr;
+
+  const SelectInst *Found = nullptr;
+  for (const Instruction &I : *BB) {
+    const auto *SI = dyn_cast<SelectInst>(&I);
+    if (!SI || SI->getDebugLoc() != DL)
+      continue;
+    if (Found)
+      return nullptr;
+    Found = SI;
+  }
+  return Found;
+}
+
+Optional<BranchProbability>
+X86CmovConverterPass::getMispredictRate(const CmovGroup &Group) const {
+  if (!UseProfileInfo)
+    return None;
+  // All CMOVs of a group share the condition, any of them will do.
+  for (MachineInstr *MI : Group)
+    if (const SelectInst *SI = findOriginalSelect(*MI))
+      if (Optional<BranchProbability> Rate = ::getMispredictRate(*SI))
+        return Rate;
+  return None;
 }
 
 bool X86CmovConverterPass::checkForProfitableCmovCandidates(
@@ -396,8 +598,17 @@ bool X86CmovConverterPass::checkForProfitableCmovCandidates(
   DepthMap[nullptr] = {0, 0};
 
   SmallPtrSet<MachineInstr *, 4> CmovInstructions;
-  for (auto &Group : CmovInstGroups)
+  // Estimated mispredict rate of each group, and the probability of the
+  // likely value of each CMOV whose group has one.
+  SmallVector<Optional<BranchProbability>, 2> MispredictRates;
+  DenseMap<MachineInstr *, BranchProbability> LikelyProbs;
+  for (auto &Group : CmovInstGroups) {
     CmovInstructions.insert(Group.begin(), Group.end());
+    MispredictRates.push_back(getMispredictRate(Group));
+    if (MispredictRates.back())
+      for (MachineInstr *MI : Group)
+        LikelyProbs[MI] = MispredictRates.back()->getCompl();
+  }
 
   //===--------------------------------------------------------------------===//
   // Step 1: Calculate instruction depth and loop depth.
@@ -449,10 +660,14 @@ bool X86CmovConverterPass::checkForProfitableCmovCandidates(
           }
         }
 
-        if (IsCMOV)
+        if (IsCMOV) {
+          auto ProbIt = LikelyProbs.find(&MI);
           MIDepthOpt = getDepthOfOptCmov(
               DepthMap[OperandToDefMap.lookup(&MI.getOperand(1))].OptDepth,
-              DepthMap[OperandToDefMap.lookup(&MI.getOperand(2))].OptDepth);
+              DepthMap[OperandToDefMap.lookup(&MI.getOperand(2))].OptDepth,
+              ProbIt != LikelyProbs.end() ? ProbIt->second
+                                          : BranchProbability(3, 4));
+        }
 
         // Iterates over all operands to handle implicit definitions as well.
         for (auto &MO : MI.operands()) {
@@ -514,8 +729,6 @@ bool X86CmovConverterPass::checkForProfitableCmovCandidates(
   if (!WorthOptLoop)
     return false;
 
-  ++NumOfLoopCandidate;
-
   //===--------------------------------------------------------------------===//
   // Step 3: Check for each CMOV-group-candidate if it worth to be optimized.
   // Worth-Optimize-Group:
@@ -525,12 +738,18 @@ bool X86CmovConverterPass::checkForProfitableCmovCandidates(
   //   Predicted branch is faster than CMOV by the difference between depth of
   //   condition operand and depth of taken (predicted) value operand.
   //   To be conservative, the gain of such CMOV transformation should cover at
-  //   at least 25% of branch-misprediction-penalty.
+  //   at least 25% of branch-misprediction-penalty, or the estimated
+  //   mispredict rate of the group times the penalty if it is known.
   //===--------------------------------------------------------------------===//
   unsigned MispredictPenalty = TSchedModel.getMCSchedModel()->MispredictPenalty;
   CmovGroups TempGroups;
   std::swap(TempGroups, CmovInstGroups);
-  for (auto &Group : TempGroups) {
+  for (unsigned G = 0, E = TempGroups.size(); G != E; ++G) {
+    auto &Group = TempGroups[G];
+    const Optional<BranchProbability> &Rate = MispredictRates[G];
+    unsigned MispredictCost = Rate ? Rate->scale(MispredictPenalty)
+                                   : divideCeil(MispredictPenalty, 4);
+    unsigned MinGain = std::numeric_limits<unsigned>::max();
     bool WorthOpGroup = true;
     for (auto *MI : Group) {
       // Avoid CMOV instruction which value is used as a pointer to load from.
@@ -540,6 +759,12 @@ bool X86CmovConverterPass::checkForProfitableCmovCandidates(
       if (!UIs.empty() && ++UIs.begin() == UIs.end()) {
         unsigned Op = UIs.begin()->getOpcode();
         if (Op == X86::MOV64rm || Op == X86::MOV32rm) {
+          ORE->emit([&]() {
+            return MachineOptimizationRemarkMissed(
+                       DEBUG_TYPE, "CmovNotConverted", MI->getDebugLoc(),
+                       MI->getParent())
+                   << "kept CMOV: its result is only used as a load address";
+          });
           WorthOpGroup = false;
           break;
         }
@@ -547,17 +772,49 @@ bool X86CmovConverterPass::checkForProfitableCmovCandidates(
 
       unsigned CondCost =
           DepthMap[OperandToDefMap.lookup(&MI->getOperand(4))].Depth;
+      auto ProbIt = LikelyProbs.find(MI);
       unsigned ValCost = getDepthOfOptCmov(
           DepthMap[OperandToDefMap.lookup(&MI->getOperand(1))].Depth,
-          DepthMap[OperandToDefMap.lookup(&MI->getOperand(2))].Depth);
-      if (ValCost > CondCost || (CondCost - ValCost) * 4 < MispredictPenalty) {
+          DepthMap[OperandToDefMap.lookup(&MI->getOperand(2))].Depth,
+          ProbIt != LikelyProbs.end() ? ProbIt->second
+                                      : BranchProbability(3, 4));
+      if (ValCost > CondCost || CondCost - ValCost < MispredictCost) {
+        ORE->emit([&]() {
+          MachineOptimizationRemarkMissed R(DEBUG_TYPE, "CmovNotConverted",
+                                            MI->getDebugLoc(),
+                                            MI->getParent());
+          R << "kept CMOV: condition is ready "
+            << ore::NV("CondDepth", CondCost) << " cycles deep, values "
+            << ore::NV("ValueDepth", ValCost) << ", expected mispredict cost "
+            << ore::NV("MispredictCost", MispredictCost) << " cycles";
+          if (Rate)
+            R << " at " << ore::NV("MispredictPercent", Rate->scale(100))
+              << "% mispredicted";
+          return R;
+        });
         WorthOpGroup = false;
         break;
       }
+      MinGain = std::min(MinGain, CondCost - ValCost);
     }
 
-    if (WorthOpGroup)
-      CmovInstGroups.push_back(Group);
+    if (!WorthOpGroup)
+      continue;
+
+    ORE->emit([&]() {
+      MachineOptimizationRemark R(DEBUG_TYPE, "CmovToBranch",
+                                  Group.front()->getDebugLoc(),
+                                  Group.front()->getParent());
+      R << "converted CMOV group into a branch: saves "
+        << ore::NV("Gain", MinGain) << " cycles of critical path against "
+        << ore::NV("MispredictCost", MispredictCost)
+        << " cycles expected mispredict cost";
+      if (Rate)
+        R << " at " << ore::NV("MispredictPercent", Rate->scale(100))
+          << "% mispredicted";
+      return R;
+    });
+    CmovInstGroups.push_back(Group);
   }
 
   return !CmovInstGroups.empty();
@@ -850,9 +1107,241 @@ void X86CmovConverterPass::convertCmovInstsToBranches(
   MBB->erase(MIItBegin, MIItEnd);
 }
 
+Optional<BranchProbability>
+X86CmovConverterPass::getMispredictRate(const MachineBasicBlock &MBB,
+                                        const MachineBasicBlock &TBB) const {
+  // An unpredictable hint is only meaningful while MBB still ends with the
+  // IR branch, i.e. its successors are those of the branch.
+  if (const BasicBlock *BB = MBB.getBasicBlock()) {
+    const auto *BI = dyn_cast_or_null<BranchInst>(BB->getTerminator());
+    if (BI && BI->isConditional() &&
+        BI->hasMetadata(LLVMContext::MD_unpredictable) &&
+        llvm::all_of(MBB.successors(), [&](const MachineBasicBlock *Succ) {
+          return Succ->getBasicBlock() == BI->getSuccessor(0) ||
+                 Succ->getBasicBlock() == BI->getSuccessor(1);
+        }))
+      return BranchProbability(1, 2);
+  }
+
+  // Without profile data the edge probabilities are static guesses.
+  if (!MBB.getParent()->getFunction().hasProfileData())
+    return None;
+  return getMispredictRateForProb(MBPI->getEdgeProbability(&MBB, &TBB));
+}
+
+/// \returns true if \p MBB is reached only from \p Head, falls into a single
+/// successor and contains at most \p MaxInstrs instructions that can be
+/// executed unconditionally in \p Head.
+static bool isSpeculatableBlock(const MachineBasicBlock &MBB,
+                                const MachineBasicBlock &Head,
+                                unsigned MaxInstrs) {
+  if (&MBB == &Head || MBB.pred_size() != 1 || MBB.succ_size() != 1 ||
+      MBB.isEHPad() || MBB.hasAddressTaken() ||
+      *MBB.succ_begin() == &MBB || *MBB.succ_begin() == &Head)
+    return false;
+
+  unsigned NumInstrs = 0;
+  for (const MachineInstr &MI : MBB) {
+    if (MI.isDebugInstr())
+      continue;
+    if (MI.isTerminator()) {
+      if (!MI.isUnconditionalBranch())
+        return false;
+      continue;
+    }
+    // Loads may fault once they are executed on both paths. Instructions
+    // touching physical registers, EFLAGS in particular, would have to be
+    // placed before the compare, so leave them alone as well.
+    bool SawStore = false;
+    if (++NumInstrs > MaxInstrs || MI.isPHI() || MI.mayLoad() ||
+        !MI.isSafeToMove(nullptr, SawStore))
+      return false;
+    for (const MachineOperand &MO : MI.operands())
+      if (MO.isRegMask() ||
+          (MO.isReg() && MO.getReg() && !MO.getReg().isVirtual()))
+        return false;
+  }
+  return true;
+}
+
+bool X86CmovConverterPass::convertBranchToCmovs(
+    MachineBasicBlock &MBB, SmallVectorImpl<MachineBasicBlock *> &DeadBlocks) {
+  //===--------------------------------------------------------------------===//
+  // Turn a triangle or diamond into straight-line code:
+  //
+  //   MBB:                                MBB:
+  //     cond = cmp ...                      cond = cmp ...
+  //     jcc %TrueMBB                        <TrueMBB instructions>
+  //   FalseMBB:                             <FalseMBB instructions>
+  //     ...                        ==>      %v = CMOVcc %f, %t, cond
+  //     jmp %SinkMBB                        jmp %SinkMBB
+  //   TrueMBB:                            SinkMBB:
+  //     ...                                 ...
+  //   SinkMBB:
+  //     %v = phi [%t, %TrueMBB], [%f, %FalseMBB]
+  //
+  // Either side may be missing, in which case its value comes from MBB.
+  //===--------------------------------------------------------------------===//
+  MachineBasicBlock *TBB = nullptr, *FBB = nullptr;
+  SmallVector<MachineOperand, 1> Cond;
+  if (MBB.succ_size() != 2 || TII->analyzeBranch(MBB, TBB, FBB, Cond) ||
+      Cond.empty())
+    return false;
+  if (!FBB)
+    FBB = *MBB.succ_begin() == TBB ? *std::next(MBB.succ_begin())
+                                   : *MBB.succ_begin();
+  if (TBB == FBB || !MBB.isSuccessor(TBB) || !MBB.isSuccessor(FBB))
+    return false;
+
+  unsigned MaxInstrs = MaxSpeculatedInstrs;
+  MachineBasicBlock *TrueMBB = nullptr, *FalseMBB = nullptr, *SinkMBB;
+  if (isSpeculatableBlock(*TBB, MBB, MaxInstrs) &&
+      *TBB->succ_begin() == FBB) {
+    TrueMBB = TBB;
+    SinkMBB = FBB;
+  } else if (isSpeculatableBlock(*FBB, MBB, MaxInstrs) &&
+             *FBB->succ_begin() == TBB) {
+    FalseMBB = FBB;
+    SinkMBB = TBB;
+  } else if (isSpeculatableBlock(*TBB, MBB, MaxInstrs) &&
+             isSpeculatableBlock(*FBB, MBB, MaxInstrs) &&
+             *TBB->succ_begin() == *FBB->succ_begin()) {
+    TrueMBB = TBB;
+    FalseMBB = FBB;
+    SinkMBB = *TBB->succ_begin();
+  } else {
+    return false;
+  }
+  if (SinkMBB == &MBB)
+    return false;
+
+  unsigned NumSpeculated = 0;
+  for (MachineBasicBlock *Side : {TrueMBB, FalseMBB})
+    if (Side)
+      NumSpeculated += llvm::count_if(*Side, [](const MachineInstr &MI) {
+        return !MI.isDebugInstr() && !MI.isTerminator();
+      });
+  if (NumSpeculated > MaxInstrs)
+    return false;
+
+  // Find the value each PHI in SinkMBB gets on either path, and make sure a
+  // CMOV can select between them.
+  MachineBasicBlock *TruePred = TrueMBB ? TrueMBB : &MBB;
+  MachineBasicBlock *FalsePred = FalseMBB ? FalseMBB : &MBB;
+  SmallVector<std::pair<Register, Register>, 4> PHIValues;
+  unsigned CmovCost = NumSpeculated;
+  for (MachineInstr &PHI : SinkMBB->phis()) {
+    Register TrueReg, FalseReg;
+    for (unsigned I = 1, E = PHI.getNumOperands(); I != E; I += 2) {
+      if (PHI.getOperand(I + 1).getMBB() == TruePred)
+        TrueReg = PHI.getOperand(I).getReg();
+      if (PHI.getOperand(I + 1).getMBB() == FalsePred)
+        FalseReg = PHI.getOperand(I).getReg();
+    }
+    assert(TrueReg && FalseReg && "PHI is missing an incoming value");
+    PHIValues.push_back({TrueReg, FalseReg});
+    if (TrueReg == FalseReg)
+      continue;
+    int CondCycles, TrueCycles, FalseCycles;
+    if (!TII->canInsertSelect(MBB, Cond, PHI.getOperand(0).getReg(), TrueReg,
+                              FalseReg, CondCycles, TrueCycles, FalseCycles))
+      return false;
+    CmovCost += CondCycles;
+  }
+
+  // Estimate the cost of the mispredictions against the cost of executing
+  // both sides and waiting for the condition.
+  Optional<BranchProbability> Rate = getMispredictRate(MBB, *TBB);
+  if (!Rate)
+    return false;
+  MachineBasicBlock::iterator InsertPt = MBB.getFirstTerminator();
+  DebugLoc DL = InsertPt->getDebugLoc();
+  unsigned MispredictCost =
+      Rate->scale(TSchedModel.getMCSchedModel()->MispredictPenalty);
+  unsigned Threshold = std::min(MispredictRateThreshold.getValue(), 100u);
+  if (*Rate < BranchProbability(Threshold, 100) ||
+      MispredictCost <= CmovCost) {
+    ORE->emit([&]() {
+      return MachineOptimizationRemarkMissed(DEBUG_TYPE, "BranchNotConverted",
+                                             DL, &MBB)
+             << "kept branch: "
+             << ore::NV("MispredictPercent", Rate->scale(100))
+             << "% mispredicted, expected mispredict cost "
+             << ore::NV("MispredictCost", MispredictCost)
+             << " cycles against CMOV cost " << ore::NV("CmovCost", CmovCost)
+             << " cycles";
+    });
+    return false;
+  }
+
+  LLVM_DEBUG(dbgs() << "Converting branch in " << printMBBReference(MBB)
+                    << " into CMOVs\n");
+
+  // Hoist both sides in front of the branch. None of their instructions
+  // touch EFLAGS, so the condition is still available afterwards.
+  for (MachineBasicBlock *Side : {TrueMBB, FalseMBB})
+    if (Side)
+      MBB.splice(InsertPt, Side, Side->begin(), Side->getFirstTerminator());
+
+  // Select the value of each PHI in MBB, and let it flow in from MBB only.
+  unsigned NumCmovs = 0;
+  auto ValueIt = PHIValues.begin();
+  for (MachineInstr &PHI : SinkMBB->phis()) {
+    Register TrueReg = ValueIt->first, FalseReg = ValueIt->second;
+    ++ValueIt;
+    Register DestReg = TrueReg;
+    if (TrueReg != FalseReg) {
+      DestReg = MRI->createVirtualRegister(
+          MRI->getRegClass(PHI.getOperand(0).getReg()));
+      TII->insertSelect(MBB, InsertPt, DL, DestReg, Cond, TrueReg, FalseReg);
+      NewCmovs.insert(&*std::prev(InsertPt));
+      ++NumCmovs;
+    }
+    for (unsigned I = PHI.getNumOperands() - 1; I > 1; I -= 2) {
+      MachineBasicBlock *Pred = PHI.getOperand(I).getMBB();
+      if (Pred == &MBB || Pred == TrueMBB || Pred == FalseMBB) {
+        PHI.RemoveOperand(I);
+        PHI.RemoveOperand(I - 1);
+      }
+    }
+    MachineInstrBuilder(*MBB.getParent(), PHI).addReg(DestReg).addMBB(&MBB);
+  }
+
+  // Branch straight to SinkMBB. The hoisted blocks are left empty and
+  // unlinked, for the caller to erase.
+  TII->removeBranch(MBB);
+  for (MachineBasicBlock *Side : {TrueMBB, FalseMBB}) {
+    if (!Side)
+      continue;
+    MBB.removeSuccessor(Side, /*NormalizeSuccProbs=*/true);
+    Side->removeSuccessor(SinkMBB);
+    DeadBlocks.push_back(Side);
+  }
+  if (!MBB.isSuccessor(SinkMBB))
+    MBB.addSuccessor(SinkMBB, BranchProbability::getOne());
+  if (!MBB.isLayoutSuccessor(SinkMBB))
+    TII->insertBranch(MBB, SinkMBB, nullptr, None, DL);
+
+  ORE->emit([&]() {
+    return MachineOptimizationRemark(DEBUG_TYPE, "BranchToCmov", DL, &MBB)
+           << "converted branch into " << ore::NV("NumCmovs", NumCmovs)
+           << " CMOVs: " << ore::NV("MispredictPercent", Rate->scale(100))
+           << "% mispredicted, expected mispredict cost "
+           << ore::NV("MispredictCost", MispredictCost)
+           << " cycles against CMOV cost " << ore::NV("CmovCost", CmovCost)
+           << " cycles";
+  });
+  ++NumOfConvertedBranches;
+  return true;
+}
+
 INITIALIZE_PASS_BEGIN(X86CmovConverterPass, DEBUG_TYPE, "X86 cmov Conversion",
                       false, false)
 INITIALIZE_PASS_DEPENDENCY(MachineLoopInfo)
+INITIALIZE_PASS_DEPENDENCY(MachineBranchProbabilityInfo)
+INITIALIZE_PASS_DEPENDENCY(ProfileSummaryInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LazyMachineBlockFrequencyInfoPass)
+INITIALIZE_PASS_DEPENDENCY(MachineOptimizationRemarkEmitterPass)
 INITIALIZE_PASS_END(X86CmovConverterPass, DEBUG_TYPE, "X86 cmov Conversion",
                     false, false)
 
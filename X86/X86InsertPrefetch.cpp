@@ -16,6 +16,17 @@
 // a location at that memory operand + the delta specified in the
 // recommendation.
 //
+// Besides the fixed-delta hints, the profile may carry, per hint index:
+//  - a stride hint (__prefetch_stride_<i>): the distance in bytes the memory
+//    operand advances each loop iteration. When no explicit delta is given the
+//    prefetch is placed -x86-prefetch-stride-iterations iterations ahead.
+//    Strides the hardware prefetchers already follow are not prefetched.
+//  - a reuse distance (__prefetch_reuse_<i>): the number of bytes touched
+//    before the prefetched line is used. Hints of type "auto" pick the
+//    prefetch flavor (t0/t1/t2/nta) from it.
+// Prefetches that would fetch a cache line already prefetched in the same
+// basic block, from an unchanged address, are coalesced.
+//
 //===----------------------------------------------------------------------===//
 
 #include "X86.h"
@@ -23,6 +34,8 @@
 #include "X86InstrInfo.h"
 #include "X86MachineFunctionInfo.h"
 #include "X86Subtarget.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/ProfileData/SampleProf.h"
@@ -31,11 +44,50 @@
 using namespace llvm;
 using namespace sampleprof;
 
+#define DEBUG_TYPE "x86-insert-prefetch"
+
+STATISTIC(NumPrefetchesInserted, "Number of prefetches inserted");
+STATISTIC(NumPrefetchesCoalesced,
+          "Number of prefetches coalesced into an earlier one to the same "
+          "cache line");
+STATISTIC(NumPrefetchesHWCovered,
+          "Number of stride prefetches suppressed because the hardware "
+          "prefetcher covers the stride");
+STATISTIC(NumStridePrefetches, "Number of prefetches placed from stride hints");
+
 static cl::opt<std::string>
     PrefetchHintsFile("prefetch-hints-file",
                       cl::desc("Path to the prefetch hints profile. See also "
                                "-x86-discriminate-memops"),
                       cl::Hidden);
+
+static cl::opt<unsigned> PrefetchCacheLineSize(
+    "x86-prefetch-cache-line-size", cl::init(64), cl::Hidden,
+    cl::desc("Cache line size used to coalesce profile-driven prefetches"));
+
+static cl::opt<unsigned> PrefetchStrideIterations(
+    "x86-prefetch-stride-iterations", cl::init(8), cl::Hidden,
+    cl::desc("Number of loop iterations ahead to prefetch for stride hints"));
+
+static cl::opt<unsigned> HWPrefetchStrideLimit(
+    "x86-prefetch-hw-stride-limit", cl::init(128), cl::Hidden,
+    cl::desc("Largest stride, in bytes, that the hardware prefetchers are "
+             "assumed to cover; stride hints at or below it are ignored"));
+
+static cl::opt<unsigned> PrefetchT0ReuseLimit(
+    "x86-prefetch-t0-reuse-limit", cl::init(32 * 1024), cl::Hidden,
+    cl::desc("Largest reuse distance, in bytes, for which an auto prefetch "
+             "hint uses prefetcht0"));
+
+static cl::opt<unsigned> PrefetchT1ReuseLimit(
+    "x86-prefetch-t1-reuse-limit", cl::init(256 * 1024), cl::Hidden,
+    cl::desc("Largest reuse distance, in bytes, for which an auto prefetch "
+             "hint uses prefetcht1"));
+
+static cl::opt<unsigned> PrefetchT2ReuseLimit(
+    "x86-prefetch-t2-reuse-limit", cl::init(8 * 1024 * 1024), cl::Hidden,
+    cl::desc("Largest reuse distance, in bytes, for which an auto prefetch "
+             "hint uses prefetcht2; larger distances use prefetchnta"));
 namespace {
 
 class X86InsertPrefetch : public MachineFunctionPass {
@@ -51,6 +103,20 @@ class X86InsertPrefetch : public MachineFunctionPass {
   bool findPrefetchInfo(const FunctionSamples *Samples, const MachineInstr &MI,
                         Prefetches &prefetches) const;
 
+  /// A prefetch already inserted in the current basic block, described by the
+  /// registers of its address and the line-sized bucket its displacement falls
+  /// into. The alignment of the base address is unknown, so the bucket only
+  /// approximates the cache line: two displacements in one bucket may touch
+  /// adjacent lines, and two in adjacent buckets may touch the same line.
+  struct IssuedPrefetch {
+    Register BaseReg;
+    int64_t Scale;
+    Register IndexReg;
+    Register SegmentReg;
+    int64_t Line;
+    MachineInstr *PFetch;
+  };
+
 public:
   static char ID;
   X86InsertPrefetch(const std::string &PrefetchHintsFilename);
@@ -100,6 +166,32 @@ char X86InsertPrefetch::ID = 0;
 X86InsertPrefetch::X86InsertPrefetch(const std::string &PrefetchHintsFilename)
     : MachineFunctionPass(ID), Filename(PrefetchHintsFilename) {}
 
+// Rank the prefetch flavors by the cache level they fill, closest first.
+static unsigned getPrefetchLocality(unsigned PFetchInstrID) {
+  switch (PFetchInstrID) {
+  case X86::PREFETCHT0:
+    return 3;
+  case X86::PREFETCHT1:
+    return 2;
+  case X86::PREFETCHT2:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// Pick the prefetch flavor for an "auto" hint from the number of bytes touched
+// before the prefetched line is reused.
+static unsigned getPrefetchForReuseDistance(uint64_t ReuseDistance) {
+  if (ReuseDistance <= PrefetchT0ReuseLimit)
+    return X86::PREFETCHT0;
+  if (ReuseDistance <= PrefetchT1ReuseLimit)
+    return X86::PREFETCHT1;
+  if (ReuseDistance <= PrefetchT2ReuseLimit)
+    return X86::PREFETCHT2;
+  return X86::PREFETCHNTA;
+}
+
 /// Return true if the provided MachineInstruction has cache prefetch hints. In
 /// that case, the prefetch hints are stored, in order, in the Prefetches
 /// vector.
@@ -108,25 +200,45 @@ bool X86InsertPrefetch::findPrefetchInfo(const FunctionSamples *TopSamples,
                                          Prefetches &Prefetches) const {
   assert(Prefetches.empty() &&
          "Expected caller passed empty PrefetchInfo vector.");
+  // A zero instruction ID requests that the flavor be derived from the reuse
+  // distance.
   static constexpr std::pair<StringLiteral, unsigned> HintTypes[] = {
       {"_nta_", X86::PREFETCHNTA},
       {"_t0_", X86::PREFETCHT0},
       {"_t1_", X86::PREFETCHT1},
       {"_t2_", X86::PREFETCHT2},
+      {"_auto_", 0},
   };
+  static constexpr StringLiteral StrideHint = "_stride_";
+  static constexpr StringLiteral ReuseHint = "_reuse_";
   static const char *SerializedPrefetchPrefix = "__prefetch";
 
+  // All hints recorded for one prefetch index.
+  struct RawHint {
+    Optional<unsigned> InstructionID;
+    Optional<int64_t> Delta;
+    Optional<int64_t> Stride;
+    Optional<uint64_t> ReuseDistance;
+  };
+
   const ErrorOr<PrefetchHints> T = getPrefetchHints(TopSamples, MI);
   if (!T)
     return false;
-  int16_t max_index = -1;
+  SmallVector<RawHint, 4> Hints;
   // Convert serialized prefetch hints into PrefetchInfo objects, and populate
   // the Prefetches vector.
   for (const auto &S_V : *T) {
     StringRef Name = S_V.getKey();
-    if (Name.consume_front(SerializedPrefetchPrefix)) {
-      int64_t D = static_cast<int64_t>(S_V.second);
-      unsigned IID = 0;
+    if (!Name.consume_front(SerializedPrefetchPrefix))
+      continue;
+    uint64_t Value = S_V.second;
+    enum { TypeHint, StrideKind, ReuseKind } Kind = TypeHint;
+    unsigned IID = ~0U;
+    if (Name.consume_front(StrideHint)) {
+      Kind = StrideKind;
+    } else if (Name.consume_front(ReuseHint)) {
+      Kind = ReuseKind;
+    } else {
       for (const auto &HintType : HintTypes) {
         if (Name.startswith(HintType.first)) {
           Name = Name.drop_front(HintType.first.size());
@@ -134,22 +246,54 @@ bool X86InsertPrefetch::findPrefetchInfo(const FunctionSamples *TopSamples,
           break;
         }
       }
-      if (IID == 0)
+      if (IID == ~0U)
         return false;
-      uint8_t index = 0;
-      Name.consumeInteger(10, index);
+    }
+    uint8_t Index = 0;
+    Name.consumeInteger(10, Index);
 
-      if (index >= Prefetches.size())
-        Prefetches.resize(index + 1);
-      Prefetches[index] = {IID, D};
-      max_index = std::max(max_index, static_cast<int16_t>(index));
+    if (Index >= Hints.size())
+      Hints.resize(Index + 1);
+    RawHint &H = Hints[Index];
+    switch (Kind) {
+    case TypeHint:
+      H.InstructionID = IID;
+      H.Delta = static_cast<int64_t>(Value);
+      break;
+    case StrideKind:
+      H.Stride = static_cast<int64_t>(Value);
+      break;
+    case ReuseKind:
+      H.ReuseDistance = Value;
+      break;
     }
   }
-  assert(max_index + 1 >= 0 &&
-         "Possible overflow: max_index + 1 should be positive.");
-  assert(static_cast<size_t>(max_index + 1) == Prefetches.size() &&
-         "The number of prefetch hints received should match the number of "
-         "PrefetchInfo objects returned");
+
+  for (const RawHint &H : Hints) {
+    // Nothing to prefetch without a delta, explicit or derived from a stride.
+    if (!H.Delta && !H.Stride)
+      continue;
+    int64_t Delta;
+    if (H.Stride) {
+      uint64_t AbsStride =
+          *H.Stride < 0 ? -static_cast<uint64_t>(*H.Stride) : *H.Stride;
+      if (AbsStride <= HWPrefetchStrideLimit) {
+        ++NumPrefetchesHWCovered;
+        continue;
+      }
+    }
+    if (H.Delta) {
+      Delta = *H.Delta;
+    } else {
+      Delta = *H.Stride * static_cast<int64_t>(PrefetchStrideIterations);
+      ++NumStridePrefetches;
+    }
+    unsigned IID = H.InstructionID.getValueOr(0);
+    if (IID == 0)
+      IID = H.ReuseDistance ? getPrefetchForReuseDistance(*H.ReuseDistance)
+                            : X86::PREFETCHT0;
+    Prefetches.push_back({IID, Delta});
+  }
   return !Prefetches.empty();
 }
 
@@ -186,12 +330,28 @@ bool X86InsertPrefetch::runOnMachineFunction(MachineFunction &MF) {
   bool Changed = false;
 
   const TargetInstrInfo *TII = MF.getSubtarget().getInstrInfo();
+  const TargetRegisterInfo *TRI = MF.getSubtarget().getRegisterInfo();
+  const int64_t LineSize = std::max(1U, PrefetchCacheLineSize.getValue());
   SmallVector<PrefetchInfo, 4> Prefetches;
+  SmallVector<IssuedPrefetch, 8> Issued;
   for (auto &MBB : MF) {
+    Issued.clear();
     for (auto MI = MBB.instr_begin(); MI != MBB.instr_end();) {
       auto Current = MI;
       ++MI;
 
+      // Forget earlier prefetches whose address registers Current redefines.
+      // This is done after handling Current's own hints, since its
+      // prefetches are inserted before it.
+      auto InvalidateIssued = make_scope_exit([&]() {
+        llvm::erase_if(Issued, [&](const IssuedPrefetch &P) {
+          return (P.BaseReg && Current->modifiesRegister(P.BaseReg, TRI)) ||
+                 (P.IndexReg && Current->modifiesRegister(P.IndexReg, TRI)) ||
+                 (P.SegmentReg &&
+                  Current->modifiesRegister(P.SegmentReg, TRI));
+        });
+      });
+
       int Offset = X86II::getMemoryOperandNo(Current->getDesc().TSFlags);
       if (Offset < 0)
         continue;
@@ -206,9 +366,40 @@ bool X86InsertPrefetch::runOnMachineFunction(MachineFunction &MF) {
       assert(!Prefetches.empty() &&
              "The Prefetches vector should contain at least a value if "
              "findPrefetchInfo returned true.");
+      Register BaseReg =
+          Current->getOperand(MemOpOffset + X86::AddrBaseReg).getReg();
+      int64_t Scale =
+          Current->getOperand(MemOpOffset + X86::AddrScaleAmt).getImm();
+      Register IndexReg =
+          Current->getOperand(MemOpOffset + X86::AddrIndexReg).getReg();
+      Register SegmentReg =
+          Current->getOperand(MemOpOffset + X86::AddrSegmentReg).getReg();
       for (auto &PrefInfo : Prefetches) {
         unsigned PFetchInstrID = PrefInfo.InstructionID;
         int64_t Delta = PrefInfo.Delta;
+        int64_t Disp =
+            Current->getOperand(MemOpOffset + X86::AddrDisp).getImm() + Delta;
+        int64_t Line = Disp >= 0 ? Disp / LineSize
+                                 : -((-Disp + LineSize - 1) / LineSize);
+
+        // If this line was already prefetched from the same address, keep a
+        // single prefetch using the closer of the two cache levels. Lines are
+        // counted from the unknown base address, so this is approximate, see
+        // IssuedPrefetch. Dropping a prefetch only loses a hint.
+        auto Prior = llvm::find_if(Issued, [&](const IssuedPrefetch &P) {
+          return P.BaseReg == BaseReg && P.Scale == Scale &&
+                 P.IndexReg == IndexReg && P.SegmentReg == SegmentReg &&
+                 P.Line == Line;
+        });
+        if (Prior != Issued.end()) {
+          MachineInstr *PriorPFetch = Prior->PFetch;
+          if (getPrefetchLocality(PFetchInstrID) >
+              getPrefetchLocality(PriorPFetch->getOpcode()))
+            PriorPFetch->setDesc(TII->get(PFetchInstrID));
+          ++NumPrefetchesCoalesced;
+          continue;
+        }
+
         const MCInstrDesc &Desc = TII->get(PFetchInstrID);
         MachineInstr *PFetch =
             MF.CreateMachineInstr(Desc, Current->getDebugLoc(), true);
@@ -222,15 +413,8 @@ bool X86InsertPrefetch::runOnMachineFunction(MachineFunction &MF) {
         // This assumes X86::AddBaseReg = 0, {...}ScaleAmt = 1, etc.
         // FIXME(mtrofin): consider adding a:
         //     MachineInstrBuilder::set(unsigned offset, op).
-        MIB.addReg(Current->getOperand(MemOpOffset + X86::AddrBaseReg).getReg())
-            .addImm(
-                Current->getOperand(MemOpOffset + X86::AddrScaleAmt).getImm())
-            .addReg(
-                Current->getOperand(MemOpOffset + X86::AddrIndexReg).getReg())
-            .addImm(Current->getOperand(MemOpOffset + X86::AddrDisp).getImm() +
-                    Delta)
-            .addReg(Current->getOperand(MemOpOffset + X86::AddrSegmentReg)
-                        .getReg());
+        MIB.addReg(BaseReg).addImm(Scale).addReg(IndexReg).addImm(Disp).addReg(
+            SegmentReg);
 
         if (!Current->memoperands_empty()) {
           MachineMemOperand *CurrentOp = *(Current->memoperands_begin());
@@ -241,6 +425,8 @@ bool X86InsertPrefetch::runOnMachineFunction(MachineFunction &MF) {
         // Insert before Current. This is because Current may clobber some of
         // the registers used to describe the input memory operand.
         MBB.insert(Current, PFetch);
+        Issued.push_back({BaseReg, Scale, IndexReg, SegmentReg, Line, PFetch});
+        ++NumPrefetchesInserted;
         Changed = true;
       }
     }
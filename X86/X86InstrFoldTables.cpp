@@ -13,14 +13,14 @@
 #include "X86InstrFoldTables.h"
 #include "X86InstrInfo.h"
 #include "llvm/ADT/STLExtras.h"
-#include <vector>
 
 using namespace llvm;
 
-// These tables are sorted by their RegOp value allowing them to be binary
-// searched at runtime without the need for additional storage. The enum values
-// are currently emitted in X86GenInstrInfo.inc in alphabetical order. Which
-// makes sorting these tables a simple matter of alphabetizing the table.
+// These tables are sorted by their RegOp value. The enum values are currently
+// emitted in X86GenInstrInfo.inc in alphabetical order. Which makes sorting
+// these tables a simple matter of alphabetizing the table. At runtime they are
+// accessed through dense opcode-indexed arrays computed at compile time, see
+// X86FoldTableIndex below.
 //
 // We also have a tablegen emitter that tries to autogenerate these tables
 // by comparing encoding information. This can be enabled by passing
@@ -32,7 +32,7 @@ using namespace llvm;
 // potentially pair up with old instructions and create new entries in the
 // tables that would be incorrect. The manual review process allows us a chance
 // to catch these before they become observable bugs.
-static const X86MemoryFoldTableEntry MemoryFoldTable2Addr[] = {
+static constexpr X86MemoryFoldTableEntry MemoryFoldTable2Addr[] = {
   { X86::ADD16ri8_DB, X86::ADD16mi8,   TB_NO_REVERSE },
   { X86::ADD16ri_DB,  X86::ADD16mi,    TB_NO_REVERSE },
   { X86::ADD16rr_DB,  X86::ADD16mr,    TB_NO_REVERSE },
@@ -251,7 +251,7 @@ static const X86MemoryFoldTableEntry MemoryFoldTable2Addr[] = {
   { X86::XOR8rr,      X86::XOR8mr,     0 },
 };
 
-static const X86MemoryFoldTableEntry MemoryFoldTable0[] = {
+static constexpr X86MemoryFoldTableEntry MemoryFoldTable0[] = {
   { X86::BT16ri8,             X86::BT16mi8,             TB_FOLDED_LOAD },
   { X86::BT32ri8,             X86::BT32mi8,             TB_FOLDED_LOAD },
   { X86::BT64ri8,             X86::BT64mi8,             TB_FOLDED_LOAD },
@@ -443,7 +443,7 @@ static const X86MemoryFoldTableEntry MemoryFoldTable0[] = {
   { X86::VPMOVWBZrr,          X86::VPMOVWBZmr,          TB_FOLDED_STORE },
 };
 
-static const X86MemoryFoldTableEntry MemoryFoldTable1[] = {
+static constexpr X86MemoryFoldTableEntry MemoryFoldTable1[] = {
   { X86::AESIMCrr,             X86::AESIMCrm,             TB_ALIGN_16 },
   { X86::AESKEYGENASSIST128rr, X86::AESKEYGENASSIST128rm, TB_ALIGN_16 },
   { X86::BEXTR32rr,            X86::BEXTR32rm,            0 },
@@ -1213,7 +1213,7 @@ static const X86MemoryFoldTableEntry MemoryFoldTable1[] = {
   { X86::VUCOMISSrr_Int,       X86::VUCOMISSrm_Int,       TB_NO_REVERSE },
 };
 
-static const X86MemoryFoldTableEntry MemoryFoldTable2[] = {
+static constexpr X86MemoryFoldTableEntry MemoryFoldTable2[] = {
   { X86::ADD16rr_DB,               X86::ADD16rm,                  TB_NO_REVERSE },
   { X86::ADD32rr_DB,               X86::ADD32rm,                  TB_NO_REVERSE },
   { X86::ADD64rr_DB,               X86::ADD64rm,                  TB_NO_REVERSE },
@@ -2995,7 +2995,7 @@ static const X86MemoryFoldTableEntry MemoryFoldTable2[] = {
   { X86::XORPSrr,                  X86::XORPSrm,                  TB_ALIGN_16 },
 };
 
-static const X86MemoryFoldTableEntry MemoryFoldTable3[] = {
+static constexpr X86MemoryFoldTableEntry MemoryFoldTable3[] = {
   { X86::VADDPDZ128rrkz,             X86::VADDPDZ128rmkz,             0 },
   { X86::VADDPDZ256rrkz,             X86::VADDPDZ256rmkz,             0 },
   { X86::VADDPDZrrkz,                X86::VADDPDZrmkz,                0 },
@@ -4344,7 +4344,7 @@ static const X86MemoryFoldTableEntry MemoryFoldTable3[] = {
   { X86::VXORPSZrrkz,                X86::VXORPSZrmkz,                0 },
 };
 
-static const X86MemoryFoldTableEntry MemoryFoldTable4[] = {
+static constexpr X86MemoryFoldTableEntry MemoryFoldTable4[] = {
   { X86::VADDPDZ128rrk,             X86::VADDPDZ128rmk,             0 },
   { X86::VADDPDZ256rrk,             X86::VADDPDZ256rmk,             0 },
   { X86::VADDPDZrrk,                X86::VADDPDZrmk,                0 },
@@ -5273,7 +5273,7 @@ static const X86MemoryFoldTableEntry MemoryFoldTable4[] = {
   { X86::VXORPSZrrk,                X86::VXORPSZrmk,                0 },
 };
 
-static const X86MemoryFoldTableEntry BroadcastFoldTable2[] = {
+static constexpr X86MemoryFoldTableEntry BroadcastFoldTable2[] = {
   { X86::VADDPDZ128rr,   X86::VADDPDZ128rmb,   TB_BCAST_SD },
   { X86::VADDPDZ256rr,   X86::VADDPDZ256rmb,   TB_BCAST_SD },
   { X86::VADDPDZrr,      X86::VADDPDZrmb,      TB_BCAST_SD },
@@ -5426,7 +5426,7 @@ static const X86MemoryFoldTableEntry BroadcastFoldTable2[] = {
   { X86::VSUBPSZrr,      X86::VSUBPSZrmb,      TB_BCAST_SS },
 };
 
-static const X86MemoryFoldTableEntry BroadcastFoldTable3[] = {
+static constexpr X86MemoryFoldTableEntry BroadcastFoldTable3[] = {
   { X86::VFMADD132PDZ128r,     X86::VFMADD132PDZ128mb,    TB_BCAST_SD },
   { X86::VFMADD132PDZ256r,     X86::VFMADD132PDZ256mb,    TB_BCAST_SD },
   { X86::VFMADD132PDZr,        X86::VFMADD132PDZmb,       TB_BCAST_SD },
@@ -5543,155 +5543,167 @@ static const X86MemoryFoldTableEntry BroadcastFoldTable3[] = {
   { X86::VPTERNLOGQZrri,       X86::VPTERNLOGQZrmbi,      TB_BCAST_Q },
 };
 
-static const X86MemoryFoldTableEntry *
-lookupFoldTableImpl(ArrayRef<X86MemoryFoldTableEntry> Table, unsigned RegOp) {
-#ifndef NDEBUG
-  // Make sure the tables are sorted.
-  static std::atomic<bool> FoldTablesChecked(false);
-  if (!FoldTablesChecked.load(std::memory_order_relaxed)) {
-    assert(llvm::is_sorted(MemoryFoldTable2Addr) &&
-           std::adjacent_find(std::begin(MemoryFoldTable2Addr),
-                              std::end(MemoryFoldTable2Addr)) ==
-               std::end(MemoryFoldTable2Addr) &&
-           "MemoryFoldTable2Addr is not sorted and unique!");
-    assert(llvm::is_sorted(MemoryFoldTable0) &&
-           std::adjacent_find(std::begin(MemoryFoldTable0),
-                              std::end(MemoryFoldTable0)) ==
-               std::end(MemoryFoldTable0) &&
-           "MemoryFoldTable0 is not sorted and unique!");
-    assert(llvm::is_sorted(MemoryFoldTable1) &&
-           std::adjacent_find(std::begin(MemoryFoldTable1),
-                              std::end(MemoryFoldTable1)) ==
-               std::end(MemoryFoldTable1) &&
-           "MemoryFoldTable1 is not sorted and unique!");
-    assert(llvm::is_sorted(MemoryFoldTable2) &&
-           std::adjacent_find(std::begin(MemoryFoldTable2),
-                              std::end(MemoryFoldTable2)) ==
-               std::end(MemoryFoldTable2) &&
-           "MemoryFoldTable2 is not sorted and unique!");
-    assert(llvm::is_sorted(MemoryFoldTable3) &&
-           std::adjacent_find(std::begin(MemoryFoldTable3),
-                              std::end(MemoryFoldTable3)) ==
-               std::end(MemoryFoldTable3) &&
-           "MemoryFoldTable3 is not sorted and unique!");
-    assert(llvm::is_sorted(MemoryFoldTable4) &&
-           std::adjacent_find(std::begin(MemoryFoldTable4),
-                              std::end(MemoryFoldTable4)) ==
-               std::end(MemoryFoldTable4) &&
-           "MemoryFoldTable4 is not sorted and unique!");
-    assert(llvm::is_sorted(BroadcastFoldTable2) &&
-           std::adjacent_find(std::begin(BroadcastFoldTable2),
-                              std::end(BroadcastFoldTable2)) ==
-               std::end(BroadcastFoldTable2) &&
-           "BroadcastFoldTable2 is not sorted and unique!");
-    assert(llvm::is_sorted(BroadcastFoldTable3) &&
-           std::adjacent_find(std::begin(BroadcastFoldTable3),
-                              std::end(BroadcastFoldTable3)) ==
-               std::end(BroadcastFoldTable3) &&
-           "BroadcastFoldTable3 is not sorted and unique!");
-    FoldTablesChecked.store(true, std::memory_order_relaxed);
+// Make sure the tables are sorted and unique. The lookups below do not depend
+// on the order, but keeping the tables alphabetized keeps them reviewable and
+// exposes accidental duplicates.
+template <size_t N>
+static constexpr bool
+isSortedAndUnique(const X86MemoryFoldTableEntry (&Table)[N]) {
+  for (size_t I = 1; I < N; ++I)
+    if (Table[I - 1].KeyOp >= Table[I].KeyOp)
+      return false;
+  return true;
+}
+
+static_assert(isSortedAndUnique(MemoryFoldTable2Addr),
+              "MemoryFoldTable2Addr is not sorted and unique!");
+static_assert(isSortedAndUnique(MemoryFoldTable0),
+              "MemoryFoldTable0 is not sorted and unique!");
+static_assert(isSortedAndUnique(MemoryFoldTable1),
+              "MemoryFoldTable1 is not sorted and unique!");
+static_assert(isSortedAndUnique(MemoryFoldTable2),
+              "MemoryFoldTable2 is not sorted and unique!");
+static_assert(isSortedAndUnique(MemoryFoldTable3),
+              "MemoryFoldTable3 is not sorted and unique!");
+static_assert(isSortedAndUnique(MemoryFoldTable4),
+              "MemoryFoldTable4 is not sorted and unique!");
+static_assert(isSortedAndUnique(BroadcastFoldTable2),
+              "BroadcastFoldTable2 is not sorted and unique!");
+static_assert(isSortedAndUnique(BroadcastFoldTable3),
+              "BroadcastFoldTable3 is not sorted and unique!");
+
+namespace {
+
+// A dense, opcode-indexed view of a folding table, so that every lookup is a
+// single array access instead of a binary search. Each slot holds one plus the
+// position of the opcode's entry in the table, with zero meaning that the
+// opcode has no entry. The indexes are computed at compile time.
+struct X86FoldTableIndex {
+  uint16_t Slots[X86::INSTRUCTION_LIST_END];
+};
+
+// The memory unfolding table, with the KeyOp and DstOp of every entry swapped,
+// and its index.
+struct X86UnfoldTable {
+  X86MemoryFoldTableEntry
+      Entries[array_lengthof(MemoryFoldTable2Addr) +
+              array_lengthof(MemoryFoldTable0) +
+              array_lengthof(MemoryFoldTable1) +
+              array_lengthof(MemoryFoldTable2) +
+              array_lengthof(MemoryFoldTable3) +
+              array_lengthof(MemoryFoldTable4) +
+              array_lengthof(BroadcastFoldTable2) +
+              array_lengthof(BroadcastFoldTable3)];
+  unsigned Size;
+  X86FoldTableIndex Index;
+  // Number of memory opcodes that appear in more than one entry.
+  unsigned NumDuplicates;
+};
+
+} // namespace
+
+template <size_t N>
+static constexpr X86FoldTableIndex
+buildForwardIndex(const X86MemoryFoldTableEntry (&Table)[N]) {
+  static_assert(N < UINT16_MAX, "Fold table too large to index!");
+  X86FoldTableIndex Index{};
+  for (size_t I = 0; I != N; ++I)
+    if (!(Table[I].Flags & TB_NO_FORWARD))
+      Index.Slots[Table[I].KeyOp] = I + 1;
+  return Index;
+}
+
+template <size_t N>
+static constexpr void
+addUnfoldEntries(X86UnfoldTable &Unfold,
+                 const X86MemoryFoldTableEntry (&Table)[N],
+                 uint16_t ExtraFlags) {
+  for (size_t I = 0; I != N; ++I) {
+    const X86MemoryFoldTableEntry &Entry = Table[I];
+    if (Entry.Flags & TB_NO_REVERSE)
+      continue;
+    // NOTE: This swaps the KeyOp and DstOp in the table so we can index it.
+    X86MemoryFoldTableEntry &NewEntry = Unfold.Entries[Unfold.Size];
+    NewEntry.KeyOp = Entry.DstOp;
+    NewEntry.DstOp = Entry.KeyOp;
+    NewEntry.Flags = Entry.Flags | ExtraFlags;
+    uint16_t &Slot = Unfold.Index.Slots[NewEntry.KeyOp];
+    if (Slot)
+      ++Unfold.NumDuplicates;
+    Slot = ++Unfold.Size;
   }
-#endif
+}
+
+static constexpr X86UnfoldTable buildUnfoldTable() {
+  X86UnfoldTable Unfold{};
+  // Index 0, folded load and store, no alignment requirement.
+  addUnfoldEntries(Unfold, MemoryFoldTable2Addr,
+                   TB_INDEX_0 | TB_FOLDED_LOAD | TB_FOLDED_STORE);
+  // Index 0, mix of loads and stores.
+  addUnfoldEntries(Unfold, MemoryFoldTable0, TB_INDEX_0);
+  // Index 1, folded load
+  addUnfoldEntries(Unfold, MemoryFoldTable1, TB_INDEX_1 | TB_FOLDED_LOAD);
+  // Index 2, folded load
+  addUnfoldEntries(Unfold, MemoryFoldTable2, TB_INDEX_2 | TB_FOLDED_LOAD);
+  // Index 3, folded load
+  addUnfoldEntries(Unfold, MemoryFoldTable3, TB_INDEX_3 | TB_FOLDED_LOAD);
+  // Index 4, folded load
+  addUnfoldEntries(Unfold, MemoryFoldTable4, TB_INDEX_4 | TB_FOLDED_LOAD);
+  // Broadcast tables.
+  // Index 2, folded broadcast
+  addUnfoldEntries(Unfold, BroadcastFoldTable2,
+                   TB_INDEX_2 | TB_FOLDED_LOAD | TB_FOLDED_BCAST);
+  // Index 3, folded broadcast
+  addUnfoldEntries(Unfold, BroadcastFoldTable3,
+                   TB_INDEX_3 | TB_FOLDED_LOAD | TB_FOLDED_BCAST);
+  return Unfold;
+}
+
+static constexpr X86FoldTableIndex TwoAddrIndex =
+    buildForwardIndex(MemoryFoldTable2Addr);
+static constexpr X86FoldTableIndex FoldIndex[] = {
+    buildForwardIndex(MemoryFoldTable0), buildForwardIndex(MemoryFoldTable1),
+    buildForwardIndex(MemoryFoldTable2), buildForwardIndex(MemoryFoldTable3),
+    buildForwardIndex(MemoryFoldTable4)};
+static constexpr X86UnfoldTable UnfoldTable = buildUnfoldTable();
+static_assert(UnfoldTable.NumDuplicates == 0,
+              "Memory unfolding table is not unique!");
 
-  const X86MemoryFoldTableEntry *Data = llvm::lower_bound(Table, RegOp);
-  if (Data != Table.end() && Data->KeyOp == RegOp &&
-      !(Data->Flags & TB_NO_FORWARD))
-    return Data;
+static const X86MemoryFoldTableEntry *
+lookupFoldTableImpl(const X86MemoryFoldTableEntry *Table,
+                    const X86FoldTableIndex &Index, unsigned Opcode) {
+  if (Opcode >= X86::INSTRUCTION_LIST_END)
+    return nullptr;
+  if (unsigned Pos = Index.Slots[Opcode])
+    return &Table[Pos - 1];
   return nullptr;
 }
 
 const X86MemoryFoldTableEntry *
 llvm::lookupTwoAddrFoldTable(unsigned RegOp) {
-  return lookupFoldTableImpl(MemoryFoldTable2Addr, RegOp);
+  return lookupFoldTableImpl(MemoryFoldTable2Addr, TwoAddrIndex, RegOp);
 }
 
 const X86MemoryFoldTableEntry *
 llvm::lookupFoldTable(unsigned RegOp, unsigned OpNum) {
-  ArrayRef<X86MemoryFoldTableEntry> FoldTable;
+  const X86MemoryFoldTableEntry *FoldTable;
   if (OpNum == 0)
-    FoldTable = makeArrayRef(MemoryFoldTable0);
+    FoldTable = MemoryFoldTable0;
   else if (OpNum == 1)
-    FoldTable = makeArrayRef(MemoryFoldTable1);
+    FoldTable = MemoryFoldTable1;
   else if (OpNum == 2)
-    FoldTable = makeArrayRef(MemoryFoldTable2);
+    FoldTable = MemoryFoldTable2;
   else if (OpNum == 3)
-    FoldTable = makeArrayRef(MemoryFoldTable3);
+    FoldTable = MemoryFoldTable3;
   else if (OpNum == 4)
-    FoldTable = makeArrayRef(MemoryFoldTable4);
+    FoldTable = MemoryFoldTable4;
   else
     return nullptr;
 
-  return lookupFoldTableImpl(FoldTable, RegOp);
-}
-
-namespace {
-
-// This class stores the memory unfolding tables. It is instantiated as a
-// ManagedStatic to lazily init the unfolding table.
-struct X86MemUnfoldTable {
-  // Stores memory unfolding tables entries sorted by opcode.
-  std::vector<X86MemoryFoldTableEntry> Table;
-
-  X86MemUnfoldTable() {
-    for (const X86MemoryFoldTableEntry &Entry : MemoryFoldTable2Addr)
-      // Index 0, folded load and store, no alignment requirement.
-      addTableEntry(Entry, TB_INDEX_0 | TB_FOLDED_LOAD | TB_FOLDED_STORE);
-
-    for (const X86MemoryFoldTableEntry &Entry : MemoryFoldTable0)
-      // Index 0, mix of loads and stores.
-      addTableEntry(Entry, TB_INDEX_0);
-
-    for (const X86MemoryFoldTableEntry &Entry : MemoryFoldTable1)
-      // Index 1, folded load
-      addTableEntry(Entry, TB_INDEX_1 | TB_FOLDED_LOAD);
-
-    for (const X86MemoryFoldTableEntry &Entry : MemoryFoldTable2)
-      // Index 2, folded load
-      addTableEntry(Entry, TB_INDEX_2 | TB_FOLDED_LOAD);
-
-    for (const X86MemoryFoldTableEntry &Entry : MemoryFoldTable3)
-      // Index 3, folded load
-      addTableEntry(Entry, TB_INDEX_3 | TB_FOLDED_LOAD);
-
-    for (const X86MemoryFoldTableEntry &Entry : MemoryFoldTable4)
-      // Index 4, folded load
-      addTableEntry(Entry, TB_INDEX_4 | TB_FOLDED_LOAD);
-
-    // Broadcast tables.
-    for (const X86MemoryFoldTableEntry &Entry : BroadcastFoldTable2)
-      // Index 2, folded broadcast
-      addTableEntry(Entry, TB_INDEX_2 | TB_FOLDED_LOAD | TB_FOLDED_BCAST);
-
-    for (const X86MemoryFoldTableEntry &Entry : BroadcastFoldTable3)
-      // Index 3, folded broadcast
-      addTableEntry(Entry, TB_INDEX_3 | TB_FOLDED_LOAD | TB_FOLDED_BCAST);
-
-    // Sort the memory->reg unfold table.
-    array_pod_sort(Table.begin(), Table.end());
-
-    // Now that it's sorted, ensure its unique.
-    assert(std::adjacent_find(Table.begin(), Table.end()) == Table.end() &&
-           "Memory unfolding table is not unique!");
-  }
-
-  void addTableEntry(const X86MemoryFoldTableEntry &Entry,
-                     uint16_t ExtraFlags) {
-    // NOTE: This swaps the KeyOp and DstOp in the table so we can sort it.
-    if ((Entry.Flags & TB_NO_REVERSE) == 0)
-      Table.push_back({Entry.DstOp, Entry.KeyOp,
-                      static_cast<uint16_t>(Entry.Flags | ExtraFlags) });
-  }
-};
+  return lookupFoldTableImpl(FoldTable, FoldIndex[OpNum], RegOp);
 }
 
-static ManagedStatic<X86MemUnfoldTable> MemUnfoldTable;
-
 const X86MemoryFoldTableEntry *
 llvm::lookupUnfoldTable(unsigned MemOp) {
-  auto &Table = MemUnfoldTable->Table;
-  auto I = llvm::lower_bound(Table, MemOp);
-  if (I != Table.end() && I->KeyOp == MemOp)
-    return &*I;
-  return nullptr;
+  return lookupFoldTableImpl(UnfoldTable.Entries, UnfoldTable.Index, MemOp);
 }
-
@@ -18,6 +18,7 @@
 #include "X86MacroFusion.h"
 #include "X86RegisterBankInfo.h"
 #include "X86TargetMachine.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/CodeGen/GlobalISel/CallLowering.h"
 #include "llvm/CodeGen/GlobalISel/InstructionSelect.h"
@@ -250,6 +251,7 @@ void X86Subtarget::initSubtargetFeatures(StringRef CPU, StringRef TuneCPU,
 
   // Parse features string and set the CPU.
   ParseSubtargetFeatures(CPU, TuneCPU, FullFS);
+  initCacheProperties(TuneCPU);
 
   // All CPUs that implement SSE4.2 or SSE4A support unaligned accesses of
   // 16-bytes and under that are reasonably fast. These features were
@@ -283,6 +285,86 @@ void X86Subtarget::initSubtargetFeatures(StringRef CPU, StringRef TuneCPU,
     PreferVectorWidth = 256;
 }
 
+namespace {
+/// Data cache hierarchy and software prefetch tuning of a CPU. Sizes are in
+/// bytes; the prefetch distance is in instructions, as LoopDataPrefetch
+/// expects.
+struct X86CacheInfo {
+  const char *Name;
+  unsigned L1DSize;
+  unsigned L1DAssociativity;
+  unsigned L2Size;
+  unsigned L2Associativity;
+  unsigned PrefetchDistance;
+  unsigned MinPrefetchStride;
+  unsigned MaxPrefetchIterationsAhead;
+};
+} // end anonymous namespace
+
+// The L2 streamer of these cores follows sequential and small strided streams
+// within a 4 KiB page on its own, so software prefetches are only issued for
+// strides the hardware prefetchers miss. CPUs that are not listed keep the
+// generic TTI answers and do not run LoopDataPrefetch.
+static const X86CacheInfo X86CacheInfoTable[] = {
+    // Skylake-SP and its derivatives: 1 MiB 16-way L2 per core, behind a
+    // mesh with a higher memory latency than the client parts.
+    {"skylake-avx512", 32 * 1024, 8, 1024 * 1024, 16, 1024, 2048, 16},
+    {"skx", 32 * 1024, 8, 1024 * 1024, 16, 1024, 2048, 16},
+    {"cascadelake", 32 * 1024, 8, 1024 * 1024, 16, 1024, 2048, 16},
+    {"cooperlake", 32 * 1024, 8, 1024 * 1024, 16, 1024, 2048, 16},
+    // Ice Lake-SP: 48 KiB 12-way L1D, 1.25 MiB 20-way L2.
+    {"icelake-server", 48 * 1024, 12, 1280 * 1024, 20, 1024, 2048, 16},
+    // Zen 1-3: 512 KiB 8-way L2 per core. The L3 is shared per CCX and is
+    // not described by TTI.
+    {"znver1", 32 * 1024, 8, 512 * 1024, 8, 800, 2048, 16},
+    {"znver2", 32 * 1024, 8, 512 * 1024, 8, 800, 2048, 16},
+    {"znver3", 32 * 1024, 8, 512 * 1024, 8, 800, 2048, 16},
+};
+
+static const X86CacheInfo *lookupCacheInfo(StringRef TuneCPU) {
+  const X86CacheInfo *Info =
+      llvm::find_if(X86CacheInfoTable, [&](const X86CacheInfo &I) {
+        return TuneCPU == I.Name;
+      });
+  return Info == std::end(X86CacheInfoTable) ? nullptr : Info;
+}
+
+bool X86Subtarget::hasPrefetchTuning(StringRef TuneCPU) {
+  const X86CacheInfo *Info = lookupCacheInfo(TuneCPU);
+  return Info && Info->PrefetchDistance;
+}
+
+void X86Subtarget::initCacheProperties(StringRef TuneCPU) {
+  const X86CacheInfo *Info = lookupCacheInfo(TuneCPU);
+  if (!Info)
+    return;
+
+  L1DCacheSize = Info->L1DSize;
+  L1DCacheAssociativity = Info->L1DAssociativity;
+  L2CacheSize = Info->L2Size;
+  L2CacheAssociativity = Info->L2Associativity;
+  CacheLineSize = 64;
+  PrefetchDistance = Info->PrefetchDistance;
+  MinPrefetchStride = Info->MinPrefetchStride;
+  MaxPrefetchIterationsAhead = Info->MaxPrefetchIterationsAhead;
+}
+
+Optional<unsigned> X86Subtarget::getCacheSize(unsigned Level) const {
+  unsigned Size = Level == 0 ? L1DCacheSize : Level == 1 ? L2CacheSize : 0;
+  if (!Size)
+    return None;
+  return Size;
+}
+
+Optional<unsigned> X86Subtarget::getCacheAssociativity(unsigned Level) const {
+  unsigned Assoc = Level == 0   ? L1DCacheAssociativity
+                   : Level == 1 ? L2CacheAssociativity
+                                : 0;
+  if (!Assoc)
+    return None;
+  return Assoc;
+}
+
 X86Subtarget &X86Subtarget::initializeSubtargetDependencies(StringRef CPU,
                                                             StringRef TuneCPU,
                                                             StringRef FS) {
@@ -17,6 +17,7 @@
 #include "X86ISelLowering.h"
 #include "X86InstrInfo.h"
 #include "X86SelectionDAGInfo.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
 #include "llvm/IR/CallingConv.h"
@@ -514,6 +515,20 @@ private:
   /// Required vector width from function attribute.
   unsigned RequiredVectorWidth;
 
+  /// Data cache hierarchy of the tuning CPU, or zero if it is not known. See
+  /// initCacheProperties.
+  unsigned L1DCacheSize = 0;
+  unsigned L1DCacheAssociativity = 0;
+  unsigned L2CacheSize = 0;
+  unsigned L2CacheAssociativity = 0;
+  unsigned CacheLineSize = 0;
+
+  /// Software prefetch tuning used by LoopDataPrefetch. A zero prefetch
+  /// distance disables the pass.
+  unsigned PrefetchDistance = 0;
+  unsigned MinPrefetchStride = 1;
+  unsigned MaxPrefetchIterationsAhead = UINT_MAX;
+
   /// True if compiling for 64-bit, false for 16-bit or 32-bit.
   bool In64BitMode = false;
 
@@ -586,8 +601,13 @@ private:
                                                 StringRef TuneCPU,
                                                 StringRef FS);
   void initSubtargetFeatures(StringRef CPU, StringRef TuneCPU, StringRef FS);
+  void initCacheProperties(StringRef TuneCPU);
 
 public:
+  /// Return true if \p TuneCPU has a nonzero prefetch distance, so that
+  /// LoopDataPrefetch may insert software prefetches for it.
+  static bool hasPrefetchTuning(StringRef TuneCPU);
+
   /// Is this x86_64? (disregarding specific ABI / programming model)
   bool is64Bit() const {
     return In64BitMode;
@@ -785,6 +805,22 @@ public:
   unsigned getPreferVectorWidth() const { return PreferVectorWidth; }
   unsigned getRequiredVectorWidth() const { return RequiredVectorWidth; }
 
+  /// Cache levels are numbered as in TargetTransformInfo::CacheLevel, i.e.
+  /// 0 is the L1 data cache and 1 the L2 cache.
+  Optional<unsigned> getCacheSize(unsigned Level) const override;
+  Optional<unsigned> getCacheAssociativity(unsigned Level) const override;
+  unsigned getCacheLineSize() const override { return CacheLineSize; }
+  unsigned getPrefetchDistance() const override { return PrefetchDistance; }
+  unsigned getMinPrefetchStride(unsigned NumMemAccesses,
+                                unsigned NumStridedMemAccesses,
+                                unsigned NumPrefetches,
+                                bool HasCall) const override {
+    return MinPrefetchStride;
+  }
+  unsigned getMaxPrefetchIterationsAhead() const override {
+    return MaxPrefetchIterationsAhead;
+  }
+
   // Helper functions to determine when we should allow widening to 512-bit
   // during codegen.
   // TODO: Currently we're always allowing widening on CPUs without VLX,
@@ -47,6 +47,7 @@
 #include "llvm/Target/TargetLoweringObjectFile.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/Transforms/CFGuard.h"
+#include "llvm/Transforms/Scalar.h"
 #include <memory>
 #include <string>
 
@@ -56,6 +57,11 @@ static cl::opt<bool> EnableMachineCombinerPass("x86-machine-combiner",
                                cl::desc("Enable the machine combiner pass"),
                                cl::init(true), cl::Hidden);
 
+static cl::opt<bool>
+    EnableLoopDataPrefetch("x86-enable-loop-data-prefetch", cl::Hidden,
+                           cl::desc("Enable the loop data prefetch pass"),
+                           cl::init(true));
+
 extern "C" LLVM_EXTERNAL_VISIBILITY void LLVMInitializeX86Target() {
   // Register the target.
   RegisterTargetMachine<X86TargetMachine> X(getTheX86_32Target());
@@ -306,6 +312,7 @@ X86TargetMachine::getSubtargetImpl(const Function &F) const {
   // point to the full string in the Key.
   FS = Key.substr(FSStart);
 
+  std::lock_guard<std::mutex> Lock(SubtargetMapMutex);
   auto &I = SubtargetMap[Key];
   if (!I) {
     // This needs to be done before we create a new subtarget since any
@@ -412,6 +419,13 @@ void X86PassConfig::addIRPasses() {
   addPass(createAtomicExpandPass());
   addPass(createX86LowerAMXTypePass());
 
+  // Run LoopDataPrefetch before LSR so that the addresses of the prefetches
+  // are strength reduced along with the loads. Only add it, and the analyses
+  // it requires, when the target CPU has a prefetch distance.
+  if (TM->getOptLevel() != CodeGenOpt::None && EnableLoopDataPrefetch &&
+      X86Subtarget::hasPrefetchTuning(TM->getTargetCPU()))
+    addPass(createLoopDataPrefetchPass());
+
   TargetPassConfig::addIRPasses();
 
   if (TM->getOptLevel() != CodeGenOpt::None) {
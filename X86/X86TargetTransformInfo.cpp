@@ -40,16 +40,74 @@
 
 #include "X86TargetTransformInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/CodeGen/BasicTTIImpl.h"
 #include "llvm/CodeGen/CostTable.h"
 #include "llvm/CodeGen/TargetLowering.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/Debug.h"
+#include <initializer_list>
 
 using namespace llvm;
 
 #define DEBUG_TYPE "x86tti"
 
+namespace {
+
+/// A cost table that is indexed when it is constructed. The static tables in
+/// this file are declared with this type instead of as arrays of entries, so
+/// that each CostTableLookup is a hash lookup instead of a linear scan. The
+/// lookup returns the first entry for a key, just like a scan of the array.
+template <typename EntryT> class IndexedTbl {
+  SmallVector<EntryT, 0> Entries;
+  DenseMap<uint64_t, unsigned> Index;
+
+public:
+  IndexedTbl(std::initializer_list<EntryT> Tbl) : Entries(Tbl) {
+    Index.reserve(Entries.size());
+    for (unsigned I = 0, E = Entries.size(); I != E; ++I)
+      Index.try_emplace(getKey(Entries[I]), I);
+  }
+
+  const EntryT *find(uint64_t Key) const {
+    auto It = Index.find(Key);
+    return It == Index.end() ? nullptr : &Entries[It->second];
+  }
+
+  static uint64_t getKey(int ISD, MVT Ty) {
+    return (uint64_t(ISD) << 32) | Ty.SimpleTy;
+  }
+  static uint64_t getKey(int ISD, MVT Dst, MVT Src) {
+    return (uint64_t(ISD) << 32) | (uint64_t(Dst.SimpleTy) << 16) |
+           Src.SimpleTy;
+  }
+  static uint64_t getKey(const CostTblEntry &E) {
+    return getKey(E.ISD, E.Type);
+  }
+  static uint64_t getKey(const TypeConversionCostTblEntry &E) {
+    return getKey(E.ISD, E.Dst, E.Src);
+  }
+};
+
+using IndexedCostTbl = IndexedTbl<CostTblEntry>;
+using IndexedConversionCostTbl = IndexedTbl<TypeConversionCostTblEntry>;
+
+// These overload the generic lookups from CostTable.h and are found through
+// argument dependent lookup, so the call sites read the same as for arrays.
+const CostTblEntry *CostTableLookup(const IndexedCostTbl &Tbl, int ISD,
+                                    MVT Ty) {
+  return Tbl.find(IndexedCostTbl::getKey(ISD, Ty));
+}
+
+const TypeConversionCostTblEntry *
+ConvertCostTableLookup(const IndexedConversionCostTbl &Tbl, int ISD, MVT Dst,
+                       MVT Src) {
+  return Tbl.find(IndexedConversionCostTbl::getKey(ISD, Dst, Src));
+}
+
+} // end anonymous namespace
+
 //===----------------------------------------------------------------------===//
 //
 // X86 cost model.
@@ -67,6 +125,10 @@ X86TTIImpl::getPopcntSupport(unsigned TyWidth) {
 
 llvm::Optional<unsigned> X86TTIImpl::getCacheSize(
   TargetTransformInfo::CacheLevel Level) const {
+  // Prefer the description of the tuning CPU if the subtarget has one.
+  if (Optional<unsigned> Size = ST->getCacheSize(static_cast<unsigned>(Level)))
+    return Size;
+
   switch (Level) {
   case TargetTransformInfo::CacheLevel::L1D:
     //   - Penryn
@@ -97,6 +159,10 @@ llvm::Optional<unsigned> X86TTIImpl::getCacheSize(
 
 llvm::Optional<unsigned> X86TTIImpl::getCacheAssociativity(
   TargetTransformInfo::CacheLevel Level) const {
+  if (Optional<unsigned> Assoc =
+          ST->getCacheAssociativity(static_cast<unsigned>(Level)))
+    return Assoc;
+
   //   - Penryn
   //   - Nehalem
   //   - Westmere
@@ -177,6 +243,31 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
                                        TTI::OperandValueProperties Opd2PropInfo,
                                        ArrayRef<const Value *> Args,
                                        const Instruction *CxtI) {
+  // Without operands or a context instruction the cost only depends on the
+  // arguments below. The reduction, shuffle and intrinsic cost models issue
+  // many such queries for the same types.
+  if (!Args.empty() || CxtI)
+    return getArithmeticInstrCostImpl(Opcode, Ty, CostKind, Op1Info, Op2Info,
+                                      Opd1PropInfo, Opd2PropInfo, Args, CxtI);
+
+  unsigned Key = (Opcode << 16) | (CostKind << 8) | (Op1Info << 6) |
+                 (Op2Info << 4) | (Opd1PropInfo << 2) | Opd2PropInfo;
+  auto It = ArithCostCache.find({Ty, Key});
+  if (It != ArithCostCache.end())
+    return It->second;
+
+  int Cost = getArithmeticInstrCostImpl(Opcode, Ty, CostKind, Op1Info, Op2Info,
+                                        Opd1PropInfo, Opd2PropInfo, Args, CxtI);
+  ArithCostCache.try_emplace({Ty, Key}, Cost);
+  return Cost;
+}
+
+int X86TTIImpl::getArithmeticInstrCostImpl(
+    unsigned Opcode, Type *Ty, TTI::TargetCostKind CostKind,
+    TTI::OperandValueKind Op1Info, TTI::OperandValueKind Op2Info,
+    TTI::OperandValueProperties Opd1PropInfo,
+    TTI::OperandValueProperties Opd2PropInfo, ArrayRef<const Value *> Args,
+    const Instruction *CxtI) {
   // TODO: Handle more cost kinds.
   if (CostKind != TTI::TCK_RecipThroughput)
     return BaseT::getArithmeticInstrCost(Opcode, Ty, CostKind, Op1Info,
@@ -188,7 +279,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
   int ISD = TLI->InstructionOpcodeToISD(Opcode);
   assert(ISD && "Invalid opcode");
 
-  static const CostTblEntry GLMCostTable[] = {
+  static const IndexedCostTbl GLMCostTable = {
     { ISD::FDIV,  MVT::f32,   18 }, // divss
     { ISD::FDIV,  MVT::v4f32, 35 }, // divps
     { ISD::FDIV,  MVT::f64,   33 }, // divsd
@@ -200,7 +291,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
                                             LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SLMCostTable[] = {
+  static const IndexedCostTbl SLMCostTable = {
     { ISD::MUL,   MVT::v4i32, 11 }, // pmulld
     { ISD::MUL,   MVT::v8i16, 2  }, // pmullw
     { ISD::MUL,   MVT::v16i8, 14 }, // extend/pmullw/trunc sequence.
@@ -300,7 +391,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
                                     TargetTransformInfo::OP_None);
   }
 
-  static const CostTblEntry AVX512BWUniformConstCostTable[] = {
+  static const IndexedCostTbl AVX512BWUniformConstCostTable = {
     { ISD::SHL,  MVT::v64i8,   2 }, // psllw + pand.
     { ISD::SRL,  MVT::v64i8,   2 }, // psrlw + pand.
     { ISD::SRA,  MVT::v64i8,   4 }, // psrlw, pand, pxor, psubb.
@@ -313,7 +404,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry AVX512UniformConstCostTable[] = {
+  static const IndexedCostTbl AVX512UniformConstCostTable = {
     { ISD::SRA,  MVT::v2i64,   1 },
     { ISD::SRA,  MVT::v4i64,   1 },
     { ISD::SRA,  MVT::v8i64,   1 },
@@ -335,7 +426,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry AVX2UniformConstCostTable[] = {
+  static const IndexedCostTbl AVX2UniformConstCostTable = {
     { ISD::SHL,  MVT::v32i8,   2 }, // psllw + pand.
     { ISD::SRL,  MVT::v32i8,   2 }, // psrlw + pand.
     { ISD::SRA,  MVT::v32i8,   4 }, // psrlw, pand, pxor, psubb.
@@ -355,7 +446,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry SSE2UniformConstCostTable[] = {
+  static const IndexedCostTbl SSE2UniformConstCostTable = {
     { ISD::SHL,  MVT::v16i8,     2 }, // psllw + pand.
     { ISD::SRL,  MVT::v16i8,     2 }, // psrlw + pand.
     { ISD::SRA,  MVT::v16i8,     4 }, // psrlw, pand, pxor, psubb.
@@ -382,7 +473,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry AVX512BWConstCostTable[] = {
+  static const IndexedCostTbl AVX512BWConstCostTable = {
     { ISD::SDIV, MVT::v64i8,  14 }, // 2*ext+2*pmulhw sequence
     { ISD::SREM, MVT::v64i8,  16 }, // 2*ext+2*pmulhw+mul+sub sequence
     { ISD::UDIV, MVT::v64i8,  14 }, // 2*ext+2*pmulhw sequence
@@ -401,7 +492,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry AVX512ConstCostTable[] = {
+  static const IndexedCostTbl AVX512ConstCostTable = {
     { ISD::SDIV, MVT::v16i32, 15 }, // vpmuldq sequence
     { ISD::SREM, MVT::v16i32, 17 }, // vpmuldq+mul+sub sequence
     { ISD::UDIV, MVT::v16i32, 15 }, // vpmuludq sequence
@@ -424,7 +515,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry AVX2ConstCostTable[] = {
+  static const IndexedCostTbl AVX2ConstCostTable = {
     { ISD::SDIV, MVT::v32i8,  14 }, // 2*ext+2*pmulhw sequence
     { ISD::SREM, MVT::v32i8,  16 }, // 2*ext+2*pmulhw+mul+sub sequence
     { ISD::UDIV, MVT::v32i8,  14 }, // 2*ext+2*pmulhw sequence
@@ -446,7 +537,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry SSE2ConstCostTable[] = {
+  static const IndexedCostTbl SSE2ConstCostTable = {
     { ISD::SDIV, MVT::v32i8,  28+2 }, // 4*ext+4*pmulhw sequence + split.
     { ISD::SREM, MVT::v32i8,  32+2 }, // 4*ext+4*pmulhw+mul+sub sequence + split.
     { ISD::SDIV, MVT::v16i8,    14 }, // 2*ext+2*pmulhw sequence
@@ -490,7 +581,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry AVX512BWShiftCostTable[] = {
+  static const IndexedCostTbl AVX512BWShiftCostTable = {
     { ISD::SHL,   MVT::v8i16,      1 }, // vpsllvw
     { ISD::SRL,   MVT::v8i16,      1 }, // vpsrlvw
     { ISD::SRA,   MVT::v8i16,      1 }, // vpsravw
@@ -508,7 +599,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(AVX512BWShiftCostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX2UniformCostTable[] = {
+  static const IndexedCostTbl AVX2UniformCostTable = {
     // Uniform splats are cheaper for the following instructions.
     { ISD::SHL,  MVT::v16i16, 1 }, // psllw.
     { ISD::SRL,  MVT::v16i16, 1 }, // psrlw.
@@ -526,7 +617,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry SSE2UniformCostTable[] = {
+  static const IndexedCostTbl SSE2UniformCostTable = {
     // Uniform splats are cheaper for the following instructions.
     { ISD::SHL,  MVT::v8i16,  1 }, // psllw.
     { ISD::SHL,  MVT::v4i32,  1 }, // pslld
@@ -548,7 +639,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry AVX512DQCostTable[] = {
+  static const IndexedCostTbl AVX512DQCostTable = {
     { ISD::MUL,  MVT::v2i64, 1 },
     { ISD::MUL,  MVT::v4i64, 1 },
     { ISD::MUL,  MVT::v8i64, 1 }
@@ -559,7 +650,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(AVX512DQCostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX512BWCostTable[] = {
+  static const IndexedCostTbl AVX512BWCostTable = {
     { ISD::SHL,   MVT::v64i8,     11 }, // vpblendvb sequence.
     { ISD::SRL,   MVT::v64i8,     11 }, // vpblendvb sequence.
     { ISD::SRA,   MVT::v64i8,     24 }, // vpblendvb sequence.
@@ -574,7 +665,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(AVX512BWCostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX512CostTable[] = {
+  static const IndexedCostTbl AVX512CostTable = {
     { ISD::SHL,     MVT::v16i32,     1 },
     { ISD::SRL,     MVT::v16i32,     1 },
     { ISD::SRA,     MVT::v16i32,     1 },
@@ -607,7 +698,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(AVX512CostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX2ShiftCostTable[] = {
+  static const IndexedCostTbl AVX2ShiftCostTable = {
     // Shifts on v4i64/v8i32 on AVX2 is legal even though we declare to
     // customize them to detect the cases where shift amount is a scalar one.
     { ISD::SHL,     MVT::v4i32,    1 },
@@ -650,7 +741,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry XOPShiftCostTable[] = {
+  static const IndexedCostTbl XOPShiftCostTable = {
     // 128bit shifts take 1cy, but right shifts require negation beforehand.
     { ISD::SHL,     MVT::v16i8,    1 },
     { ISD::SRL,     MVT::v16i8,    2 },
@@ -693,7 +784,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       return LT.first * Entry->Cost;
   }
 
-  static const CostTblEntry SSE2UniformShiftCostTable[] = {
+  static const IndexedCostTbl SSE2UniformShiftCostTable = {
     // Uniform splats are cheaper for the following instructions.
     { ISD::SHL,  MVT::v16i16, 2+2 }, // 2*psllw + split.
     { ISD::SHL,  MVT::v8i32,  2+2 }, // 2*pslld + split.
@@ -732,7 +823,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
       ISD = ISD::MUL;
   }
 
-  static const CostTblEntry AVX2CostTable[] = {
+  static const IndexedCostTbl AVX2CostTable = {
     { ISD::SHL,  MVT::v32i8,     11 }, // vpblendvb sequence.
     { ISD::SHL,  MVT::v64i8,     22 }, // 2*vpblendvb sequence.
     { ISD::SHL,  MVT::v16i16,    10 }, // extend/vpsrlvd/pack sequence.
@@ -785,7 +876,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(AVX2CostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX1CostTable[] = {
+  static const IndexedCostTbl AVX1CostTable = {
     // We don't have to scalarize unsupported ops. We can issue two half-sized
     // operations and we only need to extract the upper YMM half.
     // Two ops + 1 extract + 1 insert = 4.
@@ -821,7 +912,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(AVX1CostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SSE42CostTable[] = {
+  static const IndexedCostTbl SSE42CostTable = {
     { ISD::FADD, MVT::f64,     1 }, // Nehalem from http://www.agner.org/
     { ISD::FADD, MVT::f32,     1 }, // Nehalem from http://www.agner.org/
     { ISD::FADD, MVT::v2f64,   1 }, // Nehalem from http://www.agner.org/
@@ -847,7 +938,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(SSE42CostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SSE41CostTable[] = {
+  static const IndexedCostTbl SSE41CostTable = {
     { ISD::SHL,  MVT::v16i8,      11 }, // pblendvb sequence.
     { ISD::SHL,  MVT::v32i8,  2*11+2 }, // pblendvb sequence + split.
     { ISD::SHL,  MVT::v8i16,      14 }, // pblendvb sequence.
@@ -876,7 +967,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(SSE41CostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SSE2CostTable[] = {
+  static const IndexedCostTbl SSE2CostTable = {
     // We don't correctly identify costs of casts because they are marked as
     // custom.
     { ISD::SHL,  MVT::v16i8,      26 }, // cmpgtb sequence.
@@ -918,7 +1009,7 @@ int X86TTIImpl::getArithmeticInstrCost(unsigned Opcode, Type *Ty,
     if (const auto *Entry = CostTableLookup(SSE2CostTable, ISD, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SSE1CostTable[] = {
+  static const IndexedCostTbl SSE1CostTable = {
     { ISD::FDIV, MVT::f32,   17 }, // Pentium III from http://www.agner.org/
     { ISD::FDIV, MVT::v4f32, 34 }, // Pentium III from http://www.agner.org/
 
@@ -1027,7 +1118,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
   EVT VT = TLI->getValueType(DL, BaseTp);
   if (VT.isSimple() && VT.isVector() && VT.getSizeInBits() < 128 &&
       !ST->hasSSSE3()) {
-     static const CostTblEntry SSE2SubVectorShuffleTbl[] = {
+     static const IndexedCostTbl SSE2SubVectorShuffleTbl = {
       {TTI::SK_Broadcast,        MVT::v4i16, 1}, // pshuflw
       {TTI::SK_Broadcast,        MVT::v2i16, 1}, // pshuflw
       {TTI::SK_Broadcast,        MVT::v8i8,  2}, // punpck/pshuflw
@@ -1095,7 +1186,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
     LT.first = NumOfDests * NumOfShufflesPerDest;
   }
 
-  static const CostTblEntry AVX512VBMIShuffleTbl[] = {
+  static const IndexedCostTbl AVX512VBMIShuffleTbl = {
       {TTI::SK_Reverse, MVT::v64i8, 1}, // vpermb
       {TTI::SK_Reverse, MVT::v32i8, 1}, // vpermb
 
@@ -1112,7 +1203,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
             CostTableLookup(AVX512VBMIShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX512BWShuffleTbl[] = {
+  static const IndexedCostTbl AVX512BWShuffleTbl = {
       {TTI::SK_Broadcast, MVT::v32i16, 1}, // vpbroadcastw
       {TTI::SK_Broadcast, MVT::v64i8, 1},  // vpbroadcastb
 
@@ -1138,7 +1229,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
             CostTableLookup(AVX512BWShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX512ShuffleTbl[] = {
+  static const IndexedCostTbl AVX512ShuffleTbl = {
       {TTI::SK_Broadcast, MVT::v8f64, 1},  // vbroadcastpd
       {TTI::SK_Broadcast, MVT::v16f32, 1}, // vbroadcastps
       {TTI::SK_Broadcast, MVT::v8i64, 1},  // vpbroadcastq
@@ -1197,7 +1288,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
     if (const auto *Entry = CostTableLookup(AVX512ShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX2ShuffleTbl[] = {
+  static const IndexedCostTbl AVX2ShuffleTbl = {
       {TTI::SK_Broadcast, MVT::v4f64, 1},  // vbroadcastpd
       {TTI::SK_Broadcast, MVT::v8f32, 1},  // vbroadcastps
       {TTI::SK_Broadcast, MVT::v4i64, 1},  // vpbroadcastq
@@ -1238,7 +1329,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
     if (const auto *Entry = CostTableLookup(AVX2ShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry XOPShuffleTbl[] = {
+  static const IndexedCostTbl XOPShuffleTbl = {
       {TTI::SK_PermuteSingleSrc, MVT::v4f64, 2},  // vperm2f128 + vpermil2pd
       {TTI::SK_PermuteSingleSrc, MVT::v8f32, 2},  // vperm2f128 + vpermil2ps
       {TTI::SK_PermuteSingleSrc, MVT::v4i64, 2},  // vperm2f128 + vpermil2pd
@@ -1260,7 +1351,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
     if (const auto *Entry = CostTableLookup(XOPShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry AVX1ShuffleTbl[] = {
+  static const IndexedCostTbl AVX1ShuffleTbl = {
       {TTI::SK_Broadcast, MVT::v4f64, 2},  // vperm2f128 + vpermilpd
       {TTI::SK_Broadcast, MVT::v8f32, 2},  // vperm2f128 + vpermilps
       {TTI::SK_Broadcast, MVT::v4i64, 2},  // vperm2f128 + vpermilpd
@@ -1307,7 +1398,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
     if (const auto *Entry = CostTableLookup(AVX1ShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SSE41ShuffleTbl[] = {
+  static const IndexedCostTbl SSE41ShuffleTbl = {
       {TTI::SK_Select, MVT::v2i64, 1}, // pblendw
       {TTI::SK_Select, MVT::v2f64, 1}, // movsd
       {TTI::SK_Select, MVT::v4i32, 1}, // pblendw
@@ -1320,7 +1411,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
     if (const auto *Entry = CostTableLookup(SSE41ShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SSSE3ShuffleTbl[] = {
+  static const IndexedCostTbl SSSE3ShuffleTbl = {
       {TTI::SK_Broadcast, MVT::v8i16, 1}, // pshufb
       {TTI::SK_Broadcast, MVT::v16i8, 1}, // pshufb
 
@@ -1341,7 +1432,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
     if (const auto *Entry = CostTableLookup(SSSE3ShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SSE2ShuffleTbl[] = {
+  static const IndexedCostTbl SSE2ShuffleTbl = {
       {TTI::SK_Broadcast, MVT::v2f64, 1}, // shufpd
       {TTI::SK_Broadcast, MVT::v2i64, 1}, // pshufd
       {TTI::SK_Broadcast, MVT::v4i32, 1}, // pshufd
@@ -1380,7 +1471,7 @@ int X86TTIImpl::getShuffleCost(TTI::ShuffleKind Kind, VectorType *BaseTp,
     if (const auto *Entry = CostTableLookup(SSE2ShuffleTbl, Kind, LT.second))
       return LT.first * Entry->Cost;
 
-  static const CostTblEntry SSE1ShuffleTbl[] = {
+  static const IndexedCostTbl SSE1ShuffleTbl = {
     { TTI::SK_Broadcast,        MVT::v4f32, 1 }, // shufps
     { TTI::SK_Reverse,          MVT::v4f32, 1 }, // shufps
     { TTI::SK_Select,           MVT::v4f32, 2 }, // 2*shufps
@@ -1399,6 +1490,22 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
                                  TTI::CastContextHint CCH,
                                  TTI::TargetCostKind CostKind,
                                  const Instruction *I) {
+  // I is only passed on to the generic implementation, which relies on CCH
+  // instead, so the cost is a function of the remaining arguments.
+  unsigned Key = (Opcode << 16) | (unsigned(CCH) << 8) | CostKind;
+  auto It = CastCostCache.find({{Dst, Src}, Key});
+  if (It != CastCostCache.end())
+    return It->second;
+
+  int Cost = getCastInstrCostImpl(Opcode, Dst, Src, CCH, CostKind, I);
+  CastCostCache.try_emplace({{Dst, Src}, Key}, Cost);
+  return Cost;
+}
+
+int X86TTIImpl::getCastInstrCostImpl(unsigned Opcode, Type *Dst, Type *Src,
+                                     TTI::CastContextHint CCH,
+                                     TTI::TargetCostKind CostKind,
+                                     const Instruction *I) {
   int ISD = TLI->InstructionOpcodeToISD(Opcode);
   assert(ISD && "Invalid opcode");
 
@@ -1412,7 +1519,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
   // FIXME: Need a better design of the cost table to handle non-simple types of
   // potential massive combinations (elem_num x src_type x dst_type).
 
-  static const TypeConversionCostTblEntry AVX512BWConversionTbl[] {
+  static const IndexedConversionCostTbl AVX512BWConversionTbl {
     { ISD::SIGN_EXTEND, MVT::v32i16, MVT::v32i8, 1 },
     { ISD::ZERO_EXTEND, MVT::v32i16, MVT::v32i8, 1 },
 
@@ -1457,7 +1564,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
     { ISD::TRUNCATE,    MVT::v64i1,  MVT::v64i8,  2 },
   };
 
-  static const TypeConversionCostTblEntry AVX512DQConversionTbl[] = {
+  static const IndexedConversionCostTbl AVX512DQConversionTbl = {
     { ISD::SINT_TO_FP,  MVT::v8f32,  MVT::v8i64,  1 },
     { ISD::SINT_TO_FP,  MVT::v8f64,  MVT::v8i64,  1 },
 
@@ -1474,7 +1581,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
   // TODO: For AVX512DQ + AVX512VL, we also have cheap casts for 128-bit and
   // 256-bit wide vectors.
 
-  static const TypeConversionCostTblEntry AVX512FConversionTbl[] = {
+  static const IndexedConversionCostTbl AVX512FConversionTbl = {
     { ISD::FP_EXTEND, MVT::v8f64,   MVT::v8f32,  1 },
     { ISD::FP_EXTEND, MVT::v8f64,   MVT::v16f32, 3 },
     { ISD::FP_ROUND,  MVT::v8f32,   MVT::v8f64,  1 },
@@ -1590,7 +1697,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
     { ISD::FP_TO_UINT,  MVT::v16i8,  MVT::v16f32, 3 },
   };
 
-  static const TypeConversionCostTblEntry AVX512BWVLConversionTbl[] {
+  static const IndexedConversionCostTbl AVX512BWVLConversionTbl {
     // Mask sign extend has an instruction.
     { ISD::SIGN_EXTEND, MVT::v2i8,   MVT::v2i1,  1 },
     { ISD::SIGN_EXTEND, MVT::v2i16,  MVT::v2i1,  1 },
@@ -1625,7 +1732,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
     { ISD::TRUNCATE,    MVT::v32i1,  MVT::v32i8,  2 }, // vpsllw+vptestmb
   };
 
-  static const TypeConversionCostTblEntry AVX512DQVLConversionTbl[] = {
+  static const IndexedConversionCostTbl AVX512DQVLConversionTbl = {
     { ISD::SINT_TO_FP,  MVT::v2f32,  MVT::v2i64,  1 },
     { ISD::SINT_TO_FP,  MVT::v2f64,  MVT::v2i64,  1 },
     { ISD::SINT_TO_FP,  MVT::v4f32,  MVT::v4i64,  1 },
@@ -1647,7 +1754,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
     { ISD::FP_TO_UINT,  MVT::v4i64,  MVT::v4f64,  1 },
   };
 
-  static const TypeConversionCostTblEntry AVX512VLConversionTbl[] = {
+  static const IndexedConversionCostTbl AVX512VLConversionTbl = {
     { ISD::TRUNCATE,  MVT::v2i1,    MVT::v2i8,   3 }, // sext+vpslld+vptestmd
     { ISD::TRUNCATE,  MVT::v4i1,    MVT::v4i8,   3 }, // sext+vpslld+vptestmd
     { ISD::TRUNCATE,  MVT::v8i1,    MVT::v8i8,   3 }, // sext+vpslld+vptestmd
@@ -1727,7 +1834,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
     { ISD::FP_TO_UINT,  MVT::v8i32,  MVT::v8f32,  1 },
   };
 
-  static const TypeConversionCostTblEntry AVX2ConversionTbl[] = {
+  static const IndexedConversionCostTbl AVX2ConversionTbl = {
     { ISD::SIGN_EXTEND, MVT::v4i64,  MVT::v4i1,   3 },
     { ISD::ZERO_EXTEND, MVT::v4i64,  MVT::v4i1,   3 },
     { ISD::SIGN_EXTEND, MVT::v8i32,  MVT::v8i1,   3 },
@@ -1763,7 +1870,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
     { ISD::UINT_TO_FP,  MVT::v8f32,  MVT::v8i32,  8 },
   };
 
-  static const TypeConversionCostTblEntry AVXConversionTbl[] = {
+  static const IndexedConversionCostTbl AVXConversionTbl = {
     { ISD::SIGN_EXTEND, MVT::v4i64,  MVT::v4i1,  6 },
     { ISD::ZERO_EXTEND, MVT::v4i64,  MVT::v4i1,  4 },
     { ISD::SIGN_EXTEND, MVT::v8i32,  MVT::v8i1,  7 },
@@ -1857,7 +1964,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
     { ISD::FP_ROUND,    MVT::v4f32,  MVT::v4f64,  1 },
   };
 
-  static const TypeConversionCostTblEntry SSE41ConversionTbl[] = {
+  static const IndexedConversionCostTbl SSE41ConversionTbl = {
     { ISD::ZERO_EXTEND, MVT::v4i64, MVT::v4i8,    2 },
     { ISD::SIGN_EXTEND, MVT::v4i64, MVT::v4i8,    2 },
     { ISD::ZERO_EXTEND, MVT::v4i64, MVT::v4i16,   2 },
@@ -1910,7 +2017,7 @@ int X86TTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
     { ISD::FP_TO_UINT,  MVT::v4i16,  MVT::v4f32,  2 },
   };
 
-  static const TypeConversionCostTblEntry SSE2ConversionTbl[] = {
+  static const IndexedConversionCostTbl SSE2ConversionTbl = {
     // These are somewhat magic numbers justified by looking at the output of
     // Intel's IACA, running some kernels and making sure when we take
     // legalization into account the throughput will be overestimated.
@@ -2141,12 +2248,12 @@ int X86TTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
     }
   }
 
-  static const CostTblEntry SLMCostTbl[] = {
+  static const IndexedCostTbl SLMCostTbl = {
     // slm pcmpeq/pcmpgt throughput is 2
     { ISD::SETCC,   MVT::v2i64,   2 },
   };
 
-  static const CostTblEntry AVX512BWCostTbl[] = {
+  static const IndexedCostTbl AVX512BWCostTbl = {
     { ISD::SETCC,   MVT::v32i16,  1 },
     { ISD::SETCC,   MVT::v64i8,   1 },
 
@@ -2154,7 +2261,7 @@ int X86TTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
     { ISD::SELECT,  MVT::v64i8,   1 },
   };
 
-  static const CostTblEntry AVX512CostTbl[] = {
+  static const IndexedCostTbl AVX512CostTbl = {
     { ISD::SETCC,   MVT::v8i64,   1 },
     { ISD::SETCC,   MVT::v16i32,  1 },
     { ISD::SETCC,   MVT::v8f64,   1 },
@@ -2172,7 +2279,7 @@ int X86TTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
     { ISD::SELECT,  MVT::v64i8,   2 }, // FIXME: should be 3
   };
 
-  static const CostTblEntry AVX2CostTbl[] = {
+  static const IndexedCostTbl AVX2CostTbl = {
     { ISD::SETCC,   MVT::v4i64,   1 },
     { ISD::SETCC,   MVT::v8i32,   1 },
     { ISD::SETCC,   MVT::v16i16,  1 },
@@ -2184,7 +2291,7 @@ int X86TTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
     { ISD::SELECT,  MVT::v32i8,   1 }, // pblendvb
   };
 
-  static const CostTblEntry AVX1CostTbl[] = {
+  static const IndexedCostTbl AVX1CostTbl = {
     { ISD::SETCC,   MVT::v4f64,   1 },
     { ISD::SETCC,   MVT::v8f32,   1 },
     // AVX1 does not support 8-wide integer compare.
@@ -2201,13 +2308,13 @@ int X86TTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
     { ISD::SELECT,  MVT::v32i8,   3 }, // vandps + vandnps + vorps
   };
 
-  static const CostTblEntry SSE42CostTbl[] = {
+  static const IndexedCostTbl SSE42CostTbl = {
     { ISD::SETCC,   MVT::v2f64,   1 },
     { ISD::SETCC,   MVT::v4f32,   1 },
     { ISD::SETCC,   MVT::v2i64,   1 },
   };
 
-  static const CostTblEntry SSE41CostTbl[] = {
+  static const IndexedCostTbl SSE41CostTbl = {
     { ISD::SELECT,  MVT::v2f64,   1 }, // blendvpd
     { ISD::SELECT,  MVT::v4f32,   1 }, // blendvps
     { ISD::SELECT,  MVT::v2i64,   1 }, // pblendvb
@@ -2216,7 +2323,7 @@ int X86TTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
     { ISD::SELECT,  MVT::v16i8,   1 }, // pblendvb
   };
 
-  static const CostTblEntry SSE2CostTbl[] = {
+  static const IndexedCostTbl SSE2CostTbl = {
     { ISD::SETCC,   MVT::v2f64,   2 },
     { ISD::SETCC,   MVT::f64,     1 },
     { ISD::SETCC,   MVT::v2i64,   8 },
@@ -2231,7 +2338,7 @@ int X86TTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
     { ISD::SELECT,  MVT::v16i8,   3 }, // pand + pandn + por
   };
 
-  static const CostTblEntry SSE1CostTbl[] = {
+  static const IndexedCostTbl SSE1CostTbl = {
     { ISD::SETCC,   MVT::v4f32,   2 },
     { ISD::SETCC,   MVT::f32,     1 },
 
@@ -2291,7 +2398,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
 
   // TODO: Overflow intrinsics (*ADDO, *SUBO, *MULO) with vector types are not
   //       specialized in these tables yet.
-  static const CostTblEntry AVX512CDCostTbl[] = {
+  static const IndexedCostTbl AVX512CDCostTbl = {
     { ISD::CTLZ,       MVT::v8i64,   1 },
     { ISD::CTLZ,       MVT::v16i32,  1 },
     { ISD::CTLZ,       MVT::v32i16,  8 },
@@ -2305,7 +2412,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::CTLZ,       MVT::v8i16,   4 },
     { ISD::CTLZ,       MVT::v16i8,   4 },
   };
-  static const CostTblEntry AVX512BWCostTbl[] = {
+  static const IndexedCostTbl AVX512BWCostTbl = {
     { ISD::ABS,        MVT::v32i16,  1 },
     { ISD::ABS,        MVT::v64i8,   1 },
     { ISD::BITREVERSE, MVT::v8i64,   5 },
@@ -2341,7 +2448,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::USUBSAT,    MVT::v32i16,  1 },
     { ISD::USUBSAT,    MVT::v64i8,   1 },
   };
-  static const CostTblEntry AVX512CostTbl[] = {
+  static const IndexedCostTbl AVX512CostTbl = {
     { ISD::ABS,        MVT::v8i64,   1 },
     { ISD::ABS,        MVT::v16i32,  1 },
     { ISD::ABS,        MVT::v32i16,  2 }, // FIXME: include split
@@ -2413,7 +2520,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::FMAXNUM,    MVT::v4f64,   2 },
     { ISD::FMAXNUM,    MVT::v8f64,   2 },
   };
-  static const CostTblEntry XOPCostTbl[] = {
+  static const IndexedCostTbl XOPCostTbl = {
     { ISD::BITREVERSE, MVT::v4i64,   4 },
     { ISD::BITREVERSE, MVT::v8i32,   4 },
     { ISD::BITREVERSE, MVT::v16i16,  4 },
@@ -2427,7 +2534,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::BITREVERSE, MVT::i16,     3 },
     { ISD::BITREVERSE, MVT::i8,      3 }
   };
-  static const CostTblEntry AVX2CostTbl[] = {
+  static const IndexedCostTbl AVX2CostTbl = {
     { ISD::ABS,        MVT::v4i64,   2 }, // VBLENDVPD(X,VPSUBQ(0,X),X)
     { ISD::ABS,        MVT::v8i32,   1 },
     { ISD::ABS,        MVT::v16i16,  1 },
@@ -2482,7 +2589,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::FSQRT,      MVT::v2f64,  14 }, // Haswell from http://www.agner.org/
     { ISD::FSQRT,      MVT::v4f64,  28 }, // Haswell from http://www.agner.org/
   };
-  static const CostTblEntry AVX1CostTbl[] = {
+  static const IndexedCostTbl AVX1CostTbl = {
     { ISD::ABS,        MVT::v4i64,   5 }, // VBLENDVPD(X,VPSUBQ(0,X),X)
     { ISD::ABS,        MVT::v8i32,   3 },
     { ISD::ABS,        MVT::v16i16,  3 },
@@ -2541,25 +2648,25 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::FSQRT,      MVT::v2f64,  21 }, // SNB from http://www.agner.org/
     { ISD::FSQRT,      MVT::v4f64,  43 }, // SNB from http://www.agner.org/
   };
-  static const CostTblEntry GLMCostTbl[] = {
+  static const IndexedCostTbl GLMCostTbl = {
     { ISD::FSQRT, MVT::f32,   19 }, // sqrtss
     { ISD::FSQRT, MVT::v4f32, 37 }, // sqrtps
     { ISD::FSQRT, MVT::f64,   34 }, // sqrtsd
     { ISD::FSQRT, MVT::v2f64, 67 }, // sqrtpd
   };
-  static const CostTblEntry SLMCostTbl[] = {
+  static const IndexedCostTbl SLMCostTbl = {
     { ISD::FSQRT, MVT::f32,   20 }, // sqrtss
     { ISD::FSQRT, MVT::v4f32, 40 }, // sqrtps
     { ISD::FSQRT, MVT::f64,   35 }, // sqrtsd
     { ISD::FSQRT, MVT::v2f64, 70 }, // sqrtpd
   };
-  static const CostTblEntry SSE42CostTbl[] = {
+  static const IndexedCostTbl SSE42CostTbl = {
     { ISD::USUBSAT,    MVT::v4i32,   2 }, // pmaxud + psubd
     { ISD::UADDSAT,    MVT::v4i32,   3 }, // not + pminud + paddd
     { ISD::FSQRT,      MVT::f32,    18 }, // Nehalem from http://www.agner.org/
     { ISD::FSQRT,      MVT::v4f32,  18 }, // Nehalem from http://www.agner.org/
   };
-  static const CostTblEntry SSE41CostTbl[] = {
+  static const IndexedCostTbl SSE41CostTbl = {
     { ISD::ABS,        MVT::v2i64,   2 }, // BLENDVPD(X,PSUBQ(0,X),X)
     { ISD::SMAX,       MVT::v4i32,   1 },
     { ISD::SMAX,       MVT::v16i8,   1 },
@@ -2570,7 +2677,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::UMIN,       MVT::v4i32,   1 },
     { ISD::UMIN,       MVT::v8i16,   1 },
   };
-  static const CostTblEntry SSSE3CostTbl[] = {
+  static const IndexedCostTbl SSSE3CostTbl = {
     { ISD::ABS,        MVT::v4i32,   1 },
     { ISD::ABS,        MVT::v8i16,   1 },
     { ISD::ABS,        MVT::v16i8,   1 },
@@ -2594,7 +2701,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::CTTZ,       MVT::v8i16,  12 },
     { ISD::CTTZ,       MVT::v16i8,   9 }
   };
-  static const CostTblEntry SSE2CostTbl[] = {
+  static const IndexedCostTbl SSE2CostTbl = {
     { ISD::ABS,        MVT::v2i64,   4 },
     { ISD::ABS,        MVT::v4i32,   3 },
     { ISD::ABS,        MVT::v8i16,   2 },
@@ -2637,37 +2744,37 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::FSQRT,      MVT::f64,    32 }, // Nehalem from http://www.agner.org/
     { ISD::FSQRT,      MVT::v2f64,  32 }, // Nehalem from http://www.agner.org/
   };
-  static const CostTblEntry SSE1CostTbl[] = {
+  static const IndexedCostTbl SSE1CostTbl = {
     { ISD::FMAXNUM,    MVT::f32,     4 },
     { ISD::FMAXNUM,    MVT::v4f32,   4 },
     { ISD::FSQRT,      MVT::f32,    28 }, // Pentium III from http://www.agner.org/
     { ISD::FSQRT,      MVT::v4f32,  56 }, // Pentium III from http://www.agner.org/
   };
-  static const CostTblEntry BMI64CostTbl[] = { // 64-bit targets
+  static const IndexedCostTbl BMI64CostTbl = { // 64-bit targets
     { ISD::CTTZ,       MVT::i64,     1 },
   };
-  static const CostTblEntry BMI32CostTbl[] = { // 32 or 64-bit targets
+  static const IndexedCostTbl BMI32CostTbl = { // 32 or 64-bit targets
     { ISD::CTTZ,       MVT::i32,     1 },
     { ISD::CTTZ,       MVT::i16,     1 },
     { ISD::CTTZ,       MVT::i8,      1 },
   };
-  static const CostTblEntry LZCNT64CostTbl[] = { // 64-bit targets
+  static const IndexedCostTbl LZCNT64CostTbl = { // 64-bit targets
     { ISD::CTLZ,       MVT::i64,     1 },
   };
-  static const CostTblEntry LZCNT32CostTbl[] = { // 32 or 64-bit targets
+  static const IndexedCostTbl LZCNT32CostTbl = { // 32 or 64-bit targets
     { ISD::CTLZ,       MVT::i32,     1 },
     { ISD::CTLZ,       MVT::i16,     1 },
     { ISD::CTLZ,       MVT::i8,      1 },
   };
-  static const CostTblEntry POPCNT64CostTbl[] = { // 64-bit targets
+  static const IndexedCostTbl POPCNT64CostTbl = { // 64-bit targets
     { ISD::CTPOP,      MVT::i64,     1 },
   };
-  static const CostTblEntry POPCNT32CostTbl[] = { // 32 or 64-bit targets
+  static const IndexedCostTbl POPCNT32CostTbl = { // 32 or 64-bit targets
     { ISD::CTPOP,      MVT::i32,     1 },
     { ISD::CTPOP,      MVT::i16,     1 },
     { ISD::CTPOP,      MVT::i8,      1 },
   };
-  static const CostTblEntry X64CostTbl[] = { // 64-bit targets
+  static const IndexedCostTbl X64CostTbl = { // 64-bit targets
     { ISD::ABS,        MVT::i64,     2 }, // SUB+CMOV
     { ISD::BITREVERSE, MVT::i64,    14 },
     { ISD::CTLZ,       MVT::i64,     4 }, // BSR+XOR or BSR+XOR+CMOV
@@ -2677,7 +2784,7 @@ int X86TTIImpl::getTypeBasedIntrinsicInstrCost(
     { ISD::UADDO,      MVT::i64,     1 },
     { ISD::UMULO,      MVT::i64,     2 }, // mulq + seto
   };
-  static const CostTblEntry X86CostTbl[] = { // 32 or 64-bit targets
+  static const IndexedCostTbl X86CostTbl = { // 32 or 64-bit targets
     { ISD::ABS,        MVT::i32,     2 }, // SUB+CMOV
     { ISD::ABS,        MVT::i16,     2 }, // SUB+CMOV
     { ISD::BITREVERSE, MVT::i32,    14 },
@@ -2911,7 +3018,7 @@ int X86TTIImpl::getIntrinsicInstrCost(const IntrinsicCostAttributes &ICA,
   if (ICA.isTypeBasedOnly())
     return getTypeBasedIntrinsicInstrCost(ICA, CostKind);
 
-  static const CostTblEntry AVX512CostTbl[] = {
+  static const IndexedCostTbl AVX512CostTbl = {
     { ISD::ROTL,       MVT::v8i64,   1 },
     { ISD::ROTL,       MVT::v4i64,   1 },
     { ISD::ROTL,       MVT::v2i64,   1 },
@@ -2926,7 +3033,7 @@ int X86TTIImpl::getIntrinsicInstrCost(const IntrinsicCostAttributes &ICA,
     { ISD::ROTR,       MVT::v4i32,   1 }
   };
   // XOP: ROTL = VPROT(X,Y), ROTR = VPROT(X,SUB(0,Y))
-  static const CostTblEntry XOPCostTbl[] = {
+  static const IndexedCostTbl XOPCostTbl = {
     { ISD::ROTL,       MVT::v4i64,   4 },
     { ISD::ROTL,       MVT::v8i32,   4 },
     { ISD::ROTL,       MVT::v16i16,  4 },
@@ -2944,12 +3051,12 @@ int X86TTIImpl::getIntrinsicInstrCost(const IntrinsicCostAttributes &ICA,
     { ISD::ROTR,       MVT::v8i16,   2 },
     { ISD::ROTR,       MVT::v16i8,   2 }
   };
-  static const CostTblEntry X64CostTbl[] = { // 64-bit targets
+  static const IndexedCostTbl X64CostTbl = { // 64-bit targets
     { ISD::ROTL,       MVT::i64,     1 },
     { ISD::ROTR,       MVT::i64,     1 },
     { ISD::FSHL,       MVT::i64,     4 }
   };
-  static const CostTblEntry X86CostTbl[] = { // 32 or 64-bit targets
+  static const IndexedCostTbl X86CostTbl = { // 32 or 64-bit targets
     { ISD::ROTL,       MVT::i32,     1 },
     { ISD::ROTL,       MVT::i16,     1 },
     { ISD::ROTL,       MVT::i8,      1 },
@@ -3007,7 +3114,7 @@ int X86TTIImpl::getIntrinsicInstrCost(const IntrinsicCostAttributes &ICA,
 }
 
 int X86TTIImpl::getVectorInstrCost(unsigned Opcode, Type *Val, unsigned Index) {
-  static const CostTblEntry SLMCostTbl[] = {
+  static const IndexedCostTbl SLMCostTbl = {
      { ISD::EXTRACT_VECTOR_ELT,       MVT::i8,      4 },
      { ISD::EXTRACT_VECTOR_ELT,       MVT::i16,     4 },
      { ISD::EXTRACT_VECTOR_ELT,       MVT::i32,     4 },
@@ -3341,12 +3448,12 @@ int X86TTIImpl::getArithmeticReductionCost(unsigned Opcode, VectorType *ValTy,
   // We use the Intel Architecture Code Analyzer(IACA) to measure the throughput
   // and make it as the cost.
 
-  static const CostTblEntry SLMCostTblNoPairWise[] = {
+  static const IndexedCostTbl SLMCostTblNoPairWise = {
     { ISD::FADD,  MVT::v2f64,   3 },
     { ISD::ADD,   MVT::v2i64,   5 },
   };
 
-  static const CostTblEntry SSE2CostTblNoPairWise[] = {
+  static const IndexedCostTbl SSE2CostTblNoPairWise = {
     { ISD::FADD,  MVT::v2f64,   2 },
     { ISD::FADD,  MVT::v4f32,   4 },
     { ISD::ADD,   MVT::v2i64,   2 },      // The data reported by the IACA tool is "1.6".
@@ -3361,7 +3468,7 @@ int X86TTIImpl::getArithmeticReductionCost(unsigned Opcode, VectorType *ValTy,
     { ISD::ADD,   MVT::v16i8,   3 },
   };
 
-  static const CostTblEntry AVX1CostTblNoPairWise[] = {
+  static const IndexedCostTbl AVX1CostTblNoPairWise = {
     { ISD::FADD,  MVT::v4f64,   3 },
     { ISD::FADD,  MVT::v4f32,   3 },
     { ISD::FADD,  MVT::v8f32,   4 },
@@ -3424,7 +3531,7 @@ int X86TTIImpl::getArithmeticReductionCost(unsigned Opcode, VectorType *ValTy,
 
   // FIXME: These assume a naive kshift+binop lowering, which is probably
   // conservative in most cases.
-  static const CostTblEntry AVX512BoolReduction[] = {
+  static const IndexedCostTbl AVX512BoolReduction = {
     { ISD::AND,  MVT::v2i1,   3 },
     { ISD::AND,  MVT::v4i1,   5 },
     { ISD::AND,  MVT::v8i1,   7 },
@@ -3439,14 +3546,14 @@ int X86TTIImpl::getArithmeticReductionCost(unsigned Opcode, VectorType *ValTy,
     { ISD::OR,   MVT::v64i1, 13 },
   };
 
-  static const CostTblEntry AVX2BoolReduction[] = {
+  static const IndexedCostTbl AVX2BoolReduction = {
     { ISD::AND,  MVT::v16i16,  2 }, // vpmovmskb + cmp
     { ISD::AND,  MVT::v32i8,   2 }, // vpmovmskb + cmp
     { ISD::OR,   MVT::v16i16,  2 }, // vpmovmskb + cmp
     { ISD::OR,   MVT::v32i8,   2 }, // vpmovmskb + cmp
   };
 
-  static const CostTblEntry AVX1BoolReduction[] = {
+  static const IndexedCostTbl AVX1BoolReduction = {
     { ISD::AND,  MVT::v4i64,   2 }, // vmovmskpd + cmp
     { ISD::AND,  MVT::v8i32,   2 }, // vmovmskps + cmp
     { ISD::AND,  MVT::v16i16,  4 }, // vextractf128 + vpand + vpmovmskb + cmp
@@ -3457,7 +3564,7 @@ int X86TTIImpl::getArithmeticReductionCost(unsigned Opcode, VectorType *ValTy,
     { ISD::OR,   MVT::v32i8,   4 }, // vextractf128 + vpor + vpmovmskb + cmp
   };
 
-  static const CostTblEntry SSE2BoolReduction[] = {
+  static const IndexedCostTbl SSE2BoolReduction = {
     { ISD::AND,  MVT::v2i64,   2 }, // movmskpd + cmp
     { ISD::AND,  MVT::v4i32,   2 }, // movmskps + cmp
     { ISD::AND,  MVT::v8i16,   2 }, // pmovmskb + cmp
@@ -3586,28 +3693,28 @@ int X86TTIImpl::getMinMaxCost(Type *Ty, Type *CondTy, bool IsUnsigned) {
     ISD = ISD::FMINNUM;
   }
 
-  static const CostTblEntry SSE1CostTbl[] = {
+  static const IndexedCostTbl SSE1CostTbl = {
     {ISD::FMINNUM, MVT::v4f32, 1},
   };
 
-  static const CostTblEntry SSE2CostTbl[] = {
+  static const IndexedCostTbl SSE2CostTbl = {
     {ISD::FMINNUM, MVT::v2f64, 1},
     {ISD::SMIN,    MVT::v8i16, 1},
     {ISD::UMIN,    MVT::v16i8, 1},
   };
 
-  static const CostTblEntry SSE41CostTbl[] = {
+  static const IndexedCostTbl SSE41CostTbl = {
     {ISD::SMIN,    MVT::v4i32, 1},
     {ISD::UMIN,    MVT::v4i32, 1},
     {ISD::UMIN,    MVT::v8i16, 1},
     {ISD::SMIN,    MVT::v16i8, 1},
   };
 
-  static const CostTblEntry SSE42CostTbl[] = {
+  static const IndexedCostTbl SSE42CostTbl = {
     {ISD::UMIN,    MVT::v2i64, 3}, // xor+pcmpgtq+blendvpd
   };
 
-  static const CostTblEntry AVX1CostTbl[] = {
+  static const IndexedCostTbl AVX1CostTbl = {
     {ISD::FMINNUM, MVT::v8f32,  1},
     {ISD::FMINNUM, MVT::v4f64,  1},
     {ISD::SMIN,    MVT::v8i32,  3},
@@ -3618,7 +3725,7 @@ int X86TTIImpl::getMinMaxCost(Type *Ty, Type *CondTy, bool IsUnsigned) {
     {ISD::UMIN,    MVT::v32i8,  3},
   };
 
-  static const CostTblEntry AVX2CostTbl[] = {
+  static const IndexedCostTbl AVX2CostTbl = {
     {ISD::SMIN,    MVT::v8i32,  1},
     {ISD::UMIN,    MVT::v8i32,  1},
     {ISD::SMIN,    MVT::v16i16, 1},
@@ -3627,7 +3734,7 @@ int X86TTIImpl::getMinMaxCost(Type *Ty, Type *CondTy, bool IsUnsigned) {
     {ISD::UMIN,    MVT::v32i8,  1},
   };
 
-  static const CostTblEntry AVX512CostTbl[] = {
+  static const IndexedCostTbl AVX512CostTbl = {
     {ISD::FMINNUM, MVT::v16f32, 1},
     {ISD::FMINNUM, MVT::v8f64,  1},
     {ISD::SMIN,    MVT::v2i64,  1},
@@ -3640,7 +3747,7 @@ int X86TTIImpl::getMinMaxCost(Type *Ty, Type *CondTy, bool IsUnsigned) {
     {ISD::UMIN,    MVT::v16i32, 1},
   };
 
-  static const CostTblEntry AVX512BWCostTbl[] = {
+  static const IndexedCostTbl AVX512BWCostTbl = {
     {ISD::SMIN,    MVT::v32i16, 1},
     {ISD::UMIN,    MVT::v32i16, 1},
     {ISD::SMIN,    MVT::v64i8,  1},
@@ -3721,13 +3828,13 @@ int X86TTIImpl::getMinMaxReductionCost(VectorType *ValTy, VectorType *CondTy,
   // We use the Intel Architecture Code Analyzer(IACA) to measure the throughput
   // and make it as the cost.
 
-  static const CostTblEntry SSE2CostTblNoPairWise[] = {
+  static const IndexedCostTbl SSE2CostTblNoPairWise = {
       {ISD::UMIN, MVT::v2i16, 5}, // need pxors to use pminsw/pmaxsw
       {ISD::UMIN, MVT::v4i16, 7}, // need pxors to use pminsw/pmaxsw
       {ISD::UMIN, MVT::v8i16, 9}, // need pxors to use pminsw/pmaxsw
   };
 
-  static const CostTblEntry SSE41CostTblNoPairWise[] = {
+  static const IndexedCostTbl SSE41CostTblNoPairWise = {
       {ISD::SMIN, MVT::v2i16, 3}, // same as sse2
       {ISD::SMIN, MVT::v4i16, 5}, // same as sse2
       {ISD::UMIN, MVT::v2i16, 5}, // same as sse2
@@ -3744,14 +3851,14 @@ int X86TTIImpl::getMinMaxReductionCost(VectorType *ValTy, VectorType *CondTy,
       {ISD::UMIN, MVT::v16i8, 6}, // FIXME: umin is cheaper than umax
   };
 
-  static const CostTblEntry AVX1CostTblNoPairWise[] = {
+  static const IndexedCostTbl AVX1CostTblNoPairWise = {
       {ISD::SMIN, MVT::v16i16, 6},
       {ISD::UMIN, MVT::v16i16, 6}, // FIXME: umin is cheaper than umax
       {ISD::SMIN, MVT::v32i8, 8},
       {ISD::UMIN, MVT::v32i8, 8},
   };
 
-  static const CostTblEntry AVX512BWCostTblNoPairWise[] = {
+  static const IndexedCostTbl AVX512BWCostTblNoPairWise = {
       {ISD::SMIN, MVT::v32i16, 8},
       {ISD::UMIN, MVT::v32i16, 8}, // FIXME: umin is cheaper than umax
       {ISD::SMIN, MVT::v64i8, 10},
@@ -4553,7 +4660,7 @@ int X86TTIImpl::getInterleavedMemoryOpCostAVX2(
   // The Cost accounts only for the shuffle sequence;
   // The cost of the loads/stores is accounted for separately.
   //
-  static const CostTblEntry AVX2InterleavedLoadTbl[] = {
+  static const IndexedCostTbl AVX2InterleavedLoadTbl = {
     { 2, MVT::v4i64, 6 }, //(load 8i64 and) deinterleave into 2 x 4i64
     { 2, MVT::v4f64, 6 }, //(load 8f64 and) deinterleave into 2 x 4f64
 
@@ -4573,7 +4680,7 @@ int X86TTIImpl::getInterleavedMemoryOpCostAVX2(
     { 8, MVT::v8f32, 40 }  //(load 64f32 and)deinterleave into 8 x 8f32
   };
 
-  static const CostTblEntry AVX2InterleavedStoreTbl[] = {
+  static const IndexedCostTbl AVX2InterleavedStoreTbl = {
     { 2, MVT::v4i64, 6 }, //interleave into 2 x 4i64 into 8i64 (and store)
     { 2, MVT::v4f64, 6 }, //interleave into 2 x 4f64 into 8f64 (and store)
 
@@ -4648,7 +4755,7 @@ int X86TTIImpl::getInterleavedMemoryOpCostAVX512(
     // The cost of loads and stores are computed separately from the table.
 
     // X86InterleavedAccess support only the following interleaved-access group.
-    static const CostTblEntry AVX512InterleavedLoadTbl[] = {
+    static const IndexedCostTbl AVX512InterleavedLoadTbl = {
         {3, MVT::v16i8, 12}, //(load 48i8 and) deinterleave into 3 x 16i8
         {3, MVT::v32i8, 14}, //(load 96i8 and) deinterleave into 3 x 32i8
         {3, MVT::v64i8, 22}, //(load 96i8 and) deinterleave into 3 x 32i8
@@ -4702,7 +4809,7 @@ int X86TTIImpl::getInterleavedMemoryOpCostAVX512(
   assert(Opcode == Instruction::Store &&
          "Expected Store Instruction at this  point");
   // X86InterleavedAccess support only the following interleaved-access group.
-  static const CostTblEntry AVX512InterleavedStoreTbl[] = {
+  static const IndexedCostTbl AVX512InterleavedStoreTbl = {
       {3, MVT::v16i8, 12}, // interleave 3 x 16i8 into 48i8 (and store)
       {3, MVT::v32i8, 14}, // interleave 3 x 32i8 into 96i8 (and store)
       {3, MVT::v64i8, 26}, // interleave 3 x 64i8 into 96i8 (and store)
@@ -17,6 +17,7 @@
 #define LLVM_LIB_TARGET_X86_X86TARGETTRANSFORMINFO_H
 
 #include "X86TargetMachine.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/CodeGen/BasicTTIImpl.h"
 
@@ -32,6 +33,12 @@ class X86TTIImpl : public BasicTTIImplBase<X86TTIImpl> {
   const X86Subtarget *ST;
   const X86TargetLowering *TLI;
 
+  /// Memoized results of getArithmeticInstrCost and getCastInstrCost, keyed
+  /// on the types and the remaining arguments packed into an integer. Types
+  /// are uniqued in the context, so the keys stay valid as long as this TTI.
+  DenseMap<std::pair<Type *, unsigned>, int> ArithCostCache;
+  DenseMap<std::pair<std::pair<Type *, Type *>, unsigned>, int> CastCostCache;
+
   const X86Subtarget *getST() const { return ST; }
   const X86TargetLowering *getTLI() const { return TLI; }
 
@@ -240,6 +247,17 @@ public:
   }
 
 private:
+  int getArithmeticInstrCostImpl(unsigned Opcode, Type *Ty,
+                                 TTI::TargetCostKind CostKind,
+                                 TTI::OperandValueKind Opd1Info,
+                                 TTI::OperandValueKind Opd2Info,
+                                 TTI::OperandValueProperties Opd1PropInfo,
+                                 TTI::OperandValueProperties Opd2PropInfo,
+                                 ArrayRef<const Value *> Args,
+                                 const Instruction *CxtI);
+  int getCastInstrCostImpl(unsigned Opcode, Type *Dst, Type *Src,
+                           TTI::CastContextHint CCH,
+                           TTI::TargetCostKind CostKind, const Instruction *I);
   int getGSScalarCost(unsigned Opcode, Type *DataTy, bool VariableMask,
                       Align Alignment, unsigned AddressSpace);
   int getGSVectorCost(unsigned Opcode, Type *DataTy, const Value *Ptr,